@@ -7,5 +7,5 @@ pushd bin
 clang -std=c99 -pedantic -D_GNU_SOURCE \
     ../src/tests/tests_main.c -o tests_main -g \
     -I../src \
-    -lm
+    -lm -lpthread
 popd
@@ -1,6 +1,20 @@
 #include <stdio.h>
 #include <math.h>
 
+internal
+AG_Value *ag_push_value(Arena *arena) {
+    AG_Value *result = push_array(arena, AG_Value, 1);
+    result->value = &result->stored_value;
+    result->grad = &result->stored_grad;
+    return result;
+}
+
+internal
+void ag_bind_leaf(AG_Value *leaf, F64 *value, F64 *grad) {
+    leaf->value = value;
+    leaf->grad = grad;
+}
+
 internal
 void ag_push_predecessor(Arena *arena, AG_Value *value, AG_Value *pred) {
     AG_PredecessorNode *node = push_array(arena, AG_PredecessorNode, 1);
@@ -11,87 +25,257 @@ void ag_push_predecessor(Arena *arena, AG_Value *value, AG_Value *pred) {
 
 internal
 AG_Value *ag_source(Arena *arena, F64 value) {
-    AG_Value *result = push_array(arena, AG_Value, 1);
+    AG_Value *result = ag_push_value(arena);
     result->type = AG_ValueType_Source;
-    result->value = value;
+    *result->value = value;
+    return result;
+}
+
+internal
+AG_ValueArray ag_push_bound_sources(Arena *arena, F64 *values, F64 *grads, int count) {
+    AG_ValueArray result = {0};
+    result.count = count;
+    result.values = push_array_no_zero(arena, AG_Value*, count);
+    AG_Value *sources = push_array_no_zero(arena, AG_Value, count);
+    for (int i = 0; i < count; ++i) {
+        // Written in one go instead of zeroing the whole block first: for big models this is
+        // most of the cost of building them
+        sources[i] = (AG_Value){.value = &values[i], .type = AG_ValueType_Source, .grad = &grads[i]};
+        result.values[i] = &sources[i];
+    }
+    return result;
+}
+
+internal
+AG_Value *ag_constant(Arena *arena, F64 value) {
+    AG_Value *result = ag_push_value(arena);
+    result->type = AG_ValueType_Constant;
+    *result->value = value;
     return result;
 }
 
 internal
 AG_Value *ag_add(Arena *arena, AG_Value *a, AG_Value *b) {
-    AG_Value *result = push_array(arena, AG_Value, 1);
+    AG_Value *result = ag_push_value(arena);
 
     result->type = AG_ValueType_Add;
-    result->value = a->value + b->value;
+    *result->value = *a->value + *b->value;
 
     ag_push_predecessor(arena, result, a);
     ag_push_predecessor(arena, result, b);
 
+    ag_internal_forward_tangent(result);
+
     return result;
 }
 
 internal
 AG_Value *ag_mul(Arena *arena, AG_Value *a, AG_Value *b) {
-    AG_Value *result = push_array(arena, AG_Value, 1);
+    AG_Value *result = ag_push_value(arena);
 
     result->type = AG_ValueType_Mul;
-    result->value = a->value * b->value;
+    *result->value = *a->value * *b->value;
 
     ag_push_predecessor(arena, result, a);
     ag_push_predecessor(arena, result, b);
 
+    ag_internal_forward_tangent(result);
+
     return result;
 }
 
 internal
 AG_Value *ag_exp(Arena *arena, AG_Value *x) {
-    AG_Value *result = push_array(arena, AG_Value, 1);
+    AG_Value *result = ag_push_value(arena);
 
     result->type = AG_ValueType_Exp;
-    result->value = exp(x->value);
+    *result->value = exp(*x->value);
 
     ag_push_predecessor(arena, result, x);
 
+    ag_internal_forward_tangent(result);
+
     return result;
 }
 
 internal
 AG_Value *ag_pow(Arena *arena, AG_Value *a, F64 k) {
-    AG_Value *result = push_array(arena, AG_Value, 1);
+    AG_Value *result = ag_push_value(arena);
 
     result->type = AG_ValueType_Pow;
-    result->value = pow(a->value, k);
+    *result->value = pow(*a->value, k);
     result->op_params.k = k;
 
     ag_push_predecessor(arena, result, a);
 
+    ag_internal_forward_tangent(result);
+
+    return result;
+}
+
+internal
+AG_Value *ag_push_unary_op(Arena *arena, AG_ValueType type, AG_Value *x, F64 value) {
+    AG_Value *result = ag_push_value(arena);
+    result->type = type;
+    *result->value = value;
+    ag_push_predecessor(arena, result, x);
+    ag_internal_forward_tangent(result);
+    return result;
+}
+
+internal
+AG_Value *ag_push_binary_op(Arena *arena, AG_ValueType type, AG_Value *a, AG_Value *b, F64 value) {
+    AG_Value *result = ag_push_value(arena);
+    result->type = type;
+    *result->value = value;
+    ag_push_predecessor(arena, result, a);
+    ag_push_predecessor(arena, result, b);
+    ag_internal_forward_tangent(result);
     return result;
 }
 
 internal
 AG_Value *ag_div(Arena *arena, AG_Value *a, AG_Value *b) {
-    return ag_mul(arena, a, ag_pow(arena, b, -1));
+    return ag_push_binary_op(arena, AG_ValueType_Div, a, b, *a->value / *b->value);
 }
 
 internal
 AG_Value *ag_neg(Arena *arena, AG_Value *a) {
-    return ag_mul(arena, a, ag_source(arena, -1));
+    return ag_push_unary_op(arena, AG_ValueType_Neg, a, -*a->value);
 }
 
 internal
 AG_Value *ag_sub(Arena *arena, AG_Value *a, AG_Value *b) {
-    return ag_add(arena, a, ag_neg(arena, b));
+    return ag_push_binary_op(arena, AG_ValueType_Sub, a, b, *a->value - *b->value);
+}
+
+internal
+AG_Value *ag_log(Arena *arena, AG_Value *x) {
+    return ag_push_unary_op(arena, AG_ValueType_Log, x, log(*x->value));
+}
+
+internal
+AG_Value *ag_tanh(Arena *arena, AG_Value *x) {
+    return ag_push_unary_op(arena, AG_ValueType_Tanh, x, tanh(*x->value));
+}
+
+internal
+F64 ag_sigmoid_f64(F64 x) {
+    // Only ever exponentiate a non-positive number so large |x| can't overflow
+    if (x >= 0) return 1/(1 + exp(-x));
+    F64 e = exp(x);
+    return e/(1 + e);
+}
+
+internal
+AG_Value *ag_sigmoid(Arena *arena, AG_Value *x) {
+    return ag_push_unary_op(arena, AG_ValueType_Sigmoid, x, ag_sigmoid_f64(*x->value));
 }
 
 internal
 AG_Value *ag_relu(Arena *arena, AG_Value *a) {
-    AG_Value *result = push_array(arena, AG_Value, 1);
+    AG_Value *result = ag_push_value(arena);
     result->type = AG_ValueType_Relu;
-    result->value = a->value > 0 ? a->value : 0;
+    *result->value = *a->value > 0 ? *a->value : 0;
     ag_push_predecessor(arena, result, a);
+    ag_internal_forward_tangent(result);
+
+    return result;
+}
+
+internal
+AG_Block *ag_push_block(Arena *arena, AG_ValueArray inputs, int output_count, AG_BlockBackwardFunc *backward, void *user_data) {
+    AG_Block *block = push_array(arena, AG_Block, 1);
+    block->backward = backward;
+    block->user_data = user_data;
+
+    block->inputs.count = inputs.count;
+    block->inputs.values = push_array(arena, AG_Value*, inputs.count);
+    ArrayCopy(block->inputs.values, inputs.values, inputs.count);
+
+    AG_Value *block_node = ag_push_value(arena);
+    block_node->type = AG_ValueType_Block;
+    block_node->op_params.block = block;
+    for (int i = 0; i < inputs.count; ++i) {
+        ag_push_predecessor(arena, block_node, inputs.values[i]);
+    }
+
+    block->outputs.count = output_count;
+    block->outputs.values = push_array(arena, AG_Value*, output_count);
+    for (int i = 0; i < output_count; ++i) {
+        AG_Value *output = ag_push_value(arena);
+        output->type = AG_ValueType_BlockOutput;
+        output->op_params.block = block;
+        ag_push_predecessor(arena, output, block_node);
+        block->outputs.values[i] = output;
+    }
+
+    return block;
+}
+
+internal
+AG_ValueArray ag_detached_copy(Arena *arena, AG_ValueArray values) {
+    AG_ValueArray result = {0};
+    result.count = values.count;
+    result.values = push_array(arena, AG_Value*, result.count);
+    for (int i = 0; i < result.count; ++i) {
+        result.values[i] = ag_source(arena, *values.values[i]->value);
+        result.values[i]->tangent = values.values[i]->tangent;
+    }
+    return result;
+}
+
+internal
+AG_ValueArray ag_checkpoint(Arena *value_arena, Arena *array_arena, AG_CheckpointFunc *func, void *user_data, AG_ValueArray inputs) {
+    Arena *conflicts[] = {value_arena, array_arena};
+    ArenaTemp scratch = scratch_begin(conflicts, ArrayCount(conflicts));
+
+    AG_ValueArray detached_inputs = ag_detached_copy(scratch.arena, inputs);
+    AG_ValueArray segment_outputs = func(scratch.arena, scratch.arena, detached_inputs, user_data);
+
+    AG_Checkpoint *checkpoint = push_array(value_arena, AG_Checkpoint, 1);
+    checkpoint->func = func;
+    checkpoint->user_data = user_data;
+
+    AG_Block *block = ag_push_block(value_arena, inputs, segment_outputs.count, ag_checkpoint_backward, checkpoint);
+    for (int i = 0; i < segment_outputs.count; ++i) {
+        *block->outputs.values[i]->value = *segment_outputs.values[i]->value;
+        block->outputs.values[i]->tangent = segment_outputs.values[i]->tangent;
+    }
+
+    scratch_end(scratch);
+
+    AG_ValueArray result = {0};
+    result.count = block->outputs.count;
+    result.values = push_array(array_arena, AG_Value*, result.count);
+    ArrayCopy(result.values, block->outputs.values, result.count);
     return result;
 }
 
+internal
+void ag_checkpoint_backward(AG_Block *block, F64 *input_grads) {
+    AG_Checkpoint *checkpoint = block->user_data;
+
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    // Recompute the segment's forward pass
+    AG_ValueArray detached_inputs = ag_detached_copy(scratch.arena, block->inputs);
+    AG_ValueArray segment_outputs = checkpoint->func(scratch.arena, scratch.arena, detached_inputs, checkpoint->user_data);
+    Assert(segment_outputs.count == block->outputs.count);
+
+    // Seed the recomputed outputs with the grads that flowed into the block
+    for (int i = 0; i < segment_outputs.count; ++i) {
+        *segment_outputs.values[i]->grad += *block->outputs.values[i]->grad;
+    }
+    ag_backward_from_roots(segment_outputs.values, segment_outputs.count);
+
+    for (int i = 0; i < detached_inputs.count; ++i) {
+        input_grads[i] = *detached_inputs.values[i]->grad;
+    }
+
+    scratch_end(scratch);
+}
+
 internal
 void ag_build_topo(Arena *arena, AG_Value *value, AG_TopoList *list) {
     if (!value->visited) {
@@ -109,20 +293,262 @@ void ag_build_topo(Arena *arena, AG_Value *value, AG_TopoList *list) {
 
 internal
 void ag_backward(AG_Value *value) {
+    *value->grad = 1;
+    ag_backward_from_roots(&value, 1);
+}
+
+internal
+void ag_backward_from_roots(AG_Value **roots, int root_count) {
+    ag_backward_sweep(roots, root_count, 0);
+}
+
+internal
+void ag_backward_profiled(AG_Value *value, AG_BackwardProfile *profile) {
+    *value->grad = 1;
+    ag_backward_sweep(&value, 1, profile);
+}
+
+internal
+void ag_backward_sweep(AG_Value **roots, int root_count, AG_BackwardProfile *profile) {
     ArenaTemp scratch = scratch_begin(0,0);
 
+    U64 topo_begin = profile ? os_now_nanoseconds() : 0;
+
     // Build topologically sorted list of the value nodes
     AG_TopoList topo = {0};
-    ag_build_topo(scratch.arena, value, &topo);
+    for (int i = 0; i < root_count; ++i) {
+        ag_build_topo(scratch.arena, roots[i], &topo);
+    }
+
+    if (profile) {
+        U64 sweep_begin = os_now_nanoseconds();
+        profile->topo_nanoseconds += sweep_begin - topo_begin;
+
+        for (AG_TopoListNode *cur = topo.last; cur != 0; cur = cur->prev) {
+            U64 op_begin = os_now_nanoseconds();
+            ag_internal_backward(cur->value);
+            cur->value->visited = 0; // Reset visited flag
+            profile->op_nanoseconds[cur->value->type] += os_now_nanoseconds() - op_begin;
+            profile->op_calls[cur->value->type] += 1;
+        }
+
+        profile->sweep_nanoseconds += os_now_nanoseconds() - sweep_begin;
+    }
+    else {
+        for (AG_TopoListNode *cur = topo.last; cur != 0; cur = cur->prev) {
+            ag_internal_backward(cur->value);
+            cur->value->visited = 0; // Reset visited flag
+        }
+    }
+
+    scratch_end(scratch);
+}
+
+internal
+F64 ag_local_derivative(AG_Value *value, int slot) {
+    switch (value->type) {
+        case AG_ValueType_Add: return 1;
+
+        case AG_ValueType_Mul: {
+            Assert(value->predecessors.count == 2);
+            AG_Value *other = (slot == 0 ? value->predecessors.last->value : value->predecessors.first->value);
+            return *other->value;
+        }
+
+        case AG_ValueType_Exp: return *value->value;
+
+        case AG_ValueType_Pow: {
+            F64 x = *value->predecessors.first->value->value;
+            F64 k = value->op_params.k;
+            // Avoid the pow() call for the common exponents
+            if (k == 2)  return 2*x;
+            if (k == 1)  return 1;
+            if (k == -1) return -*value->value * *value->value;
+            if (k == 3)  return 3*x*x;
+            return k * pow(x, k-1);
+        }
+
+        case AG_ValueType_Relu: return *value->predecessors.first->value->value > 0;
+
+        case AG_ValueType_Neg: return -1;
+
+        case AG_ValueType_Sub: return slot == 0 ? 1 : -1;
+
+        case AG_ValueType_Div: {
+            AG_Value *divisor = value->predecessors.last->value;
+            return slot == 0 ? 1 / *divisor->value : -*value->value / *divisor->value;
+        }
+
+        case AG_ValueType_Log: return 1 / *value->predecessors.first->value->value;
+
+        case AG_ValueType_Tanh: return 1 - *value->value * *value->value;
+
+        case AG_ValueType_Sigmoid: return *value->value*(1 - *value->value);
+
+        default: {
+            fprintf(stderr, "ag_local_derivative: AG_ValueType %d has no local derivative\n", value->type);
+            return 0;
+        }
+    }
+}
+
+internal
+void ag_internal_forward_tangent(AG_Value *value) {
+    F64 tangent = 0;
+    int slot = 0;
+    for (AG_PredecessorNode *cur = value->predecessors.first; cur != 0; cur = cur->next, ++slot) {
+        // Skipping zero tangents keeps plain (non forward-mode) graph construction cheap
+        if (cur->value->tangent != 0) tangent += ag_local_derivative(value, slot) * cur->value->tangent;
+    }
+    value->tangent = tangent;
+}
+
+// Builds grad * d(value)/d(slot'th predecessor) as AG nodes
+internal
+AG_Value *ag_grad_contribution(Arena *arena, AG_Value *value, int slot, AG_Value *grad) {
+    AG_Value *pred = (slot == 0 ? value->predecessors.first->value : value->predecessors.last->value);
+    switch (value->type) {
+        case AG_ValueType_Add: return grad;
+
+        case AG_ValueType_Sub: return slot == 0 ? grad : ag_neg(arena, grad);
+
+        case AG_ValueType_Neg: return ag_neg(arena, grad);
+
+        case AG_ValueType_Mul: {
+            AG_Value *other = (slot == 0 ? value->predecessors.last->value : value->predecessors.first->value);
+            return ag_mul(arena, grad, other);
+        }
+
+        case AG_ValueType_Div: {
+            AG_Value *divisor = value->predecessors.last->value;
+            if (slot == 0) return ag_div(arena, grad, divisor);
+            return ag_neg(arena, ag_mul(arena, grad, ag_div(arena, value, divisor))); // -grad*a/b^2
+        }
+
+        case AG_ValueType_Exp: return ag_mul(arena, grad, value);
+
+        case AG_ValueType_Pow: {
+            F64 k = value->op_params.k;
+            if (k == 1) return grad;
+            AG_Value *derivative = (k == 2 ? pred : ag_pow(arena, pred, k-1));
+            return ag_mul(arena, grad, ag_mul(arena, ag_constant(arena, k), derivative));
+        }
+
+        case AG_ValueType_Log: return ag_div(arena, grad, pred);
+
+        case AG_ValueType_Tanh: {
+            AG_Value *one_minus_tanh_sq = ag_sub(arena, ag_constant(arena, 1), ag_mul(arena, value, value));
+            return ag_mul(arena, grad, one_minus_tanh_sq);
+        }
+
+        case AG_ValueType_Sigmoid: {
+            AG_Value *one_minus_sigmoid = ag_sub(arena, ag_constant(arena, 1), value);
+            return ag_mul(arena, grad, ag_mul(arena, value, one_minus_sigmoid));
+        }
+
+        // The derivative of relu is a step function, whose own derivative is 0 (almost everywhere)
+        case AG_ValueType_Relu: return ag_mul(arena, grad, ag_constant(arena, *pred->value > 0));
+
+        default: {
+            fprintf(stderr, "ag_grad_contribution: can't differentiate AG_ValueType %d twice\n", value->type);
+            return 0;
+        }
+    }
+}
+
+internal
+AG_ValueArray ag_backward_create_graph(Arena *arena, AG_Value *value, AG_ValueArray wrt) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    AG_Graph graph = ag_graph_capture(scratch.arena, value);
+
+    // grads[i] = d(value)/d(node i) as an AG node, 0 while nothing flowed into node i
+    AG_Value **grads = push_array(scratch.arena, AG_Value*, graph.count);
+    grads[graph.count-1] = ag_constant(arena, 1);
+
+    for (int i = graph.count-1; i >= 0; --i) {
+        AG_Value *node = graph.nodes[i];
+        AG_Value *grad = grads[i];
+        if (!grad) continue;
+
+        B32 is_supported = 1;
+        switch (node->type) {
+            case AG_ValueType_Source:
+            case AG_ValueType_Constant: break;
+
+            case AG_ValueType_Block:
+            case AG_ValueType_BlockOutput: {
+                fprintf(stderr, "ag_backward_create_graph: blocks can't be differentiated twice\n");
+                is_supported = 0;
+            } break;
 
-    value->grad = 1;
+            default: {
+                int slot = 0;
+                for (AG_PredecessorNode *cur = node->predecessors.first; cur; cur = cur->next, ++slot) {
+                    AG_Value *pred = cur->value;
+                    if (pred->type == AG_ValueType_Constant) continue;
+                    AG_Value *contribution = ag_grad_contribution(arena, node, slot, grad);
+                    if (!contribution) {
+                        is_supported = 0;
+                        break;
+                    }
+                    AG_Value **pred_grad = &grads[pred->graph_index];
+                    *pred_grad = (*pred_grad ? ag_add(arena, *pred_grad, contribution) : contribution);
+                }
+            } break;
+        }
+        if (!is_supported) {
+            scratch_end(scratch);
+            return (AG_ValueArray){0};
+        }
+    }
 
-    for (AG_TopoListNode *cur = topo.last; cur != 0; cur = cur->prev) {
-        ag_internal_backward(cur->value);
-        cur->value->visited = 0; // Reset visited flag
+    AG_ValueArray result = {0};
+    result.count = wrt.count;
+    result.values = push_array(arena, AG_Value*, result.count);
+    for (int i = 0; i < wrt.count; ++i) {
+        AG_Value *x = wrt.values[i];
+        B32 is_in_graph = x->graph_index < (U32)graph.count && graph.nodes[x->graph_index] == x;
+        AG_Value *grad = is_in_graph ? grads[x->graph_index] : 0;
+        result.values[i] = grad ? grad : ag_constant(arena, 0);
     }
 
     scratch_end(scratch);
+    return result;
+}
+
+internal
+B32 ag_hessian_vector_product(Arena *arena, AG_Value *value, AG_ValueArray params, F64 *v, F64 *hv) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    AG_ValueArray grads = ag_backward_create_graph(scratch.arena, value, params);
+    if (!grads.values) {
+        scratch_end(scratch);
+        return 0;
+    }
+
+    // d(sum_i grad_i * v_i)/d(param_j) = sum_i H_ji * v_i
+    AG_Value *grad_dot_v = ag_constant(scratch.arena, 0);
+    for (int i = 0; i < grads.count; ++i) {
+        grad_dot_v = ag_add(scratch.arena, grad_dot_v, ag_mul(scratch.arena, grads.values[i], ag_constant(scratch.arena, v[i])));
+    }
+
+    // Stale grads of the original graph's nodes would leak into the result, so zero everything
+    AG_Graph graph = ag_graph_capture(scratch.arena, grad_dot_v);
+    for (int i = 0; i < graph.count; ++i) *graph.nodes[i]->grad = 0;
+    for (int i = 0; i < params.count; ++i) *params.values[i]->grad = 0;
+    ag_backward(grad_dot_v);
+    for (int i = 0; i < params.count; ++i) hv[i] = *params.values[i]->grad;
+
+    scratch_end(scratch);
+    return 1;
+}
+
+internal
+void ag_set_tangents(AG_ValueArray leaves, F64 *direction) {
+    for (int i = 0; i < leaves.count; ++i) {
+        leaves.values[i]->tangent = direction ? direction[i] : 0;
+    }
 }
 
 internal
@@ -132,45 +558,522 @@ void ag_internal_backward(AG_Value *value) {
             fprintf(stderr, "ag_internal_backward called on uninitialized value of type AG_ValueType_Null");
         } break;
 
-        case AG_ValueType_Source: break; // nothing to do
+        case AG_ValueType_Source: 
+        case AG_ValueType_Constant: break; // nothing to do
 
-        case AG_ValueType_Add: {
-            for ( AG_PredecessorNode *cur = value->predecessors.first; cur != 0; cur = cur->next ) {
-                AG_Value *pred = cur->value;
-                pred->grad += value->grad;
+        case AG_ValueType_Add:
+        case AG_ValueType_Mul:
+        case AG_ValueType_Exp:
+        case AG_ValueType_Pow:
+        case AG_ValueType_Relu:
+        case AG_ValueType_Neg:
+        case AG_ValueType_Sub:
+        case AG_ValueType_Div:
+        case AG_ValueType_Log:
+        case AG_ValueType_Tanh:
+        case AG_ValueType_Sigmoid: {
+            int slot = 0;
+            for ( AG_PredecessorNode *cur = value->predecessors.first; cur != 0; cur = cur->next, ++slot ) {
+                *cur->value->grad += *value->grad * ag_local_derivative(value, slot);
             }
         } break;
 
-        case AG_ValueType_Mul: {
-            Assert(value->predecessors.count == 2);
+        case AG_ValueType_Block: {
+            AG_Block *block = value->op_params.block;
+            ArenaTemp scratch = scratch_begin(0,0);
+            F64 *input_grads = push_array(scratch.arena, F64, block->inputs.count);
+            block->backward(block, input_grads);
+            for (int i = 0; i < block->inputs.count; ++i) {
+                *block->inputs.values[i]->grad += input_grads[i];
+            }
+            scratch_end(scratch);
+        } break;
 
-            AG_Value *pred_1 = value->predecessors.first->value;
-            AG_Value *pred_2 = value->predecessors.last->value;
+        case AG_ValueType_BlockOutput: break; // the block's backward reads the output grads
 
-            pred_1->grad += value->grad * pred_2->value;
-            pred_2->grad += value->grad * pred_1->value;
+        default: {
+            fprintf(stderr, "ag_internal_backward: unhandled AG_ValueType\n");
         } break;
+    }
+}
+
+internal
+AG_Graph ag_graph_capture(Arena *arena, AG_Value *root) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    AG_TopoList topo = {0};
+    ag_build_topo(scratch.arena, root, &topo);
+
+    AG_Graph result = {0};
+    for (AG_TopoListNode *cur = topo.first; cur; cur = cur->next) result.count += 1;
+    result.nodes = push_array(arena, AG_Value*, result.count);
+    int node_idx = 0;
+    U32 edge_count = 0;
+    for (AG_TopoListNode *cur = topo.first; cur; cur = cur->next, ++node_idx) {
+        cur->value->visited = 0;
+        cur->value->graph_index = node_idx;
+        result.nodes[node_idx] = cur->value;
+        edge_count += cur->value->predecessors.count;
+    }
+
+    // Invert the predecessor lists into a CSR consumer table
+    result.consumer_offsets = push_array(arena, U32, result.count+1);
+    result.consumers = push_array(arena, AG_GraphEdge, edge_count);
+    for (int i = 0; i < result.count; ++i) {
+        for (AG_PredecessorNode *pred = result.nodes[i]->predecessors.first; pred; pred = pred->next) {
+            result.consumer_offsets[pred->value->graph_index+1] += 1;
+        }
+    }
+    for (int i = 0; i < result.count; ++i) result.consumer_offsets[i+1] += result.consumer_offsets[i];
+    U32 *fill = push_array(scratch.arena, U32, result.count);
+    for (int i = 0; i < result.count; ++i) {
+        U32 slot = 0;
+        for (AG_PredecessorNode *pred = result.nodes[i]->predecessors.first; pred; pred = pred->next, ++slot) {
+            U32 pred_idx = pred->value->graph_index;
+            AG_GraphEdge *edge = &result.consumers[result.consumer_offsets[pred_idx] + fill[pred_idx]];
+            edge->node_idx = i;
+            edge->slot = slot;
+            fill[pred_idx] += 1;
+        }
+    }
+
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+U32 *ag_graph_levels(Arena *arena, AG_Graph *graph, U32 *level_count) {
+    // Walking the topo order backwards visits all consumers of a node before the node itself
+    U32 *levels = push_array(arena, U32, graph->count);
+    *level_count = graph->count > 0;
+    for (int i = graph->count-1; i >= 0; --i) {
+        for (U32 e = graph->consumer_offsets[i]; e < graph->consumer_offsets[i+1]; ++e) {
+            levels[i] = MD_Max(levels[i], levels[graph->consumers[e].node_idx]+1);
+        }
+        *level_count = MD_Max(*level_count, levels[i]+1);
+    }
+    return levels;
+}
+
+typedef struct AG_ParallelBackwardJob AG_ParallelBackwardJob;
+struct AG_ParallelBackwardJob {
+    AG_Graph *graph;
+    U32 *level_nodes; // node indices of the current level
+    int level_node_count;
+    F64 **block_input_grads; // per node index, only for AG_ValueType_Block nodes
+};
+
+#define AG_PARALLEL_BACKWARD_CHUNK_SIZE 256
+
+internal
+void ag_parallel_backward_task(void *user_data, int task_idx, int thread_idx) {
+    AG_ParallelBackwardJob *job = user_data;
+    AG_Graph *graph = job->graph;
+
+    int first = task_idx*AG_PARALLEL_BACKWARD_CHUNK_SIZE;
+    int opl = MD_Min(first + AG_PARALLEL_BACKWARD_CHUNK_SIZE, job->level_node_count);
+    for (int i = first; i < opl; ++i) {
+        U32 node_idx = job->level_nodes[i];
+        AG_Value *value = graph->nodes[node_idx];
+
+        // Pull the grad contributions of all consumers
+        F64 grad = 0;
+        for (U32 e = graph->consumer_offsets[node_idx]; e < graph->consumer_offsets[node_idx+1]; ++e) {
+            AG_GraphEdge edge = graph->consumers[e];
+            AG_Value *consumer = graph->nodes[edge.node_idx];
+            switch (consumer->type) {
+                case AG_ValueType_Block: grad += job->block_input_grads[edge.node_idx][edge.slot]; break;
+                case AG_ValueType_BlockOutput: break;
+                default: grad += *consumer->grad * ag_local_derivative(consumer, edge.slot); break;
+            }
+        }
+        *value->grad += grad;
+
+        if (value->type == AG_ValueType_Block) {
+            AG_Block *block = value->op_params.block;
+            block->backward(block, job->block_input_grads[node_idx]);
+        }
+    }
+}
+
+internal
+void ag_backward_parallel(AG_Value *value, TP_ThreadPool *pool) {
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    AG_Graph graph = ag_graph_capture(scratch.arena, value);
+
+    U32 level_count = 0;
+    U32 *levels = ag_graph_levels(scratch.arena, &graph, &level_count);
+
+    // Bucket the nodes by level (counting sort keeps topo order within a level)
+    U32 *level_offsets = push_array(scratch.arena, U32, level_count+1);
+    for (int i = 0; i < graph.count; ++i) level_offsets[levels[i]+1] += 1;
+    for (U32 l = 0; l < level_count; ++l) level_offsets[l+1] += level_offsets[l];
+    U32 *fill = push_array(scratch.arena, U32, level_count);
+    U32 *level_nodes = push_array(scratch.arena, U32, graph.count);
+    for (int i = 0; i < graph.count; ++i) level_nodes[level_offsets[levels[i]] + fill[levels[i]]++] = i;
+
+    AG_ParallelBackwardJob job = {0};
+    job.graph = &graph;
+    job.block_input_grads = push_array(scratch.arena, F64*, graph.count);
+    for (int i = 0; i < graph.count; ++i) {
+        AG_Value *node = graph.nodes[i];
+        if (node->type == AG_ValueType_Block) {
+            job.block_input_grads[i] = push_array(scratch.arena, F64, node->op_params.block->inputs.count);
+        }
+    }
+
+    *value->grad = 1;
+
+    for (U32 l = 0; l < level_count; ++l) {
+        job.level_nodes = &level_nodes[level_offsets[l]];
+        job.level_node_count = level_offsets[l+1] - level_offsets[l];
+        int task_count = (job.level_node_count + AG_PARALLEL_BACKWARD_CHUNK_SIZE-1)/AG_PARALLEL_BACKWARD_CHUNK_SIZE;
+        tp_parallel_for(pool, task_count, ag_parallel_backward_task, &job);
+    }
+
+    scratch_end(scratch);
+}
+
+internal
+AG_GraphStats ag_graph_stats(AG_Value *root, Arena *value_arena, Arena *array_arena) {
+    AG_GraphStats result = {0};
+
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    AG_Graph graph = ag_graph_capture(scratch.arena, root);
+    U32 level_count = 0;
+    ag_graph_levels(scratch.arena, &graph, &level_count);
+
+    result.node_count = graph.count;
+    result.max_depth = level_count > 0 ? level_count-1 : 0;
+    for (int i = 0; i < graph.count; ++i) {
+        AG_Value *value = graph.nodes[i];
+        result.node_counts[value->type] += 1;
+        result.edge_count += value->predecessors.count;
+        result.graph_bytes += sizeof(AG_Value) + value->predecessors.count*sizeof(AG_PredecessorNode);
+        if (value->type == AG_ValueType_Block) {
+            AG_Block *block = value->op_params.block;
+            result.graph_bytes += sizeof(AG_Block) + (block->inputs.count + block->outputs.count)*sizeof(AG_Value*);
+        }
+    }
+
+    scratch_end(scratch);
 
-        case AG_ValueType_Exp: {
-            AG_Value *pred = value->predecessors.first->value;
-            pred->grad += value->grad * value->value;
+    if (value_arena) result.value_arena_bytes = arena_pos(value_arena);
+    if (array_arena) result.array_arena_bytes = arena_pos(array_arena);
+
+    return result;
+}
+
+internal
+String8 ag_value_type_name(AG_ValueType type) {
+    switch (type) {
+        case AG_ValueType_Null:        return str8_lit("Null");
+        case AG_ValueType_Source:      return str8_lit("Source");
+        case AG_ValueType_Add:         return str8_lit("Add");
+        case AG_ValueType_Mul:         return str8_lit("Mul");
+        case AG_ValueType_Exp:         return str8_lit("Exp");
+        case AG_ValueType_Pow:         return str8_lit("Pow");
+        case AG_ValueType_Relu:        return str8_lit("Relu");
+        case AG_ValueType_Block:       return str8_lit("Block");
+        case AG_ValueType_BlockOutput: return str8_lit("BlockOutput");
+        case AG_ValueType_Constant:    return str8_lit("Constant");
+        case AG_ValueType_Neg:         return str8_lit("Neg");
+        case AG_ValueType_Sub:         return str8_lit("Sub");
+        case AG_ValueType_Div:         return str8_lit("Div");
+        case AG_ValueType_Log:         return str8_lit("Log");
+        case AG_ValueType_Tanh:        return str8_lit("Tanh");
+        case AG_ValueType_Sigmoid:     return str8_lit("Sigmoid");
+        default:                       return str8_lit("Unknown");
+    }
+}
+
+internal
+void ag_fprint_graph_stats(FILE *os, AG_GraphStats *stats) {
+    fprintf(os, "nodes: %d | edges: %d | max depth: %d | graph bytes: %llu\n", 
+            stats->node_count, stats->edge_count, stats->max_depth, (unsigned long long)stats->graph_bytes);
+    for (int type = 0; type < AG_ValueType_COUNT; ++type) {
+        if (stats->node_counts[type] == 0) continue;
+        fprintf(os, "  %-12.*s %d\n", str8_varg(ag_value_type_name(type)), stats->node_counts[type]);
+    }
+    if (stats->value_arena_bytes || stats->array_arena_bytes) {
+        fprintf(os, "value arena bytes: %llu | array arena bytes: %llu\n", 
+                (unsigned long long)stats->value_arena_bytes, (unsigned long long)stats->array_arena_bytes);
+    }
+}
+
+internal
+void ag_fprint_backward_profile(FILE *os, AG_BackwardProfile *profile) {
+    fprintf(os, "topo sort: %.3f ms | sweep: %.3f ms\n", profile->topo_nanoseconds/1e6, profile->sweep_nanoseconds/1e6);
+    for (int type = 0; type < AG_ValueType_COUNT; ++type) {
+        if (profile->op_calls[type] == 0) continue;
+        fprintf(os, "  %-12.*s calls: %-10llu total: %.3f ms\n", str8_varg(ag_value_type_name(type)), 
+                (unsigned long long)profile->op_calls[type], profile->op_nanoseconds[type]/1e6);
+    }
+}
+
+internal
+F64 ag_eval_op(AG_ValueType type, AG_Value **preds, F64 k) {
+    switch (type) {
+        case AG_ValueType_Add:  return *preds[0]->value + *preds[1]->value;
+        case AG_ValueType_Mul:  return *preds[0]->value * *preds[1]->value;
+        case AG_ValueType_Exp:  return exp(*preds[0]->value);
+        case AG_ValueType_Pow:  return pow(*preds[0]->value, k);
+        case AG_ValueType_Relu: return *preds[0]->value > 0 ? *preds[0]->value : 0;
+        case AG_ValueType_Neg:  return -*preds[0]->value;
+        case AG_ValueType_Sub:  return *preds[0]->value - *preds[1]->value;
+        case AG_ValueType_Div:  return *preds[0]->value / *preds[1]->value;
+        case AG_ValueType_Log:  return log(*preds[0]->value);
+        case AG_ValueType_Tanh: return tanh(*preds[0]->value);
+        case AG_ValueType_Sigmoid: return ag_sigmoid_f64(*preds[0]->value);
+        default: {
+            fprintf(stderr, "ag_eval_op: AG_ValueType %d is not an element-wise op\n", type);
+            return 0;
+        }
+    }
+}
+
+internal
+AG_Value *ag_push_op(Arena *arena, AG_ValueType type, AG_Value **preds, int pred_count, F64 k) {
+    AG_Value *result = ag_push_value(arena);
+    result->type = type;
+    result->op_params.k = k;
+    *result->value = ag_eval_op(type, preds, k);
+    for (int i = 0; i < pred_count; ++i) ag_push_predecessor(arena, result, preds[i]);
+    ag_internal_forward_tangent(result);
+    return result;
+}
+
+internal
+B32 ag_is_constant(AG_Value *value, F64 constant) {
+    return value->type == AG_ValueType_Constant && *value->value == constant;
+}
+
+internal
+B32 ag_is_integer(F64 x) {
+    return x == floor(x);
+}
+
+// Returns the rewritten version of `node`, whose (already rewritten) predecessors are `preds`
+internal
+AG_Value *ag_rewrite_node(Arena *arena, AG_Value *node, AG_Value **preds, AG_RewriteResult *stats) {
+    AG_ValueType type = node->type;
+    F64 k = node->op_params.k;
+    int pred_count = node->predecessors.count;
+
+    // Constant folding
+    B32 all_preds_constant = 1;
+    for (int i = 0; i < pred_count; ++i) all_preds_constant &= (preds[i]->type == AG_ValueType_Constant);
+    if (all_preds_constant) {
+        stats->folded_constant_count += 1;
+        return ag_constant(arena, ag_eval_op(type, preds, k));
+    }
+
+    // Collapse expanded ops into native ones and drop identities
+    switch (type) {
+        case AG_ValueType_Add: {
+            if (ag_is_constant(preds[1], 0)) { stats->collapsed_op_count += 1; return preds[0]; }
+            if (ag_is_constant(preds[0], 0)) { stats->collapsed_op_count += 1; return preds[1]; }
+            if (preds[1]->type == AG_ValueType_Neg) {
+                stats->collapsed_op_count += 1;
+                AG_Value *sub_preds[] = {preds[0], preds[1]->predecessors.first->value};
+                return ag_push_op(arena, AG_ValueType_Sub, sub_preds, 2, 0);
+            }
+            if (preds[0]->type == AG_ValueType_Neg) {
+                stats->collapsed_op_count += 1;
+                AG_Value *sub_preds[] = {preds[1], preds[0]->predecessors.first->value};
+                return ag_push_op(arena, AG_ValueType_Sub, sub_preds, 2, 0);
+            }
         } break;
 
-        case AG_ValueType_Pow: {
-            AG_Value *pred = value->predecessors.first->value;
-            F64 k = value->op_params.k;
-            pred->grad += value->grad * k * pow(pred->value, k-1); 
+        case AG_ValueType_Mul: {
+            for (int i = 0; i < 2; ++i) {
+                AG_Value *x = preds[1-i];
+                if (ag_is_constant(preds[i], 1)) { stats->collapsed_op_count += 1; return x; }
+                if (ag_is_constant(preds[i], -1)) {
+                    stats->collapsed_op_count += 1;
+                    if (x->type == AG_ValueType_Neg) return x->predecessors.first->value;
+                    return ag_push_op(arena, AG_ValueType_Neg, &x, 1, 0);
+                }
+                if (preds[i]->type == AG_ValueType_Pow && preds[i]->op_params.k == -1) {
+                    stats->collapsed_op_count += 1;
+                    AG_Value *div_preds[] = {x, preds[i]->predecessors.first->value};
+                    return ag_push_op(arena, AG_ValueType_Div, div_preds, 2, 0);
+                }
+            }
         } break;
 
-        case AG_ValueType_Relu: {
-            AG_Value *pred = value->predecessors.first->value;
-            pred->grad += value->grad * (pred->value > 0);
+        case AG_ValueType_Neg: {
+            if (preds[0]->type == AG_ValueType_Neg) {
+                stats->collapsed_op_count += 1;
+                return preds[0]->predecessors.first->value;
+            }
         } break;
 
-        default: {
-            fprintf(stderr, "ag_internal_backward: unhandled AG_ValueType\n");
+        case AG_ValueType_Pow: {
+            if (k == 1) { stats->collapsed_op_count += 1; return preds[0]; }
+            // (x^a)^b == x^(a*b) only holds for all x when both exponents are integers
+            AG_Value *base = preds[0];
+            if (base->type == AG_ValueType_Pow && ag_is_integer(k) && ag_is_integer(base->op_params.k)) {
+                stats->collapsed_op_count += 1;
+                return ag_push_op(arena, AG_ValueType_Pow, &base->predecessors.first->value, 1, k*base->op_params.k);
+            }
         } break;
+
+        default: break;
+    }
+
+    return ag_push_op(arena, type, preds, pred_count, k);
+}
+
+typedef struct AG_RewriteTableSlot AG_RewriteTableSlot;
+struct AG_RewriteTableSlot {
+    AG_Value *value;
+    U64 hash;
+};
+
+internal
+U64 ag_rewrite_hash(AG_Value *value) {
+    U64 hash = 14695981039346656037ULL;
+    U64 words[3] = {value->type, 0, 0};
+    MemoryCopy(&words[1], (value->type == AG_ValueType_Constant ? value->value : &value->op_params.k), sizeof(F64));
+    for (int i = 0; i < 2; ++i) { hash ^= words[i]; hash *= 1099511628211ULL; }
+    for (AG_PredecessorNode *pred = value->predecessors.first; pred; pred = pred->next) {
+        hash ^= (U64)pred->value;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+internal
+B32 ag_rewrite_nodes_match(AG_Value *a, AG_Value *b) {
+    if (a->type != b->type || a->predecessors.count != b->predecessors.count) return 0;
+    if (a->type == AG_ValueType_Constant) return *a->value == *b->value;
+    if (a->type == AG_ValueType_Pow && a->op_params.k != b->op_params.k) return 0;
+    for (AG_PredecessorNode *pa = a->predecessors.first, *pb = b->predecessors.first; pa; pa = pa->next, pb = pb->next) {
+        if (pa->value != pb->value) return 0;
+    }
+    return 1;
+}
+
+internal
+AG_RewriteResult ag_graph_rewrite(Arena *arena, AG_Value *root) {
+    AG_RewriteResult result = {0};
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    AG_Graph graph = ag_graph_capture(scratch.arena, root);
+    result.node_count_before = graph.count;
+
+    // Hash set of the rewritten nodes for common-subexpression elimination
+    U64 table_size = 16;
+    while (table_size < 2*(U64)graph.count) table_size *= 2;
+    AG_RewriteTableSlot *table = push_array(scratch.arena, AG_RewriteTableSlot, table_size);
+
+    AG_Value **rewritten = push_array(scratch.arena, AG_Value*, graph.count);
+    AG_Value **preds = 0;
+    int preds_cap = 0;
+
+    for (int i = 0; i < graph.count; ++i) {
+        AG_Value *node = graph.nodes[i];
+
+        switch (node->type) {
+            // Leaves keep their identity
+            case AG_ValueType_Source: {
+                rewritten[i] = node;
+                continue;
+            }
+            // Mapped by their block, which comes first in the graph
+            case AG_ValueType_BlockOutput: {
+                continue;
+            }
+            // Rebuilt on the rewritten inputs (same callback and user data), so the rewrite reaches
+            // below the block and an input it shares with scalar ops isn't kept twice
+            case AG_ValueType_Block: {
+                AG_Block *block = node->op_params.block;
+                AG_ValueArray inputs = {0};
+                inputs.count = block->inputs.count;
+                inputs.values = push_array_no_zero(scratch.arena, AG_Value*, inputs.count);
+                B32 inputs_changed = 0;
+                for (int input_idx = 0; input_idx < inputs.count; ++input_idx) {
+                    AG_Value *input = block->inputs.values[input_idx];
+                    inputs.values[input_idx] = rewritten[input->graph_index];
+                    if (inputs.values[input_idx] != input) inputs_changed = 1;
+                }
+
+                AG_Block *rebuilt = block;
+                if (inputs_changed) {
+                    rebuilt = ag_push_block(arena, inputs, block->outputs.count, block->backward, block->user_data);
+                    for (int output_idx = 0; output_idx < block->outputs.count; ++output_idx) {
+                        *rebuilt->outputs.values[output_idx]->value = *block->outputs.values[output_idx]->value;
+                        rebuilt->outputs.values[output_idx]->tangent = block->outputs.values[output_idx]->tangent;
+                    }
+                }
+                rewritten[i] = node;
+                for (int output_idx = 0; output_idx < block->outputs.count; ++output_idx) {
+                    AG_Value *output = block->outputs.values[output_idx];
+                    B32 is_in_graph = output->graph_index < (U32)graph.count && graph.nodes[output->graph_index] == output;
+                    if (is_in_graph) rewritten[output->graph_index] = rebuilt->outputs.values[output_idx];
+                }
+                continue;
+            }
+            case AG_ValueType_Constant: {
+                rewritten[i] = ag_constant(arena, *node->value);
+            } break;
+            default: {
+                if (node->predecessors.count > preds_cap) {
+                    preds_cap = node->predecessors.count*2;
+                    preds = push_array(scratch.arena, AG_Value*, preds_cap);
+                }
+                int slot = 0;
+                for (AG_PredecessorNode *pred = node->predecessors.first; pred; pred = pred->next) {
+                    preds[slot++] = rewritten[pred->value->graph_index];
+                }
+                rewritten[i] = ag_rewrite_node(arena, node, preds, &result);
+            } break;
+        }
+
+        // Deduplicate. Only nodes built by this rewrite are looked up, so leaves never merge.
+        AG_Value *candidate = rewritten[i];
+        if (candidate->type == AG_ValueType_Source || candidate->type == AG_ValueType_BlockOutput) continue;
+        U64 hash = ag_rewrite_hash(candidate);
+        for (U64 slot_idx = hash & (table_size-1);; slot_idx = (slot_idx+1) & (table_size-1)) {
+            AG_RewriteTableSlot *slot = &table[slot_idx];
+            if (!slot->value) {
+                slot->value = candidate;
+                slot->hash = hash;
+                break;
+            }
+            if (slot->value == candidate) break;
+            if (slot->hash == hash && ag_rewrite_nodes_match(slot->value, candidate)) {
+                rewritten[i] = slot->value;
+                result.deduplicated_count += 1;
+                break;
+            }
+        }
     }
+
+    result.root = rewritten[graph.count-1];
+
+    scratch_end(scratch);
+
+    // Count what is actually reachable; the rewrite can leave unused nodes behind in arena
+    ArenaTemp count_scratch = scratch_begin(&arena, 1);
+    result.node_count_after = ag_graph_capture(count_scratch.arena, result.root).count;
+    scratch_end(count_scratch);
+    result.removed_node_count = result.node_count_before - result.node_count_after;
+
+    // Never hand back a bigger graph than the one we got
+    if (result.removed_node_count < 0) {
+        AG_RewriteResult original = {0};
+        original.root = root;
+        original.node_count_before = result.node_count_before;
+        original.node_count_after = result.node_count_before;
+        result = original;
+    }
+
+    return result;
 }
 
 internal
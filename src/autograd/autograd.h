@@ -9,6 +9,17 @@ enum AG_ValueType {
     AG_ValueType_Exp,
     AG_ValueType_Pow,
     AG_ValueType_Relu,
+    AG_ValueType_Block,
+    AG_ValueType_BlockOutput,
+    AG_ValueType_Constant, // A leaf that never needs a grad, so graph rewrites may fold it
+    AG_ValueType_Neg,
+    AG_ValueType_Sub,
+    AG_ValueType_Div,
+    AG_ValueType_Log,
+    AG_ValueType_Tanh,
+    AG_ValueType_Sigmoid,
+
+    AG_ValueType_COUNT,
 };
 typedef enum AG_ValueType AG_ValueType;
 
@@ -30,18 +41,30 @@ struct AG_PredecessorList {
 
 typedef struct AG_Value AG_Value;
 struct AG_Value {
-    F64 value;
+    // Point at stored_value/stored_grad, unless the value is a leaf bound to outside storage with
+    // ag_bind_leaf (like a model's params block, see nn_make_params)
+    F64 *value;
     AG_ValueType type;
 
-    F64 grad;
+    F64 *grad;
+
+    // Forward-mode derivative d(value)/d(t) along the direction seeded into the leaves' tangents.
+    // It is computed alongside `value` when the node is constructed (dual numbers), so a 
+    // Jacobian-vector product costs one forward pass and no backward sweep.
+    F64 tangent;
 
     AG_PredecessorList predecessors;
 
     B32 visited; // Flag used internally by backward pass
+    U32 graph_index; // Index into the nodes of the AG_Graph this value was last captured in
 
     union {
         F64 k; // The exponent of a AG_ValueType_Pow operation 
+        struct AG_Block *block; // The block of a AG_ValueType_Block or AG_ValueType_BlockOutput
     } op_params;
+
+    F64 stored_value;
+    F64 stored_grad;
 };
 
 // ==================================
@@ -65,6 +88,39 @@ struct AG_ValueArray4D {
     int shape[4];
 };
 
+// ==================================
+// Blocks
+
+// NOTE: A block is an op with many inputs and many outputs whose backward pass isn't
+//       expressed as scalar nodes, but is computed by a callback instead (e.g. by recomputing
+//       a checkpointed segment). The block gets one hidden AG_ValueType_Block node that has the
+//       inputs as predecessors, and every output is a AG_ValueType_BlockOutput node with the
+//       hidden node as its only predecessor. This keeps the edge count at inputs+outputs.
+//       The callback reads the grads of block->outputs and writes d(root)/d(input_i) into 
+//       input_grads[i] (zero initialized). It must not touch the inputs' grads itself.
+//       Whoever creates the block computes the outputs' values (and tangents, in forward mode).
+typedef struct AG_Block AG_Block;
+
+typedef void (AG_BlockBackwardFunc) (AG_Block *block, F64 *input_grads);
+
+struct AG_Block {
+    AG_ValueArray inputs;
+    AG_ValueArray outputs;
+    AG_BlockBackwardFunc *backward;
+    void *user_data;
+};
+
+// A checkpointed segment maps its inputs to its outputs by building an ordinary scalar graph.
+// Every non-constant value the segment reads (activations *and* parameters) must be passed 
+// in through `inputs`, since the segment is run on detached copies of them.
+typedef AG_ValueArray (AG_CheckpointFunc) (Arena *value_arena, Arena *array_arena, AG_ValueArray inputs, void *user_data);
+
+typedef struct AG_Checkpoint AG_Checkpoint;
+struct AG_Checkpoint {
+    AG_CheckpointFunc *func;
+    void *user_data;
+};
+
 // ==================================
 // Backprop helper structs
 
@@ -81,11 +137,84 @@ struct AG_TopoList {
     AG_TopoListNode *last;
 };
 
+// ==================================
+// Captured graphs
+
+typedef struct AG_GraphEdge AG_GraphEdge;
+struct AG_GraphEdge {
+    U32 node_idx; // The consumer (when listing consumers) or the predecessor
+    U32 slot;     // Position of the edge in the consumer's predecessor list
+};
+
+// NOTE: A captured graph is a flat, topologically sorted array of all the nodes reachable 
+//       from a root: every node comes after all of its predecessors, so the root is last.
+//       Capturing overwrites AG_Value.graph_index of all captured nodes.
+typedef struct AG_Graph AG_Graph;
+struct AG_Graph {
+    AG_Value **nodes;
+    int count;
+
+    // consumers[consumer_offsets[i] .. consumer_offsets[i+1]) are the edges that use node i
+    U32 *consumer_offsets;
+    AG_GraphEdge *consumers;
+};
+
+// ==================================
+// Graph statistics & profiling
+
+typedef struct AG_GraphStats AG_GraphStats;
+struct AG_GraphStats {
+    int node_count;
+    int node_counts[AG_ValueType_COUNT]; // indexed by AG_ValueType
+    int edge_count;
+    int max_depth; // number of edges on the longest path from the root to a leaf
+
+    // Bytes of the graph's structs reachable from the root (nodes, predecessor nodes, blocks)
+    U64 graph_bytes;
+
+    // Bytes currently pushed on the arenas passed to ag_graph_stats (0 if not passed)
+    U64 value_arena_bytes;
+    U64 array_arena_bytes;
+};
+
+typedef struct AG_BackwardProfile AG_BackwardProfile;
+struct AG_BackwardProfile {
+    U64 topo_nanoseconds;
+    U64 sweep_nanoseconds;
+    U64 op_nanoseconds[AG_ValueType_COUNT]; // time spent in ag_internal_backward per op type
+    U64 op_calls[AG_ValueType_COUNT];
+};
+
+// ==================================
+// Graph rewriting
+
+typedef struct AG_RewriteResult AG_RewriteResult;
+struct AG_RewriteResult {
+    AG_Value *root;
+    int node_count_before;
+    int node_count_after;
+    int removed_node_count;
+
+    // How often every rewrite fired (a removed node can be counted by several of these)
+    int folded_constant_count;
+    int deduplicated_count;
+    int collapsed_op_count;
+};
+
 // ==================================
 // Value construction functions
 
 internal AG_Value *ag_source(Arena *arena, F64 value);
 
+// `count` Source leaves bound to values[i] and grads[i] (see ag_bind_leaf), allocated in one block
+internal AG_ValueArray ag_push_bound_sources(Arena *arena, F64 *values, F64 *grads, int count);
+
+internal AG_Value *ag_constant(Arena *arena, F64 value);
+
+// Makes the leaf read its value from and accumulate its grad into the given storage (e.g. one
+// entry of a params block), instead of its own fields. *value isn't touched.
+internal void ag_bind_leaf(AG_Value *leaf, F64 *value, F64 *grad);
+
 internal AG_Value *ag_add(Arena *arena, AG_Value *a, AG_Value *b);
 
 internal AG_Value *ag_sub(Arena *arena, AG_Value *a, AG_Value *b);
@@ -102,13 +231,102 @@ internal AG_Value *ag_exp(Arena *arena, AG_Value *x);
 
 internal AG_Value *ag_pow(Arena *arena, AG_Value *a, F64 k);
 
+internal AG_Value *ag_log(Arena *arena, AG_Value *x);
+
+internal AG_Value *ag_tanh(Arena *arena, AG_Value *x);
+
+internal AG_Value *ag_sigmoid(Arena *arena, AG_Value *x);
+
+// ==================================
+// Block construction functions
+
+internal AG_Block *ag_push_block(Arena *arena, AG_ValueArray inputs, int output_count, AG_BlockBackwardFunc *backward, void *user_data);
+
+// Runs `func` on detached copies of `inputs` and only keeps the segment's outputs alive in
+// value_arena. The segment's graph is rebuilt (in scratch memory) during the backward pass.
+// `user_data` must outlive the backward pass.
+internal AG_ValueArray ag_checkpoint(Arena *value_arena, Arena *array_arena, AG_CheckpointFunc *func, void *user_data, AG_ValueArray inputs);
+
 // ==================================
 // Backprop functions
 
 internal void ag_backward(AG_Value *value);
 
+// Backward pass from several roots at once. The roots' grads must already be seeded.
+internal void ag_backward_from_roots(AG_Value **roots, int root_count);
+
+// Same result as ag_backward, but runs on a thread pool. Nodes are grouped into levels by 
+// their longest distance to the root, and the nodes of a level are independent of each other.
+// Instead of pushing grads into its predecessors, every node *pulls* the grad contributions 
+// from its consumers (which live in earlier levels) in a fixed order. So no two threads ever 
+// write the same grad, and the result doesn't depend on the thread count or the scheduling.
+internal void ag_backward_parallel(AG_Value *value, TP_ThreadPool *pool);
+
+// d(value)/d(slot'th predecessor) of an element-wise op
+internal F64 ag_local_derivative(AG_Value *value, int slot);
+
+// Same as ag_backward, but accumulates timings into `profile`. Every node is timed 
+// individually, so expect the sweep itself to get noticeably slower.
+internal void ag_backward_profiled(AG_Value *value, AG_BackwardProfile *profile);
+
+// ==================================
+// Graph capture
+
+internal AG_Graph ag_graph_capture(Arena *arena, AG_Value *root);
+
+// level[i] = number of edges on the longest path from the graph's root to node i
+internal U32 *ag_graph_levels(Arena *arena, AG_Graph *graph, U32 *level_count);
+
+// ==================================
+// Graph statistics & profiling
+
+// The arenas are optional and only used to report how much memory they currently hold.
+internal AG_GraphStats ag_graph_stats(AG_Value *root, Arena *value_arena, Arena *array_arena);
+
+internal void ag_fprint_graph_stats(FILE *os, AG_GraphStats *stats);
+
+internal void ag_fprint_backward_profile(FILE *os, AG_BackwardProfile *profile);
+
+internal String8 ag_value_type_name(AG_ValueType type);
+
+// ==================================
+// Graph rewriting
+
+// Builds an equivalent graph for `root` in `arena`: constant subtrees are folded, identical 
+// subexpressions are deduplicated and expanded ops are collapsed into native ones 
+// (e.g. mul(x, -1) -> neg(x), mul(a, pow(b, -1)) -> div(a, b), add(a, neg(b)) -> sub(a, b)).
+// Source leaves are shared with the original graph, so grads still end up in the same
+// parameters. Blocks are rebuilt on their rewritten inputs with the same callback and user data.
+// If the result would have more nodes than the original, the original root is returned with
+// nothing reported as rewritten.
+internal AG_RewriteResult ag_graph_rewrite(Arena *arena, AG_Value *root);
+
 internal void ag_internal_backward(AG_Value *value);
 
+// Backward pass with "create graph" semantics: instead of accumulating numbers into grads, the
+// gradient computation itself is built as AG nodes in `arena`. Returns d(value)/d(wrt_i) as
+// differentiable values (their `value` is the gradient), so they can be backpropagated through
+// again for higher-order derivatives.
+// Only the scalar ops can be differentiated twice: Add, Sub, Mul, Div, Neg, Exp, Pow, Log, Tanh,
+// Sigmoid and Relu, over Source and Constant leaves. If the gradient flows through anything else
+// (a block: conv, pooling, batch norm, fused losses, checkpointed segments), this prints an
+// error and returns an empty array (values = 0).
+internal AG_ValueArray ag_backward_create_graph(Arena *arena, AG_Value *value, AG_ValueArray wrt);
+
+// Exact Hessian-vector product hv = H(value) * v w.r.t. `params`, by running a normal backward
+// pass over the graph built by ag_backward_create_graph. Overwrites the grads of the graph.
+// Returns 0 (and leaves hv untouched) if the graph has ops ag_backward_create_graph doesn't support.
+internal B32 ag_hessian_vector_product(Arena *arena, AG_Value *value, AG_ValueArray params, F64 *v, F64 *hv);
+
+// ==================================
+// Forward-mode functions
+
+// tangent = sum_i d(value)/d(pred_i) * pred_i.tangent. Called by every op constructor.
+internal void ag_internal_forward_tangent(AG_Value *value);
+
+// Seeds the tangents of `leaves` with `direction` (pass 0 to reset them to zero)
+internal void ag_set_tangents(AG_ValueArray leaves, F64 *direction);
+
 // ==================================
 // Value "tensor" helpers
 
@@ -135,9 +353,32 @@ internal AG_ValueArray4D ag_make_value_array4d_from_raw(Arena *value_arena, Aren
 // ==================================
 // Private helpers
 
+// A zeroed value whose value and grad point at its own storage
+internal AG_Value *ag_push_value(Arena *arena);
+
 internal void ag_push_predecessor(Arena *arena, AG_Value *value, AG_Value *pred);
 
 internal void ag_build_topo(Arena *arena, AG_Value *value, AG_TopoList *list);
 
+internal AG_ValueArray ag_detached_copy(Arena *arena, AG_ValueArray values);
+
+internal void ag_checkpoint_backward(AG_Block *block, F64 *input_grads);
+
+internal void ag_backward_sweep(AG_Value **roots, int root_count, AG_BackwardProfile *profile);
+
+internal F64 ag_eval_op(AG_ValueType type, AG_Value **preds, F64 k);
+
+internal AG_Value *ag_push_op(Arena *arena, AG_ValueType type, AG_Value **preds, int pred_count, F64 k);
+
+internal AG_Value *ag_push_unary_op(Arena *arena, AG_ValueType type, AG_Value *x, F64 value);
+
+internal AG_Value *ag_push_binary_op(Arena *arena, AG_ValueType type, AG_Value *a, AG_Value *b, F64 value);
+
+internal F64 ag_sigmoid_f64(F64 x);
+
+internal AG_Value *ag_grad_contribution(Arena *arena, AG_Value *value, int slot, AG_Value *grad);
+
+internal AG_Value *ag_rewrite_node(Arena *arena, AG_Value *node, AG_Value **preds, AG_RewriteResult *stats);
+
 
 #endif
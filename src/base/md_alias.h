@@ -74,6 +74,7 @@ typedef MD_ArenaTemp    ArenaTemp;
 #define arena_release               MD_ArenaRelease
 #define push_array(a,T,c)           MD_PushArrayZero(a,T,c)
 #define push_array_no_zero(a,T,c)   MD_PushArray(a,T,c)
+#define arena_pos                   MD_IMPL_ArenaGetPos
 
 #define temp_begin MD_ArenaBeginTemp
 #define temp_end MD_ArenaEndTemp
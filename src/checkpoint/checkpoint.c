@@ -0,0 +1,426 @@
+// ==================================
+// Saving
+
+internal
+CK_Image ck_make_mlp_image(Arena *arena, NN_MLP *mlp, OPT_Optimizer *opt) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+    I32 *architecture = push_array(scratch.arena, I32, 2 + 2*mlp->layer_count);
+    int architecture_count = ck_mlp_architecture(mlp, architecture);
+    CK_Image result = ck_make_image(arena, CK_ModelKind_MLP, architecture, architecture_count, mlp->params.count, opt);
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+CK_Image ck_make_small_cnn_image(Arena *arena, NN_SmallCNN *cnn, OPT_Optimizer *opt) {
+    I32 architecture[CK_SMALL_CNN_ARCHITECTURE_COUNT];
+    int architecture_count = ck_small_cnn_architecture(cnn, architecture);
+    return ck_make_image(arena, CK_ModelKind_SmallCNN, architecture, architecture_count, cnn->params.count, opt);
+}
+
+internal
+void ck_image_capture(CK_Image *image, NN_Params *params, OPT_Optimizer *opt) {
+    Assert((U64)params->count == image->header->param_count);
+    MemoryCopy(image->params, params->values, params->count*sizeof(F64));
+    if (opt) {
+        image->header->step_count = opt->step_count;
+        if (image->m) MemoryCopy(image->m, opt->m, params->count*sizeof(F64));
+        if (image->v) MemoryCopy(image->v, opt->v, params->count*sizeof(F64));
+    }
+}
+
+internal
+B32 ck_write_image(CK_Image *image, char *path) {
+    ArenaTemp scratch = scratch_begin(0, 0);
+    U64 path_size = strlen(path);
+    char *temp_path = push_array(scratch.arena, char, path_size + sizeof(CK_TEMP_SUFFIX));
+    MemoryCopy(temp_path, path, path_size);
+    MemoryCopy(temp_path + path_size, CK_TEMP_SUFFIX, sizeof(CK_TEMP_SUFFIX));
+
+    B32 is_replaced = os_write_entire_file(temp_path, image->data, image->size, 1) && os_replace_file(temp_path, path);
+    // Don't leave a (possibly truncated) temporary file behind. Once renamed, it's already gone.
+    if (!is_replaced) remove(temp_path);
+    B32 result = is_replaced && os_sync_parent_directory(path);
+    if (!result) fprintf(stderr, "ck_write_image: couldn't write %s\n", path);
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+B32 ck_save_mlp(char *path, NN_MLP *mlp, OPT_Optimizer *opt) {
+    ArenaTemp scratch = scratch_begin(0, 0);
+    CK_Image image = ck_make_mlp_image(scratch.arena, mlp, opt);
+    ck_image_capture(&image, &mlp->params, opt);
+    B32 result = ck_write_image(&image, path);
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+B32 ck_save_small_cnn(char *path, NN_SmallCNN *cnn, OPT_Optimizer *opt) {
+    ArenaTemp scratch = scratch_begin(0, 0);
+    CK_Image image = ck_make_small_cnn_image(scratch.arena, cnn, opt);
+    ck_image_capture(&image, &cnn->params, opt);
+    B32 result = ck_write_image(&image, path);
+    scratch_end(scratch);
+    return result;
+}
+
+// ==================================
+// Asynchronous saving
+
+internal
+CK_AsyncWriter *ck_make_async_writer(Arena *arena, CK_Image *image, char *path) {
+    CK_AsyncWriter *writer = push_array(arena, CK_AsyncWriter, 1);
+    writer->images[0] = *image;
+    MD_ArenaPushAlign(arena, CK_ALIGN);
+    U8 *data = push_array_no_zero(arena, U8, image->size);
+    MemoryCopy(data, image->data, image->size);
+    B32 is_valid = ck_image_from_data(data, image->size, &writer->images[1]);
+    Assert(is_valid);
+
+    U64 path_size = strlen(path);
+    writer->path = push_array(arena, char, path_size+1);
+    MemoryCopy(writer->path, path, path_size);
+
+    writer->pending_idx = -1;
+    writer->writing_idx = -1;
+    os_mutex_init(&writer->mutex);
+    os_condition_variable_init(&writer->pending_cv);
+    os_condition_variable_init(&writer->idle_cv);
+    writer->thread = os_thread_launch(arena, ck_async_writer_main, writer);
+    return writer;
+}
+
+internal
+void ck_async_writer_capture(CK_AsyncWriter *writer, NN_Params *params, OPT_Optimizer *opt) {
+    // Take the buffer that isn't being written. If it holds a snapshot that's still waiting, that
+    // one is superseded and dropped.
+    os_mutex_lock(&writer->mutex);
+    int idx = (writer->writing_idx == 0 ? 1 : 0);
+    if (writer->pending_idx == idx) {
+        writer->pending_idx = -1;
+        writer->dropped_count += 1;
+    }
+    os_mutex_unlock(&writer->mutex);
+
+    ck_image_capture(&writer->images[idx], params, opt);
+
+    os_mutex_lock(&writer->mutex);
+    writer->pending_idx = idx;
+    os_condition_variable_broadcast(&writer->pending_cv);
+    os_mutex_unlock(&writer->mutex);
+}
+
+internal
+void ck_async_writer_flush(CK_AsyncWriter *writer) {
+    os_mutex_lock(&writer->mutex);
+    while (writer->pending_idx >= 0 || writer->writing_idx >= 0) {
+        os_condition_variable_wait(&writer->idle_cv, &writer->mutex);
+    }
+    os_mutex_unlock(&writer->mutex);
+}
+
+internal
+void ck_release_async_writer(CK_AsyncWriter *writer) {
+    os_mutex_lock(&writer->mutex);
+    writer->is_shutting_down = 1;
+    os_condition_variable_broadcast(&writer->pending_cv);
+    os_mutex_unlock(&writer->mutex);
+
+    os_thread_join(writer->thread);
+
+    os_condition_variable_release(&writer->idle_cv);
+    os_condition_variable_release(&writer->pending_cv);
+    os_mutex_release(&writer->mutex);
+}
+
+// ==================================
+// Loading
+
+internal
+CK_Checkpoint ck_open(char *path) {
+    CK_Checkpoint result = {0};
+    result.map = os_map_file(path);
+    if (!result.map.data) {
+        fprintf(stderr, "ck_open: couldn't map %s\n", path);
+        return result;
+    }
+    if (!ck_image_from_data(result.map.data, result.map.size, &result.image)) {
+        fprintf(stderr, "ck_open: %s isn't a valid checkpoint\n", path);
+        os_unmap_file(&result.map);
+        MD_MemoryZero(&result.image, sizeof(result.image));
+        return result;
+    }
+    result.architecture = (I32*)(result.image.data + result.image.header->architecture_offset);
+    return result;
+}
+
+internal
+void ck_close(CK_Checkpoint *checkpoint) {
+    os_unmap_file(&checkpoint->map);
+    MD_MemoryZero(checkpoint, sizeof(*checkpoint));
+}
+
+internal
+B32 ck_load_mlp(Arena *arena, CK_Checkpoint *checkpoint, NN_MLP *mlp, OPT_Optimizer *opt, TP_ThreadPool *pool) {
+    CK_Header *header = checkpoint->image.header;
+    if (!header || header->model_kind != CK_ModelKind_MLP) {
+        fprintf(stderr, "ck_load_mlp: not an MLP checkpoint\n");
+        return 0;
+    }
+    I32 *architecture = checkpoint->architecture;
+    int layer_count = (header->architecture_count >= 2 ? architecture[1] : 0);
+    if (layer_count <= 0 || header->architecture_count != (U32)(2 + 2*layer_count) || architecture[0] <= 0) {
+        fprintf(stderr, "ck_load_mlp: bad architecture\n");
+        return 0;
+    }
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+    int *output_dims = push_array(scratch.arena, int, layer_count);
+    B32 is_valid = 1;
+    for (int i = 0; i < layer_count; ++i) {
+        output_dims[i] = architecture[2 + 2*i];
+        if (output_dims[i] <= 0) is_valid = 0;
+    }
+    B32 result = 0;
+    if (!is_valid) {
+        fprintf(stderr, "ck_load_mlp: bad architecture\n");
+    } else if (header->param_count != (U64)nn_mlp_param_count(architecture[0], output_dims, layer_count)) {
+        fprintf(stderr, "ck_load_mlp: the param count doesn't match the architecture\n");
+    } else {
+        // Built straight on the mapped params, so there's nothing to copy or rebind afterwards
+        *mlp = nn_make_mlp_on_values(arena, architecture[0], output_dims, layer_count, checkpoint->image.params);
+        for (int i = 0; i < layer_count; ++i) {
+            NN_Layer *layer = &mlp->layers[i];
+            for (int j = 0; j < layer->neuron_count; ++j) layer->neurons[j].has_relu = architecture[3 + 2*i];
+        }
+        result = ck_load_params(checkpoint, CK_ModelKind_MLP, &mlp->params, opt, pool);
+    }
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+B32 ck_load_small_cnn(Arena *arena, CK_Checkpoint *checkpoint, NN_SmallCNN *cnn, OPT_Optimizer *opt, TP_ThreadPool *pool) {
+    CK_Header *header = checkpoint->image.header;
+    if (!header || header->model_kind != CK_ModelKind_SmallCNN || header->architecture_count != CK_SMALL_CNN_ARCHITECTURE_COUNT) {
+        fprintf(stderr, "ck_load_small_cnn: not a small CNN checkpoint\n");
+        return 0;
+    }
+    // The architecture is fixed by nn_make_small_cnn up to the class count, so the stored one
+    // has to match what it builds
+    int num_classes = checkpoint->architecture[CK_SMALL_CNN_ARCHITECTURE_COUNT-2];
+    if (num_classes <= 0) {
+        fprintf(stderr, "ck_load_small_cnn: bad architecture\n");
+        return 0;
+    }
+    *cnn = nn_make_small_cnn_on_values(arena, num_classes, 0);
+    I32 architecture[CK_SMALL_CNN_ARCHITECTURE_COUNT];
+    ck_small_cnn_architecture(cnn, architecture);
+    if (memcmp(architecture, checkpoint->architecture, sizeof(architecture)) != 0) {
+        fprintf(stderr, "ck_load_small_cnn: architecture doesn't match nn_make_small_cnn\n");
+        return 0;
+    }
+    return ck_load_params(checkpoint, CK_ModelKind_SmallCNN, &cnn->params, opt, pool);
+}
+
+// ==================================
+// Private helpers
+
+internal
+int ck_mlp_architecture(NN_MLP *mlp, I32 *out) {
+    out[0] = (mlp->layer_count > 0 ? mlp->layers[0].neurons[0].weights.count : 0);
+    out[1] = mlp->layer_count;
+    for (int i = 0; i < mlp->layer_count; ++i) {
+        out[2 + 2*i] = mlp->layers[i].neuron_count;
+        out[3 + 2*i] = mlp->layers[i].neurons[0].has_relu;
+    }
+    return 2 + 2*mlp->layer_count;
+}
+
+internal
+int ck_small_cnn_architecture(NN_SmallCNN *cnn, I32 *out) {
+    int count = 0;
+    for (int i = 0; i < ArrayCount(cnn->convs); ++i) {
+        NN_Conv2D *conv = &cnn->convs[i];
+        out[count++] = conv->in_channels;
+        out[count++] = conv->out_channels;
+        out[count++] = conv->kernel_size;
+        out[count++] = conv->stride;
+        out[count++] = conv->padding;
+        out[count++] = conv->groups;
+        out[count++] = conv->has_relu;
+    }
+    for (int i = 0; i < ArrayCount(cnn->pools); ++i) {
+        NN_Pool2D *pool = &cnn->pools[i];
+        out[count++] = pool->type;
+        out[count++] = pool->kernel_size;
+        out[count++] = pool->stride;
+        out[count++] = pool->padding;
+    }
+    out[count++] = cnn->fc.neurons[0].weights.count;
+    out[count++] = cnn->fc.neuron_count;
+    out[count++] = cnn->fc.neurons[0].has_relu;
+    Assert(count == CK_SMALL_CNN_ARCHITECTURE_COUNT);
+    return count;
+}
+
+internal
+void ck_async_writer_main(void *writer_ptr) {
+    CK_AsyncWriter *writer = writer_ptr;
+    os_mutex_lock(&writer->mutex);
+    for (;;) {
+        // Pending snapshots are still written on shutdown
+        while (writer->pending_idx < 0 && !writer->is_shutting_down) {
+            os_condition_variable_wait(&writer->pending_cv, &writer->mutex);
+        }
+        if (writer->pending_idx < 0) break;
+        int idx = writer->pending_idx;
+        writer->pending_idx = -1;
+        writer->writing_idx = idx;
+        os_mutex_unlock(&writer->mutex);
+
+        B32 written = ck_write_image(&writer->images[idx], writer->path);
+
+        os_mutex_lock(&writer->mutex);
+        writer->writing_idx = -1;
+        if (written) writer->written_count += 1;
+        else         writer->failed_count += 1;
+        if (writer->pending_idx < 0) os_condition_variable_broadcast(&writer->idle_cv);
+    }
+    os_mutex_unlock(&writer->mutex);
+}
+
+internal
+CK_Image ck_make_image(Arena *arena, CK_ModelKind kind, I32 *architecture, int architecture_count, int param_count, OPT_Optimizer *opt) {
+    U64 block_size = (U64)param_count*sizeof(F64);
+    U64 architecture_offset = ck_align(sizeof(CK_Header));
+    U64 params_offset = ck_align(architecture_offset + architecture_count*sizeof(I32));
+    U64 size = params_offset + block_size;
+    U64 m_offset = 0, v_offset = 0;
+    if (opt && opt->m) {
+        m_offset = ck_align(size);
+        size = m_offset + block_size;
+    }
+    if (opt && opt->v) {
+        v_offset = ck_align(size);
+        size = v_offset + block_size;
+    }
+
+    MD_ArenaPushAlign(arena, CK_ALIGN);
+    U8 *data = push_array(arena, U8, size); // zeroed, so the padding is deterministic
+
+    CK_Header *header = (CK_Header*)data;
+    header->magic = CK_MAGIC;
+    header->version = CK_VERSION;
+    header->model_kind = kind;
+    header->architecture_count = architecture_count;
+    header->file_size = size;
+    header->architecture_offset = architecture_offset;
+    header->params_offset = params_offset;
+    header->param_count = param_count;
+    if (opt) {
+        Assert(opt->param_count == param_count);
+        OPT_Config *config = &opt->config;
+        header->has_optimizer = 1;
+        header->optimizer_kind = config->kind;
+        header->nesterov = config->nesterov;
+        header->lr = config->lr;
+        header->momentum = config->momentum;
+        header->beta1 = config->beta1;
+        header->beta2 = config->beta2;
+        header->eps = config->eps;
+        header->weight_decay = config->weight_decay;
+        header->clip_value = config->clip_value;
+        header->clip_norm = config->clip_norm;
+        header->step_count = opt->step_count;
+        header->m_offset = m_offset;
+        header->v_offset = v_offset;
+    }
+    ArrayCopy((I32*)(data + architecture_offset), architecture, architecture_count);
+
+    CK_Image result = {0};
+    B32 is_valid = ck_image_from_data(data, size, &result);
+    Assert(is_valid);
+    return result;
+}
+
+internal
+B32 ck_image_from_data(U8 *data, U64 size, CK_Image *image) {
+    if (size < sizeof(CK_Header)) return 0;
+    CK_Header *header = (CK_Header*)data;
+    if (header->magic != CK_MAGIC || header->version != CK_VERSION || header->file_size != size) return 0;
+    if (header->model_kind != CK_ModelKind_MLP && header->model_kind != CK_ModelKind_SmallCNN) return 0;
+    if (header->param_count > (U64)0x7fffffff) return 0;
+
+    // Every section has to be aligned and inside the file
+    U64 block_size = header->param_count*sizeof(F64);
+    U64 offsets[] = {header->architecture_offset, header->params_offset, header->m_offset, header->v_offset};
+    U64 sizes[] = {header->architecture_count*sizeof(I32), block_size, block_size, block_size};
+    for (int i = 0; i < ArrayCount(offsets); ++i) {
+        if (i >= 2 && offsets[i] == 0) continue; // no such optimizer buffer
+        if (offsets[i] < sizeof(CK_Header) || offsets[i] % CK_ALIGN != 0) return 0;
+        if (offsets[i] > size || sizes[i] > size - offsets[i]) return 0;
+    }
+    if (!header->has_optimizer && (header->m_offset || header->v_offset)) return 0;
+
+    MD_MemoryZero(image, sizeof(*image));
+    image->data = data;
+    image->size = size;
+    image->header = header;
+    image->params = (F64*)(data + header->params_offset);
+    if (header->m_offset) image->m = (F64*)(data + header->m_offset);
+    if (header->v_offset) image->v = (F64*)(data + header->v_offset);
+    return 1;
+}
+
+internal
+B32 ck_load_params(CK_Checkpoint *checkpoint, CK_ModelKind kind, NN_Params *params, OPT_Optimizer *opt, TP_ThreadPool *pool) {
+    CK_Image *image = &checkpoint->image;
+    CK_Header *header = image->header;
+    if (!header || header->model_kind != kind || header->param_count != (U64)params->count) {
+        fprintf(stderr, "ck_load_params: the checkpoint doesn't match the model\n");
+        return 0;
+    }
+    if (opt && header->has_optimizer) {
+        // The buffers the optimizer kind steps with (see opt_make_optimizer)
+        B32 needs_m = (header->optimizer_kind != OPT_Kind_SGD || header->momentum != 0);
+        B32 needs_v = (header->optimizer_kind != OPT_Kind_SGD);
+        if (header->optimizer_kind > OPT_Kind_AdamW || needs_m != (image->m != 0) || needs_v != (image->v != 0)) {
+            fprintf(stderr, "ck_load_params: bad optimizer state\n");
+            return 0;
+        }
+    }
+
+    // Unless the model was built on the mapping, its own values block is left unused
+    if (params->values != image->params) nn_params_bind_values(params, image->params);
+
+    if (opt) {
+        MD_MemoryZero(opt, sizeof(*opt));
+        if (header->has_optimizer) {
+            OPT_Config *config = &opt->config;
+            config->kind = (OPT_Kind)header->optimizer_kind;
+            config->lr = header->lr;
+            config->momentum = header->momentum;
+            config->nesterov = header->nesterov;
+            config->beta1 = header->beta1;
+            config->beta2 = header->beta2;
+            config->eps = header->eps;
+            config->weight_decay = header->weight_decay;
+            config->clip_value = header->clip_value;
+            config->clip_norm = header->clip_norm;
+            opt->param_count = params->count;
+            opt->step_count = header->step_count;
+            opt->m = image->m;
+            opt->v = image->v;
+            opt->pool = pool;
+        }
+    }
+    return 1;
+}
+
+internal
+U64 ck_align(U64 x) {
+    return (x + CK_ALIGN-1) & ~(U64)(CK_ALIGN-1);
+}
@@ -0,0 +1,179 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+// ==================================
+// Binary model checkpoints
+//
+// NOTE: A checkpoint is one file laid out exactly like its in-memory image:
+//           [CK_Header][architecture: I32s][params: F64s][m: F64s][v: F64s]
+//       with every section starting at a multiple of CK_ALIGN. Saving builds the image and
+//       writes it with a single write. Loading maps the file (see os_map_file) and points the
+//       model's params block and the optimizer's moments straight into the mapping, so a restart
+//       only pays for rebuilding the model's structure and leaves, and the pages are read in as they're touched.
+//       The mapping is private: training on a loaded model copies the pages it writes and never
+//       modifies the file.
+//       Values are stored in the native byte order (little-endian on every target we build for).
+
+#define CK_MAGIC   0x54504B43 // "CKPT"
+#define CK_VERSION 1
+#define CK_ALIGN   64
+
+#define CK_TEMP_SUFFIX ".tmp" // saves go to path CK_TEMP_SUFFIX first, see ck_write_image
+
+typedef enum CK_ModelKind {
+    CK_ModelKind_MLP = 1,
+    CK_ModelKind_SmallCNN,
+} CK_ModelKind;
+
+typedef struct CK_Header CK_Header;
+struct CK_Header {
+    U32 magic;
+    U32 version;
+    U32 model_kind;
+    U32 architecture_count; // I32s in the architecture section
+    U64 file_size;
+    U64 architecture_offset;
+    U64 params_offset;
+    U64 param_count;
+
+    // Optimizer state, if has_optimizer. m_offset/v_offset are 0 when the optimizer has no such
+    // buffer (see opt_make_optimizer).
+    U32 has_optimizer;
+    U32 optimizer_kind;
+    U32 nesterov;
+    U32 reserved;
+    F64 lr;
+    F64 momentum;
+    F64 beta1;
+    F64 beta2;
+    F64 eps;
+    F64 weight_decay;
+    F64 clip_value;
+    F64 clip_norm;
+    U64 step_count;
+    U64 m_offset;
+    U64 v_offset;
+};
+
+// A checkpoint file in memory. params/m/v point into data (m/v are 0 if absent).
+typedef struct CK_Image CK_Image;
+struct CK_Image {
+    U8 *data;
+    U64 size;
+    CK_Header *header;
+    F64 *params;
+    F64 *m;
+    F64 *v;
+};
+
+// A mapped checkpoint file. Models and optimizers loaded from it point into the mapping, so it
+// has to stay open as long as they are used.
+typedef struct CK_Checkpoint CK_Checkpoint;
+struct CK_Checkpoint {
+    OS_FileMap map;
+    CK_Image image; // image.data is 0 if the file couldn't be opened or isn't a valid checkpoint
+    I32 *architecture;
+};
+
+// Saves snapshots of a model on a background thread, so training only pays for copying the
+// params and optimizer state into a buffer (ck_async_writer_capture).
+// NOTE: There are two images: while one is being written, the next snapshot is captured into
+//       the other. A snapshot that is still waiting when the next one is captured is dropped in
+//       favor of the newer one, so capturing never waits for the disk. Captures have to come
+//       from a single thread.
+typedef struct CK_AsyncWriter CK_AsyncWriter;
+struct CK_AsyncWriter {
+    CK_Image images[2];
+    char *path;
+    OS_Thread thread;
+
+    OS_Mutex mutex;
+    OS_ConditionVariable pending_cv; // a snapshot was captured, or shutting down
+    OS_ConditionVariable idle_cv;    // nothing pending or being written
+
+    // Image indices, -1 for none. Guarded by mutex.
+    int pending_idx;
+    int writing_idx;
+    B32 is_shutting_down;
+
+    U64 written_count;
+    U64 failed_count;
+    U64 dropped_count;
+};
+
+// ==================================
+// Saving
+
+// The header and architecture of a checkpoint of the model (and the optimizer, if not 0). The
+// payload is filled in by ck_image_capture.
+internal CK_Image ck_make_mlp_image(Arena *arena, NN_MLP *mlp, OPT_Optimizer *opt);
+
+internal CK_Image ck_make_small_cnn_image(Arena *arena, NN_SmallCNN *cnn, OPT_Optimizer *opt);
+
+// Copies the params block and the optimizer state (and its step count) into the image
+internal void ck_image_capture(CK_Image *image, NN_Params *params, OPT_Optimizer *opt);
+
+// Writes a temporary file next to path, flushes it to the disk, then renames it over path, so
+// path always holds a complete checkpoint, even if the process dies halfway through a save.
+internal B32 ck_write_image(CK_Image *image, char *path);
+
+// Builds the image, captures and writes it in one go. opt can be 0.
+internal B32 ck_save_mlp(char *path, NN_MLP *mlp, OPT_Optimizer *opt);
+
+internal B32 ck_save_small_cnn(char *path, NN_SmallCNN *cnn, OPT_Optimizer *opt);
+
+// ==================================
+// Asynchronous saving
+
+// image is one of the writer's two buffers (from ck_make_mlp_image or ck_make_small_cnn_image,
+// the other one is a copy of it) and has to outlive the writer
+internal CK_AsyncWriter *ck_make_async_writer(Arena *arena, CK_Image *image, char *path);
+
+// Copies the params block and the optimizer state (opt can be 0) into a free buffer and hands it
+// to the writer thread. Never waits for a write.
+internal void ck_async_writer_capture(CK_AsyncWriter *writer, NN_Params *params, OPT_Optimizer *opt);
+
+// Waits until the last captured snapshot is on the disk
+internal void ck_async_writer_flush(CK_AsyncWriter *writer);
+
+// Writes the pending snapshot, if any, and stops the writer thread
+internal void ck_release_async_writer(CK_AsyncWriter *writer);
+
+// ==================================
+// Loading
+
+// Maps and validates the file
+internal CK_Checkpoint ck_open(char *path);
+
+internal void ck_close(CK_Checkpoint *checkpoint);
+
+// Builds the model's structure from the checkpoint's architecture (no random init, see
+// nn_make_mlp_on_values), with its params block and leaves pointing into the mapping. If opt isn't 0, it's restored too (pool is its thread
+// pool); it's left zeroed if the checkpoint has no optimizer state.
+internal B32 ck_load_mlp(Arena *arena, CK_Checkpoint *checkpoint, NN_MLP *mlp, OPT_Optimizer *opt, TP_ThreadPool *pool);
+
+internal B32 ck_load_small_cnn(Arena *arena, CK_Checkpoint *checkpoint, NN_SmallCNN *cnn, OPT_Optimizer *opt, TP_ThreadPool *pool);
+
+// ==================================
+// Private helpers
+
+// The architecture section: input_dim, layer_count, then (output_dim, has_relu) for every layer
+internal int ck_mlp_architecture(NN_MLP *mlp, I32 *out);
+
+// (in_channels, out_channels, kernel_size, stride, padding, groups, has_relu) for every conv,
+// (type, kernel_size, stride, padding) for every pool, then the fc's (in_dim, out_dim, has_relu)
+#define CK_SMALL_CNN_ARCHITECTURE_COUNT (2*7 + 2*4 + 3)
+internal int ck_small_cnn_architecture(NN_SmallCNN *cnn, I32 *out);
+
+internal void ck_async_writer_main(void *writer_ptr);
+
+internal CK_Image ck_make_image(Arena *arena, CK_ModelKind kind, I32 *architecture, int architecture_count, int param_count, OPT_Optimizer *opt);
+
+// Points the image's sections into data, after validating the header against size
+internal B32 ck_image_from_data(U8 *data, U64 size, CK_Image *image);
+
+internal B32 ck_load_params(CK_Checkpoint *checkpoint, CK_ModelKind kind, NN_Params *params, OPT_Optimizer *opt, TP_ThreadPool *pool);
+
+internal U64 ck_align(U64 x);
+
+#endif
@@ -0,0 +1,416 @@
+#if defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+# define LA_SSE2 1
+#else
+# define LA_SSE2 0
+#endif
+
+// ==================================
+// GEMM
+
+internal
+void la_gemm(TP_ThreadPool *pool, B32 transpose_a, B32 transpose_b, int m, int n, int k,
+             F64 alpha, F64 *a, int lda, F64 *b, int ldb, F64 beta, F64 *c, int ldc) {
+    if (m <= 0 || n <= 0) return;
+
+    if (beta != 1) {
+        for (int i = 0; i < m; ++i) {
+            F64 *c_row = c + (U64)i*ldc;
+            if (beta == 0) MD_MemoryZero(c_row, n*sizeof(F64));
+            else for (int j = 0; j < n; ++j) c_row[j] *= beta;
+        }
+    }
+    if (k <= 0 || alpha == 0) return;
+
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    int max_nc = MD_Min(n, LA_NC);
+    int max_kc = MD_Min(k, LA_KC);
+    int padded_nc = (max_nc + LA_NR-1)/LA_NR*LA_NR;
+    MD_ArenaPushAlign(scratch.arena, 64);
+    F64 *packed_b = push_array(scratch.arena, F64, (U64)padded_nc*max_kc);
+
+    LA_GemmJob job = {0};
+    job.transpose_a = transpose_a;
+    job.alpha = alpha;
+    job.a = a;
+    job.lda = lda;
+    job.c = c;
+    job.ldc = ldc;
+    job.packed_b = packed_b;
+    job.m = m;
+
+    int row_block_count = (m + LA_MC-1)/LA_MC;
+    for (int jc = 0; jc < n; jc += LA_NC) {
+        int nc = MD_Min(LA_NC, n - jc);
+        for (int pc = 0; pc < k; pc += LA_KC) {
+            int kc = MD_Min(LA_KC, k - pc);
+            la_pack_b(packed_b, transpose_b, b, ldb, pc, kc, jc, nc);
+            job.pc = pc; job.kc = kc;
+            job.jc = jc; job.nc = nc;
+            tp_parallel_for(pool, row_block_count, la_gemm_row_block_task, &job);
+        }
+    }
+
+    scratch_end(scratch);
+}
+
+internal
+void la_gemm_f32(TP_ThreadPool *pool, B32 transpose_a, B32 transpose_b, int m, int n, int k,
+                 F32 alpha, F32 *a, int lda, F32 *b, int ldb, F32 beta, F32 *c, int ldc) {
+    if (m <= 0 || n <= 0) return;
+
+    if (beta != 1) {
+        for (int i = 0; i < m; ++i) {
+            F32 *c_row = c + (U64)i*ldc;
+            if (beta == 0) MD_MemoryZero(c_row, n*sizeof(F32));
+            else for (int j = 0; j < n; ++j) c_row[j] *= beta;
+        }
+    }
+    if (k <= 0 || alpha == 0) return;
+
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    int max_nc = MD_Min(n, LA_NC);
+    int max_kc = MD_Min(k, LA_KC);
+    int padded_nc = (max_nc + LA_NR_F32-1)/LA_NR_F32*LA_NR_F32;
+    MD_ArenaPushAlign(scratch.arena, 64);
+    F32 *packed_b = push_array(scratch.arena, F32, (U64)padded_nc*max_kc);
+
+    LA_GemmJobF32 job = {0};
+    job.transpose_a = transpose_a;
+    job.alpha = alpha;
+    job.a = a;
+    job.lda = lda;
+    job.c = c;
+    job.ldc = ldc;
+    job.packed_b = packed_b;
+    job.m = m;
+
+    int row_block_count = (m + LA_MC-1)/LA_MC;
+    for (int jc = 0; jc < n; jc += LA_NC) {
+        int nc = MD_Min(LA_NC, n - jc);
+        for (int pc = 0; pc < k; pc += LA_KC) {
+            int kc = MD_Min(LA_KC, k - pc);
+            la_pack_b_f32(packed_b, transpose_b, b, ldb, pc, kc, jc, nc);
+            job.pc = pc; job.kc = kc;
+            job.jc = jc; job.nc = nc;
+            tp_parallel_for(pool, row_block_count, la_gemm_row_block_task_f32, &job);
+        }
+    }
+
+    scratch_end(scratch);
+}
+
+internal
+void la_gemm_s8(TP_ThreadPool *pool, int m, int n, int k, I8 *a, int lda, I8 *b, int ldb, I32 *c, int ldc) {
+    if (m <= 0 || n <= 0) return;
+
+    LA_GemmJobS8 job = {0};
+    job.m = m; job.n = n; job.k = k;
+    job.a = a; job.lda = lda;
+    job.b = b; job.ldb = ldb;
+    job.c = c; job.ldc = ldc;
+
+    int row_block_count = (m + LA_MC-1)/LA_MC;
+    tp_parallel_for(pool, row_block_count, la_gemm_row_block_task_s8, &job);
+}
+
+internal
+void la_gemm_naive(B32 transpose_a, B32 transpose_b, int m, int n, int k,
+                   F64 alpha, F64 *a, int lda, F64 *b, int ldb, F64 beta, F64 *c, int ldc) {
+    for (int i = 0; i < m; ++i) {
+        for (int j = 0; j < n; ++j) {
+            F64 sum = 0;
+            for (int p = 0; p < k; ++p) {
+                F64 a_ip = transpose_a ? a[(U64)p*lda + i] : a[(U64)i*lda + p];
+                F64 b_pj = transpose_b ? b[(U64)j*ldb + p] : b[(U64)p*ldb + j];
+                sum += a_ip*b_pj;
+            }
+            F64 *c_ij = &c[(U64)i*ldc + j];
+            *c_ij = alpha*sum + (beta == 0 ? 0 : beta*(*c_ij));
+        }
+    }
+}
+
+// ==================================
+// Private helpers
+
+// Slivers of LA_MR rows, each stored p-major: dst[sliver][p][r]. Rows past mc are zero padded.
+internal
+void la_pack_a(F64 *dst, B32 transpose_a, F64 *a, int lda, int ic, int mc, int pc, int kc) {
+    for (int ir = 0; ir < mc; ir += LA_MR) {
+        int mr = MD_Min(LA_MR, mc - ir);
+        for (int p = 0; p < kc; ++p) {
+            for (int r = 0; r < LA_MR; ++r) {
+                F64 x = 0;
+                if (r < mr) {
+                    int i = ic + ir + r;
+                    x = transpose_a ? a[(U64)(pc+p)*lda + i] : a[(U64)i*lda + pc+p];
+                }
+                *dst++ = x;
+            }
+        }
+    }
+}
+
+// Slivers of LA_NR columns, each stored p-major: dst[sliver][p][c]. Columns past nc are zero padded.
+internal
+void la_pack_b(F64 *dst, B32 transpose_b, F64 *b, int ldb, int pc, int kc, int jc, int nc) {
+    for (int jr = 0; jr < nc; jr += LA_NR) {
+        int nr = MD_Min(LA_NR, nc - jr);
+        for (int p = 0; p < kc; ++p) {
+            for (int col = 0; col < LA_NR; ++col) {
+                F64 x = 0;
+                if (col < nr) {
+                    int j = jc + jr + col;
+                    x = transpose_b ? b[(U64)j*ldb + pc+p] : b[(U64)(pc+p)*ldb + j];
+                }
+                *dst++ = x;
+            }
+        }
+    }
+}
+
+// C[mr,nr] += alpha * (packed A sliver) * (packed B sliver)
+internal
+void la_micro_kernel(int kc, F64 alpha, F64 *packed_a, F64 *packed_b, F64 *c, int ldc, int mr, int nr) {
+    F64 acc[LA_MR][LA_NR];
+#if LA_SSE2
+    __m128d c00 = _mm_setzero_pd(), c01 = _mm_setzero_pd();
+    __m128d c10 = _mm_setzero_pd(), c11 = _mm_setzero_pd();
+    __m128d c20 = _mm_setzero_pd(), c21 = _mm_setzero_pd();
+    __m128d c30 = _mm_setzero_pd(), c31 = _mm_setzero_pd();
+    for (int p = 0; p < kc; ++p) {
+        __m128d b0 = _mm_loadu_pd(packed_b);
+        __m128d b1 = _mm_loadu_pd(packed_b + 2);
+        __m128d a0 = _mm_set1_pd(packed_a[0]);
+        __m128d a1 = _mm_set1_pd(packed_a[1]);
+        __m128d a2 = _mm_set1_pd(packed_a[2]);
+        __m128d a3 = _mm_set1_pd(packed_a[3]);
+        c00 = _mm_add_pd(c00, _mm_mul_pd(a0, b0)); c01 = _mm_add_pd(c01, _mm_mul_pd(a0, b1));
+        c10 = _mm_add_pd(c10, _mm_mul_pd(a1, b0)); c11 = _mm_add_pd(c11, _mm_mul_pd(a1, b1));
+        c20 = _mm_add_pd(c20, _mm_mul_pd(a2, b0)); c21 = _mm_add_pd(c21, _mm_mul_pd(a2, b1));
+        c30 = _mm_add_pd(c30, _mm_mul_pd(a3, b0)); c31 = _mm_add_pd(c31, _mm_mul_pd(a3, b1));
+        packed_a += LA_MR;
+        packed_b += LA_NR;
+    }
+    _mm_storeu_pd(&acc[0][0], c00); _mm_storeu_pd(&acc[0][2], c01);
+    _mm_storeu_pd(&acc[1][0], c10); _mm_storeu_pd(&acc[1][2], c11);
+    _mm_storeu_pd(&acc[2][0], c20); _mm_storeu_pd(&acc[2][2], c21);
+    _mm_storeu_pd(&acc[3][0], c30); _mm_storeu_pd(&acc[3][2], c31);
+#else
+    MD_MemoryZero(acc, sizeof(acc));
+    for (int p = 0; p < kc; ++p) {
+        for (int r = 0; r < LA_MR; ++r) {
+            for (int col = 0; col < LA_NR; ++col) acc[r][col] += packed_a[r]*packed_b[col];
+        }
+        packed_a += LA_MR;
+        packed_b += LA_NR;
+    }
+#endif
+    for (int r = 0; r < mr; ++r) {
+        F64 *c_row = c + (U64)r*ldc;
+        for (int col = 0; col < nr; ++col) c_row[col] += alpha*acc[r][col];
+    }
+}
+
+internal
+void la_gemm_row_block_task(void *user_data, int task_idx, int thread_idx) {
+    LA_GemmJob *job = user_data;
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    int ic = task_idx*LA_MC;
+    int mc = MD_Min(LA_MC, job->m - ic);
+    int padded_mc = (mc + LA_MR-1)/LA_MR*LA_MR;
+    MD_ArenaPushAlign(scratch.arena, 64);
+    F64 *packed_a = push_array_no_zero(scratch.arena, F64, (U64)padded_mc*job->kc);
+    la_pack_a(packed_a, job->transpose_a, job->a, job->lda, ic, mc, job->pc, job->kc);
+
+    for (int jr = 0; jr < job->nc; jr += LA_NR) {
+        int nr = MD_Min(LA_NR, job->nc - jr);
+        F64 *b_sliver = job->packed_b + (U64)jr*job->kc;
+        for (int ir = 0; ir < mc; ir += LA_MR) {
+            int mr = MD_Min(LA_MR, mc - ir);
+            F64 *a_sliver = packed_a + (U64)ir*job->kc;
+            F64 *c_block = job->c + (U64)(ic+ir)*job->ldc + job->jc + jr;
+            la_micro_kernel(job->kc, job->alpha, a_sliver, b_sliver, c_block, job->ldc, mr, nr);
+        }
+    }
+
+    scratch_end(scratch);
+}
+
+// ==================================
+// F32 private helpers (same layouts as the F64 ones)
+
+internal
+void la_pack_a_f32(F32 *dst, B32 transpose_a, F32 *a, int lda, int ic, int mc, int pc, int kc) {
+    for (int ir = 0; ir < mc; ir += LA_MR) {
+        int mr = MD_Min(LA_MR, mc - ir);
+        for (int p = 0; p < kc; ++p) {
+            for (int r = 0; r < LA_MR; ++r) {
+                F32 x = 0;
+                if (r < mr) {
+                    int i = ic + ir + r;
+                    x = transpose_a ? a[(U64)(pc+p)*lda + i] : a[(U64)i*lda + pc+p];
+                }
+                *dst++ = x;
+            }
+        }
+    }
+}
+
+internal
+void la_pack_b_f32(F32 *dst, B32 transpose_b, F32 *b, int ldb, int pc, int kc, int jc, int nc) {
+    for (int jr = 0; jr < nc; jr += LA_NR_F32) {
+        int nr = MD_Min(LA_NR_F32, nc - jr);
+        for (int p = 0; p < kc; ++p) {
+            for (int col = 0; col < LA_NR_F32; ++col) {
+                F32 x = 0;
+                if (col < nr) {
+                    int j = jc + jr + col;
+                    x = transpose_b ? b[(U64)j*ldb + pc+p] : b[(U64)(pc+p)*ldb + j];
+                }
+                *dst++ = x;
+            }
+        }
+    }
+}
+
+internal
+void la_micro_kernel_f32(int kc, F32 alpha, F32 *packed_a, F32 *packed_b, F32 *c, int ldc, int mr, int nr) {
+    F32 acc[LA_MR][LA_NR_F32];
+#if LA_SSE2
+    __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps();
+    __m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+    __m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps();
+    __m128 c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+    for (int p = 0; p < kc; ++p) {
+        __m128 b0 = _mm_loadu_ps(packed_b);
+        __m128 b1 = _mm_loadu_ps(packed_b + 4);
+        __m128 a0 = _mm_set1_ps(packed_a[0]);
+        __m128 a1 = _mm_set1_ps(packed_a[1]);
+        __m128 a2 = _mm_set1_ps(packed_a[2]);
+        __m128 a3 = _mm_set1_ps(packed_a[3]);
+        c00 = _mm_add_ps(c00, _mm_mul_ps(a0, b0)); c01 = _mm_add_ps(c01, _mm_mul_ps(a0, b1));
+        c10 = _mm_add_ps(c10, _mm_mul_ps(a1, b0)); c11 = _mm_add_ps(c11, _mm_mul_ps(a1, b1));
+        c20 = _mm_add_ps(c20, _mm_mul_ps(a2, b0)); c21 = _mm_add_ps(c21, _mm_mul_ps(a2, b1));
+        c30 = _mm_add_ps(c30, _mm_mul_ps(a3, b0)); c31 = _mm_add_ps(c31, _mm_mul_ps(a3, b1));
+        packed_a += LA_MR;
+        packed_b += LA_NR_F32;
+    }
+    _mm_storeu_ps(&acc[0][0], c00); _mm_storeu_ps(&acc[0][4], c01);
+    _mm_storeu_ps(&acc[1][0], c10); _mm_storeu_ps(&acc[1][4], c11);
+    _mm_storeu_ps(&acc[2][0], c20); _mm_storeu_ps(&acc[2][4], c21);
+    _mm_storeu_ps(&acc[3][0], c30); _mm_storeu_ps(&acc[3][4], c31);
+#else
+    MD_MemoryZero(acc, sizeof(acc));
+    for (int p = 0; p < kc; ++p) {
+        for (int r = 0; r < LA_MR; ++r) {
+            for (int col = 0; col < LA_NR_F32; ++col) acc[r][col] += packed_a[r]*packed_b[col];
+        }
+        packed_a += LA_MR;
+        packed_b += LA_NR_F32;
+    }
+#endif
+    for (int r = 0; r < mr; ++r) {
+        F32 *c_row = c + (U64)r*ldc;
+        for (int col = 0; col < nr; ++col) c_row[col] += alpha*acc[r][col];
+    }
+}
+
+internal
+void la_gemm_row_block_task_f32(void *user_data, int task_idx, int thread_idx) {
+    LA_GemmJobF32 *job = user_data;
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    int ic = task_idx*LA_MC;
+    int mc = MD_Min(LA_MC, job->m - ic);
+    int padded_mc = (mc + LA_MR-1)/LA_MR*LA_MR;
+    MD_ArenaPushAlign(scratch.arena, 64);
+    F32 *packed_a = push_array_no_zero(scratch.arena, F32, (U64)padded_mc*job->kc);
+    la_pack_a_f32(packed_a, job->transpose_a, job->a, job->lda, ic, mc, job->pc, job->kc);
+
+    for (int jr = 0; jr < job->nc; jr += LA_NR_F32) {
+        int nr = MD_Min(LA_NR_F32, job->nc - jr);
+        F32 *b_sliver = job->packed_b + (U64)jr*job->kc;
+        for (int ir = 0; ir < mc; ir += LA_MR) {
+            int mr = MD_Min(LA_MR, mc - ir);
+            F32 *a_sliver = packed_a + (U64)ir*job->kc;
+            F32 *c_block = job->c + (U64)(ic+ir)*job->ldc + job->jc + jr;
+            la_micro_kernel_f32(job->kc, job->alpha, a_sliver, b_sliver, c_block, job->ldc, mr, nr);
+        }
+    }
+
+    scratch_end(scratch);
+}
+
+internal
+void la_micro_kernel_s8(int k, I8 *a, int lda, I8 *b, int ldb, I32 *c, int ldc, int mr, int nr) {
+    // Edge blocks repeat their last row, whose results are dropped
+    I8 *a_rows[LA_MR_S8];
+    I8 *b_rows[LA_NR_S8];
+    for (int i = 0; i < LA_MR_S8; ++i) a_rows[i] = a + (U64)MD_Min(i, mr-1)*lda;
+    for (int j = 0; j < LA_NR_S8; ++j) b_rows[j] = b + (U64)MD_Min(j, nr-1)*ldb;
+
+    I32 block[LA_MR_S8][LA_NR_S8];
+    int p = 0;
+#if LA_SSE2
+    __m128i acc[LA_MR_S8][LA_NR_S8];
+    for (int i = 0; i < LA_MR_S8; ++i) {
+        for (int j = 0; j < LA_NR_S8; ++j) acc[i][j] = _mm_setzero_si128();
+    }
+    for (; p + 16 <= k; p += 16) {
+        // Sign extension: duplicate every byte into both halves of an I16, shift the copy out
+        __m128i a_lo[LA_MR_S8], a_hi[LA_MR_S8];
+        for (int i = 0; i < LA_MR_S8; ++i) {
+            __m128i a_bytes = _mm_loadu_si128((__m128i *)(a_rows[i] + p));
+            a_lo[i] = _mm_srai_epi16(_mm_unpacklo_epi8(a_bytes, a_bytes), 8);
+            a_hi[i] = _mm_srai_epi16(_mm_unpackhi_epi8(a_bytes, a_bytes), 8);
+        }
+        for (int j = 0; j < LA_NR_S8; ++j) {
+            __m128i b_bytes = _mm_loadu_si128((__m128i *)(b_rows[j] + p));
+            __m128i b_lo = _mm_srai_epi16(_mm_unpacklo_epi8(b_bytes, b_bytes), 8);
+            __m128i b_hi = _mm_srai_epi16(_mm_unpackhi_epi8(b_bytes, b_bytes), 8);
+            for (int i = 0; i < LA_MR_S8; ++i) {
+                acc[i][j] = _mm_add_epi32(acc[i][j], _mm_madd_epi16(a_lo[i], b_lo));
+                acc[i][j] = _mm_add_epi32(acc[i][j], _mm_madd_epi16(a_hi[i], b_hi));
+            }
+        }
+    }
+    // Horizontal sums of the 4 accumulators of a row, as one 4x4 transpose-and-add
+    for (int i = 0; i < LA_MR_S8; ++i) {
+        __m128i t0 = _mm_add_epi32(_mm_unpacklo_epi32(acc[i][0], acc[i][1]), _mm_unpackhi_epi32(acc[i][0], acc[i][1]));
+        __m128i t1 = _mm_add_epi32(_mm_unpacklo_epi32(acc[i][2], acc[i][3]), _mm_unpackhi_epi32(acc[i][2], acc[i][3]));
+        __m128i sums = _mm_add_epi32(_mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *)block[i], sums);
+    }
+#else
+    for (int i = 0; i < LA_MR_S8; ++i) {
+        for (int j = 0; j < LA_NR_S8; ++j) block[i][j] = 0;
+    }
+#endif
+    for (int i = 0; i < mr; ++i) {
+        for (int j = 0; j < nr; ++j) {
+            I32 sum = block[i][j];
+            for (int q = p; q < k; ++q) sum += (I32)a_rows[i][q]*b_rows[j][q];
+            c[(U64)i*ldc + j] = sum;
+        }
+    }
+}
+
+internal
+void la_gemm_row_block_task_s8(void *user_data, int task_idx, int thread_idx) {
+    LA_GemmJobS8 *job = user_data;
+    int i0 = task_idx*LA_MC;
+    int i1 = MD_Min(job->m, i0 + LA_MC);
+    for (int i = i0; i < i1; i += LA_MR_S8) {
+        int mr = MD_Min(LA_MR_S8, i1 - i);
+        for (int j = 0; j < job->n; j += LA_NR_S8) {
+            int nr = MD_Min(LA_NR_S8, job->n - j);
+            la_micro_kernel_s8(job->k, job->a + (U64)i*job->lda, job->lda, job->b + (U64)j*job->ldb, job->ldb,
+                               job->c + (U64)i*job->ldc + j, job->ldc, mr, nr);
+        }
+    }
+}
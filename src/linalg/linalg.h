@@ -0,0 +1,118 @@
+#ifndef LINALG_H
+#define LINALG_H
+
+// ==================================
+// GEMM
+//
+// Row-major C[m,n] = alpha*op(A)*op(B) + beta*C, where op(X) = X or X^T.
+// lda/ldb/ldc are the row strides of the matrices as stored (so for a transposed A, A is stored as
+// [k,m] with row stride lda). beta = 0 overwrites C without reading it.
+//
+// NOTE: The kernel packs op(A) into LA_MR-row slivers and op(B) into LA_NR-column slivers, blocked
+//       so a B panel stays in L2 and an A sliver in L1, then runs an LA_MR x LA_NR register
+//       micro-kernel over them. Packing makes the transposed cases as fast as the plain one.
+//       With a pool, the row blocks of each panel are spread over the threads; every C element
+//       is still summed in the same order, so results don't depend on the thread count.
+
+#define LA_MR 4
+#define LA_NR 4
+#define LA_MC 64
+#define LA_KC 256
+#define LA_NC 512
+
+internal void la_gemm(TP_ThreadPool *pool, B32 transpose_a, B32 transpose_b, int m, int n, int k,
+                      F64 alpha, F64 *a, int lda, F64 *b, int ldb, F64 beta, F64 *c, int ldc);
+
+// Same as la_gemm on F32 matrices (accumulating in F32). The micro-kernel is LA_MR x LA_NR_F32,
+// since a 128-bit register holds 4 F32s.
+#define LA_NR_F32 8
+
+internal void la_gemm_f32(TP_ThreadPool *pool, B32 transpose_a, B32 transpose_b, int m, int n, int k,
+                          F32 alpha, F32 *a, int lda, F32 *b, int ldb, F32 beta, F32 *c, int ldc);
+
+// Int8 GEMM with int32 accumulation: C[m,n] = A[m,k] * B[n,k]^T, i.e. every C element is the dot
+// product of a row of A and a row of B (the layout of activations times [out, in] weights, and of
+// conv weights times im2row'd images). C is overwritten.
+// NOTE: The SSE2 micro-kernel computes LA_MR_S8 x LA_NR_S8 blocks of C: it sign extends 16 bytes
+//       of every row at a time to I16 and multiplies them pairwise into I32 (pmaddwd), so each
+//       extended row is used LA_NR_S8 (or LA_MR_S8) times. Edge blocks repeat their last row
+//       instead of falling back to scalar code. Rows whose k is a multiple of 16 skip the scalar
+//       tail, so callers zero pad their rows to that. Sums are exact as long as k*127*127 fits
+//       in an I32 (k < 133000).
+#define LA_MR_S8 2
+#define LA_NR_S8 4
+
+internal void la_gemm_s8(TP_ThreadPool *pool, int m, int n, int k, I8 *a, int lda, I8 *b, int ldb, I32 *c, int ldc);
+
+// Reference triple loop, for testing
+internal void la_gemm_naive(B32 transpose_a, B32 transpose_b, int m, int n, int k,
+                            F64 alpha, F64 *a, int lda, F64 *b, int ldb, F64 beta, F64 *c, int ldc);
+
+// ==================================
+// Private helpers
+
+typedef struct LA_GemmJob LA_GemmJob;
+struct LA_GemmJob {
+    B32 transpose_a;
+    F64 alpha;
+    F64 *a;
+    int lda;
+    F64 *c;
+    int ldc;
+
+    // Current panel
+    F64 *packed_b;
+    int m;
+    int pc, kc;
+    int jc, nc;
+};
+
+internal void la_pack_a(F64 *dst, B32 transpose_a, F64 *a, int lda, int ic, int mc, int pc, int kc);
+
+internal void la_pack_b(F64 *dst, B32 transpose_b, F64 *b, int ldb, int pc, int kc, int jc, int nc);
+
+internal void la_micro_kernel(int kc, F64 alpha, F64 *packed_a, F64 *packed_b, F64 *c, int ldc, int mr, int nr);
+
+internal void la_gemm_row_block_task(void *user_data, int task_idx, int thread_idx);
+
+typedef struct LA_GemmJobF32 LA_GemmJobF32;
+struct LA_GemmJobF32 {
+    B32 transpose_a;
+    F32 alpha;
+    F32 *a;
+    int lda;
+    F32 *c;
+    int ldc;
+
+    // Current panel
+    F32 *packed_b;
+    int m;
+    int pc, kc;
+    int jc, nc;
+};
+
+internal void la_pack_a_f32(F32 *dst, B32 transpose_a, F32 *a, int lda, int ic, int mc, int pc, int kc);
+
+internal void la_pack_b_f32(F32 *dst, B32 transpose_b, F32 *b, int ldb, int pc, int kc, int jc, int nc);
+
+internal void la_micro_kernel_f32(int kc, F32 alpha, F32 *packed_a, F32 *packed_b, F32 *c, int ldc, int mr, int nr);
+
+internal void la_gemm_row_block_task_f32(void *user_data, int task_idx, int thread_idx);
+
+typedef struct LA_GemmJobS8 LA_GemmJobS8;
+struct LA_GemmJobS8 {
+    int m, n, k;
+    I8 *a;
+    int lda;
+    I8 *b;
+    int ldb;
+    I32 *c;
+    int ldc;
+};
+
+// The mr x nr block of C at c, from the mr rows of A at a and the nr rows of B at b
+internal void la_micro_kernel_s8(int k, I8 *a, int lda, I8 *b, int ldb, I32 *c, int ldc, int mr, int nr);
+
+internal void la_gemm_row_block_task_s8(void *user_data, int task_idx, int thread_idx);
+
+#endif
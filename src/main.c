@@ -1,48 +1,31 @@
 // .h
 #include "base/md.h"
 #include "base/md_alias.h"
+#include "os/os_inc.h"
+#include "linalg/linalg.h"
 #include "autograd/autograd.h"
 #include "nn/nn_inc.h"
+#include "optim/optim.h"
+#include "checkpoint/checkpoint.h"
 #include <stdio.h>
 #include <math.h>
 
 // .c
 #include "base/md.c"
+#include "os/os_inc.c"
+#include "linalg/linalg.c"
 #include "autograd/autograd.c"
 #include "nn/nn_inc.c"
+#include "optim/optim.c"
+#include "checkpoint/checkpoint.c"
 
 
-typedef struct AG_ValueArrayArray AG_ValueArrayArray;
-struct AG_ValueArrayArray {
-    AG_ValueArray *arrays;
-    int count;
-};
-
-AG_ValueArrayArray do_forward_pass(Arena *value_arena, Arena *array_arena, NN_MLP *mlp, AG_ValueArrayArray x) {
-    AG_ValueArrayArray result = {0};
-    result.count = x.count;
-    result.arrays = push_array(array_arena, AG_ValueArray, result.count);
-    for (int i = 0; i < x.count; ++i) {
-        result.arrays[i] = nn_mlp_apply(value_arena, array_arena, mlp, x.arrays[i]);
-    }
-    return result;
-}
-
-// AG_Value *mse_loss(Arena *value_arena, AG_ValueArrayArray y_true, AG_ValueArrayArray y_pred) {
-//     AG_Value *loss = ag_source(value_arena, 0);
-//     for (int i = 0; i < y_true.count; ++i) {
-//         AG_Value *error = ag_sub(value_arena, ys.values[i], y_preds.arrays[i].values[0]);
-//         AG_Value *squared_error = ag_pow(epoch_arena, error, 2);
-//         loss = ag_add(epoch_arena, loss, squared_error);
-//     }
-// }
-
 void train_mlp(void) {
 
     Arena *arena = arena_alloc();
 
     // Hyperparameters
-    F64 lr = 0.01;
+    F64 lr = 0.04; // the loss is a mean over the 4 samples
     int epoch_count = 100;
 
     // Data spec
@@ -54,57 +37,44 @@ void train_mlp(void) {
     };
     int x_count = 4;
     int x_dim = 3;
-    AG_ValueArrayArray xs = {0};
-    xs.count = x_count;
-    xs.arrays = push_array(arena, AG_ValueArray, x_count);
-    for (int i = 0; i < x_count; ++i) {
-        xs.arrays[i] = ag_value_array_from_raw(arena, &xs_raw[i*3], x_dim);
-    }
 
     F64 ys_raw[] = {1, -1, -1, 1};
-    AG_ValueArray ys = ag_value_array_from_raw(arena, ys_raw, ArrayCount(ys_raw));
 
     // MLP creation
     int layer_dims[] = {4,4,1};
     NN_MLP mlp = nn_make_mlp_with_random_init(arena, x_dim, layer_dims, ArrayCount(layer_dims));
 
-    // Params
-    AG_ValueArray mlp_params = nn_mlp_get_params(arena, &mlp);
+    NN_Params *params = &mlp.params;
+    OPT_Optimizer optimizer = opt_make_optimizer(arena, opt_sgd_config(lr, 0, 0), params->count, 0);
 
-    // Train loop
+    // Train loop (the whole dataset is one batch)
     for (int epoch = 0; epoch < epoch_count; ++epoch) {
         ArenaTemp scratch = scratch_begin(&arena, 1);
         Arena *epoch_arena = scratch.arena;
         
         // forward
-        AG_ValueArrayArray y_preds = do_forward_pass(epoch_arena, epoch_arena, &mlp, xs);
+        NN_MLPBatch batch = nn_mlp_apply_batch(epoch_arena, &mlp, xs_raw, x_count, 0);
+        F64 *y_preds = batch.output;
 
         printf("y_preds: [");
         for (int i = 0; i < x_count; ++i) {
-            printf("%f ", y_preds.arrays[i].values[0]->value);
+            printf("%f ", y_preds[i]);
         }
         printf("] ");
 
-        // loss
-        AG_Value *loss = ag_source(epoch_arena, 0);
-        for (int i = 0; i < x_count; ++i) {
-            AG_Value *error = ag_sub(epoch_arena, ys.values[i], y_preds.arrays[i].values[0]);
-            AG_Value *squared_error = ag_pow(epoch_arena, error, 2);
-            loss = ag_add(epoch_arena, loss, squared_error);
-        }
-        printf("Loss: %f\n", loss->value);
+        // loss (mean squared error) and its grad w.r.t. the predictions
+        F64 *loss_grads = push_array(epoch_arena, F64, x_count);
+        F64 loss = nn_mse(x_count, y_preds, ys_raw, loss_grads);
+        printf("Loss: %f\n", loss);
 
         // zero grad
-        for (int i = 0; i < mlp_params.count; ++i) mlp_params.values[i]->grad = 0;
+        nn_params_zero_grad(params);
 
         // backward
-        ag_backward(loss);
+        nn_mlp_backward_batch(&mlp, &batch, loss_grads, 0, 0);
 
         // update
-        for (int i = 0; i < mlp_params.count; ++i) {
-            AG_Value *param = mlp_params.values[i];
-            param->value += -lr * param->grad;
-        }
+        opt_step(&optimizer, params->values, params->grads);
 
         scratch_end(scratch);
     }
@@ -125,12 +95,39 @@ void train_small_cnn(void) {
     AG_ValueArray result = nn_small_cnn_apply(arena, arena, &cnn, &x);
 
     for (int i = 0; i < result.count; ++i) {
-        printf("cnn result[%d]: %f\n", i, result.values[i]->value);
+        printf("cnn result[%d]: %f\n", i, *result.values[i]->value);
     }
+
+    AG_GraphStats stats = ag_graph_stats(result.values[0], arena, 0);
+    ag_fprint_graph_stats(stdout, &stats);
     
 
+    // A few steps on a fixed batch of random images with arbitrary labels
+    int batch_count = 4;
+    int labels[] = {3, 1, 4, 1};
+    AG_ValueArray3D *xs = push_array(arena, AG_ValueArray3D, batch_count);
+    for (int b = 0; b < batch_count; ++b) {
+        xs[b] = ag_push_null_value_array3d(arena, 1, 28, 28);
+        for (int i = 0; i < ag_value_array3d_element_count(&xs[b]); ++i) {
+            xs[b].values[i] = ag_constant(arena, sample_f64_in_range(-1,1));
+        }
+    }
+
+    NN_Params *params = &cnn.params;
+    OPT_Optimizer optimizer = opt_make_optimizer(arena, opt_adam_config(1e-2), params->count, 0);
     for (int epoch = 0; epoch < 10; ++epoch) {
+        ArenaTemp scratch = scratch_begin(&arena, 1);
+
+        AG_ValueArray *logits = push_array(scratch.arena, AG_ValueArray, batch_count);
+        for (int b = 0; b < batch_count; ++b) logits[b] = nn_small_cnn_apply(scratch.arena, scratch.arena, &cnn, &xs[b]);
+        AG_Value *loss = nn_softmax_cross_entropy_apply(scratch.arena, logits, batch_count, labels);
+        printf("cnn loss: %f\n", *loss->value);
+
+        nn_params_zero_grad(params);
+        ag_backward(loss);
+        opt_step(&optimizer, params->values, params->grads);
 
+        scratch_end(scratch);
     }
 
     arena_release(arena);
@@ -186,11 +183,201 @@ void write_dataset_to_file(FILE *file, Dataset *dataset) {
     }
 }
 
+// Trains an MLP classifier on the moons, quantizes it and a small CNN to int8, and reports the
+// accuracy of both precisions and the speed of both forward passes
+void quantized_inference_report(void) {
+    Arena *arena = arena_alloc();
+
+    // MLP on the moons (labels as logits: > 0 is the second moon)
+    Dataset train = make_moons_2d(arena, 512, 0.1);
+    Dataset test = make_moons_2d(arena, 4096, 0.1);
+    int layer_dims[] = {64,64,1};
+    NN_MLP mlp = nn_make_mlp_with_random_init(arena, 2, layer_dims, ArrayCount(layer_dims));
+    OPT_Optimizer optimizer = opt_make_optimizer(arena, opt_adam_config(1e-2), mlp.params.count, 0);
+    for (int epoch = 0; epoch < 300; ++epoch) {
+        ArenaTemp scratch = scratch_begin(&arena, 1);
+        NN_MLPBatch batch = nn_mlp_apply_batch(scratch.arena, &mlp, train.X, train.sample_count, 0);
+        F64 *grads = push_array(scratch.arena, F64, train.sample_count);
+        nn_bce_with_logits(train.sample_count, batch.output, train.y, grads);
+        nn_params_zero_grad(&mlp.params);
+        nn_mlp_backward_batch(&mlp, &batch, grads, 0, 0);
+        opt_step(&optimizer, mlp.params.values, mlp.params.grads);
+        scratch_end(scratch);
+    }
+
+    NN_Calibration calibration = nn_make_calibration(arena, mlp.layer_count);
+    nn_calibrate_mlp(&calibration, &mlp, train.X, train.sample_count, 0);
+    NN_QuantizedMLP qmlp = nn_quantize_mlp(arena, &mlp, &calibration);
+
+    int rep_count = 20;
+    U64 f64_ns = 0, int8_ns = 0;
+    int f64_correct = 0, int8_correct = 0;
+    for (int rep = 0; rep < rep_count; ++rep) {
+        ArenaTemp scratch = scratch_begin(&arena, 1);
+        U64 begin = os_now_nanoseconds();
+        NN_MLPBatch batch = nn_mlp_apply_batch(scratch.arena, &mlp, test.X, test.sample_count, 0);
+        U64 middle = os_now_nanoseconds();
+        F32 *q_output = nn_quantized_mlp_apply(scratch.arena, &qmlp, test.X, test.sample_count, 0);
+        U64 end = os_now_nanoseconds();
+        f64_ns += middle - begin;
+        int8_ns += end - middle;
+        if (rep == 0) {
+            for (int i = 0; i < test.sample_count; ++i) {
+                f64_correct += (batch.output[i] > 0) == (test.y[i] > 0.5);
+                int8_correct += (q_output[i] > 0) == (test.y[i] > 0.5);
+            }
+        }
+        scratch_end(scratch);
+    }
+    printf("mlp f64: %.2f%% accuracy, %.3f ms | int8: %.2f%% accuracy, %.3f ms | speedup %.2fx\n",
+           100.0*f64_correct/test.sample_count, f64_ns/(1e6*rep_count),
+           100.0*int8_correct/test.sample_count, int8_ns/(1e6*rep_count), (F64)f64_ns/int8_ns);
+
+    // Small CNN on random images: no labels, so the accuracy delta is the top-1 agreement
+    NN_SmallCNN cnn = nn_make_small_cnn(arena, 10);
+    int image_count = 64, h = 28, w = 28;
+    F64 *images = push_array(arena, F64, image_count*h*w);
+    for (int i = 0; i < image_count*h*w; ++i) images[i] = sample_f64_in_range(-1, 1);
+    NN_Calibration cnn_calibration = nn_make_calibration(arena, NN_SMALL_CNN_CALIBRATION_COUNT);
+    nn_calibrate_small_cnn(&cnn_calibration, &cnn, images, image_count, h, w, 0);
+    NN_QuantizedSmallCNN qcnn = nn_quantize_small_cnn(arena, &cnn, h, w, &cnn_calibration);
+
+    f64_ns = int8_ns = 0;
+    int agreement = 0;
+    for (int rep = 0; rep < rep_count; ++rep) {
+        ArenaTemp scratch = scratch_begin(&arena, 1);
+        U64 begin = os_now_nanoseconds();
+        NN_SmallCNNBatch batch = nn_small_cnn_apply_batch(scratch.arena, &cnn, images, image_count, h, w, 0);
+        U64 middle = os_now_nanoseconds();
+        F32 *q_logits = nn_quantized_small_cnn_apply(scratch.arena, &qcnn, images, image_count, 0);
+        U64 end = os_now_nanoseconds();
+        f64_ns += middle - begin;
+        int8_ns += end - middle;
+        if (rep == 0) {
+            for (int n = 0; n < image_count; ++n) {
+                int best = 0, q_best = 0;
+                for (int c = 1; c < 10; ++c) {
+                    if (batch.logits[n*10 + c] > batch.logits[n*10 + best]) best = c;
+                    if (q_logits[n*10 + c] > q_logits[n*10 + q_best]) q_best = c;
+                }
+                agreement += best == q_best;
+            }
+        }
+        scratch_end(scratch);
+    }
+    printf("cnn f64: %.3f ms | int8: %.3f ms | speedup %.2fx | top-1 agreement %.2f%%\n",
+           f64_ns/(1e6*rep_count), int8_ns/(1e6*rep_count), (F64)f64_ns/int8_ns, 100.0*agreement/image_count);
+
+    arena_release(arena);
+}
+
+// Prunes a wide MLP to 90% sparsity both ways and compares the sparse forward passes with the
+// dense one on the same (pruned) weights
+void sparse_inference_report(void) {
+    Arena *arena = arena_alloc();
+
+    int input_dim = 784;
+    int layer_dims[] = {1024,1024,10};
+    int batch_count = 64;
+    F64 *x = push_array(arena, F64, batch_count*input_dim);
+    for (int i = 0; i < batch_count*input_dim; ++i) x[i] = sample_f64_in_range(-1, 1);
+
+    for (int format = NN_SparseFormat_CSR; format <= NN_SparseFormat_BSR; ++format) {
+        NN_MLP mlp = nn_make_mlp_with_random_init(arena, input_dim, layer_dims, ArrayCount(layer_dims));
+        NN_PruneKind kind = format == NN_SparseFormat_BSR ? NN_PruneKind_Block : NN_PruneKind_Unstructured;
+        nn_prune_mlp(&mlp, 0.9f, kind);
+        NN_SparseMLP sparse = nn_make_sparse_mlp(arena, &mlp, format);
+
+        U64 sparse_size = 0;
+        for (int l = 0; l < sparse.layer_count; ++l) sparse_size += nn_sparse_layer_size(&sparse.layers[l]);
+        U64 dense_size = (U64)mlp.params.count*sizeof(F64);
+
+        int rep_count = 10;
+        U64 dense_ns = 0, sparse_ns = 0;
+        F64 max_error = 0;
+        for (int rep = 0; rep < rep_count; ++rep) {
+            ArenaTemp scratch = scratch_begin(&arena, 1);
+            U64 begin = os_now_nanoseconds();
+            NN_MLPBatch batch = nn_mlp_apply_batch(scratch.arena, &mlp, x, batch_count, 0);
+            U64 middle = os_now_nanoseconds();
+            F64 *y = nn_sparse_mlp_apply(scratch.arena, &sparse, x, batch_count, 0);
+            U64 end = os_now_nanoseconds();
+            dense_ns += middle - begin;
+            sparse_ns += end - middle;
+            for (int i = 0; i < batch_count*layer_dims[2]; ++i) max_error = MD_Max(max_error, fabs(y[i] - batch.output[i]));
+            scratch_end(scratch);
+        }
+        printf("%s 90%% sparse: dense %.3f ms, %.2f MB | sparse %.3f ms, %.2f MB | speedup %.2fx | max error %g\n",
+               format == NN_SparseFormat_BSR ? "block/bsr" : "unstructured/csr",
+               dense_ns/(1e6*rep_count), dense_size/1e6, sparse_ns/(1e6*rep_count), sparse_size/1e6, (F64)dense_ns/sparse_ns, max_error);
+    }
+
+    arena_release(arena);
+}
+
+void checkpoint_report(void) {
+    Arena *arena = arena_alloc();
+    char *path = "mlp_report.ckpt";
+
+    int input_dim = 784;
+    int layer_dims[] = {1024,1024,10};
+    U64 build_begin = os_now_nanoseconds();
+    NN_MLP mlp = nn_make_mlp_with_random_init(arena, input_dim, layer_dims, ArrayCount(layer_dims));
+    U64 build_ns = os_now_nanoseconds() - build_begin;
+    OPT_Optimizer opt = opt_make_optimizer(arena, opt_adam_config(1e-3), mlp.params.count, 0);
+
+    U64 save_begin = os_now_nanoseconds();
+    B32 saved = ck_save_mlp(path, &mlp, &opt);
+    U64 save_ns = os_now_nanoseconds() - save_begin;
+
+    // ck_load_mlp is almost all rebuilding the model's structure on the mapped params (nn_make_mlp_on_values)
+    U64 map_begin = os_now_nanoseconds();
+    CK_Checkpoint checkpoint = ck_open(path);
+    U64 map_ns = os_now_nanoseconds() - map_begin;
+    NN_MLP loaded = {0};
+    OPT_Optimizer loaded_opt = {0};
+    U64 load_begin = os_now_nanoseconds();
+    B32 loaded_ok = saved && ck_load_mlp(arena, &checkpoint, &loaded, &loaded_opt, 0);
+    U64 load_ns = os_now_nanoseconds() - load_begin;
+
+    if (loaded_ok) {
+        printf("checkpoint of a %d param MLP with Adam state (%.2f MB): save %.3f ms | map %.3f ms | rebuild+load %.3f ms (vs %.3f ms building it with random init)\n",
+               mlp.params.count, checkpoint.image.size/1e6, save_ns/1e6, map_ns/1e6, load_ns/1e6, build_ns/1e6);
+    }
+    ck_close(&checkpoint);
+
+    // Snapshots handed to a background writer only cost the training loop a copy
+    CK_Image image = ck_make_mlp_image(arena, &mlp, &opt);
+    CK_AsyncWriter *writer = ck_make_async_writer(arena, &image, path);
+    int capture_count = 5;
+    U64 capture_ns = 0;
+    for (int i = 0; i < capture_count; ++i) {
+        U64 begin = os_now_nanoseconds();
+        ck_async_writer_capture(writer, &mlp.params, &opt);
+        capture_ns += os_now_nanoseconds() - begin;
+        opt.step_count += 1;
+    }
+    U64 flush_begin = os_now_nanoseconds();
+    ck_release_async_writer(writer);
+    U64 flush_ns = os_now_nanoseconds() - flush_begin;
+    printf("async checkpoint: capture %.3f ms (vs %.3f ms for a synchronous save) | %llu written, %llu superseded | final flush %.3f ms\n",
+           capture_ns/(1e6*capture_count), save_ns/1e6, (unsigned long long)writer->written_count, (unsigned long long)writer->dropped_count, flush_ns/1e6);
+    remove(path);
+
+    arena_release(arena);
+}
+
 int main(void) {
     train_mlp();
     
     train_small_cnn();
 
+    quantized_inference_report();
+
+    sparse_inference_report();
+
+    checkpoint_report();
+
     ArenaTemp scratch = scratch_begin(0,0);
     Dataset moons = make_moons_2d(scratch.arena, 100, 0.1);
     FILE *out_file = fopen("/home/kobedb/Dev/rommel/moons.csv", "w");
@@ -1,24 +1,113 @@
 internal
 NN_Conv2D nn_make_conv2d(Arena *arena, int in_channels, int out_channels, int kernel_size, int stride, int padding, B32 has_bias) {
+    return nn_make_grouped_conv2d(arena, in_channels, out_channels, kernel_size, stride, padding, 1, has_bias);
+}
+
+internal
+NN_Conv2D nn_make_grouped_conv2d(Arena *arena, int in_channels, int out_channels, int kernel_size, int stride, int padding, int groups, B32 has_bias) {
+    NN_Conv2D result = nn_make_unbound_conv2d(arena, in_channels, out_channels, kernel_size, stride, padding, groups);
+
+    int param_count = nn_conv2d_param_count(&result);
+    int weight_count = param_count - out_channels;
+    AG_Value **leaves = push_array(arena, AG_Value*, param_count);
+    for (int i = 0; i < weight_count; ++i) {
+        leaves[i] = ag_source(arena, sample_f64_in_range(-0.5, 0.5));
+    }
+    for (int i = weight_count; i < param_count; ++i) {
+        F64 bias = has_bias ? sample_f64_in_range(-0.5, 0.5) : 0;
+        leaves[i] = ag_source(arena, bias);
+    }
+    nn_conv2d_bind_leaves(&result, leaves);
+    return result;
+}
+
+internal
+NN_Conv2D nn_make_unbound_conv2d(Arena *arena, int in_channels, int out_channels, int kernel_size, int stride, int padding, int groups) {
+    Assert(groups > 0 && in_channels % groups == 0 && out_channels % groups == 0);
     NN_Conv2D result = {0};
     result.in_channels = in_channels;
     result.out_channels = out_channels;
     result.kernel_size = kernel_size;
     result.stride = stride;
     result.padding = padding;
-    
-    result.weights = ag_push_null_value_array4d(arena, out_channels, in_channels, kernel_size, kernel_size);
-    int weight_count = ag_value_array4d_element_count(&result.weights);
-    for (int i = 0; i < weight_count; ++i) {
-        result.weights.values[i] = ag_source(arena, sample_f64_in_range(-0.5, 0.5));
-    }
+    result.groups = groups;
 
+    result.weights.shape[0] = out_channels;
+    result.weights.shape[1] = in_channels/groups;
+    result.weights.shape[2] = kernel_size;
+    result.weights.shape[3] = kernel_size;
     result.biases.count = out_channels;
-    result.biases.values = push_array(arena, AG_Value*, result.biases.count);
-    for (int i = 0; i < result.biases.count; ++i) {
-        F64 bias = has_bias ? sample_f64_in_range(-0.5, 0.5) : 0;
-        result.biases.values[i] = ag_source(arena, bias);
+
+    if (kernel_size == 3 && stride == 1 && groups == 1) {
+        NN_WinogradCache *cache = push_array(arena, NN_WinogradCache, 1);
+        cache->weights = nn_push_winograd_weights(arena, in_channels, out_channels);
+        cache->source_weights = push_array(arena, F64, ag_value_array4d_element_count(&result.weights));
+        result.winograd_cache = cache;
+    }
+    return result;
+}
+
+internal
+void nn_conv2d_bind_leaves(NN_Conv2D *conv2d, AG_Value **leaves) {
+    conv2d->weights.values = leaves;
+    conv2d->biases.values = leaves + ag_value_array4d_element_count(&conv2d->weights);
+}
+
+internal
+int nn_conv2d_param_count(NN_Conv2D *conv2d) {
+    return ag_value_array4d_element_count(&conv2d->weights) + conv2d->biases.count;
+}
+
+internal
+NN_WinogradWeights *nn_winograd_cache_get(NN_WinogradCache *cache, F64 *weights) {
+    U64 weight_size = (U64)cache->weights.out_channels*cache->weights.in_channels*9*sizeof(F64);
+    if (!cache->is_valid || memcmp(cache->source_weights, weights, weight_size) != 0) {
+        MD_MemoryCopy(cache->source_weights, weights, weight_size);
+        nn_winograd_transform_weights(&cache->weights, weights);
+        cache->is_valid = 1;
+    }
+    return &cache->weights;
+}
+
+internal
+int nn_conv2d_output_dim(NN_Conv2D *conv2d, int input_dim) {
+    return (input_dim + 2*conv2d->padding - conv2d->kernel_size)/conv2d->stride + 1;
+}
+
+internal
+AG_ValueArray nn_conv2d_get_params(Arena *arena, NN_Conv2D *conv2d) {
+    int weight_count = ag_value_array4d_element_count(&conv2d->weights);
+    AG_ValueArray result = {0};
+    result.count = weight_count + conv2d->biases.count;
+    result.values = push_array(arena, AG_Value*, result.count);
+    ArrayCopy(result.values, conv2d->weights.values, weight_count);
+    ArrayCopy(result.values + weight_count, conv2d->biases.values, conv2d->biases.count);
+    return result;
+}
+
+internal
+AG_ValueArray nn_small_cnn_get_params(Arena *arena, NN_SmallCNN *cnn) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    AG_ValueArray parts[ArrayCount(cnn->convs)+1];
+    int total_param_count = 0;
+    for (int i = 0; i < ArrayCount(cnn->convs); ++i) {
+        parts[i] = nn_conv2d_get_params(scratch.arena, &cnn->convs[i]);
+        total_param_count += parts[i].count;
+    }
+    parts[ArrayCount(cnn->convs)] = nn_layer_get_params(scratch.arena, &cnn->fc);
+    total_param_count += parts[ArrayCount(cnn->convs)].count;
+
+    AG_ValueArray result = {0};
+    result.count = total_param_count;
+    result.values = push_array(arena, AG_Value*, total_param_count);
+    int result_idx = 0;
+    for (int i = 0; i < ArrayCount(parts); ++i) {
+        ArrayCopy(result.values + result_idx, parts[i].values, parts[i].count);
+        result_idx += parts[i].count;
     }
+
+    scratch_end(scratch);
     return result;
 }
 
@@ -28,24 +117,146 @@ AG_ValueArray3D nn_conv2d_apply(Arena *value_arena, Arena *array_arena, NN_Conv2
         fprintf(stderr, "conv2d_apply: x.shape[0] doesn't match conv2d.in_channels\n");
         return (AG_ValueArray3D){0};
     }
+
+    Arena *conflicts[] = {value_arena, array_arena};
+    ArenaTemp scratch = scratch_begin(conflicts, ArrayCount(conflicts));
+
+    // The block description is read again during backward, so it lives in value_arena
+    NN_Conv2DBlock *conv_block = push_array(value_arena, NN_Conv2DBlock, 1);
+    conv_block->shape = nn_make_grouped_conv_shape(conv2d->in_channels, x->shape[1], x->shape[2], conv2d->out_channels, 
+                                                   conv2d->kernel_size, conv2d->stride, conv2d->padding, MD_Max(conv2d->groups, 1));
+    conv_block->algorithm = nn_conv_pick_algorithm(&conv_block->shape, conv2d->algorithm);
+    conv_block->winograd_cache = conv2d->winograd_cache;
+    conv_block->has_relu = conv2d->has_relu;
+    if (conv_block->algorithm == NN_ConvAlgorithm_Winograd && !conv_block->winograd_cache) conv_block->algorithm = NN_ConvAlgorithm_Im2col;
+    NN_ConvShape *shape = &conv_block->shape;
+
+    // inputs = [x..., weights..., biases...]
+    int x_count = ag_value_array3d_element_count(x);
+    int weight_count = ag_value_array4d_element_count(&conv2d->weights);
+    AG_ValueArray inputs = {0};
+    inputs.count = x_count + weight_count + conv2d->biases.count;
+    inputs.values = push_array(scratch.arena, AG_Value*, inputs.count);
+    ArrayCopy(inputs.values, x->values, x_count);
+    ArrayCopy(inputs.values + x_count, conv2d->weights.values, weight_count);
+    ArrayCopy(inputs.values + x_count + weight_count, conv2d->biases.values, conv2d->biases.count);
+
+    int out_count = shape->out_channels*shape->out_h*shape->out_w;
+    AG_Block *block = ag_push_block(value_arena, inputs, out_count, nn_conv2d_block_backward, conv_block);
+
+    F64 *raw_inputs = push_array_no_zero(scratch.arena, F64, inputs.count);
+    F64 *raw_out = push_array_no_zero(scratch.arena, F64, out_count);
+    B32 has_tangents = 0;
+    for (int i = 0; i < inputs.count; ++i) {
+        raw_inputs[i] = *inputs.values[i]->value;
+        if (inputs.values[i]->tangent != 0) has_tangents = 1;
+    }
+    F64 *raw_weights = raw_inputs + x_count;
+    F64 *raw_biases = raw_inputs + x_count + weight_count;
+    if (conv_block->algorithm == NN_ConvAlgorithm_Winograd) {
+        NN_WinogradWeights *winograd = nn_winograd_cache_get(conv_block->winograd_cache, raw_weights);
+        nn_conv2d_forward_winograd(shape, 1, raw_inputs, winograd, raw_biases, raw_out, 0);
+    } else if (conv_block->algorithm == NN_ConvAlgorithm_Direct) {
+        nn_conv2d_forward_direct(shape, 1, raw_inputs, raw_weights, raw_biases, raw_out, 0);
+    } else if (conv_block->algorithm == NN_ConvAlgorithm_Depthwise) {
+        nn_conv2d_forward_depthwise(shape, 1, raw_inputs, raw_weights, raw_biases, raw_out, 0);
+    } else {
+        nn_conv2d_forward_im2col(shape, 1, raw_inputs, raw_weights, raw_biases, raw_out, 0);
+    }
+    // The kernels already added the biases, the relu is applied on write-back
+    if (conv2d->has_relu) {
+        for (int i = 0; i < out_count; ++i) *block->outputs.values[i]->value = MD_Max(raw_out[i], 0);
+    } else {
+        for (int i = 0; i < out_count; ++i) *block->outputs.values[i]->value = raw_out[i];
+    }
+
+    // Forward mode: the conv is bilinear in (x, weights), so 
+    // d(out) = conv(dx, weights) + dbiases + conv(x, dweights), masked by the relu. 
+    // Rare enough to always use im2col.
+    if (has_tangents) {
+        F64 *raw_tangents = push_array_no_zero(scratch.arena, F64, inputs.count);
+        F64 *raw_out_tangents = push_array_no_zero(scratch.arena, F64, out_count);
+        for (int i = 0; i < inputs.count; ++i) raw_tangents[i] = inputs.values[i]->tangent;
+        nn_conv2d_forward_im2col(shape, 1, raw_tangents, raw_inputs + x_count, raw_tangents + x_count + weight_count, raw_out_tangents, 0);
+        for (int i = 0; i < out_count; ++i) block->outputs.values[i]->tangent = raw_out_tangents[i];
+        nn_conv2d_forward_im2col(shape, 1, raw_inputs, raw_tangents + x_count, 0, raw_out_tangents, 0);
+        for (int i = 0; i < out_count; ++i) {
+            AG_Value *out = block->outputs.values[i];
+            out->tangent += raw_out_tangents[i];
+            if (conv2d->has_relu && *out->value <= 0) out->tangent = 0;
+        }
+    }
+
+    scratch_end(scratch);
+
+    AG_ValueArray3D result = ag_push_null_value_array3d(array_arena, shape->out_channels, shape->out_h, shape->out_w);
+    ArrayCopy(result.values, block->outputs.values, out_count);
+    return result;
+}
+
+internal
+void nn_conv2d_block_backward(AG_Block *block, F64 *input_grads) {
+    NN_Conv2DBlock *conv_block = block->user_data;
+    NN_ConvShape *shape = &conv_block->shape;
+
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    int x_count = shape->in_channels*shape->in_h*shape->in_w;
+    int weight_count = shape->out_channels*(shape->in_channels/shape->groups)*shape->kernel_size*shape->kernel_size;
+
+    F64 *raw_inputs = push_array_no_zero(scratch.arena, F64, block->inputs.count);
+    for (int i = 0; i < block->inputs.count; ++i) raw_inputs[i] = *block->inputs.values[i]->value;
+    F64 *out_grads = push_array_no_zero(scratch.arena, F64, block->outputs.count);
+    for (int i = 0; i < block->outputs.count; ++i) {
+        AG_Value *out = block->outputs.values[i];
+        // Outputs the relu clamped to 0 pass no grad back
+        out_grads[i] = (!conv_block->has_relu || *out->value > 0) ? *out->grad : 0;
+    }
+
+    F64 *raw_weights = raw_inputs + x_count;
+    F64 *weight_grads = input_grads + x_count;
+    F64 *bias_grads = input_grads + x_count + weight_count;
+    if (conv_block->algorithm == NN_ConvAlgorithm_Winograd) {
+        NN_WinogradWeights *winograd = nn_winograd_cache_get(conv_block->winograd_cache, raw_weights);
+        nn_conv2d_backward_winograd(shape, 1, raw_inputs, raw_weights, winograd, out_grads, weight_grads, bias_grads, input_grads, 0);
+    } else if (conv_block->algorithm == NN_ConvAlgorithm_Depthwise) {
+        nn_conv2d_backward_depthwise(shape, 1, raw_inputs, raw_weights, out_grads, weight_grads, bias_grads, input_grads, 0);
+    } else {
+        nn_conv2d_backward_im2col(shape, 1, raw_inputs, raw_weights, out_grads, weight_grads, bias_grads, input_grads, 0);
+    }
+
+    scratch_end(scratch);
+}
+
+internal
+AG_ValueArray3D nn_conv2d_apply_scalar(Arena *value_arena, Arena *array_arena, NN_Conv2D *conv2d, AG_ValueArray3D *x) {
+    if (x->shape[0] != conv2d->in_channels) {
+        fprintf(stderr, "conv2d_apply_scalar: x.shape[0] doesn't match conv2d.in_channels\n");
+        return (AG_ValueArray3D){0};
+    }
     
     int padding = conv2d->padding;
     int kernel_size = conv2d->kernel_size;
     int stride = conv2d->stride;
 
-    int out_h = (x->shape[1] + 2*padding - kernel_size)/stride + 1;
-    int out_w = (x->shape[2] + 2*padding - kernel_size)/stride + 1;
+    int out_h = nn_conv2d_output_dim(conv2d, x->shape[1]);
+    int out_w = nn_conv2d_output_dim(conv2d, x->shape[2]);
 
     AG_ValueArray3D result = ag_push_null_value_array3d(array_arena, conv2d->out_channels, out_h, out_w);
     int result_value_count = ag_value_array3d_element_count(&result);
     for (int i = 0; i < result_value_count; ++i) {
-        result.values[i] = ag_source(value_arena, 0);
+        result.values[i] = ag_constant(value_arena, 0);
     }
 
     int dim_1_opl = x->shape[1] + padding; // The one-past-last valid index for dim_1 with padding
     int dim_2_opl = x->shape[2] + padding;
 
+    int groups = MD_Max(conv2d->groups, 1);
+    int group_in_channels = conv2d->in_channels/groups;
+    int group_out_channels = conv2d->out_channels/groups;
+
     for (int kernel = 0; kernel < conv2d->out_channels; ++kernel) {
+        int first_in_channel = (kernel/group_out_channels)*group_in_channels;
         for (int cy = -padding, ty = 0; cy+kernel_size <= dim_1_opl; cy += stride, ty+=1) {
             for (int cx = -padding, tx = 0; cx+kernel_size <= dim_2_opl; cx += stride, tx+=1) {
                 for (int i = cy; i < cy + kernel_size; ++i) {
@@ -53,7 +264,7 @@ AG_ValueArray3D nn_conv2d_apply(Arena *value_arena, Arena *array_arena, NN_Conv2
                         // check if we are in zero-padding
                         if (i < 0 || i >= x->shape[1] || j < 0 || j >= x->shape[2]) continue;
                         
-                        for (int in_channel = 0; in_channel < x->shape[0] ; ++in_channel) {
+                        for (int in_channel = first_in_channel; in_channel < first_in_channel + group_in_channels; ++in_channel) {
                             AG_Value *x_pixel_value = *ag_value_array3d_get_value(x, in_channel, i, j);
                             int weight_idx_0 = i-cy;
                             int weight_idx_1 = j-cx;
@@ -61,7 +272,7 @@ AG_ValueArray3D nn_conv2d_apply(Arena *value_arena, Arena *array_arena, NN_Conv2
                                 fprintf(stderr, "weight indices are WRONG\n");
                                 continue;
                             }
-                            AG_Value *weight = *ag_value_array4d_get_value(&conv2d->weights, kernel, in_channel, i-cy, j-cx);
+                            AG_Value *weight = *ag_value_array4d_get_value(&conv2d->weights, kernel, in_channel - first_in_channel, i-cy, j-cx);
                             AG_Value *weighted_pixel = ag_mul(value_arena, x_pixel_value, weight);
                             
                             AG_Value **out_pixel = ag_value_array3d_get_value(&result, kernel, ty, tx);
@@ -72,6 +283,7 @@ AG_ValueArray3D nn_conv2d_apply(Arena *value_arena, Arena *array_arena, NN_Conv2
                 // add bias
                 AG_Value **out_pixel = ag_value_array3d_get_value(&result, kernel, ty, tx);
                 *out_pixel = ag_add(value_arena, *out_pixel, conv2d->biases.values[kernel]);
+                if (conv2d->has_relu) *out_pixel = ag_relu(value_arena, *out_pixel);
             }
         }
     }
@@ -80,17 +292,46 @@ AG_ValueArray3D nn_conv2d_apply(Arena *value_arena, Arena *array_arena, NN_Conv2
 }
 
 internal NN_SmallCNN nn_make_small_cnn(Arena *arena, int num_classes) {
+    NN_SmallCNN result = nn_make_small_cnn_on_values(arena, num_classes, 0);
+
+    // Same init as nn_make_conv2d and nn_make_layer_with_random_init, straight into the block
+    F64 *values = result.params.values;
+    for (int i = 0; i < ArrayCount(result.convs); ++i) {
+        int param_count = nn_conv2d_param_count(&result.convs[i]);
+        for (int j = 0; j < param_count; ++j) values[j] = sample_f64_in_range(-0.5, 0.5);
+        values += param_count;
+    }
+    int fc_input_dim = result.fc.neurons[0].weights.count;
+    for (int i = 0; i < result.fc.neuron_count; ++i) {
+        nn_sample_neuron_params(values, fc_input_dim);
+        values += fc_input_dim+1;
+    }
+
+    return result;
+}
+
+internal NN_SmallCNN nn_make_small_cnn_on_values(Arena *arena, int num_classes, F64 *values) {
     NN_SmallCNN result = {0};
 
-    // nn_make_conv2d(Arena *arena, int in_channels, int out_channels, int kernel_size, int stride, int padding, B32 has_bias)
-    result.convs[0] = nn_make_conv2d(arena, 1,  16, 3, 1, 1, 1); // increase channels: (16,28,28)
-    result.convs[1] = nn_make_conv2d(arena, 16, 16, 3, 2, 1, 1); // downsample, serves as max pooling operation: (16,14,14)
-    result.convs[2] = nn_make_conv2d(arena, 16, 32, 3, 1, 1, 1); // increase channels: (32,14,14)  
-    result.convs[3] = nn_make_conv2d(arena, 32, 32, 3, 2, 1, 1); // downsample, serves as max pooling operation: (32,7,7)
+    // nn_make_unbound_conv2d(Arena *arena, int in_channels, int out_channels, int kernel_size, int stride, int padding, int groups)
+    result.convs[0] = nn_make_unbound_conv2d(arena, 1,  16, 3, 1, 1, 1); // increase channels: (16,28,28)
+    result.pools[0] = nn_make_max_pool2d(2, 2, 0);                       // downsample: (16,14,14)
+    result.convs[1] = nn_make_unbound_conv2d(arena, 16, 32, 3, 1, 1, 1); // increase channels: (32,14,14)
+    result.pools[1] = nn_make_max_pool2d(2, 2, 0);                       // downsample: (32,7,7)
+    for (int i = 0; i < ArrayCount(result.convs); ++i) result.convs[i].has_relu = 1;
 
     int fc_input_dim = 32;
     B32 has_relu = 0;
-    result.fc = nn_make_layer_with_random_init(arena, fc_input_dim, num_classes, has_relu);
+    int param_count = (fc_input_dim+1)*num_classes;
+    for (int i = 0; i < ArrayCount(result.convs); ++i) param_count += nn_conv2d_param_count(&result.convs[i]);
+
+    result.params = nn_make_params_on_values(arena, values, param_count);
+    AG_Value **leaves = result.params.leaves;
+    for (int i = 0; i < ArrayCount(result.convs); ++i) {
+        nn_conv2d_bind_leaves(&result.convs[i], leaves);
+        leaves += nn_conv2d_param_count(&result.convs[i]);
+    }
+    result.fc = nn_make_layer_on_leaves(arena, fc_input_dim, num_classes, has_relu, leaves);
 
     return result;
 }
@@ -103,16 +344,178 @@ internal AG_ValueArray nn_small_cnn_apply(Arena *value_arena, Arena *array_arena
     AG_ValueArray3D cur = *x;
     
     cur = nn_conv2d_apply(value_arena, scratch.arena, &cnn->convs[0], &cur);
-    cur = nn_relu_3d(value_arena, scratch.arena, &cur);
+    cur = nn_pool2d_apply(value_arena, scratch.arena, &cnn->pools[0], &cur);
 
     cur = nn_conv2d_apply(value_arena, scratch.arena, &cnn->convs[1], &cur);
-    cur = nn_relu_3d(value_arena, scratch.arena, &cur);
+    cur = nn_pool2d_apply(value_arena, scratch.arena, &cnn->pools[1], &cur);
+
+    AG_ValueArray h = nn_gap(value_arena, scratch.arena, &cur);
+
+    // put last result's array on caller's array_arena
+    AG_ValueArray result = nn_layer_apply(value_arena, array_arena, &cnn->fc, h);
 
-    cur = nn_conv2d_apply(value_arena, scratch.arena, &cnn->convs[2], &cur);
-    cur = nn_relu_3d(value_arena, scratch.arena, &cur);
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+NN_SmallCNNBatch nn_small_cnn_apply_batch(Arena *arena, NN_SmallCNN *cnn, F64 *x, int batch_count, int in_h, int in_w, TP_ThreadPool *pool) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
 
-    cur = nn_conv2d_apply(value_arena, scratch.arena, &cnn->convs[3], &cur);
-    cur = nn_relu_3d(value_arena, scratch.arena, &cur);
+    NN_SmallCNNBatch result = {0};
+    result.batch_count = batch_count;
+
+    // cnn->params.values = [conv0 weights, conv0 biases, conv1 weights, conv1 biases, fc params]
+    F64 *params = cnn->params.values;
+    F64 *cur = x;
+    int channels = 1;
+    int h = in_h, w = in_w;
+    for (int i = 0; i < ArrayCount(cnn->convs); ++i) {
+        NN_Conv2D *conv = &cnn->convs[i];
+        NN_ConvShape *shape = &result.conv_shapes[i];
+        *shape = nn_make_grouped_conv_shape(channels, h, w, conv->out_channels, conv->kernel_size, conv->stride, conv->padding, MD_Max(conv->groups, 1));
+        F64 *weights = params;
+        params += ag_value_array4d_element_count(&conv->weights);
+        F64 *biases = conv->biases.count ? params : 0;
+        params += conv->biases.count;
+
+        U64 out_count = (U64)batch_count*shape->out_channels*shape->out_h*shape->out_w;
+        F64 *y = push_array_no_zero(arena, F64, out_count);
+        NN_ConvAlgorithm algorithm = nn_conv_pick_algorithm(shape, conv->algorithm);
+        if (algorithm == NN_ConvAlgorithm_Winograd && conv->winograd_cache) {
+            NN_WinogradWeights *winograd = nn_winograd_cache_get(conv->winograd_cache, weights);
+            nn_conv2d_forward_winograd(shape, batch_count, cur, winograd, biases, y, pool);
+        } else if (algorithm == NN_ConvAlgorithm_Direct) {
+            nn_conv2d_forward_direct(shape, batch_count, cur, weights, biases, y, pool);
+        } else if (algorithm == NN_ConvAlgorithm_Depthwise) {
+            nn_conv2d_forward_depthwise(shape, batch_count, cur, weights, biases, y, pool);
+        } else {
+            nn_conv2d_forward_im2col(shape, batch_count, cur, weights, biases, y, pool);
+        }
+        if (conv->has_relu) {
+            for (U64 j = 0; j < out_count; ++j) y[j] = MD_Max(y[j], 0);
+        }
+        result.conv_outputs[i] = y;
+
+        NN_Pool2D *pool2d = &cnn->pools[i];
+        NN_PoolShape *pool_shape = &result.pool_shapes[i];
+        *pool_shape = nn_make_pool_shape(shape->out_channels, shape->out_h, shape->out_w, pool2d->kernel_size, pool2d->stride, pool2d->padding);
+        U64 pooled_count = (U64)batch_count*pool_shape->channels*pool_shape->out_h*pool_shape->out_w;
+        F64 *pooled = push_array_no_zero(arena, F64, pooled_count);
+        if (pool2d->type == NN_PoolType_Max) {
+            U8 *argmax = push_array_no_zero(scratch.arena, U8, pooled_count);
+            nn_max_pool2d_forward(pool_shape, batch_count, y, pooled, argmax);
+        } else {
+            nn_avg_pool2d_forward(pool_shape, batch_count, y, pooled);
+        }
+        result.pool_outputs[i] = pooled;
+
+        cur = pooled;
+        channels = pool_shape->channels;
+        h = pool_shape->out_h;
+        w = pool_shape->out_w;
+    }
+
+    result.features = push_array_no_zero(arena, F64, (U64)batch_count*channels);
+    nn_global_avg_pool_forward(batch_count, channels, h*w, cur, result.features);
+
+    // fc params are [out, in+1], the bias last (see nn_layer_get_params)
+    int class_count = cnn->fc.neuron_count;
+    result.logits = push_array_no_zero(arena, F64, (U64)batch_count*class_count);
+    la_gemm(pool, 0, 1, batch_count, class_count, channels, 1, result.features, channels, params, channels+1, 0, result.logits, class_count);
+    for (int n = 0; n < batch_count; ++n) {
+        for (int o = 0; o < class_count; ++o) result.logits[(U64)n*class_count + o] += params[(U64)o*(channels+1) + channels];
+    }
+
+    scratch_end(scratch);
+    return result;
+}
+
+internal AG_ValueArray nn_small_cnn_segment_apply(Arena *value_arena, Arena *array_arena, AG_ValueArray inputs, void *user_data) {
+    NN_SmallCNNSegment *segment = user_data;
+
+    Arena *conflicts[] = {value_arena, array_arena};
+    ArenaTemp scratch = scratch_begin(conflicts, ArrayCount(conflicts));
+
+    // inputs = [activations..., conv0 weights..., conv0 biases..., conv1 weights..., ...]
+    AG_ValueArray3D cur = {0};
+    cur.values = inputs.values;
+    ArrayCopy(cur.shape, segment->in_shape, 3);
+    int input_idx = ag_value_array3d_element_count(&cur);
+
+    for (int i = 0; i < segment->conv_count; ++i) {
+        NN_Conv2D conv = segment->convs[i];
+        conv.weights.values = &inputs.values[input_idx];
+        input_idx += ag_value_array4d_element_count(&conv.weights);
+        conv.biases.values = &inputs.values[input_idx];
+        input_idx += conv.biases.count;
+
+        B32 is_last = (i == segment->conv_count-1);
+        cur = nn_conv2d_apply(value_arena, scratch.arena, &conv, &cur);
+        cur = nn_pool2d_apply(value_arena, is_last ? array_arena : scratch.arena, &segment->pools[i], &cur);
+    }
+    Assert(input_idx == inputs.count);
+
+    scratch_end(scratch);
+
+    AG_ValueArray result = {0};
+    result.values = cur.values;
+    result.count = ag_value_array3d_element_count(&cur);
+    return result;
+}
+
+internal AG_ValueArray nn_small_cnn_apply_checkpointed(Arena *value_arena, Arena *array_arena, NN_SmallCNN *cnn, AG_ValueArray3D *x, int segment_count) {
+    Arena *conflicts[] = {value_arena, array_arena};
+    ArenaTemp scratch = scratch_begin(conflicts, ArrayCount(conflicts));
+
+    int stage_count = ArrayCount(cnn->convs);
+    // A single segment would recompute (and hold) every activation at once during backward, so
+    // the default never goes below 2
+    if (segment_count <= 0) segment_count = MD_Max((int)(sqrt((F64)stage_count) + 0.5), 2);
+    segment_count = MD_Min(segment_count, stage_count);
+
+    AG_ValueArray3D cur = *x;
+
+    int stage_idx = 0;
+    for (int s = 0; s < segment_count; ++s) {
+        // spread the stages over the segments as evenly as possible
+        int segment_stage_count = stage_count/segment_count + (s < stage_count%segment_count);
+
+        // The segment description is read again during backward, so it lives in value_arena
+        NN_SmallCNNSegment *segment = push_array(value_arena, NN_SmallCNNSegment, 1);
+        segment->conv_count = segment_stage_count;
+        segment->convs = push_array(value_arena, NN_Conv2D, segment_stage_count);
+        segment->pools = &cnn->pools[stage_idx];
+        ArrayCopy(segment->in_shape, cur.shape, 3);
+
+        int input_count = ag_value_array3d_element_count(&cur);
+        for (int i = 0; i < segment_stage_count; ++i) {
+            NN_Conv2D *conv = &cnn->convs[stage_idx+i];
+            segment->convs[i] = *conv;
+            input_count += ag_value_array4d_element_count(&conv->weights) + conv->biases.count;
+        }
+
+        AG_ValueArray inputs = {0};
+        inputs.count = input_count;
+        inputs.values = push_array(scratch.arena, AG_Value*, input_count);
+        int input_idx = 0;
+        for (int i = 0; i < ag_value_array3d_element_count(&cur); ++i) inputs.values[input_idx++] = cur.values[i];
+        int out_shape[3] = {cur.shape[0], cur.shape[1], cur.shape[2]};
+        for (int i = 0; i < segment_stage_count; ++i) {
+            NN_Conv2D *conv = &segment->convs[i];
+            for (int j = 0; j < ag_value_array4d_element_count(&conv->weights); ++j) inputs.values[input_idx++] = conv->weights.values[j];
+            for (int j = 0; j < conv->biases.count; ++j) inputs.values[input_idx++] = conv->biases.values[j];
+            out_shape[0] = conv->out_channels;
+            out_shape[1] = nn_pool2d_output_dim(&segment->pools[i], nn_conv2d_output_dim(conv, out_shape[1]));
+            out_shape[2] = nn_pool2d_output_dim(&segment->pools[i], nn_conv2d_output_dim(conv, out_shape[2]));
+        }
+
+        AG_ValueArray outputs = ag_checkpoint(value_arena, scratch.arena, nn_small_cnn_segment_apply, segment, inputs);
+
+        cur.values = outputs.values;
+        ArrayCopy(cur.shape, out_shape, 3);
+        stage_idx += segment_stage_count;
+    }
 
     AG_ValueArray h = nn_gap(value_arena, scratch.arena, &cur);
 
@@ -131,22 +534,3 @@ internal AG_ValueArray3D nn_relu_3d(Arena *value_arena, Arena *array_arena, AG_V
     }
     return result;
 }
-
-internal AG_ValueArray nn_gap(Arena *value_arena, Arena *array_arena, AG_ValueArray3D *x) {
-    AG_ValueArray result = {0};
-    result.count = x->shape[0]; // num channels
-    result.values = push_array(array_arena, AG_Value*, result.count);
-    for (int c = 0; c < x->shape[0]; ++c) {
-        AG_Value *channel_avg = ag_source(value_arena, 0);
-        for (int i = 0; i < x->shape[1]; ++i) {
-            for (int j = 0; j < x->shape[2]; ++j) {
-                AG_Value **pixel_value = ag_value_array3d_get_value(x, c, i, j);
-                channel_avg = ag_add(value_arena, channel_avg, *pixel_value);
-            }
-        }
-        int channel_pixel_count = x->shape[1]*x->shape[2];
-        channel_avg = ag_div(value_arena, channel_avg, ag_source(value_arena, channel_pixel_count));
-        result.values[c] = channel_avg;
-    }
-    return result;
-}
@@ -1,6 +1,17 @@
 #ifndef CONV_H
 #define CONV_H
 
+// The Winograd transforms of the weights a conv last ran with, plus a copy of those weights, so 
+// the transform is only redone after the weights change (i.e. once per optimizer step).
+// NOTE: Refreshing it isn't thread safe, but the weights don't change during a backward pass, 
+//       so concurrent block backwards only ever read it.
+typedef struct NN_WinogradCache NN_WinogradCache;
+struct NN_WinogradCache {
+    NN_WinogradWeights weights;
+    F64 *source_weights;
+    B32 is_valid;
+};
+
 typedef struct NN_Conv2D NN_Conv2D;
 struct NN_Conv2D {
     int in_channels;
@@ -8,27 +19,111 @@ struct NN_Conv2D {
     int kernel_size;
     int stride;
     int padding;
+    int groups; // 1 = full channel mixing, in_channels = depthwise
+    B32 has_relu; // fused into the conv block: applied on the output write-back
 
-    AG_ValueArray4D weights;
+    AG_ValueArray4D weights; // [out_channels, in_channels/groups, kernel_size, kernel_size]
     AG_ValueArray   biases;
+
+    NN_ConvAlgorithm algorithm; // NN_ConvAlgorithm_Auto unless forced
+    NN_WinogradCache *winograd_cache; // Only for 3x3 stride-1 convs
+};
+
+// The user data of a conv's graph block
+typedef struct NN_Conv2DBlock NN_Conv2DBlock;
+struct NN_Conv2DBlock {
+    NN_ConvShape shape;
+    NN_ConvAlgorithm algorithm; // resolved, never Auto
+    NN_WinogradCache *winograd_cache;
+    B32 has_relu;
 };
 
 typedef struct NN_SmallCNN NN_SmallCNN;
 struct NN_SmallCNN {
-    NN_Conv2D convs[4];
+    NN_Conv2D convs[2];
+    NN_Pool2D pools[2]; // pools[i] follows convs[i] (relu fused into the conv)
     NN_Layer fc;
+    NN_Params params; // in nn_small_cnn_get_params order
 };
 
 internal NN_Conv2D nn_make_conv2d(Arena *arena, int in_channels, int out_channels, int kernel_size, int stride, int padding, B32 has_bias);
 
+// groups must divide both channel counts. groups == in_channels makes a depthwise conv.
+internal NN_Conv2D nn_make_grouped_conv2d(Arena *arena, int in_channels, int out_channels, int kernel_size, int stride, int padding, int groups, B32 has_bias);
+
+// The conv without any params: weights.values and biases.values are 0 until nn_conv2d_bind_leaves
+internal NN_Conv2D nn_make_unbound_conv2d(Arena *arena, int in_channels, int out_channels, int kernel_size, int stride, int padding, int groups);
+
+// Uses the first nn_conv2d_param_count(conv2d) of `leaves` (in nn_conv2d_get_params order) as
+// the conv's weights and biases
+internal void nn_conv2d_bind_leaves(NN_Conv2D *conv2d, AG_Value **leaves);
+
+internal int nn_conv2d_param_count(NN_Conv2D *conv2d);
+
+// The conv is a single graph block (see AG_Block) that runs the conv kernels (Winograd, direct,
+// depthwise or im2col+GEMM, see nn_conv_pick_algorithm) on the raw values, instead of one mul and one add node
+// per multiply-accumulate.
 internal AG_ValueArray3D nn_conv2d_apply(Arena *value_arena, Arena *array_arena, NN_Conv2D *conv2d, AG_ValueArray3D *x);
 
+internal void nn_conv2d_block_backward(AG_Block *block, F64 *input_grads);
+
+// Transformed weights for `weights`, from the cache if they haven't changed
+internal NN_WinogradWeights *nn_winograd_cache_get(NN_WinogradCache *cache, F64 *weights);
+
+// Reference implementation built from scalar nodes (one mul+add per multiply-accumulate). 
+// Only meant for testing the kernels.
+internal AG_ValueArray3D nn_conv2d_apply_scalar(Arena *value_arena, Arena *array_arena, NN_Conv2D *conv2d, AG_ValueArray3D *x);
+
+// Activations of a graph-free batched forward pass of a NN_SmallCNN, all [batch_count, ...] row-major
+typedef struct NN_SmallCNNBatch NN_SmallCNNBatch;
+struct NN_SmallCNNBatch {
+    int batch_count;
+    NN_ConvShape conv_shapes[2];
+    NN_PoolShape pool_shapes[2];
+    F64 *conv_outputs[2]; // after the fused relu
+    F64 *pool_outputs[2];
+    F64 *features; // global average pool of pool_outputs[1], the fc input
+    F64 *logits;
+};
+
+// The user data of a checkpointed run of consecutive conv+relu+pool stages of a NN_SmallCNN.
+// The convs are copies whose weights/biases get rebound to the segment's (detached) inputs.
+typedef struct NN_SmallCNNSegment NN_SmallCNNSegment;
+struct NN_SmallCNNSegment {
+    NN_Conv2D *convs;
+    NN_Pool2D *pools; // conv_count of them
+    int conv_count;
+    int in_shape[3];
+};
+
+internal int nn_conv2d_output_dim(NN_Conv2D *conv2d, int input_dim);
+
+// [weights..., biases...]
+internal AG_ValueArray nn_conv2d_get_params(Arena *arena, NN_Conv2D *conv2d);
+
+// [conv0 params..., conv1 params..., ..., fc params...]
+internal AG_ValueArray nn_small_cnn_get_params(Arena *arena, NN_SmallCNN *cnn);
+
 internal NN_SmallCNN nn_make_small_cnn(Arena *arena, int num_classes);
 
+// The structure of nn_make_small_cnn on an existing value block, or a zeroed one if values is 0
+// (see nn_make_mlp_on_values)
+internal NN_SmallCNN nn_make_small_cnn_on_values(Arena *arena, int num_classes, F64 *values);
+
 internal AG_ValueArray nn_small_cnn_apply(Arena *value_arena, Arena *array_arena, NN_SmallCNN *cnn, AG_ValueArray3D *x);
 
-internal AG_ValueArray3D nn_relu_3d(Arena *value_arena, Arena *array_arena, AG_ValueArray3D *x);
+// Batched forward pass over x [batch_count, 1, in_h, in_w] straight from cnn->params.values, on the 
+// conv and pooling kernels (no graph is built and the AG leaves aren't read).
+internal NN_SmallCNNBatch nn_small_cnn_apply_batch(Arena *arena, NN_SmallCNN *cnn, F64 *x, int batch_count, int in_h, int in_w, TP_ThreadPool *pool);
 
-internal AG_ValueArray nn_gap(Arena *value_arena, Arena *array_arena, AG_ValueArray3D *x);
+// Same as nn_small_cnn_apply, but the conv+relu+pool stages are split into `segment_count` 
+// checkpointed segments (see ag_checkpoint). Only the segment boundary activations stay alive
+// in value_arena. Pass segment_count = 0 to use ~sqrt(stage count) segments, but at least 2
+// (clamped to the stage count).
+internal AG_ValueArray nn_small_cnn_apply_checkpointed(Arena *value_arena, Arena *array_arena, NN_SmallCNN *cnn, AG_ValueArray3D *x, int segment_count);
+
+internal AG_ValueArray nn_small_cnn_segment_apply(Arena *value_arena, Arena *array_arena, AG_ValueArray inputs, void *user_data);
+
+internal AG_ValueArray3D nn_relu_3d(Arena *value_arena, Arena *array_arena, AG_ValueArray3D *x);
 
 #endif
@@ -0,0 +1,763 @@
+#if defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+# define NN_SSE2 1
+#else
+# define NN_SSE2 0
+#endif
+
+internal
+NN_ConvShape nn_make_conv_shape(int in_channels, int in_h, int in_w, int out_channels, int kernel_size, int stride, int padding) {
+    return nn_make_grouped_conv_shape(in_channels, in_h, in_w, out_channels, kernel_size, stride, padding, 1);
+}
+
+internal
+NN_ConvShape nn_make_grouped_conv_shape(int in_channels, int in_h, int in_w, int out_channels, int kernel_size, int stride, int padding, int groups) {
+    Assert(groups > 0 && in_channels % groups == 0 && out_channels % groups == 0);
+    NN_ConvShape result = {0};
+    result.in_channels = in_channels;
+    result.in_h = in_h;
+    result.in_w = in_w;
+    result.out_channels = out_channels;
+    result.kernel_size = kernel_size;
+    result.stride = stride;
+    result.padding = padding;
+    result.groups = groups;
+    result.out_h = (in_h + 2*padding - kernel_size)/stride + 1;
+    result.out_w = (in_w + 2*padding - kernel_size)/stride + 1;
+    return result;
+}
+
+internal
+NN_ConvShape nn_conv_group_shape(NN_ConvShape *shape) {
+    NN_ConvShape result = *shape;
+    result.in_channels = shape->in_channels/shape->groups;
+    result.out_channels = shape->out_channels/shape->groups;
+    result.groups = 1;
+    return result;
+}
+
+// ==================================
+// im2col + GEMM
+
+internal
+B32 nn_conv_is_pointwise(NN_ConvShape *shape) {
+    return shape->kernel_size == 1 && shape->stride == 1 && shape->padding == 0;
+}
+
+internal
+void nn_im2col(NN_ConvShape *shape, F64 *x, F64 *col) {
+    int k = shape->kernel_size;
+    int stride = shape->stride;
+    int padding = shape->padding;
+    int in_h = shape->in_h, in_w = shape->in_w;
+    int out_h = shape->out_h, out_w = shape->out_w;
+
+    for (int c = 0; c < shape->in_channels; ++c) {
+        F64 *x_channel = x + (U64)c*in_h*in_w;
+        for (int ky = 0; ky < k; ++ky) {
+            for (int kx = 0; kx < k; ++kx) {
+                // Valid output columns for this kernel column: 0 <= ox*stride - padding + kx < in_w
+                int ox_first = MD_Max(0, (padding - kx + stride-1)/stride);
+                int ox_opl = MD_Min(out_w, (in_w + padding - kx + stride-1)/stride);
+                for (int oy = 0; oy < out_h; ++oy) {
+                    int iy = oy*stride - padding + ky;
+                    F64 *col_row = col + (U64)oy*out_w;
+                    if (iy < 0 || iy >= in_h || ox_first >= ox_opl) {
+                        MD_MemoryZero(col_row, out_w*sizeof(F64));
+                        continue;
+                    }
+                    F64 *x_row = x_channel + (U64)iy*in_w;
+                    int ix_offset = kx - padding;
+                    for (int ox = 0; ox < ox_first; ++ox) col_row[ox] = 0;
+                    if (stride == 1) {
+                        ArrayCopy(col_row + ox_first, x_row + ox_first + ix_offset, ox_opl - ox_first);
+                    } else {
+                        for (int ox = ox_first; ox < ox_opl; ++ox) col_row[ox] = x_row[ox*stride + ix_offset];
+                    }
+                    for (int ox = ox_opl; ox < out_w; ++ox) col_row[ox] = 0;
+                }
+                col += (U64)out_h*out_w;
+            }
+        }
+    }
+}
+
+internal
+void nn_col2im(NN_ConvShape *shape, F64 *col_grads, F64 *x_grads) {
+    int k = shape->kernel_size;
+    int stride = shape->stride;
+    int padding = shape->padding;
+    int in_h = shape->in_h, in_w = shape->in_w;
+    int out_h = shape->out_h, out_w = shape->out_w;
+
+    for (int c = 0; c < shape->in_channels; ++c) {
+        F64 *x_channel = x_grads + (U64)c*in_h*in_w;
+        for (int ky = 0; ky < k; ++ky) {
+            for (int kx = 0; kx < k; ++kx) {
+                int ox_first = MD_Max(0, (padding - kx + stride-1)/stride);
+                int ox_opl = MD_Min(out_w, (in_w + padding - kx + stride-1)/stride);
+                for (int oy = 0; oy < out_h; ++oy) {
+                    int iy = oy*stride - padding + ky;
+                    if (iy < 0 || iy >= in_h) continue;
+                    F64 *col_row = col_grads + (U64)oy*out_w;
+                    F64 *x_row = x_channel + (U64)iy*in_w;
+                    int ix_offset = kx - padding;
+                    for (int ox = ox_first; ox < ox_opl; ++ox) x_row[ox*stride + ix_offset] += col_row[ox];
+                }
+                col_grads += (U64)out_h*out_w;
+            }
+        }
+    }
+}
+
+internal
+void nn_conv2d_forward_im2col(NN_ConvShape *shape, int batch_count, F64 *x, F64 *weights, F64 *biases, F64 *out, TP_ThreadPool *pool) {
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    // Every group is an independent conv on a contiguous slice of the channels
+    NN_ConvShape group_shape = nn_conv_group_shape(shape);
+    int col_rows = group_shape.in_channels*shape->kernel_size*shape->kernel_size;
+    int col_cols = shape->out_h*shape->out_w;
+    U64 x_group_size = (U64)group_shape.in_channels*shape->in_h*shape->in_w;
+    U64 out_group_size = (U64)group_shape.out_channels*col_cols;
+    U64 weight_group_size = (U64)group_shape.out_channels*col_rows;
+    B32 is_pointwise = nn_conv_is_pointwise(shape);
+
+    F64 *col = 0;
+    if (!is_pointwise) {
+        MD_ArenaPushAlign(scratch.arena, 64);
+        col = push_array_no_zero(scratch.arena, F64, (U64)col_rows*col_cols);
+    }
+
+    for (int n = 0; n < batch_count; ++n) {
+        for (int g = 0; g < shape->groups; ++g) {
+            U64 group_idx = (U64)n*shape->groups + g;
+            F64 *x_group = x + group_idx*x_group_size;
+            F64 *out_group = out + group_idx*out_group_size;
+            if (is_pointwise) col = x_group;
+            else              nn_im2col(&group_shape, x_group, col);
+
+            la_gemm(pool, 0, 0, group_shape.out_channels, col_cols, col_rows, 1, weights + g*weight_group_size, col_rows, col, col_cols, 0, out_group, col_cols);
+        }
+
+        if (biases) {
+            F64 *out_image = out + (U64)n*shape->out_channels*col_cols;
+            for (int o = 0; o < shape->out_channels; ++o) {
+                F64 *out_row = out_image + (U64)o*col_cols;
+                F64 bias = biases[o];
+                for (int p = 0; p < col_cols; ++p) out_row[p] += bias;
+            }
+        }
+    }
+
+    scratch_end(scratch);
+}
+
+internal
+void nn_conv2d_backward_im2col(NN_ConvShape *shape, int batch_count, F64 *x, F64 *weights, F64 *out_grads,
+                               F64 *weight_grads, F64 *bias_grads, F64 *x_grads, TP_ThreadPool *pool) {
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    NN_ConvShape group_shape = nn_conv_group_shape(shape);
+    int col_rows = group_shape.in_channels*shape->kernel_size*shape->kernel_size;
+    int col_cols = shape->out_h*shape->out_w;
+    U64 x_group_size = (U64)group_shape.in_channels*shape->in_h*shape->in_w;
+    U64 out_group_size = (U64)group_shape.out_channels*col_cols;
+    U64 weight_group_size = (U64)group_shape.out_channels*col_rows;
+    B32 is_pointwise = nn_conv_is_pointwise(shape);
+
+    F64 *col = 0;
+    F64 *col_grads = 0;
+    if (!is_pointwise) {
+        MD_ArenaPushAlign(scratch.arena, 64);
+        if (weight_grads) col = push_array_no_zero(scratch.arena, F64, (U64)col_rows*col_cols);
+        MD_ArenaPushAlign(scratch.arena, 64);
+        if (x_grads) col_grads = push_array_no_zero(scratch.arena, F64, (U64)col_rows*col_cols);
+    }
+
+    for (int n = 0; n < batch_count; ++n) {
+        for (int g = 0; g < shape->groups; ++g) {
+            U64 group_idx = (U64)n*shape->groups + g;
+            F64 *out_grads_group = out_grads + group_idx*out_group_size;
+            F64 *weights_group = weights + g*weight_group_size;
+
+            // dW += dOut * col^T
+            if (weight_grads) {
+                F64 *x_group = x + group_idx*x_group_size;
+                if (is_pointwise) col = x_group;
+                else              nn_im2col(&group_shape, x_group, col);
+                la_gemm(pool, 0, 1, group_shape.out_channels, col_rows, col_cols, 1, out_grads_group, col_cols, col, col_cols,
+                        1, weight_grads + g*weight_group_size, col_rows);
+            }
+
+            // dX = col2im(W^T * dOut)
+            if (x_grads) {
+                F64 *x_grads_group = x_grads + group_idx*x_group_size;
+                if (is_pointwise) {
+                    la_gemm(pool, 1, 0, col_rows, col_cols, group_shape.out_channels, 1, weights_group, col_rows, out_grads_group, col_cols, 0, x_grads_group, col_cols);
+                } else {
+                    la_gemm(pool, 1, 0, col_rows, col_cols, group_shape.out_channels, 1, weights_group, col_rows, out_grads_group, col_cols, 0, col_grads, col_cols);
+                    MD_MemoryZero(x_grads_group, x_group_size*sizeof(F64));
+                    nn_col2im(&group_shape, col_grads, x_grads_group);
+                }
+            }
+        }
+
+        if (bias_grads) {
+            F64 *out_grads_image = out_grads + (U64)n*shape->out_channels*col_cols;
+            for (int o = 0; o < shape->out_channels; ++o) {
+                F64 *out_grads_row = out_grads_image + (U64)o*col_cols;
+                F64 sum = 0;
+                for (int p = 0; p < col_cols; ++p) sum += out_grads_row[p];
+                bias_grads[o] += sum;
+            }
+        }
+    }
+
+    scratch_end(scratch);
+}
+
+// ==================================
+// Winograd F(2x2,3x3)
+
+internal
+B32 nn_conv_supports_winograd(NN_ConvShape *shape) {
+    return shape->kernel_size == 3 && shape->stride == 1 && shape->padding <= 2;
+}
+
+internal
+NN_ConvAlgorithm nn_conv_pick_algorithm(NN_ConvShape *shape, NN_ConvAlgorithm requested) {
+    NN_ConvAlgorithm result = requested;
+    if (shape->groups > 1) {
+        // Only im2col handles groups in general. Depthwise convs get their own kernel.
+        B32 use_depthwise = (requested != NN_ConvAlgorithm_Im2col && nn_conv_is_depthwise(shape));
+        result = use_depthwise ? NN_ConvAlgorithm_Depthwise : NN_ConvAlgorithm_Im2col;
+    } else if (requested == NN_ConvAlgorithm_Depthwise) {
+        result = NN_ConvAlgorithm_Im2col;
+    } else if (requested == NN_ConvAlgorithm_Auto) {
+        if (nn_conv_is_pointwise(shape) || shape->in_channels < NN_CHANNEL_BLOCK) {
+            result = NN_ConvAlgorithm_Im2col;
+        } else if (shape->in_channels >= NN_WINOGRAD_MIN_CHANNELS && nn_conv_supports_winograd(shape)) {
+            result = NN_ConvAlgorithm_Winograd;
+        } else {
+            result = NN_ConvAlgorithm_Direct;
+        }
+    }
+    if (result == NN_ConvAlgorithm_Winograd && !nn_conv_supports_winograd(shape)) {
+        result = NN_ConvAlgorithm_Im2col;
+    }
+    return result;
+}
+
+internal
+NN_WinogradWeights nn_push_winograd_weights(Arena *arena, int in_channels, int out_channels) {
+    NN_WinogradWeights result = {0};
+    result.in_channels = in_channels;
+    result.out_channels = out_channels;
+    MD_ArenaPushAlign(arena, 64);
+    result.u = push_array(arena, F64, 16*in_channels*out_channels);
+    MD_ArenaPushAlign(arena, 64);
+    result.u_rotated = push_array(arena, F64, 16*in_channels*out_channels);
+    return result;
+}
+
+internal
+void nn_winograd_transform_kernel(F64 *g, F64 *u, U64 u_stride) {
+    // Gg: 4x3
+    F64 gg[4][3];
+    for (int j = 0; j < 3; ++j) {
+        gg[0][j] = g[0*3 + j];
+        gg[1][j] = 0.5*(g[0*3 + j] + g[1*3 + j] + g[2*3 + j]);
+        gg[2][j] = 0.5*(g[0*3 + j] - g[1*3 + j] + g[2*3 + j]);
+        gg[3][j] = g[2*3 + j];
+    }
+    // (Gg)G^T: 4x4
+    for (int i = 0; i < 4; ++i) {
+        u[(4*i + 0)*u_stride] = gg[i][0];
+        u[(4*i + 1)*u_stride] = 0.5*(gg[i][0] + gg[i][1] + gg[i][2]);
+        u[(4*i + 2)*u_stride] = 0.5*(gg[i][0] - gg[i][1] + gg[i][2]);
+        u[(4*i + 3)*u_stride] = gg[i][2];
+    }
+}
+
+internal
+void nn_winograd_transform_weights(NN_WinogradWeights *winograd, F64 *weights) {
+    int in_channels = winograd->in_channels;
+    int out_channels = winograd->out_channels;
+    U64 u_stride = (U64)in_channels*out_channels;
+    for (int o = 0; o < out_channels; ++o) {
+        for (int c = 0; c < in_channels; ++c) {
+            F64 *g = weights + ((U64)o*in_channels + c)*9;
+            F64 g_rotated[9];
+            for (int i = 0; i < 9; ++i) g_rotated[i] = g[8-i];
+            nn_winograd_transform_kernel(g, winograd->u + (U64)o*in_channels + c, u_stride);
+            nn_winograd_transform_kernel(g_rotated, winograd->u_rotated + (U64)c*out_channels + o, u_stride);
+        }
+    }
+}
+
+internal
+void nn_winograd_conv(NN_ConvShape *shape, int batch_count, F64 *x, F64 *u, F64 *biases, F64 *out, TP_ThreadPool *pool) {
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    int in_channels = shape->in_channels, out_channels = shape->out_channels;
+    int in_h = shape->in_h, in_w = shape->in_w;
+    int out_h = shape->out_h, out_w = shape->out_w;
+    int padding = shape->padding;
+    int tiles_h = (out_h+1)/2, tiles_w = (out_w+1)/2;
+    int tile_count = tiles_h*tiles_w;
+    U64 x_image_size = (U64)in_channels*in_h*in_w;
+    U64 out_image_size = (U64)out_channels*out_h*out_w;
+
+    // v [16, in_channels, tile_count], m [16, out_channels, tile_count]
+    U64 v_stride = (U64)in_channels*tile_count;
+    U64 m_stride = (U64)out_channels*tile_count;
+    MD_ArenaPushAlign(scratch.arena, 64);
+    F64 *v = push_array_no_zero(scratch.arena, F64, 16*v_stride);
+    MD_ArenaPushAlign(scratch.arena, 64);
+    F64 *m = push_array_no_zero(scratch.arena, F64, 16*m_stride);
+
+    for (int n = 0; n < batch_count; ++n) {
+        F64 *x_image = x + n*x_image_size;
+        F64 *out_image = out + n*out_image_size;
+
+        // Input transform: v = B^T d B for every 4x4 tile d (zero outside the image)
+        for (int c = 0; c < in_channels; ++c) {
+            F64 *x_channel = x_image + (U64)c*in_h*in_w;
+            for (int ty = 0; ty < tiles_h; ++ty) {
+                for (int tx = 0; tx < tiles_w; ++tx) {
+                    int y0 = 2*ty - padding, x0 = 2*tx - padding;
+                    F64 d[4][4];
+                    for (int i = 0; i < 4; ++i) {
+                        int iy = y0 + i;
+                        for (int j = 0; j < 4; ++j) {
+                            int ix = x0 + j;
+                            B32 is_inside = (iy >= 0 && iy < in_h && ix >= 0 && ix < in_w);
+                            d[i][j] = is_inside ? x_channel[(U64)iy*in_w + ix] : 0;
+                        }
+                    }
+                    F64 bd[4][4]; // B^T d
+                    for (int j = 0; j < 4; ++j) {
+                        bd[0][j] = d[0][j] - d[2][j];
+                        bd[1][j] = d[1][j] + d[2][j];
+                        bd[2][j] = d[2][j] - d[1][j];
+                        bd[3][j] = d[1][j] - d[3][j];
+                    }
+                    F64 *v_tile = v + (U64)c*tile_count + ty*tiles_w + tx;
+                    for (int i = 0; i < 4; ++i) {
+                        v_tile[(4*i + 0)*v_stride] = bd[i][0] - bd[i][2];
+                        v_tile[(4*i + 1)*v_stride] = bd[i][1] + bd[i][2];
+                        v_tile[(4*i + 2)*v_stride] = bd[i][2] - bd[i][1];
+                        v_tile[(4*i + 3)*v_stride] = bd[i][1] - bd[i][3];
+                    }
+                }
+            }
+        }
+
+        // Channel sums, one GEMM per tile position
+        for (int xi = 0; xi < 16; ++xi) {
+            la_gemm(pool, 0, 0, out_channels, tile_count, in_channels, 1, u + xi*(U64)out_channels*in_channels, in_channels,
+                    v + xi*v_stride, tile_count, 0, m + xi*m_stride, tile_count);
+        }
+
+        // Output transform: A^T m A, clipped at the image border
+        for (int o = 0; o < out_channels; ++o) {
+            F64 *out_channel = out_image + (U64)o*out_h*out_w;
+            F64 bias = biases ? biases[o] : 0;
+            for (int ty = 0; ty < tiles_h; ++ty) {
+                for (int tx = 0; tx < tiles_w; ++tx) {
+                    F64 *m_tile = m + (U64)o*tile_count + ty*tiles_w + tx;
+                    F64 am[2][4]; // A^T m
+                    for (int j = 0; j < 4; ++j) {
+                        F64 m0 = m_tile[(0 + j)*m_stride], m1 = m_tile[(4 + j)*m_stride];
+                        F64 m2 = m_tile[(8 + j)*m_stride], m3 = m_tile[(12 + j)*m_stride];
+                        am[0][j] = m0 + m1 + m2;
+                        am[1][j] = m1 - m2 - m3;
+                    }
+                    for (int i = 0; i < 2; ++i) {
+                        int oy = 2*ty + i;
+                        if (oy >= out_h) break;
+                        F64 y0 = am[i][0] + am[i][1] + am[i][2];
+                        F64 y1 = am[i][1] - am[i][2] - am[i][3];
+                        out_channel[(U64)oy*out_w + 2*tx] = y0 + bias;
+                        if (2*tx+1 < out_w) out_channel[(U64)oy*out_w + 2*tx+1] = y1 + bias;
+                    }
+                }
+            }
+        }
+    }
+
+    scratch_end(scratch);
+}
+
+internal
+void nn_conv2d_forward_winograd(NN_ConvShape *shape, int batch_count, F64 *x, NN_WinogradWeights *winograd, F64 *biases, F64 *out, TP_ThreadPool *pool) {
+    Assert(nn_conv_supports_winograd(shape) && shape->groups == 1);
+    nn_winograd_conv(shape, batch_count, x, winograd->u, biases, out, pool);
+}
+
+internal
+void nn_conv2d_backward_winograd(NN_ConvShape *shape, int batch_count, F64 *x, F64 *weights, NN_WinogradWeights *winograd, F64 *out_grads,
+                                 F64 *weight_grads, F64 *bias_grads, F64 *x_grads, TP_ThreadPool *pool) {
+    Assert(nn_conv_supports_winograd(shape) && shape->groups == 1);
+    if (weight_grads || bias_grads) {
+        nn_conv2d_backward_im2col(shape, batch_count, x, weights, out_grads, weight_grads, bias_grads, 0, pool);
+    }
+    if (x_grads) {
+        // dX = conv(dOut, rotated transposed kernels), which maps [out_h, out_w] back to [in_h, in_w]
+        NN_ConvShape back_shape = nn_make_conv_shape(shape->out_channels, shape->out_h, shape->out_w, shape->in_channels, 3, 1, 2 - shape->padding);
+        Assert(back_shape.out_h == shape->in_h && back_shape.out_w == shape->in_w);
+        nn_winograd_conv(&back_shape, batch_count, out_grads, winograd->u_rotated, 0, x_grads, pool);
+    }
+}
+
+// ==================================
+// Blocked direct convolution
+
+internal
+int nn_channel_block_count(int channels) {
+    return (channels + NN_CHANNEL_BLOCK-1)/NN_CHANNEL_BLOCK;
+}
+
+internal
+void nn_nchw_to_nchwc(F64 *x, int channels, int h, int w, F64 *xc) {
+    U64 plane = (U64)h*w;
+    for (int cb = 0; cb < nn_channel_block_count(channels); ++cb) {
+        F64 *xc_block = xc + cb*plane*NN_CHANNEL_BLOCK;
+        for (int ci = 0; ci < NN_CHANNEL_BLOCK; ++ci) {
+            int c = cb*NN_CHANNEL_BLOCK + ci;
+            if (c < channels) {
+                F64 *x_channel = x + c*plane;
+                for (U64 p = 0; p < plane; ++p) xc_block[p*NN_CHANNEL_BLOCK + ci] = x_channel[p];
+            } else {
+                for (U64 p = 0; p < plane; ++p) xc_block[p*NN_CHANNEL_BLOCK + ci] = 0;
+            }
+        }
+    }
+}
+
+internal
+void nn_nchwc_to_nchw(F64 *xc, int channels, int h, int w, F64 *x) {
+    U64 plane = (U64)h*w;
+    for (int c = 0; c < channels; ++c) {
+        F64 *xc_block = xc + (c/NN_CHANNEL_BLOCK)*plane*NN_CHANNEL_BLOCK + c%NN_CHANNEL_BLOCK;
+        F64 *x_channel = x + c*plane;
+        for (U64 p = 0; p < plane; ++p) x_channel[p] = xc_block[p*NN_CHANNEL_BLOCK];
+    }
+}
+
+internal
+void nn_conv_weights_to_blocked(NN_ConvShape *shape, F64 *weights, F64 *blocked_weights) {
+    int k = shape->kernel_size;
+    int in_blocks = nn_channel_block_count(shape->in_channels);
+    int out_blocks = nn_channel_block_count(shape->out_channels);
+    U64 tap_size = NN_CHANNEL_BLOCK*NN_CHANNEL_BLOCK;
+    MD_MemoryZero(blocked_weights, (U64)out_blocks*in_blocks*k*k*tap_size*sizeof(F64));
+    for (int o = 0; o < shape->out_channels; ++o) {
+        for (int c = 0; c < shape->in_channels; ++c) {
+            for (int tap = 0; tap < k*k; ++tap) {
+                U64 block_idx = ((U64)(o/NN_CHANNEL_BLOCK)*in_blocks + c/NN_CHANNEL_BLOCK)*k*k + tap;
+                F64 *dst = blocked_weights + block_idx*tap_size + (c%NN_CHANNEL_BLOCK)*NN_CHANNEL_BLOCK + o%NN_CHANNEL_BLOCK;
+                *dst = weights[((U64)o*shape->in_channels + c)*k*k + tap];
+            }
+        }
+    }
+}
+
+internal
+void nn_direct_conv_pixels(NN_DirectConvJob *job, int ob, int oy, int ox, int pixel_count, int ky0, int ky1, int kx0, int kx1, F64 *bias8) {
+    NN_ConvShape *shape = job->shape;
+    int k = shape->kernel_size;
+    int stride = shape->stride;
+    int in_h = shape->in_h, in_w = shape->in_w;
+    int in_blocks = nn_channel_block_count(shape->in_channels);
+    int iy0 = oy*stride - shape->padding;
+    int ix0 = ox*stride - shape->padding;
+    U64 pixel_step = (U64)stride*NN_CHANNEL_BLOCK; // between the 2 pixels' inputs
+    F64 *outc = job->outc + (((U64)ob*shape->out_h + oy)*shape->out_w + ox)*NN_CHANNEL_BLOCK;
+
+#if NN_SSE2
+    __m128d acc0[4], acc1[4];
+    for (int j = 0; j < 4; ++j) acc0[j] = acc1[j] = _mm_loadu_pd(bias8 + 2*j);
+    for (int cb = 0; cb < in_blocks; ++cb) {
+        F64 *x_block = job->xc + (U64)cb*in_h*in_w*NN_CHANNEL_BLOCK;
+        F64 *w_block = job->blocked_weights + ((U64)ob*in_blocks + cb)*k*k*NN_CHANNEL_BLOCK*NN_CHANNEL_BLOCK;
+        for (int ky = ky0; ky < ky1; ++ky) {
+            F64 *x_row = x_block + (U64)(iy0 + ky)*in_w*NN_CHANNEL_BLOCK;
+            for (int kx = kx0; kx < kx1; ++kx) {
+                F64 *xp = x_row + (U64)(ix0 + kx)*NN_CHANNEL_BLOCK;
+                F64 *wp = w_block + (U64)(ky*k + kx)*NN_CHANNEL_BLOCK*NN_CHANNEL_BLOCK;
+                for (int ci = 0; ci < NN_CHANNEL_BLOCK; ++ci) {
+                    __m128d w0 = _mm_loadu_pd(wp + 0), w1 = _mm_loadu_pd(wp + 2);
+                    __m128d w2 = _mm_loadu_pd(wp + 4), w3 = _mm_loadu_pd(wp + 6);
+                    __m128d x0 = _mm_set1_pd(xp[ci]);
+                    acc0[0] = _mm_add_pd(acc0[0], _mm_mul_pd(x0, w0));
+                    acc0[1] = _mm_add_pd(acc0[1], _mm_mul_pd(x0, w1));
+                    acc0[2] = _mm_add_pd(acc0[2], _mm_mul_pd(x0, w2));
+                    acc0[3] = _mm_add_pd(acc0[3], _mm_mul_pd(x0, w3));
+                    if (pixel_count == 2) {
+                        __m128d x1 = _mm_set1_pd(xp[pixel_step + ci]);
+                        acc1[0] = _mm_add_pd(acc1[0], _mm_mul_pd(x1, w0));
+                        acc1[1] = _mm_add_pd(acc1[1], _mm_mul_pd(x1, w1));
+                        acc1[2] = _mm_add_pd(acc1[2], _mm_mul_pd(x1, w2));
+                        acc1[3] = _mm_add_pd(acc1[3], _mm_mul_pd(x1, w3));
+                    }
+                    wp += NN_CHANNEL_BLOCK;
+                }
+            }
+        }
+    }
+    for (int j = 0; j < 4; ++j) _mm_storeu_pd(outc + 2*j, acc0[j]);
+    if (pixel_count == 2) {
+        for (int j = 0; j < 4; ++j) _mm_storeu_pd(outc + NN_CHANNEL_BLOCK + 2*j, acc1[j]);
+    }
+#else
+    for (int p = 0; p < pixel_count; ++p) {
+        F64 acc[NN_CHANNEL_BLOCK];
+        ArrayCopy(acc, bias8, NN_CHANNEL_BLOCK);
+        for (int cb = 0; cb < in_blocks; ++cb) {
+            F64 *x_block = job->xc + (U64)cb*in_h*in_w*NN_CHANNEL_BLOCK;
+            F64 *w_block = job->blocked_weights + ((U64)ob*in_blocks + cb)*k*k*NN_CHANNEL_BLOCK*NN_CHANNEL_BLOCK;
+            for (int ky = ky0; ky < ky1; ++ky) {
+                F64 *x_row = x_block + (U64)(iy0 + ky)*in_w*NN_CHANNEL_BLOCK;
+                for (int kx = kx0; kx < kx1; ++kx) {
+                    F64 *xp = x_row + (U64)(ix0 + kx)*NN_CHANNEL_BLOCK + p*pixel_step;
+                    F64 *wp = w_block + (U64)(ky*k + kx)*NN_CHANNEL_BLOCK*NN_CHANNEL_BLOCK;
+                    for (int ci = 0; ci < NN_CHANNEL_BLOCK; ++ci) {
+                        for (int co = 0; co < NN_CHANNEL_BLOCK; ++co) acc[co] += xp[ci]*wp[co];
+                        wp += NN_CHANNEL_BLOCK;
+                    }
+                }
+            }
+        }
+        ArrayCopy(outc + p*NN_CHANNEL_BLOCK, acc, NN_CHANNEL_BLOCK);
+    }
+#endif
+}
+
+internal
+void nn_direct_conv_row_task(void *user_data, int task_idx, int thread_idx) {
+    NN_DirectConvJob *job = user_data;
+    NN_ConvShape *shape = job->shape;
+    int k = shape->kernel_size;
+    int stride = shape->stride;
+    int padding = shape->padding;
+    int out_w = shape->out_w;
+    int ob = task_idx/shape->out_h;
+    int oy = task_idx%shape->out_h;
+
+    F64 bias8[NN_CHANNEL_BLOCK] = {0};
+    for (int co = 0; co < NN_CHANNEL_BLOCK; ++co) {
+        int o = ob*NN_CHANNEL_BLOCK + co;
+        if (job->biases && o < shape->out_channels) bias8[co] = job->biases[o];
+    }
+
+    // Kernel rows inside the input, for this output row
+    int iy0 = oy*stride - padding;
+    int ky0 = MD_Max(0, -iy0);
+    int ky1 = MD_Min(k, shape->in_h - iy0);
+
+    // Interior columns: every kx tap is inside the input
+    int ox_lo = MD_Min(out_w, (padding + stride-1)/stride);
+    int ox_hi = (shape->in_w + padding - k >= 0) ? (shape->in_w + padding - k)/stride + 1 : 0;
+    ox_hi = MD_Max(ox_lo, MD_Min(out_w, ox_hi));
+
+    for (int ox = 0; ox < out_w; ) {
+        if (ox >= ox_lo && ox < ox_hi) {
+            int pixel_count = (ox+1 < ox_hi) ? 2 : 1;
+            nn_direct_conv_pixels(job, ob, oy, ox, pixel_count, ky0, ky1, 0, k, bias8);
+            ox += pixel_count;
+        } else {
+            int ix0 = ox*stride - padding;
+            int kx0 = MD_Max(0, -ix0);
+            int kx1 = MD_Min(k, shape->in_w - ix0);
+            nn_direct_conv_pixels(job, ob, oy, ox, 1, ky0, ky1, kx0, kx1, bias8);
+            ox += 1;
+        }
+    }
+}
+
+internal
+void nn_conv2d_forward_nchwc(NN_ConvShape *shape, F64 *xc, F64 *blocked_weights, F64 *biases, F64 *outc, TP_ThreadPool *pool) {
+    NN_DirectConvJob job = {0};
+    job.shape = shape;
+    job.xc = xc;
+    job.blocked_weights = blocked_weights;
+    job.biases = biases;
+    job.outc = outc;
+    int row_count = nn_channel_block_count(shape->out_channels)*shape->out_h;
+    tp_parallel_for(pool, row_count, nn_direct_conv_row_task, &job);
+}
+
+internal
+void nn_conv2d_forward_direct(NN_ConvShape *shape, int batch_count, F64 *x, F64 *weights, F64 *biases, F64 *out, TP_ThreadPool *pool) {
+    Assert(shape->groups == 1);
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    int k = shape->kernel_size;
+    int in_blocks = nn_channel_block_count(shape->in_channels);
+    int out_blocks = nn_channel_block_count(shape->out_channels);
+    U64 x_image_size = (U64)shape->in_channels*shape->in_h*shape->in_w;
+    U64 out_image_size = (U64)shape->out_channels*shape->out_h*shape->out_w;
+
+    MD_ArenaPushAlign(scratch.arena, 64);
+    F64 *blocked_weights = push_array_no_zero(scratch.arena, F64, (U64)out_blocks*in_blocks*k*k*NN_CHANNEL_BLOCK*NN_CHANNEL_BLOCK);
+    MD_ArenaPushAlign(scratch.arena, 64);
+    F64 *xc = push_array_no_zero(scratch.arena, F64, (U64)in_blocks*shape->in_h*shape->in_w*NN_CHANNEL_BLOCK);
+    MD_ArenaPushAlign(scratch.arena, 64);
+    F64 *outc = push_array_no_zero(scratch.arena, F64, (U64)out_blocks*shape->out_h*shape->out_w*NN_CHANNEL_BLOCK);
+    nn_conv_weights_to_blocked(shape, weights, blocked_weights);
+
+    for (int n = 0; n < batch_count; ++n) {
+        nn_nchw_to_nchwc(x + n*x_image_size, shape->in_channels, shape->in_h, shape->in_w, xc);
+        nn_conv2d_forward_nchwc(shape, xc, blocked_weights, biases, outc, pool);
+        nn_nchwc_to_nchw(outc, shape->out_channels, shape->out_h, shape->out_w, out + n*out_image_size);
+    }
+
+    scratch_end(scratch);
+}
+
+// ==================================
+// Depthwise convolution
+
+internal
+B32 nn_conv_is_depthwise(NN_ConvShape *shape) {
+    return shape->groups > 1 && shape->groups == shape->in_channels;
+}
+
+internal
+void nn_conv_tap_ox_range(NN_ConvShape *shape, int kx, int *ox_first, int *ox_opl) {
+    int stride = shape->stride;
+    int padding = shape->padding;
+    *ox_first = MD_Max(0, (padding - kx + stride-1)/stride);
+    *ox_opl = MD_Min(shape->out_w, (shape->in_w + padding - kx + stride-1)/stride);
+}
+
+internal
+void nn_depthwise_forward_task(void *user_data, int task_idx, int thread_idx) {
+    NN_DepthwiseJob *job = user_data;
+    NN_ConvShape *shape = job->shape;
+    int k = shape->kernel_size;
+    int stride = shape->stride;
+    int multiplier = shape->out_channels/shape->in_channels;
+    int out_h = shape->out_h, out_w = shape->out_w;
+    int n = task_idx/shape->in_channels;
+    int c = task_idx%shape->in_channels;
+    F64 *x_channel = job->x + ((U64)n*shape->in_channels + c)*shape->in_h*shape->in_w;
+
+    for (int j = 0; j < multiplier; ++j) {
+        int o = c*multiplier + j;
+        F64 *w = job->weights + (U64)o*k*k;
+        F64 *out_channel = job->out + ((U64)n*shape->out_channels + o)*out_h*out_w;
+        F64 bias = job->biases ? job->biases[o] : 0;
+        for (U64 i = 0; i < (U64)out_h*out_w; ++i) out_channel[i] = bias;
+
+        // One pass per (row, tap) over the output pixels that tap reaches, so no pixel is bounds checked
+        for (int oy = 0; oy < out_h; ++oy) {
+            F64 *out_row = out_channel + (U64)oy*out_w;
+            for (int ky = 0; ky < k; ++ky) {
+                int iy = oy*stride - shape->padding + ky;
+                if (iy < 0 || iy >= shape->in_h) continue;
+                F64 *x_row = x_channel + (U64)iy*shape->in_w;
+                for (int kx = 0; kx < k; ++kx) {
+                    int ox_first, ox_opl;
+                    nn_conv_tap_ox_range(shape, kx, &ox_first, &ox_opl);
+                    int ix_offset = kx - shape->padding;
+                    F64 w_tap = w[ky*k + kx];
+                    if (stride == 1) {
+                        F64 *x_tap = x_row + ix_offset;
+                        for (int ox = ox_first; ox < ox_opl; ++ox) out_row[ox] += w_tap*x_tap[ox];
+                    } else {
+                        for (int ox = ox_first; ox < ox_opl; ++ox) out_row[ox] += w_tap*x_row[ox*stride + ix_offset];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// One task per input channel, looping over the batch, so the weight grads of a channel are
+// summed in batch order by a single thread
+internal
+void nn_depthwise_backward_task(void *user_data, int task_idx, int thread_idx) {
+    NN_DepthwiseJob *job = user_data;
+    NN_ConvShape *shape = job->shape;
+    int k = shape->kernel_size;
+    int stride = shape->stride;
+    int multiplier = shape->out_channels/shape->in_channels;
+    int out_h = shape->out_h, out_w = shape->out_w;
+    U64 x_plane = (U64)shape->in_h*shape->in_w;
+    int c = task_idx;
+
+    for (int n = 0; n < job->batch_count; ++n) {
+        F64 *x_channel = job->x + ((U64)n*shape->in_channels + c)*x_plane;
+        F64 *x_grads_channel = job->x_grads ? job->x_grads + ((U64)n*shape->in_channels + c)*x_plane : 0;
+        if (x_grads_channel) MD_MemoryZero(x_grads_channel, x_plane*sizeof(F64));
+
+        for (int j = 0; j < multiplier; ++j) {
+            int o = c*multiplier + j;
+            F64 *w = job->weights + (U64)o*k*k;
+            F64 *w_grads = job->weight_grads ? job->weight_grads + (U64)o*k*k : 0;
+            F64 *out_grads_channel = job->out_grads + ((U64)n*shape->out_channels + o)*out_h*out_w;
+
+            if (job->bias_grads) {
+                F64 sum = 0;
+                for (U64 i = 0; i < (U64)out_h*out_w; ++i) sum += out_grads_channel[i];
+                job->bias_grads[o] += sum;
+            }
+
+            for (int oy = 0; oy < out_h; ++oy) {
+                F64 *out_grads_row = out_grads_channel + (U64)oy*out_w;
+                for (int ky = 0; ky < k; ++ky) {
+                    int iy = oy*stride - shape->padding + ky;
+                    if (iy < 0 || iy >= shape->in_h) continue;
+                    F64 *x_row = x_channel + (U64)iy*shape->in_w;
+                    F64 *x_grads_row = x_grads_channel ? x_grads_channel + (U64)iy*shape->in_w : 0;
+                    for (int kx = 0; kx < k; ++kx) {
+                        int ox_first, ox_opl;
+                        nn_conv_tap_ox_range(shape, kx, &ox_first, &ox_opl);
+                        int ix_offset = kx - shape->padding;
+                        if (w_grads) {
+                            F64 sum = 0;
+                            for (int ox = ox_first; ox < ox_opl; ++ox) sum += out_grads_row[ox]*x_row[ox*stride + ix_offset];
+                            w_grads[ky*k + kx] += sum;
+                        }
+                        if (x_grads_row) {
+                            F64 w_tap = w[ky*k + kx];
+                            for (int ox = ox_first; ox < ox_opl; ++ox) x_grads_row[ox*stride + ix_offset] += w_tap*out_grads_row[ox];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+internal
+void nn_conv2d_forward_depthwise(NN_ConvShape *shape, int batch_count, F64 *x, F64 *weights, F64 *biases, F64 *out, TP_ThreadPool *pool) {
+    Assert(nn_conv_is_depthwise(shape));
+    NN_DepthwiseJob job = {0};
+    job.shape = shape;
+    job.batch_count = batch_count;
+    job.x = x;
+    job.weights = weights;
+    job.biases = biases;
+    job.out = out;
+    tp_parallel_for(pool, batch_count*shape->in_channels, nn_depthwise_forward_task, &job);
+}
+
+internal
+void nn_conv2d_backward_depthwise(NN_ConvShape *shape, int batch_count, F64 *x, F64 *weights, F64 *out_grads,
+                                  F64 *weight_grads, F64 *bias_grads, F64 *x_grads, TP_ThreadPool *pool) {
+    Assert(nn_conv_is_depthwise(shape));
+    NN_DepthwiseJob job = {0};
+    job.shape = shape;
+    job.batch_count = batch_count;
+    job.x = x;
+    job.weights = weights;
+    job.out_grads = out_grads;
+    job.weight_grads = weight_grads;
+    job.bias_grads = bias_grads;
+    job.x_grads = x_grads;
+    tp_parallel_for(pool, shape->in_channels, nn_depthwise_backward_task, &job);
+}
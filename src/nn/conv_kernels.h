@@ -0,0 +1,216 @@
+#ifndef CONV_KERNELS_H
+#define CONV_KERNELS_H
+
+// Conv2D kernels on raw row-major buffers:
+//   x       [batch_count, in_channels, in_h, in_w]
+//   weights [out_channels, in_channels/groups, kernel_size, kernel_size] (== [out_channels, in_channels/groups*k*k])
+//   biases  [out_channels]
+//   out     [batch_count, out_channels, out_h, out_w]
+// These are what NN_Conv2D's graph op runs on, and they can be called directly on the params 
+// block of a model (see NN_Params) for graph-free training.
+
+typedef struct NN_ConvShape NN_ConvShape;
+struct NN_ConvShape {
+    int in_channels;
+    int in_h, in_w;
+    int out_channels;
+    int out_h, out_w;
+    int kernel_size;
+    int stride;
+    int padding;
+    int groups; // in/out channels are split into `groups` independent convs (1 = full channel mixing)
+};
+
+typedef enum NN_ConvAlgorithm {
+    NN_ConvAlgorithm_Auto, // Picked per shape, see nn_conv_pick_algorithm
+    NN_ConvAlgorithm_Im2col,
+    NN_ConvAlgorithm_Winograd,
+    NN_ConvAlgorithm_Direct,
+    NN_ConvAlgorithm_Depthwise,
+} NN_ConvAlgorithm;
+
+internal NN_ConvShape nn_make_conv_shape(int in_channels, int in_h, int in_w, int out_channels, int kernel_size, int stride, int padding);
+
+// groups must divide both channel counts
+internal NN_ConvShape nn_make_grouped_conv_shape(int in_channels, int in_h, int in_w, int out_channels, int kernel_size, int stride, int padding, int groups);
+
+// The shape of one group's conv
+internal NN_ConvShape nn_conv_group_shape(NN_ConvShape *shape);
+
+// ==================================
+// im2col + GEMM
+//
+// NOTE: im2col unrolls the receptive fields of one image into a [in_channels*k*k, out_h*out_w]
+//       matrix, so the conv becomes out = W * col, one GEMM per image. The backward pass is two
+//       more GEMMs: dW += dOut * col^T and dCol = W^T * dOut, which col2im folds back into dX.
+//       1x1 stride-1 unpadded convs skip the unrolling, since col == x for them.
+//       Grouped convs run one GEMM per group, on the group's contiguous slice of the channels.
+
+// col [in_channels*k*k, out_h*out_w] for one image x [in_channels, in_h, in_w]
+internal void nn_im2col(NN_ConvShape *shape, F64 *x, F64 *col);
+
+// x_grads += col2im(col_grads), for one image
+internal void nn_col2im(NN_ConvShape *shape, F64 *col_grads, F64 *x_grads);
+
+// biases can be 0
+internal void nn_conv2d_forward_im2col(NN_ConvShape *shape, int batch_count, F64 *x, F64 *weights, F64 *biases, F64 *out, TP_ThreadPool *pool);
+
+// weight_grads/bias_grads are accumulated into (summed over the batch), x_grads is overwritten.
+// Any of the three grad buffers can be 0 to skip computing it.
+internal void nn_conv2d_backward_im2col(NN_ConvShape *shape, int batch_count, F64 *x, F64 *weights, F64 *out_grads,
+                                        F64 *weight_grads, F64 *bias_grads, F64 *x_grads, TP_ThreadPool *pool);
+
+// ==================================
+// Winograd F(2x2,3x3)
+//
+// NOTE: Stride-1 3x3 convs are computed on 4x4 input tiles that overlap by 2: every tile is
+//       transformed (B^T d B), multiplied element-wise with the transformed kernels (G g G^T), 
+//       summed over the input channels, and transformed back into a 2x2 output tile (A^T m A).
+//       That is 16 multiplies per 2x2 outputs instead of 36, i.e. 2.25x fewer. The channel sums 
+//       for each of the 16 tile positions are one GEMM of [out_channels, in_channels] x 
+//       [in_channels, tile_count].
+//       The transforms only have coefficients 0, +-1/2 and +-1, so the error stays within a small
+//       constant factor of direct convolution; the bigger tiles (F(4x4,3x3) and up) are where 
+//       Winograd gets numerically shaky, which is why they aren't used.
+//       The input grads of a stride-1 conv are a stride-1 conv of the output grads with the 
+//       180 degree rotated, channel-transposed kernels (padding 2-padding), so they use Winograd
+//       as well. The weight grads go through im2col + GEMM.
+
+// Transformed kernels, computed once per weight update and reused for every image and for the 
+// backward pass:
+//   u         [16, out_channels, in_channels]
+//   u_rotated [16, in_channels, out_channels] of the rotated kernels, for the input grads
+typedef struct NN_WinogradWeights NN_WinogradWeights;
+struct NN_WinogradWeights {
+    int in_channels;
+    int out_channels;
+    F64 *u;
+    F64 *u_rotated;
+};
+
+// 3x3, stride 1, and padding <= 2 (so the input grads are a valid conv too)
+internal B32 nn_conv_supports_winograd(NN_ConvShape *shape);
+
+// Resolves NN_ConvAlgorithm_Auto, and falls back to im2col when Winograd isn't supported
+// (Direct is supported for every ungrouped shape). Grouped convs use the depthwise kernel when 
+// they're depthwise and im2col otherwise. For ungrouped convs, Auto picks:
+//   - im2col (i.e. a plain GEMM) for pointwise 1x1 convs
+//   - im2col below NN_CHANNEL_BLOCK input channels, where the blocked layout is mostly padding
+//   - Winograd from NN_WINOGRAD_MIN_CHANNELS input channels, where the GEMMs outweigh the transforms
+//   - direct otherwise
+internal NN_ConvAlgorithm nn_conv_pick_algorithm(NN_ConvShape *shape, NN_ConvAlgorithm requested);
+
+#define NN_WINOGRAD_MIN_CHANNELS 32
+
+internal NN_WinogradWeights nn_push_winograd_weights(Arena *arena, int in_channels, int out_channels);
+
+// weights [out_channels, in_channels, 3, 3]
+internal void nn_winograd_transform_weights(NN_WinogradWeights *winograd, F64 *weights);
+
+internal void nn_conv2d_forward_winograd(NN_ConvShape *shape, int batch_count, F64 *x, NN_WinogradWeights *winograd, F64 *biases, F64 *out, TP_ThreadPool *pool);
+
+// Same contract as nn_conv2d_backward_im2col
+internal void nn_conv2d_backward_winograd(NN_ConvShape *shape, int batch_count, F64 *x, F64 *weights, NN_WinogradWeights *winograd, F64 *out_grads,
+                                          F64 *weight_grads, F64 *bias_grads, F64 *x_grads, TP_ThreadPool *pool);
+
+// ==================================
+// Blocked direct convolution
+//
+// NOTE: The direct conv works on channel-blocked tensors (NCHW8c): [ceil(C/8), H, W, 8], with the
+//       channels zero padded to a multiple of 8. The weights are blocked the same way on both 
+//       channel dims, [ceil(O/8), ceil(C/8), k, k, 8 in, 8 out], so every tap is an 8x8 
+//       matrix-vector product: 8 broadcast inputs times 8 contiguous output-channel weights, 
+//       accumulated into 8 output channels held in registers. No unrolled copy of the input is
+//       made, unlike im2col.
+//       Every output row is split into the interior, where all the taps are inside the input and
+//       the tap loops have fixed bounds, and the border, where the tap ranges are clipped once per
+//       pixel. Neither checks bounds per tap. Rows near the top/bottom clip their kernel rows once
+//       per row.
+//       The backward pass runs on the im2col + GEMM kernels.
+
+#define NN_CHANNEL_BLOCK 8
+
+internal int nn_channel_block_count(int channels);
+
+// x [channels, h, w] -> xc [ceil(channels/8), h, w, 8]
+internal void nn_nchw_to_nchwc(F64 *x, int channels, int h, int w, F64 *xc);
+
+// xc [ceil(channels/8), h, w, 8] -> x [channels, h, w]
+internal void nn_nchwc_to_nchw(F64 *xc, int channels, int h, int w, F64 *x);
+
+// weights [out_channels, in_channels, k, k] -> [ceil(out/8), ceil(in/8), k, k, 8, 8]
+internal void nn_conv_weights_to_blocked(NN_ConvShape *shape, F64 *weights, F64 *blocked_weights);
+
+// One image, all blocked. biases (unblocked, [out_channels]) can be 0.
+internal void nn_conv2d_forward_nchwc(NN_ConvShape *shape, F64 *xc, F64 *blocked_weights, F64 *biases, F64 *outc, TP_ThreadPool *pool);
+
+// NCHW in and out, converting to and from the blocked layout
+internal void nn_conv2d_forward_direct(NN_ConvShape *shape, int batch_count, F64 *x, F64 *weights, F64 *biases, F64 *out, TP_ThreadPool *pool);
+
+// ==================================
+// Depthwise convolution
+//
+// NOTE: groups == in_channels, so every input channel is convolved on its own with 
+//       out_channels/in_channels kernels (the channel multiplier). There is no channel sum to turn
+//       into a GEMM, so the kernel sweeps every (output row, tap) pair over the contiguous run of
+//       output pixels that tap reaches inside the input: a clipped axpy with no per-pixel checks.
+//       Work is split per channel, which also keeps every weight grad summed by one thread.
+
+internal B32 nn_conv_is_depthwise(NN_ConvShape *shape);
+
+internal void nn_conv2d_forward_depthwise(NN_ConvShape *shape, int batch_count, F64 *x, F64 *weights, F64 *biases, F64 *out, TP_ThreadPool *pool);
+
+// Same contract as nn_conv2d_backward_im2col
+internal void nn_conv2d_backward_depthwise(NN_ConvShape *shape, int batch_count, F64 *x, F64 *weights, F64 *out_grads,
+                                           F64 *weight_grads, F64 *bias_grads, F64 *x_grads, TP_ThreadPool *pool);
+
+// ==================================
+// Private helpers
+
+internal B32 nn_conv_is_pointwise(NN_ConvShape *shape);
+
+// Stride-1 3x3 conv with pre-transformed kernels u [16, shape->out_channels, shape->in_channels]
+internal void nn_winograd_conv(NN_ConvShape *shape, int batch_count, F64 *x, F64 *u, F64 *biases, F64 *out, TP_ThreadPool *pool);
+
+// u[16] = G g G^T for one 3x3 kernel g, written with the given stride between the 16 values
+internal void nn_winograd_transform_kernel(F64 *g, F64 *u, U64 u_stride);
+
+typedef struct NN_DirectConvJob NN_DirectConvJob;
+struct NN_DirectConvJob {
+    NN_ConvShape *shape;
+    F64 *xc;
+    F64 *blocked_weights;
+    F64 *biases;
+    F64 *outc;
+};
+
+// Task = one row of one output channel block
+internal void nn_direct_conv_row_task(void *user_data, int task_idx, int thread_idx);
+
+// pixel_count (1 or 2) adjacent output pixels starting at out_pixel, over taps [ky0,ky1) x [kx0,kx1)
+internal void nn_direct_conv_pixels(NN_DirectConvJob *job, int ob, int oy, int ox, int pixel_count, int ky0, int ky1, int kx0, int kx1, F64 *bias8);
+
+typedef struct NN_DepthwiseJob NN_DepthwiseJob;
+struct NN_DepthwiseJob {
+    NN_ConvShape *shape;
+    int batch_count;
+    F64 *x;
+    F64 *weights;
+    F64 *biases;
+    F64 *out;
+    F64 *out_grads;
+    F64 *weight_grads;
+    F64 *bias_grads;
+    F64 *x_grads;
+};
+
+// Output pixels [ox_first, ox_opl) of a row whose kernel column kx lands inside the input
+internal void nn_conv_tap_ox_range(NN_ConvShape *shape, int kx, int *ox_first, int *ox_opl);
+
+// Task = one channel of one image
+internal void nn_depthwise_forward_task(void *user_data, int task_idx, int thread_idx);
+
+// Task = one channel, over the whole batch
+internal void nn_depthwise_backward_task(void *user_data, int task_idx, int thread_idx);
+
+#endif
@@ -0,0 +1,134 @@
+// ==================================
+// Kernels
+
+internal
+F64 nn_softmax_cross_entropy(int batch_count, int class_count, F64 *logits, int *labels, F64 *logit_grads) {
+    F64 loss = 0;
+    for (int b = 0; b < batch_count; ++b) {
+        F64 *z = logits + (U64)b*class_count;
+        Assert(labels[b] >= 0 && labels[b] < class_count);
+
+        // -log(softmax(z)[label]) = log(sum(exp(z - max))) + max - z[label]
+        F64 max = z[0];
+        for (int i = 1; i < class_count; ++i) max = MD_Max(max, z[i]);
+        F64 sum_exp = 0;
+        for (int i = 0; i < class_count; ++i) sum_exp += exp(z[i] - max);
+        F64 log_sum_exp = log(sum_exp) + max;
+        loss += log_sum_exp - z[labels[b]];
+
+        if (logit_grads) {
+            F64 *grads = logit_grads + (U64)b*class_count;
+            for (int i = 0; i < class_count; ++i) grads[i] = exp(z[i] - log_sum_exp)/batch_count;
+            grads[labels[b]] -= 1.0/batch_count;
+        }
+    }
+    return loss/batch_count;
+}
+
+internal
+F64 nn_bce_with_logits(int count, F64 *logits, F64 *targets, F64 *logit_grads) {
+    F64 loss = 0;
+    for (int i = 0; i < count; ++i) {
+        F64 z = logits[i];
+        F64 t = targets[i];
+        loss += MD_Max(z, 0) - z*t + log1p(exp(-fabs(z)));
+        if (logit_grads) logit_grads[i] = (ag_sigmoid_f64(z) - t)/count;
+    }
+    return loss/count;
+}
+
+internal
+F64 nn_mse(int count, F64 *preds, F64 *targets, F64 *pred_grads) {
+    F64 loss = 0;
+    for (int i = 0; i < count; ++i) {
+        F64 error = preds[i] - targets[i];
+        loss += error*error;
+        if (pred_grads) pred_grads[i] = 2*error/count;
+    }
+    return loss/count;
+}
+
+// ==================================
+// Graph ops
+
+internal
+F64 *nn_loss_gather_values(Arena *arena, AG_ValueArray *xs, int batch_count) {
+    int dim = xs[0].count;
+    F64 *result = push_array_no_zero(arena, F64, (U64)batch_count*dim);
+    for (int b = 0; b < batch_count; ++b) {
+        Assert(xs[b].count == dim);
+        for (int i = 0; i < dim; ++i) result[(U64)b*dim + i] = *xs[b].values[i]->value;
+    }
+    return result;
+}
+
+internal
+AG_Value *nn_push_loss_block(Arena *value_arena, AG_ValueArray *xs, int batch_count, F64 loss, F64 *grads) {
+    ArenaTemp scratch = scratch_begin(&value_arena, 1);
+
+    int dim = xs[0].count;
+    AG_ValueArray inputs = {0};
+    inputs.count = batch_count*dim;
+    inputs.values = push_array_no_zero(scratch.arena, AG_Value*, inputs.count);
+    for (int b = 0; b < batch_count; ++b) ArrayCopy(inputs.values + (U64)b*dim, xs[b].values, dim);
+
+    // The grads are read again during backward, so they live in value_arena
+    NN_LossBlock *loss_block = push_array(value_arena, NN_LossBlock, 1);
+    loss_block->input_grads = push_array_no_zero(value_arena, F64, inputs.count);
+    ArrayCopy(loss_block->input_grads, grads, inputs.count);
+
+    AG_Block *block = ag_push_block(value_arena, inputs, 1, nn_loss_block_backward, loss_block);
+    AG_Value *result = block->outputs.values[0];
+    *result->value = loss;
+
+    // Forward mode: the loss is a scalar, so its tangent is grad . tangent
+    F64 tangent = 0;
+    for (int i = 0; i < inputs.count; ++i) tangent += grads[i]*inputs.values[i]->tangent;
+    result->tangent = tangent;
+
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+AG_Value *nn_softmax_cross_entropy_apply(Arena *value_arena, AG_ValueArray *logits, int batch_count, int *labels) {
+    ArenaTemp scratch = scratch_begin(&value_arena, 1);
+    int class_count = logits[0].count;
+    F64 *raw_logits = nn_loss_gather_values(scratch.arena, logits, batch_count);
+    F64 *grads = push_array_no_zero(scratch.arena, F64, (U64)batch_count*class_count);
+    F64 loss = nn_softmax_cross_entropy(batch_count, class_count, raw_logits, labels, grads);
+    AG_Value *result = nn_push_loss_block(value_arena, logits, batch_count, loss, grads);
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+AG_Value *nn_bce_with_logits_apply(Arena *value_arena, AG_ValueArray *logits, int batch_count, F64 *targets) {
+    ArenaTemp scratch = scratch_begin(&value_arena, 1);
+    int count = batch_count*logits[0].count;
+    F64 *raw_logits = nn_loss_gather_values(scratch.arena, logits, batch_count);
+    F64 *grads = push_array_no_zero(scratch.arena, F64, count);
+    F64 loss = nn_bce_with_logits(count, raw_logits, targets, grads);
+    AG_Value *result = nn_push_loss_block(value_arena, logits, batch_count, loss, grads);
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+AG_Value *nn_mse_apply(Arena *value_arena, AG_ValueArray *preds, int batch_count, F64 *targets) {
+    ArenaTemp scratch = scratch_begin(&value_arena, 1);
+    int count = batch_count*preds[0].count;
+    F64 *raw_preds = nn_loss_gather_values(scratch.arena, preds, batch_count);
+    F64 *grads = push_array_no_zero(scratch.arena, F64, count);
+    F64 loss = nn_mse(count, raw_preds, targets, grads);
+    AG_Value *result = nn_push_loss_block(value_arena, preds, batch_count, loss, grads);
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+void nn_loss_block_backward(AG_Block *block, F64 *input_grads) {
+    NN_LossBlock *loss_block = block->user_data;
+    F64 grad = *block->outputs.values[0]->grad;
+    for (int i = 0; i < block->inputs.count; ++i) input_grads[i] = grad*loss_block->input_grads[i];
+}
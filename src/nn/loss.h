@@ -0,0 +1,50 @@
+#ifndef LOSS_H
+#define LOSS_H
+
+// All losses are means: over the batch for softmax cross-entropy, over every element for 
+// BCE-with-logits and MSE.
+
+// The user data of a loss's graph block. The grads of the loss w.r.t. its inputs come out of
+// the forward kernel, so backward only scales them by the incoming grad.
+typedef struct NN_LossBlock NN_LossBlock;
+struct NN_LossBlock {
+    F64 *input_grads;
+};
+
+// ==================================
+// Kernels on raw buffers. The grads output is optional (pass 0 to only get the loss).
+
+// logits [batch_count, class_count], labels [batch_count] in [0, class_count).
+// Uses log-sum-exp, so large logits don't overflow. logit_grads = (softmax - onehot)/batch_count
+internal F64 nn_softmax_cross_entropy(int batch_count, int class_count, F64 *logits, int *labels, F64 *logit_grads);
+
+// targets in [0, 1]. Works on the logits directly: max(z,0) - z*t + log(1 + exp(-|z|)).
+// logit_grads = (sigmoid(z) - t)/count
+internal F64 nn_bce_with_logits(int count, F64 *logits, F64 *targets, F64 *logit_grads);
+
+// pred_grads = 2*(pred - target)/count
+internal F64 nn_mse(int count, F64 *preds, F64 *targets, F64 *pred_grads);
+
+// ==================================
+// Graph ops: the whole batch's loss is a single graph block with one output
+
+// logits are batch_count arrays of class_count values
+internal AG_Value *nn_softmax_cross_entropy_apply(Arena *value_arena, AG_ValueArray *logits, int batch_count, int *labels);
+
+// logits/preds are batch_count arrays of the same length, targets is [batch_count, that length]
+internal AG_Value *nn_bce_with_logits_apply(Arena *value_arena, AG_ValueArray *logits, int batch_count, F64 *targets);
+
+internal AG_Value *nn_mse_apply(Arena *value_arena, AG_ValueArray *preds, int batch_count, F64 *targets);
+
+internal void nn_loss_block_backward(AG_Block *block, F64 *input_grads);
+
+// ==================================
+// Private helpers
+
+// Pushes the block of a loss, given the loss and its grads w.r.t. the (gathered) inputs
+internal AG_Value *nn_push_loss_block(Arena *value_arena, AG_ValueArray *xs, int batch_count, F64 loss, F64 *grads);
+
+// Gathers the values of batch_count arrays into one buffer
+internal F64 *nn_loss_gather_values(Arena *arena, AG_ValueArray *xs, int batch_count);
+
+#endif
@@ -0,0 +1,540 @@
+// ==================================
+// Specs
+
+internal
+NN_LayerSpec nn_conv_layer_spec(int out_channels, int kernel_size, int stride, int padding, B32 has_relu) {
+    NN_LayerSpec result = {0};
+    result.kind = NN_LayerKind_Conv2D;
+    result.out_channels = out_channels;
+    result.kernel_size = kernel_size;
+    result.stride = stride;
+    result.padding = padding;
+    result.groups = 1;
+    result.has_relu = has_relu;
+    return result;
+}
+
+internal
+NN_LayerSpec nn_pool_layer_spec(NN_PoolType type, int kernel_size, int stride, int padding) {
+    NN_LayerSpec result = {0};
+    result.kind = NN_LayerKind_Pool2D;
+    result.pool_type = type;
+    result.kernel_size = kernel_size;
+    result.stride = stride;
+    result.padding = padding;
+    return result;
+}
+
+internal
+NN_LayerSpec nn_global_avg_pool_layer_spec(void) {
+    NN_LayerSpec result = {0};
+    result.kind = NN_LayerKind_GlobalAvgPool;
+    return result;
+}
+
+internal
+NN_LayerSpec nn_dense_layer_spec(int out_features, B32 has_relu) {
+    NN_LayerSpec result = {0};
+    result.kind = NN_LayerKind_Dense;
+    result.out_channels = out_features;
+    result.has_relu = has_relu;
+    return result;
+}
+
+internal
+NN_LayerSpec nn_relu_layer_spec(void) {
+    NN_LayerSpec result = {0};
+    result.kind = NN_LayerKind_Relu;
+    return result;
+}
+
+internal
+NN_LayerSpec nn_batch_norm_layer_spec(void) {
+    NN_LayerSpec result = {0};
+    result.kind = NN_LayerKind_BatchNorm;
+    result.eps = NN_BATCH_NORM_DEFAULT_EPS;
+    result.momentum = NN_BATCH_NORM_DEFAULT_MOMENTUM;
+    return result;
+}
+
+internal
+NN_LayerSpec nn_add_layer_spec(int skip_from) {
+    NN_LayerSpec result = {0};
+    result.kind = NN_LayerKind_Add;
+    result.skip_from = skip_from;
+    return result;
+}
+
+// ==================================
+// Building
+
+internal
+B32 nn_model_infer_layer(NN_ModelLayer *layer, int l, int *activation_shapes) {
+    NN_LayerSpec *spec = &layer->spec;
+    int *in = activation_shapes + 3*l;
+    int *out = layer->out_shape;
+    ArrayCopy(layer->in_shape, in, 3);
+    ArrayCopy(out, in, 3);
+
+    switch (spec->kind) {
+        case NN_LayerKind_Conv2D: {
+            int groups = MD_Max(spec->groups, 1);
+            if (spec->out_channels <= 0 || in[0] % groups != 0 || spec->out_channels % groups != 0) {
+                fprintf(stderr, "nn_make_model: layer %d: conv channels (%d -> %d) don't fit %d groups\n", l, in[0], spec->out_channels, groups);
+                return 0;
+            }
+            if (in[1] + 2*spec->padding < spec->kernel_size || in[2] + 2*spec->padding < spec->kernel_size || spec->stride <= 0) {
+                fprintf(stderr, "nn_make_model: layer %d: conv kernel doesn't fit the %dx%d input\n", l, in[1], in[2]);
+                return 0;
+            }
+            layer->conv_shape = nn_make_grouped_conv_shape(in[0], in[1], in[2], spec->out_channels, spec->kernel_size, spec->stride, spec->padding, groups);
+            layer->conv_algorithm = nn_conv_pick_algorithm(&layer->conv_shape, NN_ConvAlgorithm_Auto);
+            out[0] = spec->out_channels;
+            out[1] = layer->conv_shape.out_h;
+            out[2] = layer->conv_shape.out_w;
+            layer->param_count = (U64)spec->out_channels*(in[0]/groups)*spec->kernel_size*spec->kernel_size + spec->out_channels;
+        } break;
+
+        case NN_LayerKind_Pool2D: {
+            if (spec->padding >= spec->kernel_size || spec->kernel_size*spec->kernel_size > 255 || spec->stride <= 0 ||
+                in[1] + 2*spec->padding < spec->kernel_size || in[2] + 2*spec->padding < spec->kernel_size) {
+                fprintf(stderr, "nn_make_model: layer %d: pool window doesn't fit the %dx%d input\n", l, in[1], in[2]);
+                return 0;
+            }
+            layer->pool_shape = nn_make_pool_shape(in[0], in[1], in[2], spec->kernel_size, spec->stride, spec->padding);
+            out[1] = layer->pool_shape.out_h;
+            out[2] = layer->pool_shape.out_w;
+        } break;
+
+        case NN_LayerKind_GlobalAvgPool: {
+            out[1] = 1;
+            out[2] = 1;
+        } break;
+
+        case NN_LayerKind_Dense: {
+            if (spec->out_channels <= 0) {
+                fprintf(stderr, "nn_make_model: layer %d: dense layer needs at least one output\n", l);
+                return 0;
+            }
+            int in_features = in[0]*in[1]*in[2];
+            out[0] = spec->out_channels;
+            out[1] = 1;
+            out[2] = 1;
+            layer->param_count = (U64)spec->out_channels*(in_features+1);
+        } break;
+
+        case NN_LayerKind_Relu: break;
+
+        case NN_LayerKind_BatchNorm: {
+            layer->param_count = 2*(U64)in[0];
+        } break;
+
+        case NN_LayerKind_Add: {
+            if (spec->skip_from < -1 || spec->skip_from >= l) {
+                fprintf(stderr, "nn_make_model: layer %d: add can only skip from an earlier layer (got %d)\n", l, spec->skip_from);
+                return 0;
+            }
+            int *skip = activation_shapes + 3*(spec->skip_from+1);
+            if (memcmp(skip, in, 3*sizeof(int)) != 0) {
+                fprintf(stderr, "nn_make_model: layer %d: add shapes don't match ([%d,%d,%d] vs [%d,%d,%d])\n", 
+                        l, in[0], in[1], in[2], skip[0], skip[1], skip[2]);
+                return 0;
+            }
+        } break;
+
+        default: {
+            fprintf(stderr, "nn_make_model: layer %d: unknown layer kind %d\n", l, spec->kind);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+internal
+NN_Model nn_make_model(Arena *arena, int in_channels, int in_h, int in_w, NN_LayerSpec *specs, int spec_count, 
+                       int max_batch_count, TP_ThreadPool *pool) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // Shape inference
+    int *activation_shapes = push_array(scratch.arena, int, 3*(spec_count+1)); // [spec_count+1][3]
+    activation_shapes[0] = in_channels;
+    activation_shapes[1] = in_h;
+    activation_shapes[2] = in_w;
+    NN_ModelLayer *layers = push_array(scratch.arena, NN_ModelLayer, spec_count);
+    U64 param_count = 0;
+    for (int l = 0; l < spec_count; ++l) {
+        NN_ModelLayer *layer = &layers[l];
+        layer->spec = specs[l];
+        if (!nn_model_infer_layer(layer, l, activation_shapes)) {
+            scratch_end(scratch);
+            return (NN_Model){0};
+        }
+        ArrayCopy(activation_shapes + 3*(l+1), layer->out_shape, 3);
+        layer->param_offset = param_count;
+        param_count += layer->param_count;
+    }
+
+    NN_Model result = {0};
+    result.layer_count = spec_count;
+    result.max_batch_count = max_batch_count;
+    result.is_training = 1;
+    result.pool = pool;
+    result.layers = push_array(arena, NN_ModelLayer, spec_count);
+    ArrayCopy(result.layers, layers, spec_count);
+    result.activation_sizes = push_array(arena, U64, spec_count+1);
+    for (int a = 0; a <= spec_count; ++a) {
+        int *shape = activation_shapes + 3*a;
+        result.activation_sizes[a] = (U64)shape[0]*shape[1]*shape[2];
+    }
+    scratch_end(scratch);
+
+    result.params.count = (int)param_count;
+    result.params.values = push_array(arena, F64, param_count);
+    result.params.grads = push_array(arena, F64, param_count);
+
+    result.activations = push_array(arena, F64*, spec_count+1);
+    result.activation_grads = push_array(arena, F64*, spec_count+1);
+    result.accumulation_workspaces = push_array(arena, F64*, spec_count+1);
+    result.is_skip_source = push_array(arena, B32, spec_count+1);
+
+    // Per-layer params and state
+    for (int l = 0; l < spec_count; ++l) {
+        NN_ModelLayer *layer = &result.layers[l];
+        F64 *params = result.params.values + layer->param_offset;
+        int in_count = layer->in_shape[0]*layer->in_shape[1]*layer->in_shape[2];
+        switch (layer->spec.kind) {
+            case NN_LayerKind_Conv2D: {
+                NN_ConvShape *shape = &layer->conv_shape;
+                int fan_in = (shape->in_channels/shape->groups)*shape->kernel_size*shape->kernel_size;
+                U64 weight_count = layer->param_count - shape->out_channels;
+                F64 bound = sqrt(6.0/fan_in);
+                for (U64 i = 0; i < weight_count; ++i) params[i] = sample_f64_in_range(-bound, bound);
+                if (layer->conv_algorithm == NN_ConvAlgorithm_Winograd) {
+                    NN_WinogradCache *cache = push_array(arena, NN_WinogradCache, 1);
+                    cache->weights = nn_push_winograd_weights(arena, shape->in_channels, shape->out_channels);
+                    cache->source_weights = push_array(arena, F64, weight_count);
+                    layer->winograd_cache = cache;
+                }
+            } break;
+
+            case NN_LayerKind_Pool2D: {
+                if (layer->spec.pool_type == NN_PoolType_Max) {
+                    layer->argmax = push_array_no_zero(arena, U8, (U64)max_batch_count*result.activation_sizes[l+1]);
+                }
+            } break;
+
+            case NN_LayerKind_Dense: {
+                F64 bound = sqrt(6.0/in_count);
+                for (int o = 0; o < layer->spec.out_channels; ++o) {
+                    F64 *row = params + (U64)o*(in_count+1);
+                    for (int i = 0; i < in_count; ++i) row[i] = sample_f64_in_range(-bound, bound);
+                }
+            } break;
+
+            case NN_LayerKind_BatchNorm: {
+                int channels = layer->in_shape[0];
+                for (int c = 0; c < channels; ++c) params[c] = 1;
+                layer->running_mean = push_array(arena, F64, channels);
+                layer->running_var = push_array(arena, F64, channels);
+                layer->mean = push_array(arena, F64, channels);
+                layer->inv_std = push_array(arena, F64, channels);
+                for (int c = 0; c < channels; ++c) layer->running_var[c] = 1;
+            } break;
+
+            case NN_LayerKind_Add: {
+                result.is_skip_source[layer->spec.skip_from+1] = 1;
+            } break;
+
+            default: break;
+        }
+    }
+
+    // Activation buffers, all in one planned workspace. The input activation is the caller's buffer.
+    {
+        ArenaTemp plan_scratch = scratch_begin(&arena, 1);
+        int buffer_count = NN_MODEL_PLAN_BUFFER_COUNT(spec_count);
+        NN_PlanBuffer *buffers = push_array(plan_scratch.arena, NN_PlanBuffer, buffer_count);
+        nn_model_plan_buffers(&result, buffers);
+        result.memory_plan = nn_plan_memory(buffers, buffer_count);
+
+        MD_ArenaPushAlign(arena, 64);
+        result.workspace = push_array_no_zero(arena, F64, result.memory_plan.workspace_size*max_batch_count);
+        for (int a = 0; a <= spec_count; ++a) {
+            NN_PlanBuffer *activation = &buffers[a];
+            NN_PlanBuffer *grads = &buffers[spec_count+1 + a];
+            NN_PlanBuffer *accumulation = &buffers[2*(spec_count+1) + a];
+            if (a > 0) result.activations[a] = result.workspace + activation->offset*max_batch_count;
+            result.activation_grads[a] = result.workspace + grads->offset*max_batch_count;
+            if (result.is_skip_source[a]) result.accumulation_workspaces[a] = result.workspace + accumulation->offset*max_batch_count;
+        }
+        scratch_end(plan_scratch);
+    }
+
+    return result;
+}
+
+internal
+B32 nn_layer_backward_reads_input(NN_LayerSpec *spec) {
+    return spec->kind == NN_LayerKind_Conv2D || spec->kind == NN_LayerKind_Dense || spec->kind == NN_LayerKind_BatchNorm;
+}
+
+internal
+B32 nn_layer_backward_reads_output(NN_LayerSpec *spec) {
+    // A relu's grads are masked by its output (out > 0 exactly where the input was)
+    return spec->has_relu || spec->kind == NN_LayerKind_Relu;
+}
+
+internal
+void nn_model_plan_buffers(NN_Model *model, NN_PlanBuffer *buffers) {
+    int layer_count = model->layer_count;
+    NN_PlanBuffer *activations = buffers;
+    NN_PlanBuffer *grads = buffers + layer_count+1;
+    NN_PlanBuffer *accumulations = buffers + 2*(layer_count+1);
+    MD_MemoryZero(buffers, NN_MODEL_PLAN_BUFFER_COUNT(layer_count)*sizeof(NN_PlanBuffer));
+    int backward_begin = layer_count;
+
+    for (int a = 0; a <= layer_count; ++a) {
+        U64 size = model->activation_sizes[a];
+        int backward_of_producer = 2*layer_count - (a-1);
+        int backward_of_consumer = 2*layer_count - a;
+
+        // Output of layer a-1. The caller reads the last one until the backward pass starts.
+        if (a > 0) {
+            NN_PlanBuffer *activation = &activations[a];
+            activation->size = size;
+            activation->first_use = a-1;
+            activation->last_use = a < layer_count ? a : backward_begin;
+            if (nn_layer_backward_reads_output(&model->layers[a-1].spec)) activation->last_use = backward_of_producer;
+            if (a < layer_count && nn_layer_backward_reads_input(&model->layers[a].spec)) {
+                activation->last_use = MD_Max(activation->last_use, backward_of_consumer);
+            }
+        }
+
+        // Written by layer a's backward (by the backward setup for the output and for 
+        // skip sources, which start at 0), read by layer a-1's backward (by the caller for the input)
+        NN_PlanBuffer *grad = &grads[a];
+        grad->size = size;
+        grad->first_use = (a == layer_count || model->is_skip_source[a]) ? backward_begin : backward_of_consumer;
+        grad->last_use = a > 0 ? backward_of_producer : 2*layer_count + 1;
+
+        if (model->is_skip_source[a]) {
+            NN_PlanBuffer *accumulation = &accumulations[a];
+            accumulation->size = size;
+            accumulation->first_use = backward_of_consumer;
+            accumulation->last_use = backward_of_consumer;
+        }
+    }
+
+    // Activations an Add reads as its skip input
+    for (int l = 0; l < layer_count; ++l) {
+        NN_LayerSpec *spec = &model->layers[l].spec;
+        if (spec->kind == NN_LayerKind_Add && spec->skip_from >= 0) {
+            NN_PlanBuffer *skip = &activations[spec->skip_from+1];
+            skip->last_use = MD_Max(skip->last_use, l);
+        }
+    }
+}
+
+internal
+U64 nn_model_output_size(NN_Model *model) {
+    return model->activation_sizes[model->layer_count];
+}
+
+// ==================================
+// Forward/backward
+
+internal
+void nn_model_layer_forward(NN_Model *model, int l, int batch_count) {
+    NN_ModelLayer *layer = &model->layers[l];
+    F64 *x = model->activations[l];
+    F64 *y = model->activations[l+1];
+    F64 *params = model->params.values + layer->param_offset;
+    U64 x_count = (U64)batch_count*model->activation_sizes[l];
+    U64 y_count = (U64)batch_count*model->activation_sizes[l+1];
+
+    switch (layer->spec.kind) {
+        case NN_LayerKind_Conv2D: {
+            NN_ConvShape *shape = &layer->conv_shape;
+            F64 *biases = params + layer->param_count - shape->out_channels;
+            if (layer->conv_algorithm == NN_ConvAlgorithm_Winograd) {
+                NN_WinogradWeights *winograd = nn_winograd_cache_get(layer->winograd_cache, params);
+                nn_conv2d_forward_winograd(shape, batch_count, x, winograd, biases, y, model->pool);
+            } else if (layer->conv_algorithm == NN_ConvAlgorithm_Direct) {
+                nn_conv2d_forward_direct(shape, batch_count, x, params, biases, y, model->pool);
+            } else if (layer->conv_algorithm == NN_ConvAlgorithm_Depthwise) {
+                nn_conv2d_forward_depthwise(shape, batch_count, x, params, biases, y, model->pool);
+            } else {
+                nn_conv2d_forward_im2col(shape, batch_count, x, params, biases, y, model->pool);
+            }
+            if (layer->spec.has_relu) {
+                for (U64 i = 0; i < y_count; ++i) y[i] = MD_Max(y[i], 0);
+            }
+        } break;
+
+        case NN_LayerKind_Pool2D: {
+            if (layer->spec.pool_type == NN_PoolType_Max) nn_max_pool2d_forward(&layer->pool_shape, batch_count, x, y, layer->argmax);
+            else                                          nn_avg_pool2d_forward(&layer->pool_shape, batch_count, x, y);
+        } break;
+
+        case NN_LayerKind_GlobalAvgPool: {
+            nn_global_avg_pool_forward(batch_count, layer->in_shape[0], layer->in_shape[1]*layer->in_shape[2], x, y);
+        } break;
+
+        case NN_LayerKind_Dense: {
+            int in_dim = (int)model->activation_sizes[l];
+            int out_dim = layer->spec.out_channels;
+            la_gemm(model->pool, 0, 1, batch_count, out_dim, in_dim, 1, x, in_dim, params, in_dim+1, 0, y, out_dim);
+
+            // Fused bias + relu
+            for (int n = 0; n < batch_count; ++n) {
+                F64 *y_row = y + (U64)n*out_dim;
+                for (int o = 0; o < out_dim; ++o) {
+                    F64 z = y_row[o] + params[(U64)o*(in_dim+1) + in_dim];
+                    y_row[o] = (layer->spec.has_relu && z <= 0) ? 0 : z;
+                }
+            }
+        } break;
+
+        case NN_LayerKind_Relu: {
+            for (U64 i = 0; i < x_count; ++i) y[i] = MD_Max(x[i], 0);
+        } break;
+
+        case NN_LayerKind_BatchNorm: {
+            int channels = layer->in_shape[0];
+            int plane_size = layer->in_shape[1]*layer->in_shape[2];
+            F64 eps = layer->spec.eps, momentum = layer->spec.momentum;
+            if (model->is_training) {
+                ArenaTemp scratch = scratch_begin(0,0);
+                F64 *var = push_array_no_zero(scratch.arena, F64, channels);
+                nn_batch_norm_statistics(batch_count, channels, plane_size, x, layer->mean, var);
+                U64 n = (U64)batch_count*plane_size;
+                F64 unbias = n > 1 ? (F64)n/(n - 1) : 1;
+                for (int c = 0; c < channels; ++c) {
+                    layer->inv_std[c] = 1/sqrt(var[c] + eps);
+                    layer->running_mean[c] = (1 - momentum)*layer->running_mean[c] + momentum*layer->mean[c];
+                    layer->running_var[c] = (1 - momentum)*layer->running_var[c] + momentum*var[c]*unbias;
+                }
+                scratch_end(scratch);
+            } else {
+                for (int c = 0; c < channels; ++c) {
+                    layer->mean[c] = layer->running_mean[c];
+                    layer->inv_std[c] = 1/sqrt(layer->running_var[c] + eps);
+                }
+            }
+            nn_batch_norm_normalize(batch_count, channels, plane_size, x, layer->mean, layer->inv_std, params, params + channels, y);
+        } break;
+
+        case NN_LayerKind_Add: {
+            F64 *skip = model->activations[layer->spec.skip_from+1];
+            for (U64 i = 0; i < x_count; ++i) y[i] = x[i] + skip[i];
+        } break;
+
+        default: break;
+    }
+}
+
+internal
+void nn_model_layer_backward(NN_Model *model, int l, int batch_count, F64 *in_grads) {
+    NN_ModelLayer *layer = &model->layers[l];
+    F64 *x = model->activations[l];
+    F64 *y = model->activations[l+1];
+    F64 *y_grads = model->activation_grads[l+1];
+    F64 *params = model->params.values + layer->param_offset;
+    F64 *param_grads = model->params.grads + layer->param_offset;
+    U64 x_count = (U64)batch_count*model->activation_sizes[l];
+    U64 y_count = (U64)batch_count*model->activation_sizes[l+1];
+
+    // Outputs a fused relu clamped to 0 pass no grad back. y_grads isn't needed afterwards, so it's masked in place.
+    if (layer->spec.has_relu) {
+        for (U64 i = 0; i < y_count; ++i) if (y[i] <= 0) y_grads[i] = 0;
+    }
+
+    switch (layer->spec.kind) {
+        case NN_LayerKind_Conv2D: {
+            NN_ConvShape *shape = &layer->conv_shape;
+            U64 weight_count = layer->param_count - shape->out_channels;
+            F64 *bias_grads = param_grads + weight_count;
+            if (layer->conv_algorithm == NN_ConvAlgorithm_Winograd) {
+                NN_WinogradWeights *winograd = nn_winograd_cache_get(layer->winograd_cache, params);
+                nn_conv2d_backward_winograd(shape, batch_count, x, params, winograd, y_grads, param_grads, bias_grads, in_grads, model->pool);
+            } else if (layer->conv_algorithm == NN_ConvAlgorithm_Depthwise) {
+                nn_conv2d_backward_depthwise(shape, batch_count, x, params, y_grads, param_grads, bias_grads, in_grads, model->pool);
+            } else {
+                nn_conv2d_backward_im2col(shape, batch_count, x, params, y_grads, param_grads, bias_grads, in_grads, model->pool);
+            }
+        } break;
+
+        case NN_LayerKind_Pool2D: {
+            if (layer->spec.pool_type == NN_PoolType_Max) nn_max_pool2d_backward(&layer->pool_shape, batch_count, y_grads, layer->argmax, in_grads);
+            else                                          nn_avg_pool2d_backward(&layer->pool_shape, batch_count, y_grads, in_grads);
+        } break;
+
+        case NN_LayerKind_GlobalAvgPool: {
+            nn_global_avg_pool_backward(batch_count, layer->in_shape[0], layer->in_shape[1]*layer->in_shape[2], y_grads, in_grads);
+        } break;
+
+        case NN_LayerKind_Dense: {
+            int in_dim = (int)model->activation_sizes[l];
+            int out_dim = layer->spec.out_channels;
+
+            // dW += dY^T X, db += column sums of dY, dX = dY W
+            la_gemm(model->pool, 1, 0, out_dim, in_dim, batch_count, 1, y_grads, out_dim, x, in_dim, 1, param_grads, in_dim+1);
+            for (int n = 0; n < batch_count; ++n) {
+                F64 *y_grads_row = y_grads + (U64)n*out_dim;
+                for (int o = 0; o < out_dim; ++o) param_grads[(U64)o*(in_dim+1) + in_dim] += y_grads_row[o];
+            }
+            la_gemm(model->pool, 0, 0, batch_count, in_dim, out_dim, 1, y_grads, out_dim, params, in_dim+1, 0, in_grads, in_dim);
+        } break;
+
+        case NN_LayerKind_Relu: {
+            for (U64 i = 0; i < x_count; ++i) in_grads[i] = y[i] > 0 ? y_grads[i] : 0;
+        } break;
+
+        case NN_LayerKind_BatchNorm: {
+            int channels = layer->in_shape[0];
+            nn_batch_norm_backward(batch_count, channels, layer->in_shape[1]*layer->in_shape[2], x, layer->mean, layer->inv_std, params,
+                                   model->is_training, y_grads, in_grads, param_grads, param_grads + channels);
+        } break;
+
+        case NN_LayerKind_Add: {
+            F64 *skip_grads = model->activation_grads[layer->spec.skip_from+1];
+            for (U64 i = 0; i < x_count; ++i) {
+                in_grads[i] = y_grads[i];
+                skip_grads[i] += y_grads[i];
+            }
+        } break;
+
+        default: break;
+    }
+}
+
+internal
+F64 *nn_model_forward(NN_Model *model, F64 *x, int batch_count) {
+    Assert(batch_count <= model->max_batch_count);
+    model->activations[0] = x;
+    for (int l = 0; l < model->layer_count; ++l) nn_model_layer_forward(model, l, batch_count);
+    return model->activations[model->layer_count];
+}
+
+internal
+void nn_model_backward(NN_Model *model, F64 *output_grads, int batch_count) {
+    int layer_count = model->layer_count;
+    MD_MemoryCopy(model->activation_grads[layer_count], output_grads, (U64)batch_count*model->activation_sizes[layer_count]*sizeof(F64));
+
+    // Grads of activations an Add reads get contributions from two layers, so they start at 0
+    for (int a = 0; a < layer_count; ++a) {
+        if (model->is_skip_source[a]) MD_MemoryZero(model->activation_grads[a], (U64)batch_count*model->activation_sizes[a]*sizeof(F64));
+    }
+
+    for (int l = layer_count-1; l >= 0; --l) {
+        if (model->is_skip_source[l]) {
+            U64 count = (U64)batch_count*model->activation_sizes[l];
+            F64 *in_grads = model->activation_grads[l];
+            F64 *accumulation = model->accumulation_workspaces[l];
+            nn_model_layer_backward(model, l, batch_count, accumulation);
+            for (U64 i = 0; i < count; ++i) in_grads[i] += accumulation[i];
+        } else {
+            nn_model_layer_backward(model, l, batch_count, model->activation_grads[l]);
+        }
+    }
+}
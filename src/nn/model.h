@@ -0,0 +1,135 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+// A model built from a list of layer specs, run on raw batched buffers (no graph nodes).
+// All shapes are inferred when the model is built, so every activation, activation grad and
+// per-layer state buffer (max pool argmax, batch norm statistics) is allocated up front for 
+// max_batch_count samples and reused by every forward/backward pass.
+//
+// NOTE: The activations and activation grads live in one workspace laid out by nn_plan_memory.
+//       Their lifetimes over a training step (forward, then backward) are known statically, 
+//       e.g. a max pool's input is dead once the next layer has run unless the layer before 
+//       the pool needs it for its own backward. Buffers that are never live at the same step 
+//       share memory, so the workspace is usually close to the live peak instead of the sum 
+//       of all activations.
+
+typedef enum NN_LayerKind {
+    NN_LayerKind_Conv2D,
+    NN_LayerKind_Pool2D,
+    NN_LayerKind_GlobalAvgPool,
+    NN_LayerKind_Dense, // flattens its input
+    NN_LayerKind_Relu,
+    NN_LayerKind_BatchNorm,
+    NN_LayerKind_Add,   // residual add
+
+    NN_LayerKind_COUNT,
+} NN_LayerKind;
+
+typedef struct NN_LayerSpec NN_LayerSpec;
+struct NN_LayerSpec {
+    NN_LayerKind kind;
+    int out_channels;  // Conv2D: output channels, Dense: output features
+    int kernel_size;   // Conv2D, Pool2D
+    int stride;        // Conv2D, Pool2D
+    int padding;       // Conv2D, Pool2D
+    int groups;        // Conv2D, 0 means 1
+    NN_PoolType pool_type;
+    B32 has_relu;      // Conv2D, Dense: fused into the output write-back
+    int skip_from;     // Add: index of the layer whose output is added to the input (-1 = model input)
+    F64 eps;           // BatchNorm, see NN_BatchNorm
+    F64 momentum;      // BatchNorm
+};
+
+typedef struct NN_ModelLayer NN_ModelLayer;
+struct NN_ModelLayer {
+    NN_LayerSpec spec;
+    int in_shape[3];  // [channels, h, w]. Dense and GlobalAvgPool outputs are [features, 1, 1].
+    int out_shape[3];
+    U64 param_offset; // into the model's params
+    U64 param_count;  // Conv2D: [weights..., biases...], Dense: [out, in+1] (bias last), BatchNorm: [gamma..., beta...]
+
+    NN_ConvShape conv_shape;
+    NN_ConvAlgorithm conv_algorithm; // resolved, never Auto
+    NN_WinogradCache *winograd_cache;
+    NN_PoolShape pool_shape;
+    U8 *argmax; // max pool: [max_batch_count, output size]
+
+    F64 *running_mean; // BatchNorm
+    F64 *running_var;
+    F64 *mean;         // BatchNorm: the statistics of the last forward pass
+    F64 *inv_std;
+};
+
+typedef struct NN_Model NN_Model;
+struct NN_Model {
+    NN_ModelLayer *layers;
+    int layer_count;
+    int max_batch_count;
+    B32 is_training; // batch norm statistics (and running statistics updates)
+    NN_Params params; // no AG leaves, see opt_step
+
+    // activations[0] is the input, activations[l+1] is the output of layer l. 
+    // activation_sizes are per sample.
+    U64 *activation_sizes;
+    F64 **activations;
+    F64 **activation_grads;        // activation_grads[0] gets the grads of the input
+    B32 *is_skip_source;           // read by an Add on top of the next layer, so its grads accumulate
+    F64 **accumulation_workspaces; // skip sources only: the next layer's input grads, before they're added
+
+    NN_MemoryPlan memory_plan; // per sample, in F64s
+    F64 *workspace;            // memory_plan.workspace_size*max_batch_count
+
+    TP_ThreadPool *pool;
+};
+
+// Spec constructors
+internal NN_LayerSpec nn_conv_layer_spec(int out_channels, int kernel_size, int stride, int padding, B32 has_relu);
+internal NN_LayerSpec nn_pool_layer_spec(NN_PoolType type, int kernel_size, int stride, int padding);
+internal NN_LayerSpec nn_global_avg_pool_layer_spec(void);
+internal NN_LayerSpec nn_dense_layer_spec(int out_features, B32 has_relu);
+internal NN_LayerSpec nn_relu_layer_spec(void);
+// With the NN_BatchNorm defaults for eps and momentum
+internal NN_LayerSpec nn_batch_norm_layer_spec(void);
+internal NN_LayerSpec nn_add_layer_spec(int skip_from);
+
+// Infers every layer's shape and allocates the params and all buffers. Prints an error and 
+// returns a model with layer_count 0 if the specs don't fit together.
+internal NN_Model nn_make_model(Arena *arena, int in_channels, int in_h, int in_w, NN_LayerSpec *specs, int spec_count, 
+                                int max_batch_count, TP_ThreadPool *pool);
+
+// Per sample
+internal U64 nn_model_output_size(NN_Model *model);
+
+// x is [batch_count, in_channels, in_h, in_w] and must stay alive until the backward pass.
+// Returns the output activation [batch_count, output size].
+internal F64 *nn_model_forward(NN_Model *model, F64 *x, int batch_count);
+
+// Accumulates into model->params.grads, the input's grads end up in activation_grads[0].
+// batch_count must match the last forward pass.
+internal void nn_model_backward(NN_Model *model, F64 *output_grads, int batch_count);
+
+// ==================================
+// Private helpers
+
+internal void nn_model_layer_forward(NN_Model *model, int l, int batch_count);
+
+// Writes the grads of layer l's input to in_grads (overwriting)
+internal void nn_model_layer_backward(NN_Model *model, int l, int batch_count, F64 *in_grads);
+
+// activation_shapes is [layer_count+1][3], indexed like NN_Model.activations. Fills in layer l's
+// shapes, params and kernel setup, returns 0 (after printing why) if the spec doesn't fit its input.
+internal B32 nn_model_infer_layer(NN_ModelLayer *layer, int l, int *activation_shapes);
+
+// Lifetimes of the activation (index a), activation grad (layer_count+1 + a) and accumulation 
+// workspace (2*(layer_count+1) + a) buffers over a training step, with per-sample sizes. Buffers
+// a model doesn't have are empty. buffers has room for NN_MODEL_PLAN_BUFFER_COUNT(layer_count).
+// Steps: layer l's forward runs at l, the backward starts at layer_count, layer l's backward 
+// runs at 2*layer_count - l, and the input grads are read at 2*layer_count + 1.
+#define NN_MODEL_PLAN_BUFFER_COUNT(layer_count) (3*((layer_count)+1))
+internal void nn_model_plan_buffers(NN_Model *model, NN_PlanBuffer *buffers);
+
+// Which activations layer's backward reads
+internal B32 nn_layer_backward_reads_input(NN_LayerSpec *spec);
+internal B32 nn_layer_backward_reads_output(NN_LayerSpec *spec);
+
+#endif
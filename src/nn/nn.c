@@ -21,16 +21,21 @@ NN_Neuron nn_make_neuron_from_weights(Arena *arena, F64 *weights, int weight_cou
 
 
 internal
-NN_Neuron nn_make_neuron_with_random_init(Arena *arena, int input_dim, B32 has_relu) {
-    ArenaTemp scratch = scratch_begin(&arena, 1);
-    F64 *weights = push_array(scratch.arena, F64, input_dim);
+void nn_sample_neuron_params(F64 *params, int input_dim) {
     F64 kaiming_bound = sqrt(6.0/input_dim);
     local_persist B32 is_seeded = 0;
     if (!is_seeded) srand(time(0)); // TODO: this is pretty bad, needa fix later with proper seeding system to get determinism
     is_seeded = 1;
-    for (int i = 0; i < input_dim; ++i) weights[i] = sample_f64_in_range(-kaiming_bound, kaiming_bound);
-    F64 bias = 0.1; // small bias to help prevent dead ReLUs
-    NN_Neuron result = nn_make_neuron_from_weights(arena, weights, input_dim, bias, has_relu);
+    for (int i = 0; i < input_dim; ++i) params[i] = sample_f64_in_range(-kaiming_bound, kaiming_bound);
+    params[input_dim] = 0.1; // small bias to help prevent dead ReLUs
+}
+
+internal
+NN_Neuron nn_make_neuron_with_random_init(Arena *arena, int input_dim, B32 has_relu) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+    F64 *params = push_array(scratch.arena, F64, input_dim+1);
+    nn_sample_neuron_params(params, input_dim);
+    NN_Neuron result = nn_make_neuron_from_weights(arena, params, input_dim, params[input_dim], has_relu);
     scratch_end(scratch);
     return result;
 }
@@ -78,6 +83,22 @@ NN_Layer nn_make_layer_with_random_init(Arena *arena, int input_dim, int output_
     return result;
 }
 
+internal
+NN_Layer nn_make_layer_on_leaves(Arena *arena, int input_dim, int output_dim, B32 has_relu, AG_Value **leaves) {
+    NN_Layer result = {0};
+    result.neuron_count = output_dim;
+    result.neurons = push_array(arena, NN_Neuron, result.neuron_count);
+    for (int i = 0; i < result.neuron_count; ++i) {
+        NN_Neuron *neuron = &result.neurons[i];
+        AG_Value **neuron_leaves = leaves + (U64)i*(input_dim+1);
+        neuron->weights.count = input_dim;
+        neuron->weights.values = neuron_leaves;
+        neuron->bias = neuron_leaves[input_dim];
+        neuron->has_relu = has_relu;
+    }
+    return result;
+}
+
 internal
 AG_ValueArray nn_layer_apply(Arena *value_arena, Arena *array_arena, NN_Layer *layer, AG_ValueArray x) {
     AG_ValueArray result = {0};
@@ -141,6 +162,33 @@ NN_MLP nn_make_mlp_with_random_init(Arena *arena, int input_dim, int *output_dim
         B32 has_relu = (i != layer_count-1); // output layer has no relu
         result.layers[i] = nn_make_layer_with_random_init(arena, layer_input_dim, layer_output_dim, has_relu);
     }
+    result.params = nn_make_params(arena, nn_mlp_get_params(arena, &result));
+    return result;
+}
+
+internal
+NN_MLP nn_make_mlp_on_values(Arena *arena, int input_dim, int *output_dims, int layer_count, F64 *values) {
+    NN_MLP result = {0};
+    result.layer_count = layer_count;
+    result.layers = push_array(arena, NN_Layer, layer_count);
+    result.params = nn_make_params_on_values(arena, values, nn_mlp_param_count(input_dim, output_dims, layer_count));
+    AG_Value **leaves = result.params.leaves;
+    for (int i = 0; i < layer_count; ++i) {
+        int layer_input_dim = (i > 0 ? output_dims[i-1] : input_dim);
+        B32 has_relu = (i != layer_count-1); // output layer has no relu
+        result.layers[i] = nn_make_layer_on_leaves(arena, layer_input_dim, output_dims[i], has_relu, leaves);
+        leaves += (layer_input_dim+1)*output_dims[i];
+    }
+    return result;
+}
+
+internal
+int nn_mlp_param_count(int input_dim, int *output_dims, int layer_count) {
+    int result = 0;
+    for (int i = 0; i < layer_count; ++i) {
+        int layer_input_dim = (i > 0 ? output_dims[i-1] : input_dim);
+        result += (layer_input_dim+1)*output_dims[i];
+    }
     return result;
 }
 
@@ -196,6 +244,274 @@ AG_ValueArray nn_mlp_apply(Arena *value_arena, Arena *array_arena, NN_MLP *mlp,
     return current_layer_output;
 }
 
+// NOTE: Layer l's params are out_dim neurons of (in_dim weights, bias) in the params block, i.e. a
+//       row-major [out_dim, in_dim+1] matrix whose last column is the bias. The batched passes 
+//       use it in place as W with row stride in_dim+1.
+internal
+NN_MLPBatch nn_mlp_apply_batch(Arena *arena, NN_MLP *mlp, F64 *x, int batch_count, TP_ThreadPool *pool) {
+    NN_MLPBatch result = {0};
+    result.batch_count = batch_count;
+    result.layer_count = mlp->layer_count;
+    result.dims = push_array(arena, int, mlp->layer_count+1);
+    result.activations = push_array(arena, F64*, mlp->layer_count+1);
+    result.dims[0] = mlp->layers[0].neurons[0].weights.count;
+    result.activations[0] = x;
+
+    F64 *layer_params = mlp->params.values;
+    for (int l = 0; l < mlp->layer_count; ++l) {
+        NN_Layer *layer = &mlp->layers[l];
+        int in_dim = result.dims[l];
+        int out_dim = layer->neuron_count;
+        B32 has_relu = layer->neurons[0].has_relu;
+        F64 *in = result.activations[l];
+
+        MD_ArenaPushAlign(arena, 64);
+        F64 *out = push_array_no_zero(arena, F64, (U64)batch_count*out_dim);
+        la_gemm(pool, 0, 1, batch_count, out_dim, in_dim, 1, in, in_dim, layer_params, in_dim+1, 0, out, out_dim);
+
+        // Fused bias + relu
+        for (int n = 0; n < batch_count; ++n) {
+            F64 *out_row = out + (U64)n*out_dim;
+            for (int o = 0; o < out_dim; ++o) {
+                F64 z = out_row[o] + layer_params[(U64)o*(in_dim+1) + in_dim];
+                out_row[o] = (has_relu && z <= 0) ? 0 : z;
+            }
+        }
+
+        result.dims[l+1] = out_dim;
+        result.activations[l+1] = out;
+        layer_params += (U64)out_dim*(in_dim+1);
+    }
+
+    result.output = result.activations[mlp->layer_count];
+    return result;
+}
+
+internal
+void nn_mlp_backward_batch(NN_MLP *mlp, NN_MLPBatch *batch, F64 *output_grads, F64 *input_grads, TP_ThreadPool *pool) {
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    int batch_count = batch->batch_count;
+
+    // Params offset of every layer
+    U64 *param_offsets = push_array(scratch.arena, U64, batch->layer_count);
+    for (int l = 1; l < batch->layer_count; ++l) {
+        param_offsets[l] = param_offsets[l-1] + (U64)batch->dims[l]*(batch->dims[l-1]+1);
+    }
+
+    F64 *out_grads = output_grads;
+    for (int l = batch->layer_count-1; l >= 0; --l) {
+        int in_dim = batch->dims[l];
+        int out_dim = batch->dims[l+1];
+        B32 has_relu = mlp->layers[l].neurons[0].has_relu;
+        F64 *in = batch->activations[l];
+        F64 *out = batch->activations[l+1];
+        F64 *w = mlp->params.values + param_offsets[l];
+        F64 *w_grads = mlp->params.grads + param_offsets[l];
+
+        // d(loss)/d(pre-activation), masked by the relu (out > 0 exactly where the pre-activation was)
+        F64 *z_grads = out_grads;
+        if (has_relu) {
+            z_grads = push_array_no_zero(scratch.arena, F64, (U64)batch_count*out_dim);
+            for (U64 i = 0; i < (U64)batch_count*out_dim; ++i) z_grads[i] = out[i] > 0 ? out_grads[i] : 0;
+        }
+
+        // dW += dZ^T X, db += column sums of dZ
+        la_gemm(pool, 1, 0, out_dim, in_dim, batch_count, 1, z_grads, out_dim, in, in_dim, 1, w_grads, in_dim+1);
+        for (int n = 0; n < batch_count; ++n) {
+            F64 *z_grads_row = z_grads + (U64)n*out_dim;
+            for (int o = 0; o < out_dim; ++o) w_grads[(U64)o*(in_dim+1) + in_dim] += z_grads_row[o];
+        }
+
+        // dX = dZ W
+        F64 *in_grads = 0;
+        if (l > 0) in_grads = push_array_no_zero(scratch.arena, F64, (U64)batch_count*in_dim);
+        else       in_grads = input_grads;
+        if (in_grads) {
+            la_gemm(pool, 0, 0, batch_count, in_dim, out_dim, 1, z_grads, out_dim, w, in_dim+1, 0, in_grads, in_dim);
+        }
+        out_grads = in_grads;
+    }
+
+    scratch_end(scratch);
+}
+
+// ===================================
+// Mixed precision
+
+internal
+NN_MLPBatchF32 nn_mlp_apply_batch_f32(Arena *arena, NN_MLP *mlp, F32 *x, int batch_count, TP_ThreadPool *pool) {
+    NN_MLPBatchF32 result = {0};
+    result.batch_count = batch_count;
+    result.layer_count = mlp->layer_count;
+    result.dims = push_array(arena, int, mlp->layer_count+1);
+    result.activations = push_array(arena, F32*, mlp->layer_count+1);
+    result.dims[0] = mlp->layers[0].neurons[0].weights.count;
+    result.activations[0] = x;
+
+    MD_ArenaPushAlign(arena, 64);
+    result.weights = push_array_no_zero(arena, F32, mlp->params.count);
+    for (int i = 0; i < mlp->params.count; ++i) result.weights[i] = (F32)mlp->params.values[i];
+
+    F32 *layer_params = result.weights;
+    for (int l = 0; l < mlp->layer_count; ++l) {
+        NN_Layer *layer = &mlp->layers[l];
+        int in_dim = result.dims[l];
+        int out_dim = layer->neuron_count;
+        B32 has_relu = layer->neurons[0].has_relu;
+        F32 *in = result.activations[l];
+
+        MD_ArenaPushAlign(arena, 64);
+        F32 *out = push_array_no_zero(arena, F32, (U64)batch_count*out_dim);
+        la_gemm_f32(pool, 0, 1, batch_count, out_dim, in_dim, 1, in, in_dim, layer_params, in_dim+1, 0, out, out_dim);
+
+        // Fused bias + relu
+        for (int n = 0; n < batch_count; ++n) {
+            F32 *out_row = out + (U64)n*out_dim;
+            for (int o = 0; o < out_dim; ++o) {
+                F32 z = out_row[o] + layer_params[(U64)o*(in_dim+1) + in_dim];
+                out_row[o] = (has_relu && z <= 0) ? 0 : z;
+            }
+        }
+
+        result.dims[l+1] = out_dim;
+        result.activations[l+1] = out;
+        layer_params += (U64)out_dim*(in_dim+1);
+    }
+
+    result.output = result.activations[mlp->layer_count];
+    return result;
+}
+
+internal
+B32 nn_mlp_backward_batch_f32(NN_MLP *mlp, NN_MLPBatchF32 *batch, F32 *output_grads, F32 loss_scale, TP_ThreadPool *pool) {
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    int batch_count = batch->batch_count;
+    int layer_count = batch->layer_count;
+
+    // Params offset of every layer
+    U64 *param_offsets = push_array(scratch.arena, U64, layer_count);
+    for (int l = 1; l < layer_count; ++l) {
+        param_offsets[l] = param_offsets[l-1] + (U64)batch->dims[l]*(batch->dims[l-1]+1);
+    }
+
+    // The scaled grads of this pass, only added to the F64 grads once they're known to be finite
+    MD_ArenaPushAlign(scratch.arena, 64);
+    F32 *param_grads = push_array(scratch.arena, F32, mlp->params.count);
+
+    U64 output_count = (U64)batch_count*batch->dims[layer_count];
+    F32 *out_grads = push_array_no_zero(scratch.arena, F32, output_count);
+    for (U64 i = 0; i < output_count; ++i) out_grads[i] = output_grads[i]*loss_scale;
+
+    for (int l = layer_count-1; l >= 0; --l) {
+        int in_dim = batch->dims[l];
+        int out_dim = batch->dims[l+1];
+        B32 has_relu = mlp->layers[l].neurons[0].has_relu;
+        F32 *in = batch->activations[l];
+        F32 *out = batch->activations[l+1];
+        F32 *w = batch->weights + param_offsets[l];
+        F32 *w_grads = param_grads + param_offsets[l];
+
+        // d(loss)/d(pre-activation), masked by the relu (in place, out_grads isn't needed afterwards)
+        if (has_relu) {
+            for (U64 i = 0; i < (U64)batch_count*out_dim; ++i) if (out[i] <= 0) out_grads[i] = 0;
+        }
+
+        // dW += dZ^T X, db += column sums of dZ
+        la_gemm_f32(pool, 1, 0, out_dim, in_dim, batch_count, 1, out_grads, out_dim, in, in_dim, 1, w_grads, in_dim+1);
+        for (int n = 0; n < batch_count; ++n) {
+            F32 *z_grads_row = out_grads + (U64)n*out_dim;
+            for (int o = 0; o < out_dim; ++o) w_grads[(U64)o*(in_dim+1) + in_dim] += z_grads_row[o];
+        }
+
+        // dX = dZ W
+        if (l > 0) {
+            F32 *in_grads = push_array_no_zero(scratch.arena, F32, (U64)batch_count*in_dim);
+            la_gemm_f32(pool, 0, 0, batch_count, in_dim, out_dim, 1, out_grads, out_dim, w, in_dim+1, 0, in_grads, in_dim);
+            out_grads = in_grads;
+        }
+    }
+
+    // An overflow anywhere shows up as inf/nan in the param grads
+    B32 is_finite = 1;
+    for (int i = 0; i < mlp->params.count; ++i) {
+        if (!isfinite(param_grads[i])) {
+            is_finite = 0;
+            break;
+        }
+    }
+    if (is_finite) {
+        F64 inv_scale = 1.0/loss_scale;
+        for (int i = 0; i < mlp->params.count; ++i) mlp->params.grads[i] += param_grads[i]*inv_scale;
+    }
+
+    scratch_end(scratch);
+    return is_finite;
+}
+
+internal
+NN_LossScaler nn_make_loss_scaler(F32 initial_scale, int growth_interval) {
+    NN_LossScaler result = {0};
+    result.scale = initial_scale;
+    result.growth_interval = growth_interval;
+    return result;
+}
+
+internal
+void nn_loss_scaler_update(NN_LossScaler *scaler, B32 grads_are_finite) {
+    if (!grads_are_finite) {
+        scaler->scale = MD_Max(scaler->scale*0.5f, 1.0f);
+        scaler->finite_step_count = 0;
+    } else if (++scaler->finite_step_count >= scaler->growth_interval) {
+        scaler->scale *= 2;
+        scaler->finite_step_count = 0;
+    }
+}
+
+// ===================================
+// Params
+
+internal
+NN_Params nn_make_params(Arena *arena, AG_ValueArray leaves) {
+    NN_Params result = {0};
+    result.count = leaves.count;
+    result.leaves = leaves.values;
+    MD_ArenaPushAlign(arena, 64); // keep the blocks friendly to vector loads
+    result.values = push_array(arena, F64, result.count);
+    MD_ArenaPushAlign(arena, 64);
+    result.grads = push_array(arena, F64, result.count);
+    for (int i = 0; i < result.count; ++i) result.values[i] = *leaves.values[i]->value;
+    nn_params_bind_values(&result, result.values);
+    return result;
+}
+
+internal
+NN_Params nn_make_params_on_values(Arena *arena, F64 *values, int count) {
+    NN_Params result = {0};
+    result.count = count;
+    if (!values) {
+        MD_ArenaPushAlign(arena, 64);
+        values = push_array(arena, F64, count);
+    }
+    result.values = values;
+    MD_ArenaPushAlign(arena, 64);
+    result.grads = push_array(arena, F64, count);
+    result.leaves = ag_push_bound_sources(arena, result.values, result.grads, count).values;
+    return result;
+}
+
+internal
+void nn_params_zero_grad(NN_Params *params) {
+    MD_MemoryZero(params->grads, params->count*sizeof(F64));
+}
+
+internal
+void nn_params_bind_values(NN_Params *params, F64 *values) {
+    params->values = values;
+    if (!params->leaves) return;
+    for (int i = 0; i < params->count; ++i) ag_bind_leaf(params->leaves[i], &values[i], &params->grads[i]);
+}
 
 internal
 void push_parameter(Arena *arena, NN_ParameterList *list, AG_Value *param) {
@@ -14,10 +14,59 @@ struct NN_Layer {
     int neuron_count;
 };
 
+// NOTE: A model's parameters are owned by one contiguous block of values and a matching block 
+//       of grads, so zero_grad is a memset and optimizer updates are flat sweeps. The AG leaves
+//       that graphs are built from are views into the blocks (see ag_bind_leaf): a forward pass
+//       reads the values the optimizer wrote and a backward pass accumulates straight into the
+//       grad block, with nothing to sync in between.
+typedef struct NN_Params NN_Params;
+struct NN_Params {
+    F64 *values;
+    F64 *grads;
+    AG_Value **leaves;
+    int count;
+};
+
 typedef struct NN_MLP NN_MLP;
 struct NN_MLP {
     NN_Layer *layers;
     int layer_count;
+    NN_Params params; // in nn_mlp_get_params order
+};
+
+// Activations of a batched MLP forward pass, kept around for the batched backward pass.
+// activations[0] is the input [batch_count, dims[0]], activations[l+1] is the output of layer l
+// [batch_count, dims[l+1]] (after its relu, if it has one). All row-major.
+typedef struct NN_MLPBatch NN_MLPBatch;
+struct NN_MLPBatch {
+    int batch_count;
+    int layer_count;
+    int *dims;
+    F64 **activations;
+    F64 *output; // == activations[layer_count]
+};
+
+// Mixed precision version of NN_MLPBatch: F32 activations, plus the F32 copy of the (F64 master)
+// params the forward pass ran with, which the backward pass reuses.
+typedef struct NN_MLPBatchF32 NN_MLPBatchF32;
+struct NN_MLPBatchF32 {
+    int batch_count;
+    int layer_count;
+    int *dims;
+    F32 *weights; // in mlp->params order
+    F32 **activations;
+    F32 *output; // == activations[layer_count]
+};
+
+// Dynamic loss scaling for mixed precision backward passes: grads are computed for 
+// loss*scale, so small grads don't flush to zero in F32, and unscaled into the F64 grads.
+// A step whose scaled grads overflow is skipped and halves the scale; after growth_interval 
+// finite steps in a row the scale doubles.
+typedef struct NN_LossScaler NN_LossScaler;
+struct NN_LossScaler {
+    F32 scale;
+    int growth_interval;
+    int finite_step_count;
 };
 
 typedef struct NN_ParameterNode NN_ParameterNode;
@@ -40,6 +89,9 @@ internal NN_Neuron nn_make_neuron_from_weights(Arena *arena, F64 *weights, int w
 
 internal NN_Neuron nn_make_neuron_with_random_init(Arena *arena, int input_dim, B32 has_relu);
 
+// The random init of nn_make_neuron_with_random_init into params [weights..., bias]
+internal void nn_sample_neuron_params(F64 *params, int input_dim);
+
 internal AG_ValueArray nn_neuron_get_params(Arena *arena, NN_Neuron *neuron);
 
 internal AG_Value *nn_neuron_apply(Arena *arena, NN_Neuron *neuron, AG_ValueArray x);
@@ -49,6 +101,10 @@ internal AG_Value *nn_neuron_apply(Arena *arena, NN_Neuron *neuron, AG_ValueArra
 
 internal NN_Layer nn_make_layer_with_random_init(Arena *arena, int input_dim, int output_dim, B32 has_relu);
 
+// Uses the first output_dim*(input_dim+1) of `leaves` (in nn_layer_get_params order) as the
+// layer's params instead of making new ones
+internal NN_Layer nn_make_layer_on_leaves(Arena *arena, int input_dim, int output_dim, B32 has_relu, AG_Value **leaves);
+
 internal AG_ValueArray nn_layer_apply(Arena *value_arena, Arena *array_arena, NN_Layer *layer,  AG_ValueArray x);
 
 internal AG_ValueArray nn_layer_get_params(Arena *arena, NN_Layer *layer);
@@ -58,10 +114,60 @@ internal AG_ValueArray nn_layer_get_params(Arena *arena, NN_Layer *layer);
 
 internal NN_MLP nn_make_mlp_with_random_init(Arena *arena, int input_dim, int *output_dims, int layer_count);
 
+// The structure of nn_make_mlp_with_random_init on top of an existing value block (in
+// nn_mlp_get_params order), or a zeroed one if values is 0. Nothing is sampled or copied and the
+// leaves are allocated in one block, so this is what loading a model costs (see ck_load_mlp).
+internal NN_MLP nn_make_mlp_on_values(Arena *arena, int input_dim, int *output_dims, int layer_count, F64 *values);
+
+internal int nn_mlp_param_count(int input_dim, int *output_dims, int layer_count);
+
 internal AG_ValueArray nn_mlp_get_params(Arena *arena, NN_MLP *mlp);
 
 internal AG_ValueArray nn_mlp_apply(Arena *value_arena, Arena *array_arena, NN_MLP *mlp, AG_ValueArray x);
 
+// Batched forward pass over x [batch_count, input_dim], straight from mlp->params.values (no graph
+// is built and the AG leaves aren't read). Each layer is one GEMM followed by one fused
+// bias+relu sweep.
+internal NN_MLPBatch nn_mlp_apply_batch(Arena *arena, NN_MLP *mlp, F64 *x, int batch_count, TP_ThreadPool *pool);
+
+// Batched backward pass matching nn_mlp_apply_batch. output_grads is d(loss)/d(output) 
+// [batch_count, output_dim]. Adds the weight and bias grads into mlp->params.grads, and writes 
+// d(loss)/d(x) into input_grads [batch_count, input_dim] if it's non-zero.
+internal void nn_mlp_backward_batch(NN_MLP *mlp, NN_MLPBatch *batch, F64 *output_grads, F64 *input_grads, TP_ThreadPool *pool);
+
+// ===================================
+// Mixed precision
+
+// Mixed precision nn_mlp_apply_batch: the params are rounded to F32 once per pass, the GEMMs
+// and activations are F32. mlp->params.values stay the F64 master weights the optimizer updates.
+internal NN_MLPBatchF32 nn_mlp_apply_batch_f32(Arena *arena, NN_MLP *mlp, F32 *x, int batch_count, TP_ThreadPool *pool);
+
+// Mixed precision nn_mlp_backward_batch. output_grads are the unscaled d(loss)/d(output); the 
+// backward pass runs in F32 on output_grads*loss_scale. If every scaled grad is finite, 
+// grads/loss_scale is added into the F64 mlp->params.grads and 1 is returned. Otherwise 
+// params.grads is left untouched and 0 is returned (skip the step, see NN_LossScaler).
+internal B32 nn_mlp_backward_batch_f32(NN_MLP *mlp, NN_MLPBatchF32 *batch, F32 *output_grads, F32 loss_scale, TP_ThreadPool *pool);
+
+internal NN_LossScaler nn_make_loss_scaler(F32 initial_scale, int growth_interval);
+
+internal void nn_loss_scaler_update(NN_LossScaler *scaler, B32 grads_are_finite);
+
+// ===================================
+// Params
+
+// Copies the current values of `leaves` into a new contiguous block and binds the leaves to it
+internal NN_Params nn_make_params(Arena *arena, AG_ValueArray leaves);
+
+// Params on `values` (a new zeroed block if it's 0) with a zeroed grad block, and `count` new
+// leaves bound to them. values isn't copied.
+internal NN_Params nn_make_params_on_values(Arena *arena, F64 *values, int count);
+
+internal void nn_params_zero_grad(NN_Params *params);
+
+// Makes `values` the params' value block (e.g. one mapped from a checkpoint), and rebinds the
+// leaves to it. The values aren't copied.
+internal void nn_params_bind_values(NN_Params *params, F64 *values);
+
 // ============================
 // Helpers
 
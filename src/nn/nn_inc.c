@@ -1,2 +1,10 @@
 #include "nn.c"
+#include "conv_kernels.c"
+#include "pool.c"
 #include "conv.c"
+#include "norm.c"
+#include "loss.c"
+#include "plan.c"
+#include "model.c"
+#include "quant.c"
+#include "sparse.c"
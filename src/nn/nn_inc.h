@@ -3,6 +3,14 @@
 
 #include "random.h"
 #include "nn.h"
+#include "conv_kernels.h"
+#include "pool.h"
 #include "conv.h"
+#include "norm.h"
+#include "loss.h"
+#include "plan.h"
+#include "model.h"
+#include "quant.h"
+#include "sparse.h"
 
 #endif
@@ -0,0 +1,255 @@
+internal
+NN_BatchNorm nn_make_batch_norm(Arena *arena, int channels) {
+    NN_BatchNorm result = {0};
+    result.channels = channels;
+    result.eps = NN_BATCH_NORM_DEFAULT_EPS;
+    result.momentum = NN_BATCH_NORM_DEFAULT_MOMENTUM;
+    result.is_training = 1;
+
+    result.gamma.count = channels;
+    result.gamma.values = push_array(arena, AG_Value*, channels);
+    result.beta.count = channels;
+    result.beta.values = push_array(arena, AG_Value*, channels);
+    result.running_mean = push_array(arena, F64, channels);
+    result.running_var = push_array(arena, F64, channels);
+    for (int c = 0; c < channels; ++c) {
+        result.gamma.values[c] = ag_source(arena, 1);
+        result.beta.values[c] = ag_source(arena, 0);
+        result.running_var[c] = 1;
+    }
+    return result;
+}
+
+internal
+AG_ValueArray nn_batch_norm_get_params(Arena *arena, NN_BatchNorm *bn) {
+    AG_ValueArray result = {0};
+    result.count = 2*bn->channels;
+    result.values = push_array(arena, AG_Value*, result.count);
+    ArrayCopy(result.values, bn->gamma.values, bn->channels);
+    ArrayCopy(result.values + bn->channels, bn->beta.values, bn->channels);
+    return result;
+}
+
+// ==================================
+// Kernels
+
+internal
+void nn_batch_norm_statistics(int batch_count, int channels, int plane_size, F64 *x, F64 *mean, F64 *var) {
+    // NOTE: The sums are taken around each channel's first element, which keeps the one-pass 
+    //       variance (E[d^2] - E[d]^2) from cancelling catastrophically when |mean| >> std.
+    U64 n = (U64)batch_count*plane_size;
+    for (int c = 0; c < channels; ++c) {
+        F64 shift = x[(U64)c*plane_size];
+        F64 sum = 0, sum_sq = 0;
+        for (int b = 0; b < batch_count; ++b) {
+            F64 *x_plane = x + ((U64)b*channels + c)*plane_size;
+            for (int i = 0; i < plane_size; ++i) {
+                F64 d = x_plane[i] - shift;
+                sum += d;
+                sum_sq += d*d;
+            }
+        }
+        F64 mean_d = sum/n;
+        mean[c] = shift + mean_d;
+        var[c] = MD_Max(sum_sq/n - mean_d*mean_d, 0);
+    }
+}
+
+internal
+void nn_batch_norm_normalize(int batch_count, int channels, int plane_size, F64 *x, F64 *mean, F64 *inv_std, F64 *gamma, F64 *beta, F64 *out) {
+    for (int b = 0; b < batch_count; ++b) {
+        for (int c = 0; c < channels; ++c) {
+            // out = x*scale + shift
+            F64 scale = gamma[c]*inv_std[c];
+            F64 shift = beta[c] - mean[c]*scale;
+            U64 offset = ((U64)b*channels + c)*plane_size;
+            for (int i = 0; i < plane_size; ++i) out[offset + i] = x[offset + i]*scale + shift;
+        }
+    }
+}
+
+internal
+void nn_batch_norm_backward(int batch_count, int channels, int plane_size, F64 *x, F64 *mean, F64 *inv_std, F64 *gamma, 
+                            B32 batch_statistics, F64 *out_grads, F64 *x_grads, F64 *gamma_grads, F64 *beta_grads) {
+    U64 n = (U64)batch_count*plane_size;
+    for (int c = 0; c < channels; ++c) {
+        // sum(dy) and sum(dy*x_hat)
+        F64 sum_dy = 0, sum_dy_x_hat = 0;
+        for (int b = 0; b < batch_count; ++b) {
+            U64 offset = ((U64)b*channels + c)*plane_size;
+            for (int i = 0; i < plane_size; ++i) {
+                F64 dy = out_grads[offset + i];
+                sum_dy += dy;
+                sum_dy_x_hat += dy*(x[offset + i] - mean[c])*inv_std[c];
+            }
+        }
+        gamma_grads[c] += sum_dy_x_hat;
+        beta_grads[c] += sum_dy;
+
+        // dx = gamma*inv_std*(dy - mean(dy) - x_hat*mean(dy*x_hat)), the last two terms only with batch statistics
+        F64 scale = gamma[c]*inv_std[c];
+        F64 mean_dy = batch_statistics ? sum_dy/n : 0;
+        F64 mean_dy_x_hat = batch_statistics ? sum_dy_x_hat/n : 0;
+        for (int b = 0; b < batch_count; ++b) {
+            U64 offset = ((U64)b*channels + c)*plane_size;
+            for (int i = 0; i < plane_size; ++i) {
+                F64 x_hat = (x[offset + i] - mean[c])*inv_std[c];
+                x_grads[offset + i] = scale*(out_grads[offset + i] - mean_dy - x_hat*mean_dy_x_hat);
+            }
+        }
+    }
+}
+
+// ==================================
+// Graph ops
+
+internal
+AG_Block *nn_batch_norm_push_block(Arena *value_arena, NN_BatchNorm *bn, AG_Value **x, int batch_count, int plane_size) {
+    ArenaTemp scratch = scratch_begin(&value_arena, 1);
+
+    int channels = bn->channels;
+    int x_count = batch_count*channels*plane_size;
+
+    // The block description is read again during backward, so it lives in value_arena
+    NN_BatchNormBlock *bn_block = push_array(value_arena, NN_BatchNormBlock, 1);
+    bn_block->batch_count = batch_count;
+    bn_block->channels = channels;
+    bn_block->plane_size = plane_size;
+    bn_block->batch_statistics = bn->is_training;
+    bn_block->mean = push_array_no_zero(value_arena, F64, channels);
+    bn_block->inv_std = push_array_no_zero(value_arena, F64, channels);
+
+    // inputs = [x..., gamma..., beta...]
+    AG_ValueArray inputs = {0};
+    inputs.count = x_count + 2*channels;
+    inputs.values = push_array(scratch.arena, AG_Value*, inputs.count);
+    ArrayCopy(inputs.values, x, x_count);
+    ArrayCopy(inputs.values + x_count, bn->gamma.values, channels);
+    ArrayCopy(inputs.values + x_count + channels, bn->beta.values, channels);
+    AG_Block *block = ag_push_block(value_arena, inputs, x_count, nn_batch_norm_block_backward, bn_block);
+
+    F64 *raw_inputs = push_array_no_zero(scratch.arena, F64, inputs.count);
+    F64 *raw_out = push_array_no_zero(scratch.arena, F64, x_count);
+    B32 has_tangents = 0;
+    for (int i = 0; i < inputs.count; ++i) {
+        raw_inputs[i] = *inputs.values[i]->value;
+        if (inputs.values[i]->tangent != 0) has_tangents = 1;
+    }
+    F64 *raw_gamma = raw_inputs + x_count;
+    F64 *raw_beta = raw_inputs + x_count + channels;
+
+    if (bn->is_training) {
+        F64 *var = push_array_no_zero(scratch.arena, F64, channels);
+        nn_batch_norm_statistics(batch_count, channels, plane_size, raw_inputs, bn_block->mean, var);
+        U64 n = (U64)batch_count*plane_size;
+        F64 unbias = n > 1 ? (F64)n/(n - 1) : 1;
+        for (int c = 0; c < channels; ++c) {
+            bn_block->inv_std[c] = 1/sqrt(var[c] + bn->eps);
+            bn->running_mean[c] = (1 - bn->momentum)*bn->running_mean[c] + bn->momentum*bn_block->mean[c];
+            bn->running_var[c] = (1 - bn->momentum)*bn->running_var[c] + bn->momentum*var[c]*unbias;
+        }
+    } else {
+        for (int c = 0; c < channels; ++c) {
+            bn_block->mean[c] = bn->running_mean[c];
+            bn_block->inv_std[c] = 1/sqrt(bn->running_var[c] + bn->eps);
+        }
+    }
+    nn_batch_norm_normalize(batch_count, channels, plane_size, raw_inputs, bn_block->mean, bn_block->inv_std, raw_gamma, raw_beta, raw_out);
+    for (int i = 0; i < x_count; ++i) *block->outputs.values[i]->value = raw_out[i];
+
+    // Forward mode: the Jacobian of the normalization is symmetric, so the x part of the 
+    // tangent is the backward kernel applied to dx. Then add dgamma*x_hat + dbeta.
+    if (has_tangents) {
+        F64 *raw_tangents = push_array_no_zero(scratch.arena, F64, inputs.count);
+        F64 *unused_grads = push_array(scratch.arena, F64, 2*channels);
+        for (int i = 0; i < inputs.count; ++i) raw_tangents[i] = inputs.values[i]->tangent;
+        nn_batch_norm_backward(batch_count, channels, plane_size, raw_inputs, bn_block->mean, bn_block->inv_std, raw_gamma,
+                               bn_block->batch_statistics, raw_tangents, raw_out, unused_grads, unused_grads + channels);
+        F64 *tangent_out = push_array_no_zero(scratch.arena, F64, x_count);
+        nn_batch_norm_normalize(batch_count, channels, plane_size, raw_inputs, bn_block->mean, bn_block->inv_std, 
+                                raw_tangents + x_count, raw_tangents + x_count + channels, tangent_out);
+        for (int i = 0; i < x_count; ++i) block->outputs.values[i]->tangent = raw_out[i] + tangent_out[i];
+    }
+
+    scratch_end(scratch);
+    return block;
+}
+
+internal
+void nn_batch_norm_block_backward(AG_Block *block, F64 *input_grads) {
+    NN_BatchNormBlock *bn_block = block->user_data;
+    int x_count = block->outputs.count;
+    int channels = bn_block->channels;
+
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    F64 *raw_inputs = push_array_no_zero(scratch.arena, F64, block->inputs.count);
+    for (int i = 0; i < block->inputs.count; ++i) raw_inputs[i] = *block->inputs.values[i]->value;
+    F64 *out_grads = push_array_no_zero(scratch.arena, F64, x_count);
+    for (int i = 0; i < x_count; ++i) out_grads[i] = *block->outputs.values[i]->grad;
+
+    nn_batch_norm_backward(bn_block->batch_count, channels, bn_block->plane_size, raw_inputs, bn_block->mean, bn_block->inv_std, 
+                           raw_inputs + x_count, bn_block->batch_statistics, out_grads, 
+                           input_grads, input_grads + x_count, input_grads + x_count + channels);
+
+    scratch_end(scratch);
+}
+
+internal
+AG_ValueArray3D *nn_batch_norm2d_apply(Arena *value_arena, Arena *array_arena, NN_BatchNorm *bn, AG_ValueArray3D *xs, int batch_count) {
+    Arena *conflicts[] = {value_arena, array_arena};
+    ArenaTemp scratch = scratch_begin(conflicts, ArrayCount(conflicts));
+
+    Assert(xs[0].shape[0] == bn->channels);
+    int sample_count = ag_value_array3d_element_count(&xs[0]);
+    AG_Value **x = push_array_no_zero(scratch.arena, AG_Value*, (U64)batch_count*sample_count);
+    for (int b = 0; b < batch_count; ++b) ArrayCopy(x + (U64)b*sample_count, xs[b].values, sample_count);
+
+    AG_Block *block = nn_batch_norm_push_block(value_arena, bn, x, batch_count, xs[0].shape[1]*xs[0].shape[2]);
+
+    scratch_end(scratch);
+
+    AG_ValueArray3D *result = push_array(array_arena, AG_ValueArray3D, batch_count);
+    for (int b = 0; b < batch_count; ++b) {
+        result[b] = ag_push_null_value_array3d(array_arena, xs[b].shape[0], xs[b].shape[1], xs[b].shape[2]);
+        ArrayCopy(result[b].values, block->outputs.values + (U64)b*sample_count, sample_count);
+    }
+    return result;
+}
+
+internal
+AG_ValueArray *nn_batch_norm1d_apply(Arena *value_arena, Arena *array_arena, NN_BatchNorm *bn, AG_ValueArray *xs, int batch_count) {
+    Arena *conflicts[] = {value_arena, array_arena};
+    ArenaTemp scratch = scratch_begin(conflicts, ArrayCount(conflicts));
+
+    int channels = bn->channels;
+    Assert(xs[0].count == channels);
+    AG_Value **x = push_array_no_zero(scratch.arena, AG_Value*, (U64)batch_count*channels);
+    for (int b = 0; b < batch_count; ++b) ArrayCopy(x + (U64)b*channels, xs[b].values, channels);
+
+    AG_Block *block = nn_batch_norm_push_block(value_arena, bn, x, batch_count, 1);
+
+    scratch_end(scratch);
+
+    AG_ValueArray *result = push_array(array_arena, AG_ValueArray, batch_count);
+    for (int b = 0; b < batch_count; ++b) {
+        result[b].count = channels;
+        result[b].values = push_array(array_arena, AG_Value*, channels);
+        ArrayCopy(result[b].values, block->outputs.values + (U64)b*channels, channels);
+    }
+    return result;
+}
+
+internal
+void nn_conv2d_fold_batch_norm(NN_Conv2D *conv, NN_BatchNorm *bn) {
+    Assert(conv->out_channels == bn->channels && !conv->has_relu);
+    int weights_per_channel = ag_value_array4d_element_count(&conv->weights)/conv->out_channels;
+    for (int c = 0; c < conv->out_channels; ++c) {
+        // bn(y) = y*scale + (beta - running_mean*scale), and y is linear in (weights, bias)
+        F64 scale = *bn->gamma.values[c]->value/sqrt(bn->running_var[c] + bn->eps);
+        AG_Value **channel_weights = conv->weights.values + (U64)c*weights_per_channel;
+        for (int i = 0; i < weights_per_channel; ++i) *channel_weights[i]->value *= scale;
+        AG_Value *bias = conv->biases.values[c];
+        *bias->value = (*bias->value - bn->running_mean[c])*scale + *bn->beta.values[c]->value;
+    }
+}
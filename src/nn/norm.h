@@ -0,0 +1,75 @@
+#ifndef NORM_H
+#define NORM_H
+
+// Normalizes every channel over the batch (and, for 2D, over the spatial positions):
+// out = gamma*(x - mean)*inv_std + beta, with inv_std = 1/sqrt(var + eps).
+// In training mode mean/var are the batch statistics and the running statistics are updated
+// (each apply counts as one update), otherwise the running statistics are used.
+#define NN_BATCH_NORM_DEFAULT_EPS      1e-5
+#define NN_BATCH_NORM_DEFAULT_MOMENTUM 0.1
+
+typedef struct NN_BatchNorm NN_BatchNorm;
+struct NN_BatchNorm {
+    int channels;
+    F64 eps;
+    F64 momentum; // running = (1 - momentum)*running + momentum*batch
+    B32 is_training;
+
+    AG_ValueArray gamma;
+    AG_ValueArray beta;
+    F64 *running_mean;
+    F64 *running_var; // unbiased
+};
+
+// The user data of a batch norm's graph block
+typedef struct NN_BatchNormBlock NN_BatchNormBlock;
+struct NN_BatchNormBlock {
+    int batch_count;
+    int channels;
+    int plane_size;
+    B32 batch_statistics; // mean/inv_std depend on x (training mode)
+    F64 *mean;
+    F64 *inv_std;
+};
+
+internal NN_BatchNorm nn_make_batch_norm(Arena *arena, int channels);
+
+// [gamma..., beta...]
+internal AG_ValueArray nn_batch_norm_get_params(Arena *arena, NN_BatchNorm *bn);
+
+// ==================================
+// Kernels on raw [batch_count, channels, plane_size] buffers
+
+// Per-channel mean and (biased) variance in a single pass over x
+internal void nn_batch_norm_statistics(int batch_count, int channels, int plane_size, F64 *x, F64 *mean, F64 *var);
+
+internal void nn_batch_norm_normalize(int batch_count, int channels, int plane_size, F64 *x, F64 *mean, F64 *inv_std, F64 *gamma, F64 *beta, F64 *out);
+
+// x_grads is overwritten, gamma_grads/beta_grads are accumulated into. With batch_statistics, 
+// the grads flowing through mean/inv_std are included (both per-channel reductions are fused
+// into one pass over out_grads).
+internal void nn_batch_norm_backward(int batch_count, int channels, int plane_size, F64 *x, F64 *mean, F64 *inv_std, F64 *gamma, 
+                                     B32 batch_statistics, F64 *out_grads, F64 *x_grads, F64 *gamma_grads, F64 *beta_grads);
+
+// ==================================
+// Graph ops (one block each, see AG_Block)
+
+// xs are batch_count samples of shape [channels, h, w]. Returns batch_count arrays on array_arena.
+internal AG_ValueArray3D *nn_batch_norm2d_apply(Arena *value_arena, Arena *array_arena, NN_BatchNorm *bn, AG_ValueArray3D *xs, int batch_count);
+
+// xs are batch_count samples of shape [channels]. Returns batch_count arrays on array_arena.
+internal AG_ValueArray *nn_batch_norm1d_apply(Arena *value_arena, Arena *array_arena, NN_BatchNorm *bn, AG_ValueArray *xs, int batch_count);
+
+internal void nn_batch_norm_block_backward(AG_Block *block, F64 *input_grads);
+
+// Inference-time export: scales conv's weights and shifts its biases so that the conv alone
+// computes bn(conv(x)) with bn's running statistics. bn must be dropped from the model afterwards.
+internal void nn_conv2d_fold_batch_norm(NN_Conv2D *conv, NN_BatchNorm *bn);
+
+// ==================================
+// Private helpers
+
+// x is [batch_count, channels, plane_size], returns the block (outputs in the same order)
+internal AG_Block *nn_batch_norm_push_block(Arena *value_arena, NN_BatchNorm *bn, AG_Value **x, int batch_count, int plane_size);
+
+#endif
@@ -0,0 +1,85 @@
+internal
+B32 nn_plan_buffers_overlap_in_time(NN_PlanBuffer *a, NN_PlanBuffer *b) {
+    return a->first_use <= b->last_use && b->first_use <= a->last_use;
+}
+
+internal
+U64 nn_plan_aligned_size(U64 size) {
+    return (size + NN_PLAN_ALIGNMENT-1)/NN_PLAN_ALIGNMENT*NN_PLAN_ALIGNMENT;
+}
+
+internal
+NN_MemoryPlan nn_plan_memory(NN_PlanBuffer *buffers, int buffer_count) {
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    NN_MemoryPlan result = {0};
+
+    // Largest first (ties by index, so the plan is deterministic). Insertion sort, buffer counts 
+    // are in the tens.
+    int *order = push_array_no_zero(scratch.arena, int, buffer_count);
+    for (int i = 0; i < buffer_count; ++i) {
+        int j = i;
+        while (j > 0 && buffers[order[j-1]].size < buffers[i].size) {
+            order[j] = order[j-1];
+            --j;
+        }
+        order[j] = i;
+    }
+
+    // placed: buffers that already have an offset. conflicts: the placed buffers that are live 
+    // together with the one being placed.
+    int *placed = push_array_no_zero(scratch.arena, int, buffer_count);
+    int *conflicts = push_array_no_zero(scratch.arena, int, buffer_count);
+    int placed_count = 0;
+    for (int i = 0; i < buffer_count; ++i) {
+        NN_PlanBuffer *buffer = &buffers[order[i]];
+        U64 size = nn_plan_aligned_size(buffer->size);
+        result.unshared_size += size;
+        if (size == 0) {
+            buffer->offset = 0;
+            continue;
+        }
+
+        int conflict_count = 0;
+        for (int p = 0; p < placed_count; ++p) {
+            NN_PlanBuffer *other = &buffers[placed[p]];
+            if (nn_plan_buffers_overlap_in_time(buffer, other)) conflicts[conflict_count++] = placed[p];
+        }
+
+        // Lowest offset that fits: keep jumping past whichever conflict it collides with
+        U64 offset = 0;
+        for (B32 moved = 1; moved;) {
+            moved = 0;
+            for (int c = 0; c < conflict_count; ++c) {
+                NN_PlanBuffer *other = &buffers[conflicts[c]];
+                U64 other_end = other->offset + nn_plan_aligned_size(other->size);
+                if (offset < other_end && other->offset < offset + size) {
+                    offset = other_end;
+                    moved = 1;
+                }
+            }
+        }
+        buffer->offset = offset;
+        placed[placed_count++] = order[i];
+        result.workspace_size = MD_Max(result.workspace_size, offset + size);
+    }
+
+    // Lower bound
+    int first_step = 0, last_step = 0;
+    for (int i = 0; i < buffer_count; ++i) {
+        first_step = i == 0 ? buffers[i].first_use : MD_Min(first_step, buffers[i].first_use);
+        last_step = MD_Max(last_step, buffers[i].last_use);
+    }
+    for (int step = first_step; step <= last_step; ++step) {
+        U64 live = 0;
+        for (int i = 0; i < buffer_count; ++i) {
+            if (buffers[i].first_use <= step && step <= buffers[i].last_use) {
+                live += nn_plan_aligned_size(buffers[i].size);
+            }
+        }
+        result.live_peak = MD_Max(result.live_peak, live);
+    }
+
+    scratch_end(scratch);
+    return result;
+}
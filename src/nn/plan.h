@@ -0,0 +1,35 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+// Static memory planning: buffers with known sizes and lifetimes (in abstract steps, inclusive) 
+// get offsets in one workspace. Buffers whose lifetimes don't overlap may share memory.
+// Buffers are placed largest first, each at the lowest offset that doesn't collide with an 
+// already placed buffer it's live together with. Empty buffers aren't placed (offset 0).
+
+#define NN_PLAN_ALIGNMENT 8 // in elements, so every buffer starts on a 64-byte boundary (for F64s)
+
+typedef struct NN_PlanBuffer NN_PlanBuffer;
+struct NN_PlanBuffer {
+    U64 size;      // in elements
+    int first_use; // step that writes it first
+    int last_use;  // step that reads it last
+    U64 offset;    // in elements, filled in by nn_plan_memory
+};
+
+typedef struct NN_MemoryPlan NN_MemoryPlan;
+struct NN_MemoryPlan {
+    U64 workspace_size; // in elements
+    U64 unshared_size;  // what a separate allocation per buffer would take
+    U64 live_peak;      // largest total size of the buffers live at one step: no plan can go below it
+};
+
+internal NN_MemoryPlan nn_plan_memory(NN_PlanBuffer *buffers, int buffer_count);
+
+// ==================================
+// Private helpers
+
+internal B32 nn_plan_buffers_overlap_in_time(NN_PlanBuffer *a, NN_PlanBuffer *b);
+
+internal U64 nn_plan_aligned_size(U64 size);
+
+#endif
@@ -0,0 +1,302 @@
+internal
+NN_PoolShape nn_make_pool_shape(int channels, int in_h, int in_w, int kernel_size, int stride, int padding) {
+    Assert(padding < kernel_size && kernel_size*kernel_size <= 255);
+    NN_PoolShape result = {0};
+    result.channels = channels;
+    result.in_h = in_h;
+    result.in_w = in_w;
+    result.kernel_size = kernel_size;
+    result.stride = stride;
+    result.padding = padding;
+    result.out_h = (in_h + 2*padding - kernel_size)/stride + 1;
+    result.out_w = (in_w + 2*padding - kernel_size)/stride + 1;
+    return result;
+}
+
+internal
+void nn_pool_window(NN_PoolShape *shape, int oy, int ox, int *ky0, int *ky1, int *kx0, int *kx1) {
+    int iy0 = oy*shape->stride - shape->padding;
+    int ix0 = ox*shape->stride - shape->padding;
+    *ky0 = MD_Max(0, -iy0);
+    *ky1 = MD_Min(shape->kernel_size, shape->in_h - iy0);
+    *kx0 = MD_Max(0, -ix0);
+    *kx1 = MD_Min(shape->kernel_size, shape->in_w - ix0);
+}
+
+// ==================================
+// Kernels
+
+internal
+void nn_max_pool2d_forward(NN_PoolShape *shape, int batch_count, F64 *x, F64 *out, U8 *argmax) {
+    int k = shape->kernel_size;
+    int in_w = shape->in_w;
+    U64 in_plane = (U64)shape->in_h*in_w;
+    U64 out_plane = (U64)shape->out_h*shape->out_w;
+    for (U64 plane = 0; plane < (U64)batch_count*shape->channels; ++plane) {
+        F64 *x_plane = x + plane*in_plane;
+        F64 *out_plane_ptr = out + plane*out_plane;
+        U8 *argmax_plane = argmax + plane*out_plane;
+        for (int oy = 0; oy < shape->out_h; ++oy) {
+            for (int ox = 0; ox < shape->out_w; ++ox) {
+                int ky0, ky1, kx0, kx1;
+                nn_pool_window(shape, oy, ox, &ky0, &ky1, &kx0, &kx1);
+                F64 *x_window = x_plane + (I64)(oy*shape->stride - shape->padding)*in_w + (ox*shape->stride - shape->padding);
+                F64 best = x_window[(I64)ky0*in_w + kx0];
+                int best_tap = ky0*k + kx0;
+                for (int ky = ky0; ky < ky1; ++ky) {
+                    for (int kx = kx0; kx < kx1; ++kx) {
+                        F64 v = x_window[(I64)ky*in_w + kx];
+                        if (v > best) {
+                            best = v;
+                            best_tap = ky*k + kx;
+                        }
+                    }
+                }
+                out_plane_ptr[oy*shape->out_w + ox] = best;
+                argmax_plane[oy*shape->out_w + ox] = (U8)best_tap;
+            }
+        }
+    }
+}
+
+internal
+void nn_max_pool2d_backward(NN_PoolShape *shape, int batch_count, F64 *out_grads, U8 *argmax, F64 *x_grads) {
+    int k = shape->kernel_size;
+    U64 in_plane = (U64)shape->in_h*shape->in_w;
+    U64 out_plane = (U64)shape->out_h*shape->out_w;
+    MD_MemoryZero(x_grads, (U64)batch_count*shape->channels*in_plane*sizeof(F64));
+    for (U64 plane = 0; plane < (U64)batch_count*shape->channels; ++plane) {
+        F64 *x_grads_plane = x_grads + plane*in_plane;
+        F64 *out_grads_plane = out_grads + plane*out_plane;
+        U8 *argmax_plane = argmax + plane*out_plane;
+        for (int oy = 0; oy < shape->out_h; ++oy) {
+            for (int ox = 0; ox < shape->out_w; ++ox) {
+                int tap = argmax_plane[oy*shape->out_w + ox];
+                int iy = oy*shape->stride - shape->padding + tap/k;
+                int ix = ox*shape->stride - shape->padding + tap%k;
+                x_grads_plane[(U64)iy*shape->in_w + ix] += out_grads_plane[oy*shape->out_w + ox];
+            }
+        }
+    }
+}
+
+internal
+void nn_avg_pool2d_forward(NN_PoolShape *shape, int batch_count, F64 *x, F64 *out) {
+    int in_w = shape->in_w;
+    U64 in_plane = (U64)shape->in_h*in_w;
+    U64 out_plane = (U64)shape->out_h*shape->out_w;
+    for (U64 plane = 0; plane < (U64)batch_count*shape->channels; ++plane) {
+        F64 *x_plane = x + plane*in_plane;
+        F64 *out_plane_ptr = out + plane*out_plane;
+        for (int oy = 0; oy < shape->out_h; ++oy) {
+            for (int ox = 0; ox < shape->out_w; ++ox) {
+                int ky0, ky1, kx0, kx1;
+                nn_pool_window(shape, oy, ox, &ky0, &ky1, &kx0, &kx1);
+                F64 *x_window = x_plane + (I64)(oy*shape->stride - shape->padding)*in_w + (ox*shape->stride - shape->padding);
+                F64 sum = 0;
+                for (int ky = ky0; ky < ky1; ++ky) {
+                    for (int kx = kx0; kx < kx1; ++kx) sum += x_window[(I64)ky*in_w + kx];
+                }
+                out_plane_ptr[oy*shape->out_w + ox] = sum/((ky1-ky0)*(kx1-kx0));
+            }
+        }
+    }
+}
+
+internal
+void nn_avg_pool2d_backward(NN_PoolShape *shape, int batch_count, F64 *out_grads, F64 *x_grads) {
+    int in_w = shape->in_w;
+    U64 in_plane = (U64)shape->in_h*in_w;
+    U64 out_plane = (U64)shape->out_h*shape->out_w;
+    MD_MemoryZero(x_grads, (U64)batch_count*shape->channels*in_plane*sizeof(F64));
+    for (U64 plane = 0; plane < (U64)batch_count*shape->channels; ++plane) {
+        F64 *x_grads_plane = x_grads + plane*in_plane;
+        F64 *out_grads_plane = out_grads + plane*out_plane;
+        for (int oy = 0; oy < shape->out_h; ++oy) {
+            for (int ox = 0; ox < shape->out_w; ++ox) {
+                int ky0, ky1, kx0, kx1;
+                nn_pool_window(shape, oy, ox, &ky0, &ky1, &kx0, &kx1);
+                F64 *x_grads_window = x_grads_plane + (I64)(oy*shape->stride - shape->padding)*in_w + (ox*shape->stride - shape->padding);
+                F64 grad = out_grads_plane[oy*shape->out_w + ox]/((ky1-ky0)*(kx1-kx0));
+                for (int ky = ky0; ky < ky1; ++ky) {
+                    for (int kx = kx0; kx < kx1; ++kx) x_grads_window[(I64)ky*in_w + kx] += grad;
+                }
+            }
+        }
+    }
+}
+
+internal
+void nn_global_avg_pool_forward(int batch_count, int channels, int plane_size, F64 *x, F64 *out) {
+    for (U64 plane = 0; plane < (U64)batch_count*channels; ++plane) {
+        F64 *x_plane = x + plane*plane_size;
+        F64 sum = 0;
+        for (int i = 0; i < plane_size; ++i) sum += x_plane[i];
+        out[plane] = sum/plane_size;
+    }
+}
+
+internal
+void nn_global_avg_pool_backward(int batch_count, int channels, int plane_size, F64 *out_grads, F64 *x_grads) {
+    for (U64 plane = 0; plane < (U64)batch_count*channels; ++plane) {
+        F64 *x_grads_plane = x_grads + plane*plane_size;
+        F64 grad = out_grads[plane]/plane_size;
+        for (int i = 0; i < plane_size; ++i) x_grads_plane[i] = grad;
+    }
+}
+
+// ==================================
+// Graph ops
+
+internal
+NN_Pool2D nn_make_max_pool2d(int kernel_size, int stride, int padding) {
+    NN_Pool2D result = {0};
+    result.type = NN_PoolType_Max;
+    result.kernel_size = kernel_size;
+    result.stride = stride;
+    result.padding = padding;
+    return result;
+}
+
+internal
+NN_Pool2D nn_make_avg_pool2d(int kernel_size, int stride, int padding) {
+    NN_Pool2D result = nn_make_max_pool2d(kernel_size, stride, padding);
+    result.type = NN_PoolType_Avg;
+    return result;
+}
+
+internal
+int nn_pool2d_output_dim(NN_Pool2D *pool, int input_dim) {
+    return (input_dim + 2*pool->padding - pool->kernel_size)/pool->stride + 1;
+}
+
+internal
+AG_ValueArray3D nn_pool2d_apply(Arena *value_arena, Arena *array_arena, NN_Pool2D *pool, AG_ValueArray3D *x) {
+    Arena *conflicts[] = {value_arena, array_arena};
+    ArenaTemp scratch = scratch_begin(conflicts, ArrayCount(conflicts));
+
+    // The block description (and the argmax) is read again during backward, so it lives in value_arena
+    NN_Pool2DBlock *pool_block = push_array(value_arena, NN_Pool2DBlock, 1);
+    pool_block->shape = nn_make_pool_shape(x->shape[0], x->shape[1], x->shape[2], pool->kernel_size, pool->stride, pool->padding);
+    pool_block->type = pool->type;
+    NN_PoolShape *shape = &pool_block->shape;
+
+    int x_count = ag_value_array3d_element_count(x);
+    int out_count = shape->channels*shape->out_h*shape->out_w;
+    AG_ValueArray inputs = {0};
+    inputs.values = x->values;
+    inputs.count = x_count;
+    AG_Block *block = ag_push_block(value_arena, inputs, out_count, nn_pool2d_block_backward, pool_block);
+
+    F64 *raw_x = push_array_no_zero(scratch.arena, F64, x_count);
+    F64 *raw_out = push_array_no_zero(scratch.arena, F64, out_count);
+    B32 has_tangents = 0;
+    for (int i = 0; i < x_count; ++i) {
+        raw_x[i] = *x->values[i]->value;
+        if (x->values[i]->tangent != 0) has_tangents = 1;
+    }
+
+    if (pool->type == NN_PoolType_Max) {
+        pool_block->argmax = push_array_no_zero(value_arena, U8, out_count);
+        nn_max_pool2d_forward(shape, 1, raw_x, raw_out, pool_block->argmax);
+    } else {
+        nn_avg_pool2d_forward(shape, 1, raw_x, raw_out);
+    }
+    for (int i = 0; i < out_count; ++i) *block->outputs.values[i]->value = raw_out[i];
+
+    // Forward mode: the tangent of the window's max, or the window's average tangent
+    if (has_tangents) {
+        for (int i = 0; i < x_count; ++i) raw_x[i] = x->values[i]->tangent;
+        if (pool->type == NN_PoolType_Max) {
+            int k = shape->kernel_size;
+            for (int i = 0; i < out_count; ++i) {
+                int c = i/(shape->out_h*shape->out_w);
+                int oy = (i/shape->out_w)%shape->out_h;
+                int ox = i%shape->out_w;
+                int tap = pool_block->argmax[i];
+                int iy = oy*shape->stride - shape->padding + tap/k;
+                int ix = ox*shape->stride - shape->padding + tap%k;
+                block->outputs.values[i]->tangent = raw_x[((U64)c*shape->in_h + iy)*shape->in_w + ix];
+            }
+        } else {
+            nn_avg_pool2d_forward(shape, 1, raw_x, raw_out);
+            for (int i = 0; i < out_count; ++i) block->outputs.values[i]->tangent = raw_out[i];
+        }
+    }
+
+    scratch_end(scratch);
+
+    AG_ValueArray3D result = ag_push_null_value_array3d(array_arena, shape->channels, shape->out_h, shape->out_w);
+    ArrayCopy(result.values, block->outputs.values, out_count);
+    return result;
+}
+
+internal
+void nn_pool2d_block_backward(AG_Block *block, F64 *input_grads) {
+    NN_Pool2DBlock *pool_block = block->user_data;
+
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    F64 *out_grads = push_array_no_zero(scratch.arena, F64, block->outputs.count);
+    for (int i = 0; i < block->outputs.count; ++i) out_grads[i] = *block->outputs.values[i]->grad;
+
+    if (pool_block->type == NN_PoolType_Max) {
+        nn_max_pool2d_backward(&pool_block->shape, 1, out_grads, pool_block->argmax, input_grads);
+    } else {
+        nn_avg_pool2d_backward(&pool_block->shape, 1, out_grads, input_grads);
+    }
+
+    scratch_end(scratch);
+}
+
+internal
+AG_ValueArray nn_gap(Arena *value_arena, Arena *array_arena, AG_ValueArray3D *x) {
+    Arena *conflicts[] = {value_arena, array_arena};
+    ArenaTemp scratch = scratch_begin(conflicts, ArrayCount(conflicts));
+
+    int channels = x->shape[0];
+    int plane_size = x->shape[1]*x->shape[2];
+    AG_ValueArray inputs = {0};
+    inputs.values = x->values;
+    inputs.count = channels*plane_size;
+
+    // The plane size is all the backward pass needs, so it's stored as the user data
+    AG_Block *block = ag_push_block(value_arena, inputs, channels, nn_gap_block_backward, (void *)(U64)plane_size);
+
+    F64 *raw_x = push_array_no_zero(scratch.arena, F64, inputs.count);
+    F64 *raw_out = push_array_no_zero(scratch.arena, F64, channels);
+    B32 has_tangents = 0;
+    for (int i = 0; i < inputs.count; ++i) {
+        raw_x[i] = *x->values[i]->value;
+        if (x->values[i]->tangent != 0) has_tangents = 1;
+    }
+    nn_global_avg_pool_forward(1, channels, plane_size, raw_x, raw_out);
+    for (int c = 0; c < channels; ++c) *block->outputs.values[c]->value = raw_out[c];
+
+    // Forward mode: the pool is linear
+    if (has_tangents) {
+        for (int i = 0; i < inputs.count; ++i) raw_x[i] = x->values[i]->tangent;
+        nn_global_avg_pool_forward(1, channels, plane_size, raw_x, raw_out);
+        for (int c = 0; c < channels; ++c) block->outputs.values[c]->tangent = raw_out[c];
+    }
+
+    scratch_end(scratch);
+
+    AG_ValueArray result = {0};
+    result.count = channels;
+    result.values = push_array(array_arena, AG_Value*, channels);
+    ArrayCopy(result.values, block->outputs.values, channels);
+    return result;
+}
+
+internal
+void nn_gap_block_backward(AG_Block *block, F64 *input_grads) {
+    int plane_size = (int)(U64)block->user_data;
+    int channels = block->outputs.count;
+
+    ArenaTemp scratch = scratch_begin(0,0);
+    F64 *out_grads = push_array_no_zero(scratch.arena, F64, channels);
+    for (int c = 0; c < channels; ++c) out_grads[c] = *block->outputs.values[c]->grad;
+    nn_global_avg_pool_backward(1, channels, plane_size, out_grads, input_grads);
+    scratch_end(scratch);
+}
@@ -0,0 +1,84 @@
+#ifndef POOL_H
+#define POOL_H
+
+typedef enum NN_PoolType {
+    NN_PoolType_Max,
+    NN_PoolType_Avg, // averages over the window's in-image elements (padding isn't counted)
+} NN_PoolType;
+
+typedef struct NN_PoolShape NN_PoolShape;
+struct NN_PoolShape {
+    int channels;
+    int in_h, in_w;
+    int out_h, out_w;
+    int kernel_size;
+    int stride;
+    int padding; // must be < kernel_size, so every window sees at least one input
+};
+
+typedef struct NN_Pool2D NN_Pool2D;
+struct NN_Pool2D {
+    NN_PoolType type;
+    int kernel_size;
+    int stride;
+    int padding;
+};
+
+// The user data of a pooling op's graph block
+typedef struct NN_Pool2DBlock NN_Pool2DBlock;
+struct NN_Pool2DBlock {
+    NN_PoolShape shape;
+    NN_PoolType type;
+    U8 *argmax; // Max only
+};
+
+internal NN_PoolShape nn_make_pool_shape(int channels, int in_h, int in_w, int kernel_size, int stride, int padding);
+
+// ==================================
+// Kernels on raw [batch_count, channels, h, w] buffers
+//
+// NOTE: Max pooling stores the argmax of every window as its index inside the window 
+//       (ky*kernel_size + kx), one byte per output, so the backward pass is a scatter that never
+//       looks at the input again.
+
+internal void nn_max_pool2d_forward(NN_PoolShape *shape, int batch_count, F64 *x, F64 *out, U8 *argmax);
+
+// x_grads is overwritten
+internal void nn_max_pool2d_backward(NN_PoolShape *shape, int batch_count, F64 *out_grads, U8 *argmax, F64 *x_grads);
+
+internal void nn_avg_pool2d_forward(NN_PoolShape *shape, int batch_count, F64 *x, F64 *out);
+
+// x_grads is overwritten
+internal void nn_avg_pool2d_backward(NN_PoolShape *shape, int batch_count, F64 *out_grads, F64 *x_grads);
+
+// out [batch_count, channels] = mean over each channel's plane
+internal void nn_global_avg_pool_forward(int batch_count, int channels, int plane_size, F64 *x, F64 *out);
+
+// x_grads is overwritten
+internal void nn_global_avg_pool_backward(int batch_count, int channels, int plane_size, F64 *out_grads, F64 *x_grads);
+
+// ==================================
+// Graph ops (one block each, see AG_Block)
+
+internal NN_Pool2D nn_make_max_pool2d(int kernel_size, int stride, int padding);
+
+internal NN_Pool2D nn_make_avg_pool2d(int kernel_size, int stride, int padding);
+
+internal int nn_pool2d_output_dim(NN_Pool2D *pool, int input_dim);
+
+internal AG_ValueArray3D nn_pool2d_apply(Arena *value_arena, Arena *array_arena, NN_Pool2D *pool, AG_ValueArray3D *x);
+
+internal void nn_pool2d_block_backward(AG_Block *block, F64 *input_grads);
+
+// Global average pool: [channels, h, w] -> [channels]
+internal AG_ValueArray nn_gap(Arena *value_arena, Arena *array_arena, AG_ValueArray3D *x);
+
+internal void nn_gap_block_backward(AG_Block *block, F64 *input_grads);
+
+// ==================================
+// Private helpers
+
+// Clips the window of output (oy, ox) to the input: taps [ky0,ky1) x [kx0,kx1)
+internal void nn_pool_window(NN_PoolShape *shape, int oy, int ox, int *ky0, int *ky1, int *kx0, int *kx1);
+
+#endif
@@ -0,0 +1,459 @@
+// ==================================
+// Calibration
+
+internal
+NN_Calibration nn_make_calibration(Arena *arena, int count) {
+    NN_Calibration result = {0};
+    result.count = count;
+    result.abs_maxes = push_array(arena, F32, count);
+    return result;
+}
+
+internal
+void nn_calibration_observe(NN_Calibration *calibration, int point, U64 count, F64 *values) {
+    Assert(point < calibration->count);
+    F64 abs_max = calibration->abs_maxes[point];
+    for (U64 i = 0; i < count; ++i) abs_max = MD_Max(abs_max, fabs(values[i]));
+    calibration->abs_maxes[point] = (F32)abs_max;
+}
+
+internal
+void nn_calibrate_mlp(NN_Calibration *calibration, NN_MLP *mlp, F64 *x, int batch_count, TP_ThreadPool *pool) {
+    Assert(calibration->count == mlp->layer_count);
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    NN_MLPBatch batch = nn_mlp_apply_batch(scratch.arena, mlp, x, batch_count, pool);
+    for (int l = 0; l < mlp->layer_count; ++l) {
+        nn_calibration_observe(calibration, l, (U64)batch_count*batch.dims[l], batch.activations[l]);
+    }
+
+    scratch_end(scratch);
+}
+
+internal
+void nn_calibrate_small_cnn(NN_Calibration *calibration, NN_SmallCNN *cnn, F64 *x, int batch_count, int in_h, int in_w, TP_ThreadPool *pool) {
+    Assert(calibration->count == NN_SMALL_CNN_CALIBRATION_COUNT);
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    NN_SmallCNNBatch batch = nn_small_cnn_apply_batch(scratch.arena, cnn, x, batch_count, in_h, in_w, pool);
+    nn_calibration_observe(calibration, 0, (U64)batch_count*in_h*in_w, x);
+    for (int i = 0; i < ArrayCount(batch.conv_shapes); ++i) {
+        NN_ConvShape *shape = &batch.conv_shapes[i];
+        nn_calibration_observe(calibration, 1+i, (U64)batch_count*shape->out_channels*shape->out_h*shape->out_w, batch.conv_outputs[i]);
+    }
+    nn_calibration_observe(calibration, 3, (U64)batch_count*batch.pool_shapes[1].channels, batch.features);
+
+    scratch_end(scratch);
+}
+
+internal
+F32 nn_activation_scale(F32 abs_max) {
+    // An all-zero tensor quantizes to zeros with any scale
+    return abs_max > 0 ? abs_max/127 : 1;
+}
+
+// ==================================
+// Quantization
+
+internal
+NN_QuantizedWeights nn_quantize_weights(Arena *arena, int out_count, int in_count, F64 *weights, int weight_stride, F64 *biases, int bias_stride) {
+    NN_QuantizedWeights result = {0};
+    result.out_count = out_count;
+    result.in_count = in_count;
+    result.in_stride = (in_count + NN_QUANT_ROW_ALIGN-1)/NN_QUANT_ROW_ALIGN*NN_QUANT_ROW_ALIGN;
+    MD_ArenaPushAlign(arena, 64);
+    result.values = push_array(arena, I8, (U64)out_count*result.in_stride);
+    result.scales = push_array(arena, F32, out_count);
+    result.biases = push_array(arena, F32, out_count);
+
+    for (int o = 0; o < out_count; ++o) {
+        F64 *w_row = weights + (U64)o*weight_stride;
+        F64 abs_max = 0;
+        for (int i = 0; i < in_count; ++i) abs_max = MD_Max(abs_max, fabs(w_row[i]));
+        F32 scale = nn_activation_scale((F32)abs_max);
+        F32 inv_scale = 1/scale;
+        I8 *q_row = result.values + (U64)o*result.in_stride;
+        for (int i = 0; i < in_count; ++i) q_row[i] = nn_quantize_value((F32)w_row[i], inv_scale);
+        result.scales[o] = scale;
+        if (biases) result.biases[o] = (F32)biases[(U64)o*bias_stride];
+    }
+    return result;
+}
+
+internal
+NN_QuantizedLayer nn_quantize_dense_params(Arena *arena, int in_dim, int out_dim, F64 *params, B32 has_relu, F32 input_abs_max) {
+    NN_QuantizedLayer result = {0};
+    result.weights = nn_quantize_weights(arena, out_dim, in_dim, params, in_dim+1, params + in_dim, in_dim+1);
+    result.input_scale = nn_activation_scale(input_abs_max);
+    result.has_relu = has_relu;
+    return result;
+}
+
+internal
+NN_QuantizedConv2D nn_quantize_conv2d_params(Arena *arena, NN_ConvShape *shape, F64 *weights, F64 *biases, B32 has_relu, F32 input_abs_max) {
+    NN_QuantizedConv2D result = {0};
+    result.shape = *shape;
+    int group_in_count = shape->in_channels/shape->groups*shape->kernel_size*shape->kernel_size;
+    result.weights = nn_quantize_weights(arena, shape->out_channels, group_in_count, weights, group_in_count, biases, 1);
+    result.input_scale = nn_activation_scale(input_abs_max);
+    result.has_relu = has_relu;
+    return result;
+}
+
+internal
+NN_QuantizedLayer nn_quantize_layer(Arena *arena, NN_Layer *layer, F32 input_abs_max) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    int in_dim = layer->neurons[0].weights.count;
+    int out_dim = layer->neuron_count;
+    F64 *params = push_array_no_zero(scratch.arena, F64, (U64)out_dim*(in_dim+1));
+    for (int o = 0; o < out_dim; ++o) {
+        NN_Neuron *neuron = &layer->neurons[o];
+        F64 *row = params + (U64)o*(in_dim+1);
+        for (int i = 0; i < in_dim; ++i) row[i] = *neuron->weights.values[i]->value;
+        row[in_dim] = *neuron->bias->value;
+    }
+    NN_QuantizedLayer result = nn_quantize_dense_params(arena, in_dim, out_dim, params, layer->neurons[0].has_relu, input_abs_max);
+
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+NN_QuantizedConv2D nn_quantize_conv2d(Arena *arena, NN_Conv2D *conv2d, int in_h, int in_w, F32 input_abs_max) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    NN_ConvShape shape = nn_make_grouped_conv_shape(conv2d->in_channels, in_h, in_w, conv2d->out_channels,
+                                                    conv2d->kernel_size, conv2d->stride, conv2d->padding, MD_Max(conv2d->groups, 1));
+    int weight_count = ag_value_array4d_element_count(&conv2d->weights);
+    F64 *weights = push_array_no_zero(scratch.arena, F64, weight_count);
+    for (int i = 0; i < weight_count; ++i) weights[i] = *conv2d->weights.values[i]->value;
+    F64 *biases = 0;
+    if (conv2d->biases.count) {
+        biases = push_array_no_zero(scratch.arena, F64, conv2d->biases.count);
+        for (int i = 0; i < conv2d->biases.count; ++i) biases[i] = *conv2d->biases.values[i]->value;
+    }
+    NN_QuantizedConv2D result = nn_quantize_conv2d_params(arena, &shape, weights, biases, conv2d->has_relu, input_abs_max);
+
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+NN_QuantizedMLP nn_quantize_mlp(Arena *arena, NN_MLP *mlp, NN_Calibration *calibration) {
+    Assert(calibration->count == mlp->layer_count);
+    NN_QuantizedMLP result = {0};
+    result.layer_count = mlp->layer_count;
+    result.layers = push_array(arena, NN_QuantizedLayer, mlp->layer_count);
+
+    F64 *layer_params = mlp->params.values;
+    for (int l = 0; l < mlp->layer_count; ++l) {
+        NN_Layer *layer = &mlp->layers[l];
+        int in_dim = layer->neurons[0].weights.count;
+        int out_dim = layer->neuron_count;
+        result.layers[l] = nn_quantize_dense_params(arena, in_dim, out_dim, layer_params, layer->neurons[0].has_relu, calibration->abs_maxes[l]);
+        layer_params += (U64)out_dim*(in_dim+1);
+    }
+    return result;
+}
+
+internal
+NN_QuantizedSmallCNN nn_quantize_small_cnn(Arena *arena, NN_SmallCNN *cnn, int in_h, int in_w, NN_Calibration *calibration) {
+    Assert(calibration->count == NN_SMALL_CNN_CALIBRATION_COUNT);
+    NN_QuantizedSmallCNN result = {0};
+
+    // Same walk over the params block as nn_small_cnn_apply_batch
+    F64 *params = cnn->params.values;
+    int channels = 1;
+    int h = in_h, w = in_w;
+    for (int i = 0; i < ArrayCount(cnn->convs); ++i) {
+        NN_Conv2D *conv = &cnn->convs[i];
+        NN_ConvShape shape = nn_make_grouped_conv_shape(channels, h, w, conv->out_channels, conv->kernel_size, conv->stride, conv->padding, MD_Max(conv->groups, 1));
+        F64 *weights = params;
+        params += ag_value_array4d_element_count(&conv->weights);
+        F64 *biases = conv->biases.count ? params : 0;
+        params += conv->biases.count;
+        result.convs[i] = nn_quantize_conv2d_params(arena, &shape, weights, biases, conv->has_relu, calibration->abs_maxes[i]);
+
+        NN_Pool2D *pool2d = &cnn->pools[i];
+        Assert(pool2d->type == NN_PoolType_Max);
+        result.pool_shapes[i] = nn_make_pool_shape(shape.out_channels, shape.out_h, shape.out_w, pool2d->kernel_size, pool2d->stride, pool2d->padding);
+        channels = shape.out_channels;
+        h = result.pool_shapes[i].out_h;
+        w = result.pool_shapes[i].out_w;
+    }
+    result.feature_map_scale = nn_activation_scale(calibration->abs_maxes[ArrayCount(cnn->convs)]);
+    result.fc = nn_quantize_dense_params(arena, channels, cnn->fc.neuron_count, params, 0, calibration->abs_maxes[ArrayCount(cnn->convs)+1]);
+
+    return result;
+}
+
+// ==================================
+// Kernels
+
+internal
+I8 nn_quantize_value(F32 x, F32 inv_scale) {
+    F32 q = x*inv_scale;
+    q = MD_Min(MD_Max(q, -127.f), 127.f);
+    // Round half up, without a branch or a libm call: the shifted value is positive, so the
+    // truncating cast floors it
+    return (I8)((int)(q + 128.5f) - 128);
+}
+
+internal
+void nn_quantize_rows(int row_count, int col_count, F64 *x, int x_stride, F32 scale, I8 *out, int out_stride) {
+    F32 inv_scale = 1/scale;
+    for (int r = 0; r < row_count; ++r) {
+        F64 *x_row = x + (U64)r*x_stride;
+        I8 *out_row = out + (U64)r*out_stride;
+        for (int c = 0; c < col_count; ++c) out_row[c] = nn_quantize_value((F32)x_row[c], inv_scale);
+        for (int c = col_count; c < out_stride; ++c) out_row[c] = 0;
+    }
+}
+
+internal
+void nn_quantized_layer_forward(NN_QuantizedLayer *layer, int batch_count, I8 *x, F32 output_scale, I8 *out, int out_stride, F32 *out_f32, TP_ThreadPool *pool) {
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    NN_QuantizedWeights *weights = &layer->weights;
+    int out_count = weights->out_count;
+    I32 *acc = push_array_no_zero(scratch.arena, I32, (U64)batch_count*out_count);
+    la_gemm_s8(pool, batch_count, out_count, weights->in_stride, x, weights->in_stride, weights->values, weights->in_stride, acc, out_count);
+
+    // Requantize: one combined scale per output channel
+    F32 *acc_scales = push_array_no_zero(scratch.arena, F32, out_count);
+    for (int o = 0; o < out_count; ++o) acc_scales[o] = layer->input_scale*weights->scales[o];
+    F32 inv_output_scale = out ? 1/output_scale : 0;
+    for (int n = 0; n < batch_count; ++n) {
+        I32 *acc_row = acc + (U64)n*out_count;
+        if (out) {
+            I8 *out_row = out + (U64)n*out_stride;
+            nn_requantize(out_count, acc_row, acc_scales, weights->biases, 1, layer->has_relu, inv_output_scale, out_row, 0);
+            for (int o = out_count; o < out_stride; ++o) out_row[o] = 0;
+        } else {
+            nn_requantize(out_count, acc_row, acc_scales, weights->biases, 1, layer->has_relu, 0, 0, out_f32 + (U64)n*out_count);
+        }
+    }
+
+    scratch_end(scratch);
+}
+
+internal
+void nn_quantized_conv2d_forward(NN_QuantizedConv2D *conv, int batch_count, I8 *x, F32 output_scale, I8 *out, F32 *out_f32, TP_ThreadPool *pool) {
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    NN_QuantizedConvJob job = {0};
+    job.conv = conv;
+    job.x = x;
+    job.out = out;
+    job.out_f32 = out_f32;
+    job.inv_output_scale = out ? 1/output_scale : 0;
+    job.acc_scales = push_array_no_zero(scratch.arena, F32, conv->shape.out_channels);
+    for (int o = 0; o < conv->shape.out_channels; ++o) job.acc_scales[o] = conv->input_scale*conv->weights.scales[o];
+    tp_parallel_for(pool, batch_count, nn_quantized_conv2d_image_task, &job);
+
+    scratch_end(scratch);
+}
+
+internal
+void nn_max_pool2d_forward_s8(NN_PoolShape *shape, int batch_count, I8 *x, I8 *out) {
+    int in_w = shape->in_w;
+    U64 in_plane = (U64)shape->in_h*in_w;
+    U64 out_plane = (U64)shape->out_h*shape->out_w;
+    for (U64 plane = 0; plane < (U64)batch_count*shape->channels; ++plane) {
+        I8 *x_plane = x + plane*in_plane;
+        I8 *out_plane_ptr = out + plane*out_plane;
+        for (int oy = 0; oy < shape->out_h; ++oy) {
+            for (int ox = 0; ox < shape->out_w; ++ox) {
+                int ky0, ky1, kx0, kx1;
+                nn_pool_window(shape, oy, ox, &ky0, &ky1, &kx0, &kx1);
+                I8 *x_window = x_plane + (I64)(oy*shape->stride - shape->padding)*in_w + (ox*shape->stride - shape->padding);
+                I8 best = x_window[(I64)ky0*in_w + kx0];
+                for (int ky = ky0; ky < ky1; ++ky) {
+                    for (int kx = kx0; kx < kx1; ++kx) best = MD_Max(best, x_window[(I64)ky*in_w + kx]);
+                }
+                out_plane_ptr[oy*shape->out_w + ox] = best;
+            }
+        }
+    }
+}
+
+internal
+F32 *nn_quantized_mlp_apply(Arena *arena, NN_QuantizedMLP *mlp, F64 *x, int batch_count, TP_ThreadPool *pool) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    NN_QuantizedLayer *first = &mlp->layers[0];
+    I8 *cur = push_array_no_zero(scratch.arena, I8, (U64)batch_count*first->weights.in_stride);
+    nn_quantize_rows(batch_count, first->weights.in_count, x, first->weights.in_count, first->input_scale, cur, first->weights.in_stride);
+
+    F32 *result = 0;
+    for (int l = 0; l < mlp->layer_count; ++l) {
+        NN_QuantizedLayer *layer = &mlp->layers[l];
+        if (l+1 < mlp->layer_count) {
+            NN_QuantizedLayer *next = &mlp->layers[l+1];
+            I8 *out = push_array_no_zero(scratch.arena, I8, (U64)batch_count*next->weights.in_stride);
+            nn_quantized_layer_forward(layer, batch_count, cur, next->input_scale, out, next->weights.in_stride, 0, pool);
+            cur = out;
+        } else {
+            result = push_array_no_zero(arena, F32, (U64)batch_count*layer->weights.out_count);
+            nn_quantized_layer_forward(layer, batch_count, cur, 0, 0, 0, result, pool);
+        }
+    }
+
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+F32 *nn_quantized_small_cnn_apply(Arena *arena, NN_QuantizedSmallCNN *cnn, F64 *x, int batch_count, TP_ThreadPool *pool) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    NN_ConvShape *first_shape = &cnn->convs[0].shape;
+    U64 x_count = (U64)batch_count*first_shape->in_channels*first_shape->in_h*first_shape->in_w;
+    I8 *cur = push_array_no_zero(scratch.arena, I8, x_count);
+    nn_quantize_rows(1, (int)x_count, x, 0, cnn->convs[0].input_scale, cur, (int)x_count);
+
+    for (int i = 0; i < ArrayCount(cnn->convs); ++i) {
+        NN_QuantizedConv2D *conv = &cnn->convs[i];
+        NN_ConvShape *shape = &conv->shape;
+        // A conv's output is in the scale of whatever reads it next (pooling keeps the scale)
+        F32 output_scale = i+1 < ArrayCount(cnn->convs) ? cnn->convs[i+1].input_scale : cnn->feature_map_scale;
+        I8 *y = push_array_no_zero(scratch.arena, I8, (U64)batch_count*shape->out_channels*shape->out_h*shape->out_w);
+        nn_quantized_conv2d_forward(conv, batch_count, cur, output_scale, y, 0, pool);
+
+        NN_PoolShape *pool_shape = &cnn->pool_shapes[i];
+        I8 *pooled = push_array_no_zero(scratch.arena, I8, (U64)batch_count*pool_shape->channels*pool_shape->out_h*pool_shape->out_w);
+        nn_max_pool2d_forward_s8(pool_shape, batch_count, y, pooled);
+        cur = pooled;
+    }
+
+    // Global average pool in int32, requantized straight into the fc input rows
+    NN_PoolShape *last_pool = &cnn->pool_shapes[ArrayCount(cnn->pool_shapes)-1];
+    int channels = last_pool->channels;
+    int plane_size = last_pool->out_h*last_pool->out_w;
+    int in_stride = cnn->fc.weights.in_stride;
+    I8 *features = push_array(scratch.arena, I8, (U64)batch_count*in_stride);
+    F32 feature_scale = cnn->feature_map_scale/plane_size;
+    F32 inv_fc_scale = 1/cnn->fc.input_scale;
+    for (int n = 0; n < batch_count; ++n) {
+        for (int c = 0; c < channels; ++c) {
+            I8 *plane = cur + ((U64)n*channels + c)*plane_size;
+            I32 sum = 0;
+            for (int i = 0; i < plane_size; ++i) sum += plane[i];
+            features[(U64)n*in_stride + c] = nn_quantize_value(sum*feature_scale, inv_fc_scale);
+        }
+    }
+
+    F32 *result = push_array_no_zero(arena, F32, (U64)batch_count*cnn->fc.weights.out_count);
+    nn_quantized_layer_forward(&cnn->fc, batch_count, features, 0, 0, 0, result, pool);
+
+    scratch_end(scratch);
+    return result;
+}
+
+// ==================================
+// Private helpers
+
+internal
+void nn_requantize(int count, I32 *acc, F32 *acc_scales, F32 *biases, int param_stride, B32 has_relu, F32 inv_output_scale, I8 *out, F32 *out_f32) {
+    int i = 0;
+#if NN_SSE2
+    // 8 at a time: the same math as nn_quantize_value, then I32 -> I16 -> I8 with saturating packs
+    __m128 inv_scale = _mm_set1_ps(inv_output_scale);
+    __m128 q_min = _mm_set1_ps(-127.f), q_max = _mm_set1_ps(127.f);
+    __m128 shift = _mm_set1_ps(128.5f);
+    __m128i shift_back = _mm_set1_epi32(128);
+    for (; i + 8 <= count; i += 8) {
+        __m128i q[2];
+        for (int h = 0; h < 2; ++h) {
+            int o = i + 4*h;
+            __m128 scales = param_stride ? _mm_loadu_ps(acc_scales + o) : _mm_set1_ps(acc_scales[0]);
+            __m128 bias = param_stride ? _mm_loadu_ps(biases + o) : _mm_set1_ps(biases[0]);
+            __m128 y = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((__m128i *)(acc + o))), scales), bias);
+            if (has_relu) y = _mm_max_ps(y, _mm_setzero_ps());
+            if (out) {
+                __m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(y, inv_scale), q_min), q_max);
+                q[h] = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(v, shift)), shift_back);
+            } else {
+                _mm_storeu_ps(out_f32 + o, y);
+            }
+        }
+        if (out) _mm_storel_epi64((__m128i *)(out + i), _mm_packs_epi16(_mm_packs_epi32(q[0], q[1]), _mm_setzero_si128()));
+    }
+#endif
+    for (; i < count; ++i) {
+        F32 y = acc[i]*acc_scales[i*param_stride] + biases[i*param_stride];
+        if (has_relu) y = MD_Max(y, 0);
+        if (out) out[i] = nn_quantize_value(y, inv_output_scale);
+        else     out_f32[i] = y;
+    }
+}
+
+// One image: per group, acc [group_out_channels, out_h*out_w] = W_g * rows^T, so every output
+// channel is requantized as one contiguous run
+internal
+void nn_quantized_conv2d_image_task(void *user_data, int task_idx, int thread_idx) {
+    NN_QuantizedConvJob *job = user_data;
+    NN_QuantizedConv2D *conv = job->conv;
+    NN_ConvShape *shape = &conv->shape;
+    NN_QuantizedWeights *weights = &conv->weights;
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    int group_in_channels = shape->in_channels/shape->groups;
+    int group_out_channels = shape->out_channels/shape->groups;
+    int pixel_count = shape->out_h*shape->out_w;
+    int row_stride = weights->in_stride;
+    int n = task_idx;
+
+    // The padding of the rows past in_count is never written, so it stays zero
+    MD_ArenaPushAlign(scratch.arena, 64);
+    I8 *rows = push_array(scratch.arena, I8, (U64)pixel_count*row_stride);
+    I32 *acc = push_array_no_zero(scratch.arena, I32, (U64)group_out_channels*pixel_count);
+
+    I8 *x_image = job->x + (U64)n*shape->in_channels*shape->in_h*shape->in_w;
+    U64 out_image_offset = (U64)n*shape->out_channels*pixel_count;
+    for (int g = 0; g < shape->groups; ++g) {
+        nn_im2row_s8(shape, x_image + (U64)g*group_in_channels*shape->in_h*shape->in_w, rows, row_stride);
+        I8 *group_weights = weights->values + (U64)g*group_out_channels*row_stride;
+        la_gemm_s8(0, group_out_channels, pixel_count, row_stride, group_weights, row_stride, rows, row_stride, acc, pixel_count);
+
+        for (int oc = 0; oc < group_out_channels; ++oc) {
+            int o = g*group_out_channels + oc;
+            U64 out_offset = out_image_offset + (U64)o*pixel_count;
+            nn_requantize(pixel_count, acc + (U64)oc*pixel_count, &job->acc_scales[o], &weights->biases[o], 0, conv->has_relu, job->inv_output_scale,
+                          job->out ? job->out + out_offset : 0, job->out ? 0 : job->out_f32 + out_offset);
+        }
+    }
+
+    scratch_end(scratch);
+}
+
+internal
+void nn_im2row_s8(NN_ConvShape *shape, I8 *x, I8 *rows, int row_stride) {
+    int k = shape->kernel_size;
+    int group_in_channels = shape->in_channels/shape->groups;
+    for (int oy = 0; oy < shape->out_h; ++oy) {
+        int iy0 = oy*shape->stride - shape->padding;
+        for (int ox = 0; ox < shape->out_w; ++ox) {
+            I8 *row = rows + (U64)(oy*shape->out_w + ox)*row_stride;
+            int ix0 = ox*shape->stride - shape->padding;
+            // The taps [kx0, kx1) of every kernel row are inside the image
+            int kx0 = MD_Max(0, -ix0);
+            int kx1 = MD_Min(k, shape->in_w - ix0);
+            for (int c = 0; c < group_in_channels; ++c) {
+                I8 *x_plane = x + (U64)c*shape->in_h*shape->in_w;
+                for (int ky = 0; ky < k; ++ky, row += k) {
+                    int iy = iy0 + ky;
+                    if (iy < 0 || iy >= shape->in_h || kx0 >= kx1) {
+                        MD_MemoryZero(row, k);
+                        continue;
+                    }
+                    I8 *x_row = x_plane + iy*shape->in_w + ix0;
+                    for (int kx = 0; kx < kx0; ++kx) row[kx] = 0;
+                    for (int kx = kx0; kx < kx1; ++kx) row[kx] = x_row[kx];
+                    for (int kx = kx1; kx < k; ++kx) row[kx] = 0;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,158 @@
+#ifndef QUANT_H
+#define QUANT_H
+
+// ==================================
+// Post-training int8 quantization
+//
+// NOTE: Quantization is symmetric, real = scale*q with q in [-127, 127], so zero is exact (zero
+//       padding stays zero) and the int8 GEMMs need no zero point corrections.
+//       Weights get one scale per output channel (max |w| of the channel / 127), since the
+//       channels of a layer can differ in range by orders of magnitude. Activations get one scale
+//       per tensor, from the largest |activation| seen on calibration data (see NN_Calibration).
+//       A quantized layer is an int8 GEMM with int32 accumulation (see la_gemm_s8) whose sums
+//       are requantized on write-back:
+//           y = acc*input_scale*weight_scales[o] + biases[o], then the fused relu, then
+//           q = round(y/output_scale) in the scale of the next layer's input
+//       so activations stay int8 from the input up to the last layer, which writes F32.
+//       Max pooling commutes with quantization (rounding is monotonic), so it runs on the int8
+//       values as they are.
+
+#define NN_QUANT_ROW_ALIGN 16 // quantized rows (weights, activations, im2row) are zero padded to a multiple of this
+
+typedef struct NN_QuantizedWeights NN_QuantizedWeights;
+struct NN_QuantizedWeights {
+    int out_count;
+    int in_count;
+    int in_stride; // in_count rounded up to NN_QUANT_ROW_ALIGN
+    I8 *values;    // [out_count, in_stride]
+    F32 *scales;   // [out_count]
+    F32 *biases;   // [out_count], not quantized
+};
+
+typedef struct NN_QuantizedLayer NN_QuantizedLayer;
+struct NN_QuantizedLayer {
+    NN_QuantizedWeights weights;
+    F32 input_scale;
+    B32 has_relu;
+};
+
+typedef struct NN_QuantizedConv2D NN_QuantizedConv2D;
+struct NN_QuantizedConv2D {
+    NN_ConvShape shape; // the input size is fixed at quantization time
+    NN_QuantizedWeights weights; // [out_channels, (in_channels/groups)*k*k]
+    F32 input_scale;
+    B32 has_relu;
+};
+
+typedef struct NN_QuantizedMLP NN_QuantizedMLP;
+struct NN_QuantizedMLP {
+    NN_QuantizedLayer *layers;
+    int layer_count;
+};
+
+typedef struct NN_QuantizedSmallCNN NN_QuantizedSmallCNN;
+struct NN_QuantizedSmallCNN {
+    NN_QuantizedConv2D convs[2];
+    NN_PoolShape pool_shapes[2];
+    F32 feature_map_scale; // of the last conv's output, which the global average pool reads
+    NN_QuantizedLayer fc;
+};
+
+// The largest |activation| seen at every quantization point (the input of every quantized layer),
+// over all the calibration batches observed so far.
+typedef struct NN_Calibration NN_Calibration;
+struct NN_Calibration {
+    F32 *abs_maxes;
+    int count;
+};
+
+// The points of a NN_SmallCNN: the input, the output of every conv, and the fc input
+#define NN_SMALL_CNN_CALIBRATION_COUNT 4
+
+// ==================================
+// Calibration
+
+internal NN_Calibration nn_make_calibration(Arena *arena, int count);
+
+internal void nn_calibration_observe(NN_Calibration *calibration, int point, U64 count, F64 *values);
+
+// calibration->count must be mlp->layer_count. Runs nn_mlp_apply_batch on mlp->params.values.
+internal void nn_calibrate_mlp(NN_Calibration *calibration, NN_MLP *mlp, F64 *x, int batch_count, TP_ThreadPool *pool);
+
+// calibration->count must be NN_SMALL_CNN_CALIBRATION_COUNT. Runs nn_small_cnn_apply_batch.
+internal void nn_calibrate_small_cnn(NN_Calibration *calibration, NN_SmallCNN *cnn, F64 *x, int batch_count, int in_h, int in_w, TP_ThreadPool *pool);
+
+// Activation scale for a calibrated range
+internal F32 nn_activation_scale(F32 abs_max);
+
+// ==================================
+// Quantization
+
+// weights [out_count, in_count] with row stride weight_stride, biases[o*bias_stride] (biases can be 0)
+internal NN_QuantizedWeights nn_quantize_weights(Arena *arena, int out_count, int in_count, F64 *weights, int weight_stride, F64 *biases, int bias_stride);
+
+// params [out_dim, in_dim+1] with the bias last, the layout of a NN_MLP's params block
+internal NN_QuantizedLayer nn_quantize_dense_params(Arena *arena, int in_dim, int out_dim, F64 *params, B32 has_relu, F32 input_abs_max);
+
+internal NN_QuantizedConv2D nn_quantize_conv2d_params(Arena *arena, NN_ConvShape *shape, F64 *weights, F64 *biases, B32 has_relu, F32 input_abs_max);
+
+// These two read the AG leaf values (which are views into the model's params block)
+internal NN_QuantizedLayer nn_quantize_layer(Arena *arena, NN_Layer *layer, F32 input_abs_max);
+
+internal NN_QuantizedConv2D nn_quantize_conv2d(Arena *arena, NN_Conv2D *conv2d, int in_h, int in_w, F32 input_abs_max);
+
+// These two read the params block, like the batched forward passes
+internal NN_QuantizedMLP nn_quantize_mlp(Arena *arena, NN_MLP *mlp, NN_Calibration *calibration);
+
+// The pools must be max pools
+internal NN_QuantizedSmallCNN nn_quantize_small_cnn(Arena *arena, NN_SmallCNN *cnn, int in_h, int in_w, NN_Calibration *calibration);
+
+// ==================================
+// Kernels
+
+internal I8 nn_quantize_value(F32 x, F32 inv_scale);
+
+// x [row_count, col_count] with row stride x_stride -> out [row_count, out_stride], zero padded past col_count
+internal void nn_quantize_rows(int row_count, int col_count, F64 *x, int x_stride, F32 scale, I8 *out, int out_stride);
+
+// x [batch_count, weights.in_stride] in layer->input_scale. With out, writes int8
+// [batch_count, out_stride] in output_scale (zero padded), otherwise F32 out_f32 [batch_count, out_count].
+internal void nn_quantized_layer_forward(NN_QuantizedLayer *layer, int batch_count, I8 *x, F32 output_scale, I8 *out, int out_stride, F32 *out_f32, TP_ThreadPool *pool);
+
+// x [batch_count, in_channels, in_h, in_w] in conv->input_scale. With out, writes int8
+// [batch_count, out_channels, out_h, out_w] in output_scale, otherwise F32 out_f32 in the same layout.
+internal void nn_quantized_conv2d_forward(NN_QuantizedConv2D *conv, int batch_count, I8 *x, F32 output_scale, I8 *out, F32 *out_f32, TP_ThreadPool *pool);
+
+internal void nn_max_pool2d_forward_s8(NN_PoolShape *shape, int batch_count, I8 *x, I8 *out);
+
+// x [batch_count, input_dim] -> F32 [batch_count, output_dim]
+internal F32 *nn_quantized_mlp_apply(Arena *arena, NN_QuantizedMLP *mlp, F64 *x, int batch_count, TP_ThreadPool *pool);
+
+// x [batch_count, 1, in_h, in_w] -> F32 logits [batch_count, class_count]
+internal F32 *nn_quantized_small_cnn_apply(Arena *arena, NN_QuantizedSmallCNN *cnn, F64 *x, int batch_count, TP_ThreadPool *pool);
+
+// ==================================
+// Private helpers
+
+// A run of `count` accumulators: acc*acc_scales + biases, the relu, then either quantized into out
+// or written to out_f32. param_stride is 1 for one scale/bias per accumulator (the channels of a
+// dense layer's row) or 0 for a single one (the pixels of a conv channel).
+internal void nn_requantize(int count, I32 *acc, F32 *acc_scales, F32 *biases, int param_stride, B32 has_relu, F32 inv_output_scale, I8 *out, F32 *out_f32);
+
+typedef struct NN_QuantizedConvJob NN_QuantizedConvJob;
+struct NN_QuantizedConvJob {
+    NN_QuantizedConv2D *conv;
+    I8 *x;
+    I8 *out;
+    F32 *out_f32;
+    F32 inv_output_scale;
+    F32 *acc_scales; // input_scale*weight_scales[o]
+};
+
+internal void nn_quantized_conv2d_image_task(void *user_data, int task_idx, int thread_idx);
+
+// rows [out_h*out_w, row_stride] of one group of one image, x pointing at the group's
+// in_channels/groups channels. Only the first (in_channels/groups)*k*k values of every row are written.
+internal void nn_im2row_s8(NN_ConvShape *shape, I8 *x, I8 *rows, int row_stride);
+
+#endif
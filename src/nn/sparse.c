@@ -0,0 +1,386 @@
+// ==================================
+// Pruning
+
+internal
+int nn_prune_weights(int rows, int cols, F64 *weights, int stride, F32 sparsity, NN_PruneKind kind) {
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    // The unit of pruning is a weight or a block, ranked by |w| or the block's L2 norm
+    B32 is_block = kind == NN_PruneKind_Block;
+    int unit_rows = is_block ? (rows + NN_SPARSE_BLOCK-1)/NN_SPARSE_BLOCK : rows;
+    int unit_cols = is_block ? (cols + NN_SPARSE_BLOCK-1)/NN_SPARSE_BLOCK : cols;
+    int unit_size = is_block ? NN_SPARSE_BLOCK : 1;
+    int unit_count = unit_rows*unit_cols;
+    F64 *scores = push_array(scratch.arena, F64, unit_count);
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            F64 w = weights[(U64)r*stride + c];
+            scores[(r/unit_size)*unit_cols + c/unit_size] += w*w;
+        }
+    }
+
+    int prune_count = (int)(MD_Min(MD_Max(sparsity, 0), 1)*unit_count + 0.5f);
+    int pruned_weight_count = 0;
+    if (prune_count > 0) {
+        F64 *sorted = push_array_no_zero(scratch.arena, F64, unit_count);
+        ArrayCopy(sorted, scores, unit_count);
+        qsort(sorted, unit_count, sizeof(F64), nn_compare_f64);
+        F64 threshold = sorted[prune_count-1];
+
+        // Everything below the threshold goes, then ties in order until the count is reached
+        int tie_count = prune_count;
+        for (int u = 0; u < unit_count; ++u) tie_count -= scores[u] < threshold;
+        for (int u = 0; u < unit_count; ++u) {
+            B32 is_pruned = scores[u] < threshold;
+            if (!is_pruned && scores[u] == threshold && tie_count > 0) {
+                is_pruned = 1;
+                tie_count -= 1;
+            }
+            if (!is_pruned) continue;
+
+            int r0 = (u/unit_cols)*unit_size, c0 = (u%unit_cols)*unit_size;
+            for (int r = r0; r < MD_Min(r0 + unit_size, rows); ++r) {
+                for (int c = c0; c < MD_Min(c0 + unit_size, cols); ++c) {
+                    weights[(U64)r*stride + c] = 0;
+                    pruned_weight_count += 1;
+                }
+            }
+        }
+    }
+
+    scratch_end(scratch);
+    return pruned_weight_count;
+}
+
+internal
+int nn_prune_layer(NN_Layer *layer, F32 sparsity, NN_PruneKind kind) {
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    int in_dim = layer->neurons[0].weights.count;
+    int out_dim = layer->neuron_count;
+    F64 *weights = push_array_no_zero(scratch.arena, F64, (U64)out_dim*in_dim);
+    for (int o = 0; o < out_dim; ++o) {
+        for (int i = 0; i < in_dim; ++i) weights[(U64)o*in_dim + i] = *layer->neurons[o].weights.values[i]->value;
+    }
+    int result = nn_prune_weights(out_dim, in_dim, weights, in_dim, sparsity, kind);
+    for (int o = 0; o < out_dim; ++o) {
+        for (int i = 0; i < in_dim; ++i) *layer->neurons[o].weights.values[i]->value = weights[(U64)o*in_dim + i];
+    }
+
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+int nn_prune_mlp(NN_MLP *mlp, F32 sparsity, NN_PruneKind kind) {
+    int result = 0;
+    F64 *layer_params = mlp->params.values;
+    for (int l = 0; l < mlp->layer_count; ++l) {
+        int in_dim = mlp->layers[l].neurons[0].weights.count;
+        int out_dim = mlp->layers[l].neuron_count;
+        // [out_dim, in_dim+1]: the stride skips the bias column
+        result += nn_prune_weights(out_dim, in_dim, layer_params, in_dim+1, sparsity, kind);
+        layer_params += (U64)out_dim*(in_dim+1);
+    }
+    return result;
+}
+
+// ==================================
+// Sparse formats
+
+internal
+NN_CSRMatrix nn_make_csr(Arena *arena, int rows, int cols, F64 *weights, int stride) {
+    NN_CSRMatrix result = {0};
+    result.row_count = rows;
+    result.col_count = cols;
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) result.nonzero_count += weights[(U64)r*stride + c] != 0;
+    }
+
+    result.row_offsets = push_array_no_zero(arena, int, rows+1);
+    result.cols = push_array_no_zero(arena, int, result.nonzero_count);
+    result.values = push_array_no_zero(arena, F64, result.nonzero_count);
+    int nonzero_idx = 0;
+    for (int r = 0; r < rows; ++r) {
+        result.row_offsets[r] = nonzero_idx;
+        for (int c = 0; c < cols; ++c) {
+            F64 w = weights[(U64)r*stride + c];
+            if (w == 0) continue;
+            result.cols[nonzero_idx] = c;
+            result.values[nonzero_idx] = w;
+            nonzero_idx += 1;
+        }
+    }
+    result.row_offsets[rows] = nonzero_idx;
+    return result;
+}
+
+internal
+NN_BSRMatrix nn_make_bsr(Arena *arena, int rows, int cols, F64 *weights, int stride) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    NN_BSRMatrix result = {0};
+    result.row_count = rows;
+    result.col_count = cols;
+    result.block_row_count = (rows + NN_SPARSE_BLOCK-1)/NN_SPARSE_BLOCK;
+    int block_col_count = (cols + NN_SPARSE_BLOCK-1)/NN_SPARSE_BLOCK;
+
+    B8 *is_nonzero = push_array(scratch.arena, B8, (U64)result.block_row_count*block_col_count);
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            if (weights[(U64)r*stride + c] != 0) is_nonzero[(r/NN_SPARSE_BLOCK)*block_col_count + c/NN_SPARSE_BLOCK] = 1;
+        }
+    }
+    for (int b = 0; b < result.block_row_count*block_col_count; ++b) result.block_count += is_nonzero[b];
+
+    result.block_row_offsets = push_array_no_zero(arena, int, result.block_row_count+1);
+    result.block_cols = push_array_no_zero(arena, int, result.block_count);
+    MD_ArenaPushAlign(arena, 64);
+    result.values = push_array(arena, F64, (U64)result.block_count*NN_SPARSE_BLOCK*NN_SPARSE_BLOCK);
+    int block_idx = 0;
+    for (int br = 0; br < result.block_row_count; ++br) {
+        result.block_row_offsets[br] = block_idx;
+        for (int bc = 0; bc < block_col_count; ++bc) {
+            if (!is_nonzero[br*block_col_count + bc]) continue;
+            result.block_cols[block_idx] = bc;
+            F64 *block = result.values + (U64)block_idx*NN_SPARSE_BLOCK*NN_SPARSE_BLOCK;
+            for (int i = 0; i < NN_SPARSE_BLOCK && br*NN_SPARSE_BLOCK + i < rows; ++i) {
+                for (int j = 0; j < NN_SPARSE_BLOCK && bc*NN_SPARSE_BLOCK + j < cols; ++j) {
+                    block[i*NN_SPARSE_BLOCK + j] = weights[(U64)(br*NN_SPARSE_BLOCK + i)*stride + bc*NN_SPARSE_BLOCK + j];
+                }
+            }
+            block_idx += 1;
+        }
+    }
+    result.block_row_offsets[result.block_row_count] = block_idx;
+
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+NN_SparseLayer nn_make_sparse_layer_from_params(Arena *arena, int in_dim, int out_dim, F64 *params, B32 has_relu, NN_SparseFormat format) {
+    NN_SparseLayer result = {0};
+    result.format = format;
+    result.in_dim = in_dim;
+    result.out_dim = out_dim;
+    result.has_relu = has_relu;
+    if (format == NN_SparseFormat_BSR) result.bsr = nn_make_bsr(arena, out_dim, in_dim, params, in_dim+1);
+    else                               result.csr = nn_make_csr(arena, out_dim, in_dim, params, in_dim+1);
+    result.biases = push_array_no_zero(arena, F64, out_dim);
+    for (int o = 0; o < out_dim; ++o) result.biases[o] = params[(U64)o*(in_dim+1) + in_dim];
+    return result;
+}
+
+internal
+NN_SparseLayer nn_make_sparse_layer(Arena *arena, NN_Layer *layer, NN_SparseFormat format) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    int in_dim = layer->neurons[0].weights.count;
+    int out_dim = layer->neuron_count;
+    F64 *params = push_array_no_zero(scratch.arena, F64, (U64)out_dim*(in_dim+1));
+    for (int o = 0; o < out_dim; ++o) {
+        NN_Neuron *neuron = &layer->neurons[o];
+        F64 *row = params + (U64)o*(in_dim+1);
+        for (int i = 0; i < in_dim; ++i) row[i] = *neuron->weights.values[i]->value;
+        row[in_dim] = *neuron->bias->value;
+    }
+    NN_SparseLayer result = nn_make_sparse_layer_from_params(arena, in_dim, out_dim, params, layer->neurons[0].has_relu, format);
+
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+NN_SparseMLP nn_make_sparse_mlp(Arena *arena, NN_MLP *mlp, NN_SparseFormat format) {
+    NN_SparseMLP result = {0};
+    result.layer_count = mlp->layer_count;
+    result.layers = push_array(arena, NN_SparseLayer, mlp->layer_count);
+
+    F64 *layer_params = mlp->params.values;
+    for (int l = 0; l < mlp->layer_count; ++l) {
+        NN_Layer *layer = &mlp->layers[l];
+        int in_dim = layer->neurons[0].weights.count;
+        int out_dim = layer->neuron_count;
+        result.layers[l] = nn_make_sparse_layer_from_params(arena, in_dim, out_dim, layer_params, layer->neurons[0].has_relu, format);
+        layer_params += (U64)out_dim*(in_dim+1);
+    }
+    return result;
+}
+
+internal
+U64 nn_sparse_layer_size(NN_SparseLayer *layer) {
+    U64 result = (U64)layer->out_dim*sizeof(F64);
+    if (layer->format == NN_SparseFormat_BSR) {
+        NN_BSRMatrix *bsr = &layer->bsr;
+        result += (U64)(bsr->block_row_count+1)*sizeof(int) + (U64)bsr->block_count*sizeof(int);
+        result += (U64)bsr->block_count*NN_SPARSE_BLOCK*NN_SPARSE_BLOCK*sizeof(F64);
+    } else {
+        NN_CSRMatrix *csr = &layer->csr;
+        result += (U64)(csr->row_count+1)*sizeof(int) + (U64)csr->nonzero_count*(sizeof(int) + sizeof(F64));
+    }
+    return result;
+}
+
+// ==================================
+// Kernels
+
+internal
+void nn_csr_matmul_t(NN_CSRMatrix *csr, int batch_count, F64 *xt, F64 *yt, TP_ThreadPool *pool) {
+    NN_SparseMatmulJob job = {0};
+    job.csr = csr;
+    job.batch_count = batch_count;
+    job.xt = xt;
+    job.yt = yt;
+    tp_parallel_for(pool, (csr->row_count + NN_SPARSE_ROWS_PER_TASK-1)/NN_SPARSE_ROWS_PER_TASK, nn_csr_matmul_task, &job);
+}
+
+internal
+void nn_bsr_matmul_t(NN_BSRMatrix *bsr, int batch_count, F64 *xt, F64 *yt, TP_ThreadPool *pool) {
+    NN_SparseMatmulJob job = {0};
+    job.bsr = bsr;
+    job.batch_count = batch_count;
+    job.xt = xt;
+    job.yt = yt;
+    int block_rows_per_task = NN_SPARSE_ROWS_PER_TASK/NN_SPARSE_BLOCK;
+    tp_parallel_for(pool, (bsr->block_row_count + block_rows_per_task-1)/block_rows_per_task, nn_bsr_matmul_task, &job);
+}
+
+internal
+F64 *nn_sparse_mlp_apply(Arena *arena, NN_SparseMLP *mlp, F64 *x, int batch_count, TP_ThreadPool *pool) {
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // Padding rows are zeroed here and stay zero (see nn_bsr_matmul_t)
+    int in_dim = mlp->layers[0].in_dim;
+    MD_ArenaPushAlign(scratch.arena, 64);
+    F64 *xt = push_array(scratch.arena, F64, (U64)nn_padded_rows(in_dim)*batch_count);
+    for (int n = 0; n < batch_count; ++n) {
+        for (int i = 0; i < in_dim; ++i) xt[(U64)i*batch_count + n] = x[(U64)n*in_dim + i];
+    }
+
+    for (int l = 0; l < mlp->layer_count; ++l) {
+        NN_SparseLayer *layer = &mlp->layers[l];
+        MD_ArenaPushAlign(scratch.arena, 64);
+        F64 *yt = push_array(scratch.arena, F64, (U64)nn_padded_rows(layer->out_dim)*batch_count);
+        if (layer->format == NN_SparseFormat_BSR) nn_bsr_matmul_t(&layer->bsr, batch_count, xt, yt, pool);
+        else                                      nn_csr_matmul_t(&layer->csr, batch_count, xt, yt, pool);
+
+        // Fused bias + relu
+        for (int o = 0; o < layer->out_dim; ++o) {
+            F64 *yt_row = yt + (U64)o*batch_count;
+            F64 bias = layer->biases[o];
+            for (int n = 0; n < batch_count; ++n) {
+                F64 z = yt_row[n] + bias;
+                yt_row[n] = (layer->has_relu && z <= 0) ? 0 : z;
+            }
+        }
+        xt = yt;
+    }
+
+    int out_dim = mlp->layers[mlp->layer_count-1].out_dim;
+    F64 *result = push_array_no_zero(arena, F64, (U64)batch_count*out_dim);
+    for (int o = 0; o < out_dim; ++o) {
+        for (int n = 0; n < batch_count; ++n) result[(U64)n*out_dim + o] = xt[(U64)o*batch_count + n];
+    }
+
+    scratch_end(scratch);
+    return result;
+}
+
+// ==================================
+// Private helpers
+
+internal
+void nn_csr_matmul_task(void *user_data, int task_idx, int thread_idx) {
+    NN_SparseMatmulJob *job = user_data;
+    NN_CSRMatrix *csr = job->csr;
+    int batch_count = job->batch_count;
+    int r0 = task_idx*NN_SPARSE_ROWS_PER_TASK;
+    int r1 = MD_Min(csr->row_count, r0 + NN_SPARSE_ROWS_PER_TASK);
+
+    for (int r = r0; r < r1; ++r) {
+        int first = csr->row_offsets[r], opl = csr->row_offsets[r+1];
+        F64 *yt_row = job->yt + (U64)r*batch_count;
+        int n = 0;
+#if NN_SSE2
+        // 8 batch elements per pass, in 4 registers
+        for (; n + 8 <= batch_count; n += 8) {
+            __m128d acc[4];
+            for (int j = 0; j < 4; ++j) acc[j] = _mm_setzero_pd();
+            for (int e = first; e < opl; ++e) {
+                __m128d w = _mm_set1_pd(csr->values[e]);
+                F64 *xt_run = job->xt + (U64)csr->cols[e]*batch_count + n;
+                for (int j = 0; j < 4; ++j) acc[j] = _mm_add_pd(acc[j], _mm_mul_pd(w, _mm_loadu_pd(xt_run + 2*j)));
+            }
+            for (int j = 0; j < 4; ++j) _mm_storeu_pd(yt_row + n + 2*j, acc[j]);
+        }
+#endif
+        for (; n < batch_count; ++n) {
+            F64 sum = 0;
+            for (int e = first; e < opl; ++e) sum += csr->values[e]*job->xt[(U64)csr->cols[e]*batch_count + n];
+            yt_row[n] = sum;
+        }
+    }
+}
+
+internal
+void nn_bsr_matmul_task(void *user_data, int task_idx, int thread_idx) {
+    NN_SparseMatmulJob *job = user_data;
+    NN_BSRMatrix *bsr = job->bsr;
+    int batch_count = job->batch_count;
+    int block_rows_per_task = NN_SPARSE_ROWS_PER_TASK/NN_SPARSE_BLOCK;
+    int br0 = task_idx*block_rows_per_task;
+    int br1 = MD_Min(bsr->block_row_count, br0 + block_rows_per_task);
+
+    for (int br = br0; br < br1; ++br) {
+        int first = bsr->block_row_offsets[br], opl = bsr->block_row_offsets[br+1];
+        F64 *yt_rows = job->yt + (U64)br*NN_SPARSE_BLOCK*batch_count;
+        int n = 0;
+#if NN_SSE2
+        // A NN_SPARSE_BLOCK x 4 tile of yt in registers: each block is 4 loads of xt for 64 multiply-adds
+        for (; n + 4 <= batch_count; n += 4) {
+            __m128d acc[NN_SPARSE_BLOCK][2];
+            for (int i = 0; i < NN_SPARSE_BLOCK; ++i) acc[i][0] = acc[i][1] = _mm_setzero_pd();
+            for (int b = first; b < opl; ++b) {
+                F64 *block = bsr->values + (U64)b*NN_SPARSE_BLOCK*NN_SPARSE_BLOCK;
+                F64 *xt_rows = job->xt + (U64)bsr->block_cols[b]*NN_SPARSE_BLOCK*batch_count + n;
+                for (int j = 0; j < NN_SPARSE_BLOCK; ++j) {
+                    __m128d x0 = _mm_loadu_pd(xt_rows + (U64)j*batch_count);
+                    __m128d x1 = _mm_loadu_pd(xt_rows + (U64)j*batch_count + 2);
+                    for (int i = 0; i < NN_SPARSE_BLOCK; ++i) {
+                        __m128d w = _mm_set1_pd(block[i*NN_SPARSE_BLOCK + j]);
+                        acc[i][0] = _mm_add_pd(acc[i][0], _mm_mul_pd(w, x0));
+                        acc[i][1] = _mm_add_pd(acc[i][1], _mm_mul_pd(w, x1));
+                    }
+                }
+            }
+            for (int i = 0; i < NN_SPARSE_BLOCK; ++i) {
+                _mm_storeu_pd(yt_rows + (U64)i*batch_count + n, acc[i][0]);
+                _mm_storeu_pd(yt_rows + (U64)i*batch_count + n + 2, acc[i][1]);
+            }
+        }
+#endif
+        for (; n < batch_count; ++n) {
+            F64 sums[NN_SPARSE_BLOCK] = {0};
+            for (int b = first; b < opl; ++b) {
+                F64 *block = bsr->values + (U64)b*NN_SPARSE_BLOCK*NN_SPARSE_BLOCK;
+                F64 *xt_rows = job->xt + (U64)bsr->block_cols[b]*NN_SPARSE_BLOCK*batch_count + n;
+                for (int i = 0; i < NN_SPARSE_BLOCK; ++i) {
+                    for (int j = 0; j < NN_SPARSE_BLOCK; ++j) sums[i] += block[i*NN_SPARSE_BLOCK + j]*xt_rows[(U64)j*batch_count];
+                }
+            }
+            for (int i = 0; i < NN_SPARSE_BLOCK; ++i) yt_rows[(U64)i*batch_count + n] = sums[i];
+        }
+    }
+}
+
+internal
+int nn_compare_f64(const void *a, const void *b) {
+    F64 x = *(const F64 *)a, y = *(const F64 *)b;
+    return (x > y) - (x < y);
+}
+
+internal
+int nn_padded_rows(int rows) {
+    return (rows + NN_SPARSE_BLOCK-1)/NN_SPARSE_BLOCK*NN_SPARSE_BLOCK;
+}
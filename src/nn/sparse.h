@@ -0,0 +1,135 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+// ==================================
+// Magnitude pruning and sparse inference
+//
+// NOTE: Pruning zeroes the weights (never the biases) with the smallest magnitudes, either one by
+//       one (unstructured) or in NN_SPARSE_BLOCK x NN_SPARSE_BLOCK blocks ranked by their L2 norm
+//       (block), layer by layer. A pruned layer is then stored in a compressed format:
+//         - CSR: the nonzeros of every row with their column indices, for unstructured pruning
+//         - BSR: the nonzero blocks of every block row with their block column indices, for block
+//           pruning; one index per NN_SPARSE_BLOCK^2 values, and dense register-tiled blocks
+//       The kernels work on transposed activations, xt [in, batch_count], so every nonzero
+//       weight scales a contiguous run of the batch: yt[o, :] += w[o, i]*xt[i, :].
+
+#define NN_SPARSE_BLOCK 4
+
+typedef enum NN_PruneKind {
+    NN_PruneKind_Unstructured,
+    NN_PruneKind_Block,
+} NN_PruneKind;
+
+typedef enum NN_SparseFormat {
+    NN_SparseFormat_CSR,
+    NN_SparseFormat_BSR,
+} NN_SparseFormat;
+
+typedef struct NN_CSRMatrix NN_CSRMatrix;
+struct NN_CSRMatrix {
+    int row_count;
+    int col_count;
+    int nonzero_count;
+    int *row_offsets; // [row_count+1], the nonzeros of row r are [row_offsets[r], row_offsets[r+1])
+    int *cols;        // [nonzero_count]
+    F64 *values;      // [nonzero_count]
+};
+
+typedef struct NN_BSRMatrix NN_BSRMatrix;
+struct NN_BSRMatrix {
+    int row_count;
+    int col_count;
+    int block_row_count; // ceil(row_count/NN_SPARSE_BLOCK)
+    int block_count;
+    int *block_row_offsets; // [block_row_count+1]
+    int *block_cols;        // [block_count]
+    F64 *values;            // [block_count, NN_SPARSE_BLOCK, NN_SPARSE_BLOCK], zero padded past the matrix edges
+};
+
+typedef struct NN_SparseLayer NN_SparseLayer;
+struct NN_SparseLayer {
+    NN_SparseFormat format;
+    NN_CSRMatrix csr; // CSR only
+    NN_BSRMatrix bsr; // BSR only
+    int in_dim;
+    int out_dim;
+    F64 *biases;
+    B32 has_relu;
+};
+
+typedef struct NN_SparseMLP NN_SparseMLP;
+struct NN_SparseMLP {
+    NN_SparseLayer *layers;
+    int layer_count;
+};
+
+// ==================================
+// Pruning
+
+// Zeroes round(sparsity*rows*cols) of weights [rows, cols] (row stride `stride`), in blocks for
+// NN_PruneKind_Block (partial edge blocks are ranked by the norm of their in-matrix part, and
+// the count is rounded to whole blocks). Returns the number of weights zeroed.
+internal int nn_prune_weights(int rows, int cols, F64 *weights, int stride, F32 sparsity, NN_PruneKind kind);
+
+// Prunes the layer's leaves
+internal int nn_prune_layer(NN_Layer *layer, F32 sparsity, NN_PruneKind kind);
+
+// Prunes every layer of mlp->params.values to `sparsity` (the leaves are views into it)
+internal int nn_prune_mlp(NN_MLP *mlp, F32 sparsity, NN_PruneKind kind);
+
+// ==================================
+// Sparse formats
+
+internal NN_CSRMatrix nn_make_csr(Arena *arena, int rows, int cols, F64 *weights, int stride);
+
+internal NN_BSRMatrix nn_make_bsr(Arena *arena, int rows, int cols, F64 *weights, int stride);
+
+// params [out_dim, in_dim+1] with the bias last, the layout of a NN_MLP's params block
+internal NN_SparseLayer nn_make_sparse_layer_from_params(Arena *arena, int in_dim, int out_dim, F64 *params, B32 has_relu, NN_SparseFormat format);
+
+// Reads the AG leaf values
+internal NN_SparseLayer nn_make_sparse_layer(Arena *arena, NN_Layer *layer, NN_SparseFormat format);
+
+// Reads mlp->params.values
+internal NN_SparseMLP nn_make_sparse_mlp(Arena *arena, NN_MLP *mlp, NN_SparseFormat format);
+
+// Bytes of weights, indices and biases
+internal U64 nn_sparse_layer_size(NN_SparseLayer *layer);
+
+// ==================================
+// Kernels
+
+// yt [row_count, batch_count] = W xt, xt [col_count, batch_count]
+internal void nn_csr_matmul_t(NN_CSRMatrix *csr, int batch_count, F64 *xt, F64 *yt, TP_ThreadPool *pool);
+
+// Same as nn_csr_matmul_t, but xt and yt have their rows padded to a multiple of NN_SPARSE_BLOCK.
+// The padding rows of xt must be zero; the padding rows of yt are written with zeros.
+internal void nn_bsr_matmul_t(NN_BSRMatrix *bsr, int batch_count, F64 *xt, F64 *yt, TP_ThreadPool *pool);
+
+// x [batch_count, input_dim] -> [batch_count, output_dim]. The activations stay transposed
+// between layers, so x and the output are transposed once each.
+internal F64 *nn_sparse_mlp_apply(Arena *arena, NN_SparseMLP *mlp, F64 *x, int batch_count, TP_ThreadPool *pool);
+
+// ==================================
+// Private helpers
+
+#define NN_SPARSE_ROWS_PER_TASK 16
+
+typedef struct NN_SparseMatmulJob NN_SparseMatmulJob;
+struct NN_SparseMatmulJob {
+    NN_CSRMatrix *csr;
+    NN_BSRMatrix *bsr;
+    int batch_count;
+    F64 *xt;
+    F64 *yt;
+};
+
+internal void nn_csr_matmul_task(void *user_data, int task_idx, int thread_idx);
+
+internal void nn_bsr_matmul_task(void *user_data, int task_idx, int thread_idx);
+
+internal int nn_compare_f64(const void *a, const void *b);
+
+internal int nn_padded_rows(int rows);
+
+#endif
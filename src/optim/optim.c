@@ -0,0 +1,211 @@
+#if defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+# define OPT_SSE2 1
+#else
+# define OPT_SSE2 0
+#endif
+
+internal
+OPT_Config opt_sgd_config(F64 lr, F64 momentum, B32 nesterov) {
+    OPT_Config result = {0};
+    result.kind = OPT_Kind_SGD;
+    result.lr = lr;
+    result.momentum = momentum;
+    result.nesterov = nesterov;
+    return result;
+}
+
+internal
+OPT_Config opt_adam_config(F64 lr) {
+    OPT_Config result = {0};
+    result.kind = OPT_Kind_Adam;
+    result.lr = lr;
+    result.beta1 = 0.9;
+    result.beta2 = 0.999;
+    result.eps = 1e-8;
+    return result;
+}
+
+internal
+OPT_Config opt_adamw_config(F64 lr, F64 weight_decay) {
+    OPT_Config result = opt_adam_config(lr);
+    result.kind = OPT_Kind_AdamW;
+    result.weight_decay = weight_decay;
+    return result;
+}
+
+internal
+OPT_Optimizer opt_make_optimizer(Arena *arena, OPT_Config config, int param_count, TP_ThreadPool *pool) {
+    OPT_Optimizer result = {0};
+    result.config = config;
+    result.param_count = param_count;
+    result.pool = pool;
+
+    B32 needs_m = (config.kind != OPT_Kind_SGD || config.momentum != 0);
+    B32 needs_v = (config.kind != OPT_Kind_SGD);
+    if (needs_m) {
+        MD_ArenaPushAlign(arena, 64);
+        result.m = push_array(arena, F64, param_count);
+    }
+    if (needs_v) {
+        MD_ArenaPushAlign(arena, 64);
+        result.v = push_array(arena, F64, param_count);
+    }
+    return result;
+}
+
+internal
+F64 opt_sum_of_squares(F64 *x, int count) {
+    int i = 0;
+    F64 result = 0;
+#if OPT_SSE2
+    __m128d acc = _mm_setzero_pd();
+    for (; i+2 <= count; i += 2) {
+        __m128d g = _mm_loadu_pd(&x[i]);
+        acc = _mm_add_pd(acc, _mm_mul_pd(g, g));
+    }
+    F64 lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    result = lanes[0] + lanes[1];
+#endif
+    for (; i < count; ++i) result += x[i]*x[i];
+    return result;
+}
+
+internal
+void opt_sgd_kernel(OPT_Config *config, F64 *values, F64 *grads, F64 *m, int count, F64 grad_scale) {
+    F64 lr = config->lr;
+    F64 mu = config->momentum;
+    F64 wd = config->weight_decay;
+    F64 clip = config->clip_value;
+    int i = 0;
+#if OPT_SSE2
+    __m128d lr_v = _mm_set1_pd(lr), mu_v = _mm_set1_pd(mu), wd_v = _mm_set1_pd(wd);
+    __m128d scale_v = _mm_set1_pd(grad_scale);
+    __m128d clip_hi = _mm_set1_pd(clip), clip_lo = _mm_set1_pd(-clip);
+    for (; i+2 <= count; i += 2) {
+        __m128d p = _mm_loadu_pd(&values[i]);
+        __m128d g = _mm_mul_pd(_mm_loadu_pd(&grads[i]), scale_v);
+        if (clip > 0) g = _mm_min_pd(_mm_max_pd(g, clip_lo), clip_hi);
+        g = _mm_add_pd(g, _mm_mul_pd(wd_v, p));
+        __m128d d = g;
+        if (m) {
+            __m128d mom = _mm_add_pd(_mm_mul_pd(mu_v, _mm_loadu_pd(&m[i])), g);
+            _mm_storeu_pd(&m[i], mom);
+            d = config->nesterov ? _mm_add_pd(g, _mm_mul_pd(mu_v, mom)) : mom;
+        }
+        _mm_storeu_pd(&values[i], _mm_sub_pd(p, _mm_mul_pd(lr_v, d)));
+    }
+#endif
+    for (; i < count; ++i) {
+        F64 g = grads[i]*grad_scale;
+        if (clip > 0) g = MD_Min(MD_Max(g, -clip), clip);
+        g += wd*values[i];
+        F64 d = g;
+        if (m) {
+            m[i] = mu*m[i] + g;
+            d = config->nesterov ? g + mu*m[i] : m[i];
+        }
+        values[i] -= lr*d;
+    }
+}
+
+internal
+void opt_adam_kernel(OPT_Config *config, F64 *values, F64 *grads, F64 *m, F64 *v, int count, F64 grad_scale, U64 step_count) {
+    F64 b1 = config->beta1, b2 = config->beta2;
+    F64 clip = config->clip_value;
+    B32 is_decoupled = (config->kind == OPT_Kind_AdamW);
+    F64 l2 = is_decoupled ? 0 : config->weight_decay;
+    F64 decay = is_decoupled ? 1 - config->lr*config->weight_decay : 1;
+    // Fold the bias corrections into the step size and epsilon:
+    // lr*(m/bc1)/(sqrt(v/bc2)+eps) == (lr*sqrt(bc2)/bc1) * m/(sqrt(v) + eps*sqrt(bc2))
+    F64 bc1 = 1 - pow(b1, (F64)step_count);
+    F64 bc2 = 1 - pow(b2, (F64)step_count);
+    F64 step_size = config->lr*sqrt(bc2)/bc1;
+    F64 eps = config->eps*sqrt(bc2);
+    int i = 0;
+#if OPT_SSE2
+    __m128d b1_v = _mm_set1_pd(b1), one_minus_b1 = _mm_set1_pd(1-b1);
+    __m128d b2_v = _mm_set1_pd(b2), one_minus_b2 = _mm_set1_pd(1-b2);
+    __m128d l2_v = _mm_set1_pd(l2), decay_v = _mm_set1_pd(decay);
+    __m128d step_v = _mm_set1_pd(step_size), eps_v = _mm_set1_pd(eps);
+    __m128d scale_v = _mm_set1_pd(grad_scale);
+    __m128d clip_hi = _mm_set1_pd(clip), clip_lo = _mm_set1_pd(-clip);
+    for (; i+2 <= count; i += 2) {
+        __m128d p = _mm_loadu_pd(&values[i]);
+        __m128d g = _mm_mul_pd(_mm_loadu_pd(&grads[i]), scale_v);
+        if (clip > 0) g = _mm_min_pd(_mm_max_pd(g, clip_lo), clip_hi);
+        g = _mm_add_pd(g, _mm_mul_pd(l2_v, p));
+        __m128d mi = _mm_add_pd(_mm_mul_pd(b1_v, _mm_loadu_pd(&m[i])), _mm_mul_pd(one_minus_b1, g));
+        __m128d vi = _mm_add_pd(_mm_mul_pd(b2_v, _mm_loadu_pd(&v[i])), _mm_mul_pd(one_minus_b2, _mm_mul_pd(g, g)));
+        _mm_storeu_pd(&m[i], mi);
+        _mm_storeu_pd(&v[i], vi);
+        __m128d update = _mm_div_pd(_mm_mul_pd(step_v, mi), _mm_add_pd(_mm_sqrt_pd(vi), eps_v));
+        _mm_storeu_pd(&values[i], _mm_sub_pd(_mm_mul_pd(decay_v, p), update));
+    }
+#endif
+    for (; i < count; ++i) {
+        F64 g = grads[i]*grad_scale;
+        if (clip > 0) g = MD_Min(MD_Max(g, -clip), clip);
+        g += l2*values[i];
+        m[i] = b1*m[i] + (1-b1)*g;
+        v[i] = b2*v[i] + (1-b2)*g*g;
+        values[i] = decay*values[i] - step_size*m[i]/(sqrt(v[i]) + eps);
+    }
+}
+
+internal
+void opt_sum_of_squares_task(void *user_data, int task_idx, int thread_idx) {
+    OPT_StepJob *job = user_data;
+    int first = task_idx*OPT_CHUNK_SIZE;
+    int count = MD_Min(OPT_CHUNK_SIZE, job->opt->param_count - first);
+    job->chunk_sums_of_squares[task_idx] = opt_sum_of_squares(job->grads + first, count);
+}
+
+internal
+void opt_step_task(void *user_data, int task_idx, int thread_idx) {
+    OPT_StepJob *job = user_data;
+    OPT_Optimizer *opt = job->opt;
+    int first = task_idx*OPT_CHUNK_SIZE;
+    int count = MD_Min(OPT_CHUNK_SIZE, opt->param_count - first);
+    F64 *m = opt->m ? opt->m + first : 0;
+    F64 *v = opt->v ? opt->v + first : 0;
+    switch (opt->config.kind) {
+        case OPT_Kind_SGD: {
+            opt_sgd_kernel(&opt->config, job->values + first, job->grads + first, m, count, job->grad_scale);
+        } break;
+        case OPT_Kind_Adam:
+        case OPT_Kind_AdamW: {
+            opt_adam_kernel(&opt->config, job->values + first, job->grads + first, m, v, count, job->grad_scale, opt->step_count);
+        } break;
+    }
+}
+
+internal
+void opt_step(OPT_Optimizer *opt, F64 *values, F64 *grads) {
+    ArenaTemp scratch = scratch_begin(0,0);
+
+    opt->step_count += 1;
+
+    OPT_StepJob job = {0};
+    job.opt = opt;
+    job.values = values;
+    job.grads = grads;
+    job.grad_scale = 1;
+
+    int chunk_count = (opt->param_count + OPT_CHUNK_SIZE-1)/OPT_CHUNK_SIZE;
+
+    if (opt->config.clip_norm > 0) {
+        // Per-chunk partial sums, added up in chunk order, so the norm is deterministic
+        job.chunk_sums_of_squares = push_array(scratch.arena, F64, chunk_count);
+        tp_parallel_for(opt->pool, chunk_count, opt_sum_of_squares_task, &job);
+        F64 sum_of_squares = 0;
+        for (int i = 0; i < chunk_count; ++i) sum_of_squares += job.chunk_sums_of_squares[i];
+        F64 norm = sqrt(sum_of_squares);
+        if (norm > opt->config.clip_norm) job.grad_scale = opt->config.clip_norm/norm;
+    }
+
+    tp_parallel_for(opt->pool, chunk_count, opt_step_task, &job);
+
+    scratch_end(scratch);
+}
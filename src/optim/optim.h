@@ -0,0 +1,86 @@
+#ifndef OPTIM_H
+#define OPTIM_H
+
+typedef enum OPT_Kind {
+    OPT_Kind_SGD, // with optional (Nesterov) momentum
+    OPT_Kind_Adam,
+    OPT_Kind_AdamW,
+} OPT_Kind;
+
+typedef struct OPT_Config OPT_Config;
+struct OPT_Config {
+    OPT_Kind kind;
+    F64 lr;
+
+    // SGD
+    F64 momentum; // 0 = plain SGD
+    B32 nesterov;
+
+    // Adam(W)
+    F64 beta1;
+    F64 beta2;
+    F64 eps;
+
+    // Added to the grad (L2 penalty) for SGD/Adam, decoupled from the grad for AdamW
+    F64 weight_decay;
+
+    F64 clip_value; // 0 = off, otherwise every grad is clamped to [-clip_value, clip_value]
+    F64 clip_norm;  // 0 = off, otherwise grads are scaled so their global L2 norm is <= clip_norm
+};
+
+// NOTE: The optimizer state (momentum or Adam moments) is kept in contiguous buffers parallel to
+//       the parameter/grad blocks (see NN_Params), so every step is one fused sweep that does
+//       clipping, weight decay and the update at once. The sweep is split into chunks that run
+//       on the thread pool, if there is one.
+typedef struct OPT_Optimizer OPT_Optimizer;
+struct OPT_Optimizer {
+    OPT_Config config;
+    int param_count;
+    U64 step_count;
+
+    F64 *m; // SGD momentum buffer, or Adam's first moment
+    F64 *v; // Adam's second moment
+
+    TP_ThreadPool *pool; // optional
+};
+
+internal OPT_Config opt_sgd_config(F64 lr, F64 momentum, B32 nesterov);
+
+internal OPT_Config opt_adam_config(F64 lr);
+
+internal OPT_Config opt_adamw_config(F64 lr, F64 weight_decay);
+
+internal OPT_Optimizer opt_make_optimizer(Arena *arena, OPT_Config config, int param_count, TP_ThreadPool *pool);
+
+// values -= update(grads). Leaves `grads` untouched.
+internal void opt_step(OPT_Optimizer *opt, F64 *values, F64 *grads);
+
+// ==================================
+// Kernels (operate on one chunk of the buffers)
+
+// grad_scale is the global-norm clipping factor (1 if off)
+internal void opt_sgd_kernel(OPT_Config *config, F64 *values, F64 *grads, F64 *m, int count, F64 grad_scale);
+
+internal void opt_adam_kernel(OPT_Config *config, F64 *values, F64 *grads, F64 *m, F64 *v, int count, F64 grad_scale, U64 step_count);
+
+internal F64 opt_sum_of_squares(F64 *x, int count);
+
+// ==================================
+// Private helpers
+
+typedef struct OPT_StepJob OPT_StepJob;
+struct OPT_StepJob {
+    OPT_Optimizer *opt;
+    F64 *values;
+    F64 *grads;
+    F64 grad_scale;
+    F64 *chunk_sums_of_squares;
+};
+
+#define OPT_CHUNK_SIZE 16384
+
+internal void opt_sum_of_squares_task(void *user_data, int task_idx, int thread_idx);
+
+internal void opt_step_task(void *user_data, int task_idx, int thread_idx);
+
+#endif
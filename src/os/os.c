@@ -0,0 +1,255 @@
+#if MD_OS_WINDOWS
+
+internal
+DWORD WINAPI os_thread_entry(LPVOID params_ptr) {
+    OS_ThreadLaunchParams *params = params_ptr;
+    params->func(params->user_data);
+    return 0;
+}
+
+internal
+OS_Thread os_thread_launch(Arena *arena, OS_ThreadFunc *func, void *user_data) {
+    OS_ThreadLaunchParams *params = push_array(arena, OS_ThreadLaunchParams, 1);
+    params->func = func;
+    params->user_data = user_data;
+    OS_Thread result = {0};
+    result.handle = (U64)CreateThread(0, 0, os_thread_entry, params, 0, 0);
+    if (!result.handle) fprintf(stderr, "os_thread_launch: CreateThread failed\n");
+    return result;
+}
+
+internal
+void os_thread_join(OS_Thread thread) {
+    HANDLE handle = (HANDLE)thread.handle;
+    WaitForSingleObject(handle, INFINITE);
+    CloseHandle(handle);
+}
+
+internal void os_mutex_init(OS_Mutex *mutex) { InitializeSRWLock(&mutex->lock); }
+internal void os_mutex_release(OS_Mutex *mutex) { (void)mutex; }
+internal void os_mutex_lock(OS_Mutex *mutex) { AcquireSRWLockExclusive(&mutex->lock); }
+internal void os_mutex_unlock(OS_Mutex *mutex) { ReleaseSRWLockExclusive(&mutex->lock); }
+
+internal void os_condition_variable_init(OS_ConditionVariable *cv) { InitializeConditionVariable(&cv->cv); }
+internal void os_condition_variable_release(OS_ConditionVariable *cv) { (void)cv; }
+internal void os_condition_variable_wait(OS_ConditionVariable *cv, OS_Mutex *mutex) { SleepConditionVariableSRW(&cv->cv, &mutex->lock, INFINITE, 0); }
+internal void os_condition_variable_broadcast(OS_ConditionVariable *cv) { WakeAllConditionVariable(&cv->cv); }
+
+internal
+I32 os_atomic_i32_fetch_add(volatile I32 *x, I32 to_add) {
+    return InterlockedExchangeAdd((volatile LONG*)x, to_add);
+}
+
+internal
+int os_logical_core_count(void) {
+    SYSTEM_INFO info = {0};
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+
+internal
+U64 os_now_microseconds(void) {
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (U64)(counter.QuadPart * 1000000 / frequency.QuadPart);
+}
+
+internal
+U64 os_now_nanoseconds(void) {
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    U64 seconds = counter.QuadPart / frequency.QuadPart;
+    U64 rest = counter.QuadPart % frequency.QuadPart;
+    return seconds*1000000000 + rest*1000000000/frequency.QuadPart;
+}
+
+internal
+B32 os_write_entire_file(char *path, void *data, U64 size, B32 sync) {
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+    U8 *cur = data;
+    U64 remaining = size;
+    B32 result = 1;
+    while (remaining > 0) {
+        DWORD to_write = (DWORD)MD_Min(remaining, (U64)1 << 30);
+        DWORD written = 0;
+        if (!WriteFile(file, cur, to_write, &written, 0) || written == 0) { result = 0; break; }
+        cur += written;
+        remaining -= written;
+    }
+    if (result && sync && !FlushFileBuffers(file)) result = 0;
+    CloseHandle(file);
+    return result;
+}
+
+internal
+B32 os_replace_file(char *from, char *to) {
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+internal
+B32 os_sync_parent_directory(char *path) {
+    (void)path;
+    return 1; // MOVEFILE_WRITE_THROUGH already flushed the rename
+}
+
+internal
+OS_FileMap os_map_file(char *path) {
+    OS_FileMap result = {0};
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE) return result;
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+        if (mapping) {
+            // The view keeps the mapping object alive
+            result.data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+            if (result.data) result.size = (U64)size.QuadPart;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+    return result;
+}
+
+internal
+void os_unmap_file(OS_FileMap *map) {
+    if (map->data) UnmapViewOfFile(map->data);
+    MD_MemoryZero(map, sizeof(*map));
+}
+
+#else
+
+internal
+void *os_thread_entry(void *params_ptr) {
+    OS_ThreadLaunchParams *params = params_ptr;
+    params->func(params->user_data);
+    return 0;
+}
+
+internal
+OS_Thread os_thread_launch(Arena *arena, OS_ThreadFunc *func, void *user_data) {
+    OS_ThreadLaunchParams *params = push_array(arena, OS_ThreadLaunchParams, 1);
+    params->func = func;
+    params->user_data = user_data;
+    OS_Thread result = {0};
+    pthread_t handle;
+    if (pthread_create(&handle, 0, os_thread_entry, params) != 0) {
+        fprintf(stderr, "os_thread_launch: pthread_create failed\n");
+        return result;
+    }
+    result.handle = (U64)handle;
+    return result;
+}
+
+internal
+void os_thread_join(OS_Thread thread) {
+    pthread_join((pthread_t)thread.handle, 0);
+}
+
+internal void os_mutex_init(OS_Mutex *mutex) { pthread_mutex_init(&mutex->lock, 0); }
+internal void os_mutex_release(OS_Mutex *mutex) { pthread_mutex_destroy(&mutex->lock); }
+internal void os_mutex_lock(OS_Mutex *mutex) { pthread_mutex_lock(&mutex->lock); }
+internal void os_mutex_unlock(OS_Mutex *mutex) { pthread_mutex_unlock(&mutex->lock); }
+
+internal void os_condition_variable_init(OS_ConditionVariable *cv) { pthread_cond_init(&cv->cv, 0); }
+internal void os_condition_variable_release(OS_ConditionVariable *cv) { pthread_cond_destroy(&cv->cv); }
+internal void os_condition_variable_wait(OS_ConditionVariable *cv, OS_Mutex *mutex) { pthread_cond_wait(&cv->cv, &mutex->lock); }
+internal void os_condition_variable_broadcast(OS_ConditionVariable *cv) { pthread_cond_broadcast(&cv->cv); }
+
+internal
+I32 os_atomic_i32_fetch_add(volatile I32 *x, I32 to_add) {
+    return __atomic_fetch_add(x, to_add, __ATOMIC_SEQ_CST);
+}
+
+internal
+int os_logical_core_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+internal
+U64 os_now_microseconds(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (U64)t.tv_sec*1000000 + (U64)t.tv_nsec/1000;
+}
+
+internal
+U64 os_now_nanoseconds(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (U64)t.tv_sec*1000000000 + (U64)t.tv_nsec;
+}
+
+internal
+B32 os_write_entire_file(char *path, void *data, U64 size, B32 sync) {
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0) return 0;
+    U8 *cur = data;
+    U64 remaining = size;
+    B32 result = 1;
+    while (remaining > 0) {
+        ssize_t written = write(fd, cur, remaining);
+        if (written <= 0) { result = 0; break; }
+        cur += written;
+        remaining -= (U64)written;
+    }
+    if (result && sync && fsync(fd) != 0) result = 0;
+    if (close(fd) != 0) result = 0;
+    return result;
+}
+
+internal
+B32 os_replace_file(char *from, char *to) {
+    return rename(from, to) == 0;
+}
+
+internal
+B32 os_sync_parent_directory(char *path) {
+    // A rename is an update of the directory, which needs its own fsync to be durable
+    ArenaTemp scratch = scratch_begin(0, 0);
+    char *dir = ".";
+    char *last_slash = strrchr(path, '/');
+    if (last_slash) {
+        U64 dir_size = (last_slash == path ? 1 : (U64)(last_slash - path));
+        dir = push_array(scratch.arena, char, dir_size+1);
+        MemoryCopy(dir, path, dir_size);
+    }
+    B32 result = 0;
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        result = (fsync(fd) == 0);
+        close(fd);
+    }
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+OS_FileMap os_map_file(char *path) {
+    OS_FileMap result = {0};
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return result;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        // The mapping stays valid after the fd is closed
+        void *data = mmap(0, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            result.data = data;
+            result.size = (U64)st.st_size;
+        }
+    }
+    close(fd);
+    return result;
+}
+
+internal
+void os_unmap_file(OS_FileMap *map) {
+    if (map->data) munmap(map->data, map->size);
+    MD_MemoryZero(map, sizeof(*map));
+}
+
+#endif
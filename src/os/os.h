@@ -0,0 +1,101 @@
+#ifndef OS_H
+#define OS_H
+
+// ==================================
+// Threads & synchronization
+
+typedef void (OS_ThreadFunc) (void *user_data);
+
+typedef struct OS_Thread OS_Thread;
+struct OS_Thread {
+    U64 handle;
+};
+
+typedef struct OS_Mutex OS_Mutex;
+struct OS_Mutex {
+#if MD_OS_WINDOWS
+    SRWLOCK lock;
+#else
+    pthread_mutex_t lock;
+#endif
+};
+
+typedef struct OS_ConditionVariable OS_ConditionVariable;
+struct OS_ConditionVariable {
+#if MD_OS_WINDOWS
+    CONDITION_VARIABLE cv;
+#else
+    pthread_cond_t cv;
+#endif
+};
+
+internal OS_Thread os_thread_launch(Arena *arena, OS_ThreadFunc *func, void *user_data);
+
+internal void os_thread_join(OS_Thread thread);
+
+internal void os_mutex_init(OS_Mutex *mutex);
+
+internal void os_mutex_release(OS_Mutex *mutex);
+
+internal void os_mutex_lock(OS_Mutex *mutex);
+
+internal void os_mutex_unlock(OS_Mutex *mutex);
+
+internal void os_condition_variable_init(OS_ConditionVariable *cv);
+
+internal void os_condition_variable_release(OS_ConditionVariable *cv);
+
+// Atomically unlocks `mutex` and waits. `mutex` is locked again when this returns.
+internal void os_condition_variable_wait(OS_ConditionVariable *cv, OS_Mutex *mutex);
+
+internal void os_condition_variable_broadcast(OS_ConditionVariable *cv);
+
+// Returns the value *before* the add.
+internal I32 os_atomic_i32_fetch_add(volatile I32 *x, I32 to_add);
+
+// ==================================
+// System info & time
+
+internal int os_logical_core_count(void);
+
+internal U64 os_now_microseconds(void);
+
+internal U64 os_now_nanoseconds(void);
+
+// ==================================
+// Files
+
+// A view of a whole file. The pages are private copy-on-write: they are read from the
+// file on first touch, and writes to them go to private copies that never reach the file.
+typedef struct OS_FileMap OS_FileMap;
+struct OS_FileMap {
+    U8 *data; // 0 if the file couldn't be mapped
+    U64 size;
+};
+
+// Creates or truncates the file, then writes `size` bytes in as few write calls as the OS allows.
+// With `sync`, the data is flushed to the disk before this returns.
+internal B32 os_write_entire_file(char *path, void *data, U64 size, B32 sync);
+
+// Atomically replaces `to` (if it exists) with `from`, so readers see either the old or the new
+// file, never a partial one. Returns 0 if nothing was renamed.
+internal B32 os_replace_file(char *from, char *to);
+
+// Flushes the directory holding `path` to the disk, which makes a rename into it durable (see
+// os_replace_file). A no-op on Windows, where the rename is written through already.
+internal B32 os_sync_parent_directory(char *path);
+
+internal OS_FileMap os_map_file(char *path);
+
+internal void os_unmap_file(OS_FileMap *map);
+
+// ==================================
+// Private helpers
+
+typedef struct OS_ThreadLaunchParams OS_ThreadLaunchParams;
+struct OS_ThreadLaunchParams {
+    OS_ThreadFunc *func;
+    void *user_data;
+};
+
+#endif
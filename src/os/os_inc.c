@@ -0,0 +1,2 @@
+#include "os.c"
+#include "thread_pool.c"
@@ -0,0 +1,18 @@
+#ifndef OS_INC_H
+#define OS_INC_H
+
+#if MD_OS_WINDOWS
+# include <Windows.h>
+#else
+# include <pthread.h>
+# include <time.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+#include "os.h"
+#include "thread_pool.h"
+
+#endif
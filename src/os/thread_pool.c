@@ -0,0 +1,99 @@
+internal
+TP_ThreadPool *tp_make_thread_pool(Arena *arena, int thread_count) {
+    if (thread_count <= 0) thread_count = os_logical_core_count();
+
+    TP_ThreadPool *pool = push_array(arena, TP_ThreadPool, 1);
+    pool->thread_count = thread_count;
+    os_mutex_init(&pool->mutex);
+    os_condition_variable_init(&pool->job_cv);
+    os_condition_variable_init(&pool->done_cv);
+
+    // The calling thread is thread 0, so only thread_count-1 workers are launched
+    pool->workers = push_array(arena, TP_Worker, thread_count);
+    for (int i = 1; i < thread_count; ++i) {
+        TP_Worker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->thread_idx = i;
+        worker->thread = os_thread_launch(arena, tp_worker_main, worker);
+    }
+    return pool;
+}
+
+internal
+void tp_release_thread_pool(TP_ThreadPool *pool) {
+    os_mutex_lock(&pool->mutex);
+    pool->is_shutting_down = 1;
+    os_condition_variable_broadcast(&pool->job_cv);
+    os_mutex_unlock(&pool->mutex);
+
+    for (int i = 1; i < pool->thread_count; ++i) os_thread_join(pool->workers[i].thread);
+
+    os_condition_variable_release(&pool->done_cv);
+    os_condition_variable_release(&pool->job_cv);
+    os_mutex_release(&pool->mutex);
+}
+
+internal
+void tp_run_tasks(TP_ThreadPool *pool, int thread_idx) {
+    for (;;) {
+        I32 task_idx = os_atomic_i32_fetch_add(&pool->next_task, 1);
+        if (task_idx >= pool->task_count) break;
+        pool->func(pool->user_data, task_idx, thread_idx);
+    }
+}
+
+internal
+void tp_worker_main(void *worker_ptr) {
+    TP_Worker *worker = worker_ptr;
+    TP_ThreadPool *pool = worker->pool;
+    U64 seen_generation = 0;
+
+    for (;;) {
+        os_mutex_lock(&pool->mutex);
+        while (!pool->is_shutting_down && pool->job_generation == seen_generation) {
+            os_condition_variable_wait(&pool->job_cv, &pool->mutex);
+        }
+        B32 is_shutting_down = pool->is_shutting_down;
+        seen_generation = pool->job_generation;
+        os_mutex_unlock(&pool->mutex);
+
+        if (is_shutting_down) break;
+
+        tp_run_tasks(pool, worker->thread_idx);
+
+        os_mutex_lock(&pool->mutex);
+        pool->finished_worker_count += 1;
+        if (pool->finished_worker_count == pool->thread_count-1) {
+            os_condition_variable_broadcast(&pool->done_cv);
+        }
+        os_mutex_unlock(&pool->mutex);
+    }
+}
+
+internal
+void tp_parallel_for(TP_ThreadPool *pool, int task_count, TP_TaskFunc *func, void *user_data) {
+    if (!pool || pool->thread_count <= 1 || task_count <= 1) {
+        for (int i = 0; i < task_count; ++i) func(user_data, i, 0);
+        return;
+    }
+
+    os_mutex_lock(&pool->mutex);
+    pool->func = func;
+    pool->user_data = user_data;
+    pool->task_count = task_count;
+    pool->next_task = 0;
+    pool->finished_worker_count = 0;
+    pool->job_generation += 1;
+    os_condition_variable_broadcast(&pool->job_cv);
+    os_mutex_unlock(&pool->mutex);
+
+    tp_run_tasks(pool, 0);
+
+    // Wait for *every* worker, not just for the tasks: a worker that is still about to read
+    // the job fields must not see the next job's fields.
+    os_mutex_lock(&pool->mutex);
+    while (pool->finished_worker_count < pool->thread_count-1) {
+        os_condition_variable_wait(&pool->done_cv, &pool->mutex);
+    }
+    os_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,51 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Runs task `task_idx` of a parallel for. `thread_idx` is in [0, pool->thread_count) and can be 
+// used to index per-thread data. Thread 0 is the thread that called tp_parallel_for.
+typedef void (TP_TaskFunc) (void *user_data, int task_idx, int thread_idx);
+
+typedef struct TP_Worker TP_Worker;
+struct TP_Worker {
+    struct TP_ThreadPool *pool;
+    OS_Thread thread;
+    int thread_idx;
+};
+
+typedef struct TP_ThreadPool TP_ThreadPool;
+struct TP_ThreadPool {
+    int thread_count; // including the calling thread
+    TP_Worker *workers;
+
+    OS_Mutex mutex;
+    OS_ConditionVariable job_cv;
+    OS_ConditionVariable done_cv;
+
+    // The current job. Only written by tp_parallel_for while all workers are idle.
+    TP_TaskFunc *func;
+    void *user_data;
+    I32 task_count;
+    volatile I32 next_task;
+
+    U64 job_generation;
+    int finished_worker_count;
+    B32 is_shutting_down;
+};
+
+// thread_count <= 0 uses one thread per logical core
+internal TP_ThreadPool *tp_make_thread_pool(Arena *arena, int thread_count);
+
+internal void tp_release_thread_pool(TP_ThreadPool *pool);
+
+// Runs func for every task_idx in [0, task_count) and returns when all tasks are done.
+// Passing pool = 0 runs all tasks on the calling thread.
+internal void tp_parallel_for(TP_ThreadPool *pool, int task_count, TP_TaskFunc *func, void *user_data);
+
+// ==================================
+// Private helpers
+
+internal void tp_worker_main(void *worker_ptr);
+
+internal void tp_run_tasks(TP_ThreadPool *pool, int thread_idx);
+
+#endif
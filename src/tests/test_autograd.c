@@ -15,10 +15,10 @@ T_TestResultList test_backward(Arena *arena) {
 
         ag_backward(z);
 
-        T_TestAssert(arena, &result, a->grad == z->grad);
-        T_TestAssert(arena, &result, z->grad == 1);
-        T_TestAssert(arena, &result, b->grad == c->value);
-        T_TestAssert(arena, &result, c->grad == b->value);
+        T_TestAssert(arena, &result, *a->grad == *z->grad);
+        T_TestAssert(arena, &result, *z->grad == 1);
+        T_TestAssert(arena, &result, *b->grad == *c->value);
+        T_TestAssert(arena, &result, *c->grad == *b->value);
     }
     {
         // z = a+a*a
@@ -28,8 +28,8 @@ T_TestResultList test_backward(Arena *arena) {
 
         ag_backward(z);
 
-        T_TestAssert(arena, &result, z->grad == 1);
-        T_TestAssert(arena, &result, a->grad == 1+2*a->value);
+        T_TestAssert(arena, &result, *z->grad == 1);
+        T_TestAssert(arena, &result, *a->grad == 1+2 * *a->value);
     }
     {
         // z = a - b
@@ -40,10 +40,45 @@ T_TestResultList test_backward(Arena *arena) {
 
         ag_backward(z);
 
-        T_TestAssert(arena, &result, z->grad == 1);
-        T_TestAssert(arena, &result, a->grad == 1);
-        T_TestAssert(arena, &result, b->grad == -1);
-        T_TestAssert(arena, &result, z->value == -10);
+        T_TestAssert(arena, &result, z->type == AG_ValueType_Sub);
+        T_TestAssert(arena, &result, *z->grad == 1);
+        T_TestAssert(arena, &result, *a->grad == 1);
+        T_TestAssert(arena, &result, *b->grad == -1);
+        T_TestAssert(arena, &result, *z->value == -10);
+    }
+    {
+        // z = a / b
+        AG_Value *a = ag_source(scratch.arena, 10);
+        AG_Value *b = ag_source(scratch.arena, 4);
+        AG_Value *z = ag_div(scratch.arena, a, b);
+        ag_backward(z);
+        T_TestAssert(arena, &result, z->type == AG_ValueType_Div && *z->value == 2.5);
+        T_TestAssert(arena, &result, *a->grad == 1 / *b->value);
+        T_TestAssert(arena, &result, *b->grad == -*a->value/(*b->value * *b->value));
+    }
+    {
+        // z = log(a) + tanh(a) + sigmoid(a) - a
+        AG_Value *a = ag_source(scratch.arena, 0.75);
+        AG_Value *z = ag_add(scratch.arena, ag_log(scratch.arena, a), ag_tanh(scratch.arena, a));
+        z = ag_sub(scratch.arena, ag_add(scratch.arena, z, ag_sigmoid(scratch.arena, a)), a);
+        ag_backward(z);
+        F64 x = *a->value, t = tanh(x), s = 1/(1+exp(-x));
+        T_TestAssert(arena, &result, fabs(*z->value - (log(x) + t + s - x)) < 1e-12);
+        T_TestAssert(arena, &result, fabs(*a->grad - (1/x + (1-t*t) + s*(1-s) - 1)) < 1e-12);
+
+        // sigmoid must not overflow for large negative inputs
+        T_TestAssert(arena, &result, *ag_sigmoid(scratch.arena, ag_source(scratch.arena, -1000))->value == 0);
+    }
+    {
+        // The pow fast paths must match the generic rule
+        F64 ks[] = {-1, 2, 3, 0.5, -2.5};
+        B32 all_match = 1;
+        for (int i = 0; i < ArrayCount(ks); ++i) {
+            AG_Value *a = ag_source(scratch.arena, 1.7);
+            ag_backward(ag_pow(scratch.arena, a, ks[i]));
+            if (fabs(*a->grad - ks[i]*pow(*a->value, ks[i]-1)) > 1e-12) all_match = 0;
+        }
+        T_TestAssert(arena, &result, all_match);
     }
     {
         // z = relu(a)
@@ -53,37 +88,323 @@ T_TestResultList test_backward(Arena *arena) {
         
         ag_backward(z);
 
-        T_TestAssert(arena, &result, z->grad == 1);
-        T_TestAssert(arena, &result, a->grad == 1);
+        T_TestAssert(arena, &result, *z->grad == 1);
+        T_TestAssert(arena, &result, *a->grad == 1);
 
         // zero grad
-        a->grad = 0;
-        z->grad = 0;
+        *a->grad = 0;
+        *z->grad = 0;
 
-        a->value = -10;
+        *a->value = -10;
         ag_backward(z);
         
-        T_TestAssert(arena, &result, z->grad == 1);
-        T_TestAssert(arena, &result, a->grad == 0);
+        T_TestAssert(arena, &result, *z->grad == 1);
+        T_TestAssert(arena, &result, *a->grad == 0);
     }
     {
         // z = pow(a, k)
         AG_Value *a = ag_source(scratch.arena, 10);
         AG_Value *z = ag_pow(scratch.arena, a, 3);
         ag_backward(z);
-        T_TestAssert(arena, &result, a->grad == 3*a->value*a->value);
-        T_TestAssert(arena, &result, z->value == 1000);
+        T_TestAssert(arena, &result, *a->grad == 3 * *a->value * *a->value);
+        T_TestAssert(arena, &result, *z->value == 1000);
+    }
+
+    scratch_end(scratch);
+    return result;
+}
+
+// segment(a, b) = [a*b, pow(a+b, 2)]
+internal
+AG_ValueArray test_checkpoint_segment(Arena *value_arena, Arena *array_arena, AG_ValueArray inputs, void *user_data) {
+    AG_Value *a = inputs.values[0];
+    AG_Value *b = inputs.values[1];
+    AG_ValueArray result = {0};
+    result.count = 2;
+    result.values = push_array(array_arena, AG_Value*, result.count);
+    result.values[0] = ag_mul(value_arena, a, b);
+    result.values[1] = ag_pow(value_arena, ag_add(value_arena, a, b), 2);
+    return result;
+}
+
+internal
+T_TestResultList test_checkpoint(Arena *arena) {
+    T_TestResultList result = {0};
+    
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // z = c*s0 + s1 where [s0, s1] = segment(a, b)
+    F64 raw[] = {3, 4};
+    AG_ValueArray inputs = ag_value_array_from_raw(scratch.arena, raw, ArrayCount(raw));
+    AG_Value *c = ag_source(scratch.arena, 5);
+
+    AG_ValueArray s = ag_checkpoint(scratch.arena, scratch.arena, test_checkpoint_segment, 0, inputs);
+    AG_Value *z = ag_add(scratch.arena, ag_mul(scratch.arena, c, s.values[0]), s.values[1]);
+
+    T_TestAssert(arena, &result, s.count == 2);
+    T_TestAssert(arena, &result, *z->value == 5*3*4 + 7*7);
+
+    ag_backward(z);
+
+    AG_Value *a = inputs.values[0], *b = inputs.values[1];
+    T_TestAssert(arena, &result, *a->grad == *c->value * *b->value + 2*(*a->value+*b->value));
+    T_TestAssert(arena, &result, *b->grad == *c->value * *a->value + 2*(*a->value+*b->value));
+    T_TestAssert(arena, &result, *c->grad == *a->value * *b->value);
+
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+T_TestResultList test_backward_parallel(Arena *arena) {
+    T_TestResultList result = {0};
+    
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+    TP_ThreadPool *pool = tp_make_thread_pool(scratch.arena, 4);
+
+    // A wide graph where many nodes share predecessors: 
+    // z = sum_ij relu(x_i*x_j + x_j) + sum_k pow(x_k, 2) + checkpointed segment
+    int x_count = 64;
+    AG_ValueArray x = ag_make_zero_value_array(scratch.arena, x_count);
+    for (int i = 0; i < x_count; ++i) *x.values[i]->value = sample_f64_in_range(-1, 1);
+
+    AG_Value *z = ag_source(scratch.arena, 0);
+    for (int i = 0; i < x_count; ++i) {
+        for (int j = 0; j < x_count; ++j) {
+            AG_Value *h = ag_add(scratch.arena, ag_mul(scratch.arena, x.values[i], x.values[j]), x.values[j]);
+            z = ag_add(scratch.arena, z, ag_relu(scratch.arena, h));
+        }
+        z = ag_add(scratch.arena, z, ag_pow(scratch.arena, x.values[i], 2));
+    }
+    AG_ValueArray s = ag_checkpoint(scratch.arena, scratch.arena, test_checkpoint_segment, 0, x);
+    z = ag_add(scratch.arena, z, ag_mul(scratch.arena, s.values[0], s.values[1]));
+
+    ag_backward(z);
+    F64 *expected = push_array(scratch.arena, F64, x_count);
+    for (int i = 0; i < x_count; ++i) expected[i] = *x.values[i]->grad;
+
+    // Interior grads are accumulated too, so zero every node before running again
+    AG_Graph graph = ag_graph_capture(scratch.arena, z);
+    for (int i = 0; i < graph.count; ++i) *graph.nodes[i]->grad = 0;
+
+    ag_backward_parallel(z, pool);
+    F64 *first_run = push_array(scratch.arena, F64, x_count);
+    B32 matches_serial = 1;
+    for (int i = 0; i < x_count; ++i) {
+        first_run[i] = *x.values[i]->grad;
+        if (fabs(first_run[i] - expected[i]) > 1e-9) matches_serial = 0;
+    }
+    T_TestAssert(arena, &result, matches_serial);
+
+    for (int i = 0; i < graph.count; ++i) *graph.nodes[i]->grad = 0;
+    ag_backward_parallel(z, pool);
+    B32 is_deterministic = 1;
+    for (int i = 0; i < x_count; ++i) {
+        if (*x.values[i]->grad != first_run[i]) is_deterministic = 0;
+    }
+    T_TestAssert(arena, &result, is_deterministic);
+
+    tp_release_thread_pool(pool);
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+T_TestResultList test_graph_stats(Arena *arena) {
+    T_TestResultList result = {0};
+    
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // z = a + b*c + a
+    AG_Value *a = ag_source(scratch.arena, 1);
+    AG_Value *b = ag_source(scratch.arena, 2);
+    AG_Value *c = ag_source(scratch.arena, 3);
+    AG_Value *z = ag_add(scratch.arena, ag_add(scratch.arena, a, ag_mul(scratch.arena, b, c)), a);
+
+    AG_GraphStats stats = ag_graph_stats(z, scratch.arena, 0);
+    T_TestAssert(arena, &result, stats.node_count == 6);
+    T_TestAssert(arena, &result, stats.node_counts[AG_ValueType_Source] == 3);
+    T_TestAssert(arena, &result, stats.node_counts[AG_ValueType_Add] == 2);
+    T_TestAssert(arena, &result, stats.node_counts[AG_ValueType_Mul] == 1);
+    T_TestAssert(arena, &result, stats.edge_count == 6);
+    T_TestAssert(arena, &result, stats.max_depth == 3);
+    T_TestAssert(arena, &result, stats.value_arena_bytes >= stats.graph_bytes);
+
+    AG_BackwardProfile profile = {0};
+    ag_backward_profiled(z, &profile);
+    T_TestAssert(arena, &result, profile.op_calls[AG_ValueType_Source] == 3);
+    T_TestAssert(arena, &result, profile.op_calls[AG_ValueType_Add] == 2);
+    T_TestAssert(arena, &result, profile.op_calls[AG_ValueType_Mul] == 1);
+    T_TestAssert(arena, &result, *a->grad == 2 && *b->grad == *c->value);
+
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+T_TestResultList test_graph_rewrite(Arena *arena) {
+    T_TestResultList result = {0};
+    
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    {
+        // a + b*(-1) collapses into a single native sub
+        AG_Value *a = ag_source(scratch.arena, 10);
+        AG_Value *b = ag_source(scratch.arena, 4);
+        AG_Value *z = ag_add(scratch.arena, a, ag_mul(scratch.arena, b, ag_constant(scratch.arena, -1)));
+
+        AG_RewriteResult rewrite = ag_graph_rewrite(scratch.arena, z);
+        T_TestAssert(arena, &result, rewrite.root->type == AG_ValueType_Sub);
+        T_TestAssert(arena, &result, rewrite.removed_node_count == 2);
+        T_TestAssert(arena, &result, *rewrite.root->value == *z->value);
+
+        ag_backward(rewrite.root);
+        T_TestAssert(arena, &result, *a->grad == 1 && *b->grad == -1);
+    }
+    {
+        // (2*3 + a) * (a/b) + (2*3 + a) * (a/b): folds 2*3, collapses the div and dedupes the product
+        AG_Value *a = ag_source(scratch.arena, 3);
+        AG_Value *b = ag_source(scratch.arena, 2);
+        AG_Value *terms[2];
+        for (int i = 0; i < 2; ++i) {
+            AG_Value *six = ag_mul(scratch.arena, ag_constant(scratch.arena, 2), ag_constant(scratch.arena, 3));
+            terms[i] = ag_mul(scratch.arena, ag_add(scratch.arena, six, a), ag_div(scratch.arena, a, b));
+        }
+        AG_Value *z = ag_add(scratch.arena, terms[0], terms[1]);
+
+        ag_backward(z);
+        F64 expected_a_grad = *a->grad, expected_b_grad = *b->grad;
+        *a->grad = 0;
+        *b->grad = 0;
+
+        AG_RewriteResult rewrite = ag_graph_rewrite(scratch.arena, z);
+        // a, b, 6, add, div, mul, add
+        T_TestAssert(arena, &result, rewrite.node_count_after == 7);
+        T_TestAssert(arena, &result, rewrite.removed_node_count == rewrite.node_count_before - 7);
+        T_TestAssert(arena, &result, rewrite.deduplicated_count > 0);
+        T_TestAssert(arena, &result, rewrite.folded_constant_count > 0);
+        T_TestAssert(arena, &result, *rewrite.root->value == *z->value);
+
+        ag_backward(rewrite.root);
+        T_TestAssert(arena, &result, fabs(*a->grad - expected_a_grad) < 1e-12);
+        T_TestAssert(arena, &result, fabs(*b->grad - expected_b_grad) < 1e-12);
+    }
+    {
+        // Two copies of a + b*(-1) feed a checkpointed block and a mul: the rewrite reaches below
+        // the block, so both become the same sub, which the rebuilt block and the mul share
+        AG_Value *a = ag_source(scratch.arena, 10);
+        AG_Value *b = ag_source(scratch.arena, 4);
+        AG_Value *d[2];
+        for (int i = 0; i < 2; ++i) d[i] = ag_add(scratch.arena, a, ag_mul(scratch.arena, b, ag_constant(scratch.arena, -1)));
+        AG_ValueArray inputs = {d, 2};
+        AG_ValueArray s = ag_checkpoint(scratch.arena, scratch.arena, test_checkpoint_segment, 0, inputs);
+        AG_Value *z = ag_add(scratch.arena, ag_add(scratch.arena, s.values[0], s.values[1]), ag_mul(scratch.arena, d[0], d[1]));
+
+        ag_backward(z);
+        F64 expected_a_grad = *a->grad, expected_b_grad = *b->grad;
+        *a->grad = 0;
+        *b->grad = 0;
+
+        AG_RewriteResult rewrite = ag_graph_rewrite(scratch.arena, z);
+        // a, b, sub, block, 2 block outputs, add, mul, add
+        T_TestAssert(arena, &result, rewrite.node_count_before == 14 && rewrite.node_count_after == 9);
+        T_TestAssert(arena, &result, rewrite.removed_node_count == 5 && rewrite.deduplicated_count > 0);
+        T_TestAssert(arena, &result, *rewrite.root->value == *z->value);
+
+        ag_backward(rewrite.root);
+        T_TestAssert(arena, &result, fabs(*a->grad - expected_a_grad) < 1e-12);
+        T_TestAssert(arena, &result, fabs(*b->grad - expected_b_grad) < 1e-12);
     }
 
     scratch_end(scratch);
     return result;
 }
 
+internal
+T_TestResultList test_forward_mode(Arena *arena) {
+    T_TestResultList result = {0};
+    
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    F64 raw[] = {0.5, 2};
+    AG_ValueArray inputs = ag_value_array_from_raw(scratch.arena, raw, ArrayCount(raw));
+    AG_Value *x = inputs.values[0], *y = inputs.values[1];
+
+    // z = exp(x*y) + x^3 - relu(y)/x + s0*s1 where [s0, s1] = checkpointed segment(x, y)
+    F64 direction[] = {0.25, -3};
+    ag_set_tangents(inputs, direction);
+    AG_Value *z = ag_add(scratch.arena, ag_exp(scratch.arena, ag_mul(scratch.arena, x, y)), ag_pow(scratch.arena, x, 3));
+    z = ag_sub(scratch.arena, z, ag_div(scratch.arena, ag_relu(scratch.arena, y), x));
+    AG_ValueArray s = ag_checkpoint(scratch.arena, scratch.arena, test_checkpoint_segment, 0, inputs);
+    z = ag_add(scratch.arena, z, ag_mul(scratch.arena, s.values[0], s.values[1]));
+
+    // The JVP must match the reverse mode gradient dotted with the direction
+    ag_backward(z);
+    F64 expected = *x->grad*direction[0] + *y->grad*direction[1];
+    T_TestAssert(arena, &result, fabs(z->tangent - expected) < 1e-9);
+
+    // Leaves without a seeded tangent don't contribute
+    ag_set_tangents(inputs, 0);
+    AG_Value *w = ag_mul(scratch.arena, x, y);
+    T_TestAssert(arena, &result, w->tangent == 0);
+
+    scratch_end(scratch);
+    return result;
+}
+
+internal
+T_TestResultList test_hessian_vector_product(Arena *arena) {
+    T_TestResultList result = {0};
+    
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // f = x^3*y + exp(x*y) - y/x
+    F64 raw[] = {0.5, 2};
+    AG_ValueArray params = ag_value_array_from_raw(scratch.arena, raw, ArrayCount(raw));
+    AG_Value *x = params.values[0], *y = params.values[1];
+    AG_Value *f = ag_add(scratch.arena, ag_mul(scratch.arena, ag_pow(scratch.arena, x, 3), y), ag_exp(scratch.arena, ag_mul(scratch.arena, x, y)));
+    f = ag_sub(scratch.arena, f, ag_div(scratch.arena, y, x));
+
+    F64 X = raw[0], Y = raw[1], E = exp(X*Y);
+
+    AG_ValueArray grads = ag_backward_create_graph(scratch.arena, f, params);
+    T_TestAssert(arena, &result, fabs(*grads.values[0]->value - (3*X*X*Y + Y*E + Y/(X*X))) < 1e-9);
+    T_TestAssert(arena, &result, fabs(*grads.values[1]->value - (X*X*X + X*E - 1/X)) < 1e-9);
+
+    F64 f_xx = 6*X*Y + Y*Y*E - 2*Y/(X*X*X);
+    F64 f_xy = 3*X*X + E + X*Y*E + 1/(X*X);
+    F64 f_yy = X*X*E;
+    ag_backward(f); // stale grads must not leak into the HVP
+
+    F64 v[] = {1.5, -0.5};
+    F64 hv[2];
+    T_TestAssert(arena, &result, ag_hessian_vector_product(scratch.arena, f, params, v, hv));
+    T_TestAssert(arena, &result, fabs(hv[0] - (f_xx*v[0] + f_xy*v[1])) < 1e-9);
+    T_TestAssert(arena, &result, fabs(hv[1] - (f_xy*v[0] + f_yy*v[1])) < 1e-9);
+
+    // Blocks can't be differentiated twice, which is reported instead of silently dropping their terms
+    AG_ValueArray s = ag_checkpoint(scratch.arena, scratch.arena, test_checkpoint_segment, 0, params);
+    AG_Value *g = ag_mul(scratch.arena, s.values[0], s.values[1]);
+    T_TestAssert(arena, &result, ag_backward_create_graph(scratch.arena, g, params).values == 0);
+    F64 untouched_hv[2] = {7, 7};
+    T_TestAssert(arena, &result, !ag_hessian_vector_product(scratch.arena, g, params, v, untouched_hv));
+    T_TestAssert(arena, &result, untouched_hv[0] == 7 && untouched_hv[1] == 7);
+
+    scratch_end(scratch);
+    return result;
+}
+
 internal
 T_TestResultList test_autograd(Arena *arena) {
     T_TestResultList results = {0};
 
     T_RunTest(arena, &results, test_backward);
+    T_RunTest(arena, &results, test_checkpoint);
+    T_RunTest(arena, &results, test_backward_parallel);
+    T_RunTest(arena, &results, test_graph_stats);
+    T_RunTest(arena, &results, test_graph_rewrite);
+    T_RunTest(arena, &results, test_forward_mode);
+    T_RunTest(arena, &results, test_hessian_vector_product);
 
     return results;
 }
@@ -0,0 +1,181 @@
+T_TestResultList test_model_checkpoint_mlp(Arena *arena) {
+    T_TestResultList test_results = {0};
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+    char *path = "test_checkpoint_mlp.ckpt";
+
+    int output_dims[] = {5, 2};
+    NN_MLP mlp = nn_make_mlp_with_random_init(scratch.arena, 3, output_dims, ArrayCount(output_dims));
+    int count = mlp.params.count;
+    OPT_Optimizer opt = opt_make_optimizer(scratch.arena, opt_adam_config(0.01), count, 0);
+    F64 *grads = push_array(scratch.arena, F64, count);
+    for (int i = 0; i < count; ++i) grads[i] = sin(0.7*i);
+    for (int step = 0; step < 2; ++step) opt_step(&opt, mlp.params.values, grads);
+
+    T_TestAssert(arena, &test_results, ck_save_mlp(path, &mlp, &opt));
+
+    CK_Checkpoint checkpoint = ck_open(path);
+    NN_MLP loaded = {0};
+    OPT_Optimizer loaded_opt = {0};
+    T_TestAssert(arena, &test_results, ck_load_mlp(scratch.arena, &checkpoint, &loaded, &loaded_opt, 0));
+    T_TestAssert(arena, &test_results, loaded.layer_count == mlp.layer_count && loaded.params.count == count);
+    T_TestAssert(arena, &test_results, loaded.layers[0].neurons[0].has_relu && !loaded.layers[1].neurons[0].has_relu);
+    T_TestAssert(arena, &test_results, memcmp(loaded.params.values, mlp.params.values, count*sizeof(F64)) == 0);
+    T_TestAssert(arena, &test_results, loaded.params.values == checkpoint.image.params);
+    B32 leaves_match = 1;
+    for (int i = 0; i < count; ++i) {
+        if (loaded.params.leaves[i]->value != &loaded.params.values[i]) leaves_match = 0;
+    }
+    T_TestAssert(arena, &test_results, leaves_match);
+    T_TestAssert(arena, &test_results, loaded_opt.config.kind == OPT_Kind_Adam && loaded_opt.step_count == 2);
+    T_TestAssert(arena, &test_results, memcmp(loaded_opt.m, opt.m, count*sizeof(F64)) == 0 && memcmp(loaded_opt.v, opt.v, count*sizeof(F64)) == 0);
+
+    // Training resumes exactly where it stopped, and never writes through to the file
+    opt_step(&opt, mlp.params.values, grads);
+    opt_step(&loaded_opt, loaded.params.values, grads);
+    T_TestAssert(arena, &test_results, memcmp(loaded.params.values, mlp.params.values, count*sizeof(F64)) == 0);
+    CK_Checkpoint reopened = ck_open(path);
+    T_TestAssert(arena, &test_results, reopened.image.data && reopened.image.header->step_count == 2);
+    T_TestAssert(arena, &test_results, memcmp(reopened.image.params, loaded.params.values, count*sizeof(F64)) != 0);
+
+    // Without an optimizer, the optimizer is left zeroed
+    T_TestAssert(arena, &test_results, ck_save_mlp(path, &mlp, 0));
+    CK_Checkpoint no_opt = ck_open(path);
+    OPT_Optimizer no_opt_opt = opt;
+    T_TestAssert(arena, &test_results, ck_load_mlp(scratch.arena, &no_opt, &loaded, &no_opt_opt, 0));
+    T_TestAssert(arena, &test_results, no_opt_opt.param_count == 0 && no_opt_opt.m == 0 && no_opt_opt.v == 0);
+    T_TestAssert(arena, &test_results, no_opt.image.size < checkpoint.image.size);
+
+    ck_close(&no_opt);
+    ck_close(&reopened);
+    ck_close(&checkpoint);
+    remove(path);
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_model_checkpoint_small_cnn(Arena *arena) {
+    T_TestResultList test_results = {0};
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+    char *path = "test_checkpoint_small_cnn.ckpt";
+
+    int num_classes = 3;
+    NN_SmallCNN cnn = nn_make_small_cnn(scratch.arena, num_classes);
+    OPT_Optimizer opt = opt_make_optimizer(scratch.arena, opt_sgd_config(0.1, 0.9, 1), cnn.params.count, 0);
+    opt.step_count = 7;
+    T_TestAssert(arena, &test_results, ck_save_small_cnn(path, &cnn, &opt));
+
+    CK_Checkpoint checkpoint = ck_open(path);
+    NN_SmallCNN loaded = {0};
+    OPT_Optimizer loaded_opt = {0};
+    T_TestAssert(arena, &test_results, ck_load_small_cnn(scratch.arena, &checkpoint, &loaded, &loaded_opt, 0));
+    T_TestAssert(arena, &test_results, loaded_opt.config.kind == OPT_Kind_SGD && loaded_opt.config.nesterov && loaded_opt.step_count == 7);
+    T_TestAssert(arena, &test_results, loaded_opt.m != 0 && loaded_opt.v == 0);
+
+    int batch_count = 2, in_h = 8, in_w = 8;
+    F64 *x = push_array(scratch.arena, F64, batch_count*in_h*in_w);
+    for (int i = 0; i < batch_count*in_h*in_w; ++i) x[i] = cos(0.3*i);
+    NN_SmallCNNBatch expected = nn_small_cnn_apply_batch(scratch.arena, &cnn, x, batch_count, in_h, in_w, 0);
+    NN_SmallCNNBatch actual = nn_small_cnn_apply_batch(scratch.arena, &loaded, x, batch_count, in_h, in_w, 0);
+    T_TestAssert(arena, &test_results, memcmp(expected.logits, actual.logits, batch_count*num_classes*sizeof(F64)) == 0);
+
+    // The wrong model kind is rejected
+    NN_MLP mlp = {0};
+    T_TestAssert(arena, &test_results, !ck_load_mlp(scratch.arena, &checkpoint, &mlp, 0, 0));
+    ck_close(&checkpoint);
+
+    // So are truncated files and files that aren't checkpoints
+    {
+        CK_Image image = ck_make_small_cnn_image(scratch.arena, &cnn, 0);
+        image.size -= sizeof(F64);
+        T_TestAssert(arena, &test_results, ck_write_image(&image, path));
+        CK_Checkpoint truncated = ck_open(path);
+        T_TestAssert(arena, &test_results, truncated.image.data == 0 && truncated.map.data == 0);
+
+        // A failed save doesn't leave its temporary file behind (a directory can't be replaced)
+        T_TestAssert(arena, &test_results, !ck_write_image(&image, "."));
+        FILE *temp_file = fopen("." CK_TEMP_SUFFIX, "rb");
+        T_TestAssert(arena, &test_results, temp_file == 0);
+        if (temp_file) fclose(temp_file);
+
+        char junk[256] = "not a checkpoint";
+        T_TestAssert(arena, &test_results, os_write_entire_file(path, junk, sizeof(junk), 0));
+        CK_Checkpoint not_checkpoint = ck_open(path);
+        T_TestAssert(arena, &test_results, not_checkpoint.image.data == 0);
+    }
+    remove(path);
+
+    CK_Checkpoint missing = ck_open(path);
+    T_TestAssert(arena, &test_results, missing.image.data == 0);
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_model_checkpoint_async(Arena *arena) {
+    T_TestResultList test_results = {0};
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+    char *path = "test_checkpoint_async.ckpt";
+
+    int output_dims[] = {16, 4};
+    NN_MLP mlp = nn_make_mlp_with_random_init(scratch.arena, 8, output_dims, ArrayCount(output_dims));
+    int count = mlp.params.count;
+    OPT_Optimizer opt = opt_make_optimizer(scratch.arena, opt_adamw_config(0.01, 0.01), count, 0);
+    F64 *grads = push_array(scratch.arena, F64, count);
+    for (int i = 0; i < count; ++i) grads[i] = sin(0.3*i);
+
+    CK_Image image = ck_make_mlp_image(scratch.arena, &mlp, &opt);
+    CK_AsyncWriter *writer = ck_make_async_writer(scratch.arena, &image, path);
+
+    // Keep training while the snapshots are written. Every capture is either written or
+    // superseded by a later one, and the file ends up holding the last one.
+    int step_count = 50;
+    for (int step = 0; step < step_count; ++step) {
+        opt_step(&opt, mlp.params.values, grads);
+        ck_async_writer_capture(writer, &mlp.params, &opt);
+    }
+    F64 *last_values = push_array(scratch.arena, F64, count);
+    MemoryCopy(last_values, mlp.params.values, count*sizeof(F64));
+    opt_step(&opt, mlp.params.values, grads); // not captured
+    ck_async_writer_flush(writer);
+    T_TestAssert(arena, &test_results, writer->failed_count == 0 && writer->written_count >= 1);
+    T_TestAssert(arena, &test_results, writer->written_count + writer->dropped_count == (U64)step_count);
+
+    CK_Checkpoint checkpoint = ck_open(path);
+    T_TestAssert(arena, &test_results, checkpoint.image.data && checkpoint.image.header->step_count == (U64)step_count);
+    T_TestAssert(arena, &test_results, checkpoint.image.data && memcmp(checkpoint.image.params, last_values, count*sizeof(F64)) == 0);
+    ck_close(&checkpoint);
+
+    // The temporary file was renamed over the checkpoint
+    FILE *temp_file = fopen("test_checkpoint_async.ckpt" CK_TEMP_SUFFIX, "rb");
+    T_TestAssert(arena, &test_results, temp_file == 0);
+    if (temp_file) fclose(temp_file);
+
+    // A capture right before the release is still written
+    ck_async_writer_capture(writer, &mlp.params, &opt);
+    ck_release_async_writer(writer);
+    checkpoint = ck_open(path);
+    T_TestAssert(arena, &test_results, checkpoint.image.data && checkpoint.image.header->step_count == (U64)step_count+1);
+    T_TestAssert(arena, &test_results, checkpoint.image.data && memcmp(checkpoint.image.params, mlp.params.values, count*sizeof(F64)) == 0);
+    ck_close(&checkpoint);
+    remove(path);
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_model_checkpoints(Arena *arena) {
+    T_TestResultList test_results = {0};
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    T_RunTest(arena, &test_results, test_model_checkpoint_mlp);
+    T_RunTest(arena, &test_results, test_model_checkpoint_small_cnn);
+    T_RunTest(arena, &test_results, test_model_checkpoint_async);
+
+    scratch_end(scratch);
+    return test_results;
+}
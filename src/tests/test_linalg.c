@@ -0,0 +1,162 @@
+T_TestResultList test_gemm(Arena *arena) {
+    T_TestResultList test_results = {0};
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // Sizes that aren't multiples of the micro-kernel or the blocks, and k spanning two KC panels
+    int m = 70, n = 37, k = LA_KC + 19;
+    F64 *a = push_array(scratch.arena, F64, m*k);
+    F64 *b = push_array(scratch.arena, F64, k*n);
+    F64 *c_init = push_array(scratch.arena, F64, m*n);
+    for (int i = 0; i < m*k; ++i) a[i] = sin(0.3*i);
+    for (int i = 0; i < k*n; ++i) b[i] = cos(0.7*i);
+    for (int i = 0; i < m*n; ++i) c_init[i] = 0.01*i;
+
+    F64 *c = push_array(scratch.arena, F64, m*n);
+    F64 *c_expected = push_array(scratch.arena, F64, m*n);
+    for (int transpose = 0; transpose < 4; ++transpose) {
+        B32 transpose_a = transpose & 1;
+        B32 transpose_b = (transpose >> 1) & 1;
+        int lda = transpose_a ? m : k;
+        int ldb = transpose_b ? k : n;
+        F64 betas[] = {0, 1, 0.5};
+        for (int beta_idx = 0; beta_idx < ArrayCount(betas); ++beta_idx) {
+            F64 beta = betas[beta_idx];
+            ArrayCopy(c, c_init, m*n);
+            ArrayCopy(c_expected, c_init, m*n);
+            la_gemm(0, transpose_a, transpose_b, m, n, k, 2, a, lda, b, ldb, beta, c, n);
+            la_gemm_naive(transpose_a, transpose_b, m, n, k, 2, a, lda, b, ldb, beta, c_expected, n);
+            B32 matches = 1;
+            for (int i = 0; i < m*n; ++i) {
+                if (fabs(c[i] - c_expected[i]) > 1e-9) matches = 0;
+            }
+            T_TestAssert(arena, &test_results, matches);
+        }
+    }
+
+    // Sub-matrix strides: C's top-left 3x2 block of a 5-wide C
+    {
+        F64 a_small[] = {1, 2,
+                         3, 4,
+                         5, 6};
+        F64 b_small[] = {1, 0,
+                         0, 1};
+        F64 c_small[15] = {0};
+        for (int i = 0; i < 15; ++i) c_small[i] = -1;
+        la_gemm(0, 0, 0, 3, 2, 2, 1, a_small, 2, b_small, 2, 0, c_small, 5);
+        T_TestAssert(arena, &test_results, c_small[0] == 1 && c_small[1] == 2 && c_small[2] == -1);
+        T_TestAssert(arena, &test_results, c_small[10] == 5 && c_small[11] == 6 && c_small[14] == -1);
+    }
+
+    // Threaded must match serial bit for bit
+    {
+        TP_ThreadPool *pool = tp_make_thread_pool(scratch.arena, 4);
+        F64 *c_threaded = push_array(scratch.arena, F64, m*n);
+        la_gemm(0, 0, 0, m, n, k, 1, a, k, b, n, 0, c, n);
+        la_gemm(pool, 0, 0, m, n, k, 1, a, k, b, n, 0, c_threaded, n);
+        T_TestAssert(arena, &test_results, memcmp(c, c_threaded, m*n*sizeof(F64)) == 0);
+        tp_release_thread_pool(pool);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_gemm_f32(Arena *arena) {
+    T_TestResultList test_results = {0};
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // Against the F64 reference on the same (F32-representable) inputs
+    int m = 70, n = 45, k = LA_KC + 19;
+    F32 *a = push_array(scratch.arena, F32, m*k);
+    F32 *b = push_array(scratch.arena, F32, k*n);
+    F64 *a64 = push_array(scratch.arena, F64, m*k);
+    F64 *b64 = push_array(scratch.arena, F64, k*n);
+    for (int i = 0; i < m*k; ++i) a64[i] = a[i] = (F32)sin(0.3*i);
+    for (int i = 0; i < k*n; ++i) b64[i] = b[i] = (F32)cos(0.7*i);
+
+    F32 *c = push_array(scratch.arena, F32, m*n);
+    F64 *c_expected = push_array(scratch.arena, F64, m*n);
+    for (int transpose = 0; transpose < 4; ++transpose) {
+        B32 transpose_a = transpose & 1;
+        B32 transpose_b = (transpose >> 1) & 1;
+        int lda = transpose_a ? m : k;
+        int ldb = transpose_b ? k : n;
+        for (int i = 0; i < m*n; ++i) c_expected[i] = c[i] = (F32)(0.01*i);
+        la_gemm_f32(0, transpose_a, transpose_b, m, n, k, 2, a, lda, b, ldb, 0.5f, c, n);
+        la_gemm_naive(transpose_a, transpose_b, m, n, k, 2, a64, lda, b64, ldb, 0.5, c_expected, n);
+        B32 matches = 1;
+        for (int i = 0; i < m*n; ++i) {
+            if (fabs(c[i] - c_expected[i]) > 1e-3) matches = 0;
+        }
+        T_TestAssert(arena, &test_results, matches);
+    }
+
+    // Threaded must match serial bit for bit
+    {
+        TP_ThreadPool *pool = tp_make_thread_pool(scratch.arena, 4);
+        F32 *c_threaded = push_array(scratch.arena, F32, m*n);
+        la_gemm_f32(0, 0, 0, m, n, k, 1, a, k, b, n, 0, c, n);
+        la_gemm_f32(pool, 0, 0, m, n, k, 1, a, k, b, n, 0, c_threaded, n);
+        T_TestAssert(arena, &test_results, memcmp(c, c_threaded, m*n*sizeof(F32)) == 0);
+        tp_release_thread_pool(pool);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_gemm_s8(Arena *arena) {
+    T_TestResultList test_results = {0};
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // Odd sizes and strides, so both the SIMD body and the scalar tails run. Includes -127 and 127.
+    int m = LA_MC + 7, n = 2*LA_NR_S8 + 3, k = 37;
+    int lda = k + 5, ldb = k + 2, ldc = n + 1;
+    I8 *a = push_array(scratch.arena, I8, m*lda);
+    I8 *b = push_array(scratch.arena, I8, n*ldb);
+    for (int i = 0; i < m*lda; ++i) a[i] = (I8)((i*37) % 255 - 127);
+    for (int i = 0; i < n*ldb; ++i) b[i] = (I8)((i*91 + 13) % 255 - 127);
+
+    I32 *c = push_array(scratch.arena, I32, m*ldc);
+    la_gemm_s8(0, m, n, k, a, lda, b, ldb, c, ldc);
+    B32 matches = 1;
+    for (int i = 0; i < m; ++i) {
+        for (int j = 0; j < n; ++j) {
+            I32 expected = 0;
+            for (int p = 0; p < k; ++p) expected += (I32)a[i*lda + p]*b[j*ldb + p];
+            if (c[i*ldc + j] != expected) matches = 0;
+        }
+    }
+    T_TestAssert(arena, &test_results, matches);
+
+    {
+        TP_ThreadPool *pool = tp_make_thread_pool(scratch.arena, 4);
+        I32 *c_threaded = push_array(scratch.arena, I32, m*ldc);
+        la_gemm_s8(pool, m, n, k, a, lda, b, ldb, c_threaded, ldc);
+        B32 threaded_matches = 1;
+        for (int i = 0; i < m; ++i) {
+            if (memcmp(c + i*ldc, c_threaded + i*ldc, n*sizeof(I32)) != 0) threaded_matches = 0;
+        }
+        T_TestAssert(arena, &test_results, threaded_matches);
+        tp_release_thread_pool(pool);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_linalg(Arena *arena) {
+    T_TestResultList test_results = {0};
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    T_RunTest(arena, &test_results, test_gemm);
+    T_RunTest(arena, &test_results, test_gemm_f32);
+    T_RunTest(arena, &test_results, test_gemm_s8);
+
+    scratch_end(scratch);
+    return test_results;
+}
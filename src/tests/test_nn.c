@@ -18,7 +18,7 @@ T_TestResultList test_neuron(Arena *arena) {
 
     F64 weighted_sum = bias;
     for (int i = 0; i < input_dim; ++i) weighted_sum += weights[i]*x_raw[i];
-    T_TestAssert(arena, &test_results, n_result->value == weighted_sum);
+    T_TestAssert(arena, &test_results, *n_result->value == weighted_sum);
 
     scratch_end(scratch);
     return test_results;
@@ -51,8 +51,8 @@ T_TestResultList test_layer(Arena *arena) {
         expected[0] += x_raw[i] * w0_raw[i];
         expected[1] += x_raw[i] * w1_raw[i];
     } 
-    T_TestAssert(arena, &test_results, lresult.values[0]->value == expected[0]);
-    T_TestAssert(arena, &test_results, lresult.values[1]->value == expected[1]);
+    T_TestAssert(arena, &test_results, *lresult.values[0]->value == expected[0]);
+    T_TestAssert(arena, &test_results, *lresult.values[1]->value == expected[1]);
 
 
     scratch_end(scratch);
@@ -77,6 +77,227 @@ T_TestResultList test_mlp(Arena *arena) {
     return test_results;
 }
 
+T_TestResultList test_params(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    int layer_dims[] = {4,2};
+    NN_MLP mlp = nn_make_mlp_with_random_init(scratch.arena, 3, layer_dims, ArrayCount(layer_dims));
+    NN_Params *params = &mlp.params;
+    AG_ValueArray leaves = nn_mlp_get_params(scratch.arena, &mlp);
+
+    T_TestAssert(arena, &test_results, params->count == leaves.count && params->count == (3+1)*4 + (4+1)*2);
+    B32 values_match = 1;
+    for (int i = 0; i < params->count; ++i) {
+        if (params->values[i] != *leaves.values[i]->value || params->leaves[i] != leaves.values[i]) values_match = 0;
+    }
+    T_TestAssert(arena, &test_results, values_match);
+
+    F64 x_raw[] = {1,2,3};
+    AG_ValueArray x = ag_value_array_from_raw(scratch.arena, x_raw, ArrayCount(x_raw));
+
+    // The leaves are views into the blocks: grads of two backward passes accumulate straight into
+    // the grad block, and the leaves read what's written to the value block
+    nn_params_zero_grad(params);
+    F64 *first_grads = push_array(scratch.arena, F64, params->count);
+    for (int pass = 0; pass < 2; ++pass) {
+        AG_ValueArray y = nn_mlp_apply(scratch.arena, scratch.arena, &mlp, x);
+        ag_backward(ag_add(scratch.arena, y.values[0], y.values[1]));
+        if (pass == 0) ArrayCopy(first_grads, params->grads, params->count);
+    }
+    B32 grads_match = 1;
+    for (int i = 0; i < params->count; ++i) {
+        if (params->grads[i] != 2*first_grads[i] || leaves.values[i]->grad != &params->grads[i]) grads_match = 0;
+    }
+    T_TestAssert(arena, &test_results, grads_match);
+
+    params->values[0] = 42;
+    T_TestAssert(arena, &test_results, *leaves.values[0]->value == 42);
+
+    nn_params_zero_grad(params);
+    T_TestAssert(arena, &test_results, params->grads[0] == 0);
+
+    // A model built on the block computes the same thing, without copying it
+    {
+        NN_MLP on_values = nn_make_mlp_on_values(scratch.arena, 3, layer_dims, ArrayCount(layer_dims), params->values);
+        T_TestAssert(arena, &test_results, on_values.params.count == params->count && on_values.params.values == params->values);
+        T_TestAssert(arena, &test_results, on_values.layers[0].neurons[0].has_relu && !on_values.layers[1].neurons[0].has_relu);
+        AG_ValueArray expected = nn_mlp_apply(scratch.arena, scratch.arena, &mlp, x);
+        AG_ValueArray actual = nn_mlp_apply(scratch.arena, scratch.arena, &on_values, x);
+        T_TestAssert(arena, &test_results, *actual.values[0]->value == *expected.values[0]->value && *actual.values[1]->value == *expected.values[1]->value);
+
+        NN_MLP zeroed = nn_make_mlp_on_values(scratch.arena, 3, layer_dims, ArrayCount(layer_dims), 0);
+        B32 is_zero = 1;
+        for (int i = 0; i < zeroed.params.count; ++i) {
+            if (zeroed.params.values[i] != 0 || *zeroed.params.leaves[i]->value != 0) is_zero = 0;
+        }
+        T_TestAssert(arena, &test_results, is_zero);
+    }
+
+    NN_SmallCNN cnn = nn_make_small_cnn(scratch.arena, 10);
+    int expected_cnn_param_count = (1*16*9+16) + (16*32*9+32) + (32+1)*10;
+    T_TestAssert(arena, &test_results, cnn.params.count == expected_cnn_param_count);
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_mlp_batch(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    int input_dim = 3;
+    int layer_dims[] = {5,4,2};
+    NN_MLP mlp = nn_make_mlp_with_random_init(scratch.arena, input_dim, layer_dims, ArrayCount(layer_dims));
+    NN_Params *params = &mlp.params;
+
+    int batch_count = 7;
+    F64 *x = push_array(scratch.arena, F64, batch_count*input_dim);
+    for (int i = 0; i < batch_count*input_dim; ++i) x[i] = sin(1.3*i);
+    F64 output_weights[] = {0.5, -2};
+
+    // Reference: one scalar graph per sample, loss = sum_n sum_o output_weights[o]*y[n][o]
+    F64 *expected_outputs = push_array(scratch.arena, F64, batch_count*2);
+    F64 *expected_input_grads = push_array(scratch.arena, F64, batch_count*input_dim);
+    nn_params_zero_grad(params);
+    for (int n = 0; n < batch_count; ++n) {
+        AG_ValueArray xn = ag_value_array_from_raw(scratch.arena, &x[n*input_dim], input_dim);
+        AG_ValueArray y = nn_mlp_apply(scratch.arena, scratch.arena, &mlp, xn);
+        AG_Value *loss = ag_add(scratch.arena, ag_mul(scratch.arena, y.values[0], ag_constant(scratch.arena, output_weights[0])),
+                                               ag_mul(scratch.arena, y.values[1], ag_constant(scratch.arena, output_weights[1])));
+        ag_backward(loss);
+        for (int o = 0; o < 2; ++o) expected_outputs[n*2 + o] = *y.values[o]->value;
+        for (int i = 0; i < input_dim; ++i) expected_input_grads[n*input_dim + i] = *xn.values[i]->grad;
+    }
+    F64 *expected_grads = push_array(scratch.arena, F64, params->count);
+    ArrayCopy(expected_grads, params->grads, params->count);
+
+    // Batched
+    nn_params_zero_grad(params);
+    NN_MLPBatch batch = nn_mlp_apply_batch(scratch.arena, &mlp, x, batch_count, 0);
+    F64 *output_grads = push_array(scratch.arena, F64, batch_count*2);
+    for (int n = 0; n < batch_count; ++n) ArrayCopy(&output_grads[n*2], output_weights, 2);
+    F64 *input_grads = push_array(scratch.arena, F64, batch_count*input_dim);
+    nn_mlp_backward_batch(&mlp, &batch, output_grads, input_grads, 0);
+
+    B32 outputs_match = 1;
+    for (int i = 0; i < batch_count*2; ++i) {
+        if (fabs(batch.output[i] - expected_outputs[i]) > 1e-12) outputs_match = 0;
+    }
+    T_TestAssert(arena, &test_results, outputs_match);
+
+    B32 grads_match = 1;
+    for (int i = 0; i < params->count; ++i) {
+        if (fabs(params->grads[i] - expected_grads[i]) > 1e-12) grads_match = 0;
+    }
+    T_TestAssert(arena, &test_results, grads_match);
+
+    B32 input_grads_match = 1;
+    for (int i = 0; i < batch_count*input_dim; ++i) {
+        if (fabs(input_grads[i] - expected_input_grads[i]) > 1e-12) input_grads_match = 0;
+    }
+    T_TestAssert(arena, &test_results, input_grads_match);
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_mlp_batch_f32(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    int input_dim = 6;
+    int layer_dims[] = {16,16,3};
+    NN_MLP mlp = nn_make_mlp_with_random_init(scratch.arena, input_dim, layer_dims, ArrayCount(layer_dims));
+    NN_Params *params = &mlp.params;
+
+    int batch_count = 9;
+    int output_count = batch_count*3;
+    F64 *x = push_array(scratch.arena, F64, batch_count*input_dim);
+    F32 *x32 = push_array(scratch.arena, F32, batch_count*input_dim);
+    for (int i = 0; i < batch_count*input_dim; ++i) x32[i] = (F32)(x[i] = sin(1.3*i));
+    F64 *output_grads = push_array(scratch.arena, F64, output_count);
+    F32 *output_grads32 = push_array(scratch.arena, F32, output_count);
+    for (int i = 0; i < output_count; ++i) output_grads32[i] = (F32)(output_grads[i] = cos(0.4*i));
+
+    // Against the F64 path
+    nn_params_zero_grad(params);
+    NN_MLPBatch batch = nn_mlp_apply_batch(scratch.arena, &mlp, x, batch_count, 0);
+    nn_mlp_backward_batch(&mlp, &batch, output_grads, 0, 0);
+    F64 *expected_grads = push_array(scratch.arena, F64, params->count);
+    ArrayCopy(expected_grads, params->grads, params->count);
+
+    nn_params_zero_grad(params);
+    NN_MLPBatchF32 batch32 = nn_mlp_apply_batch_f32(scratch.arena, &mlp, x32, batch_count, 0);
+    B32 is_finite = nn_mlp_backward_batch_f32(&mlp, &batch32, output_grads32, 1024, 0);
+    T_TestAssert(arena, &test_results, is_finite);
+
+    F64 max_output = 0, max_output_error = 0;
+    for (int i = 0; i < output_count; ++i) {
+        max_output = MD_Max(max_output, fabs(batch.output[i]));
+        max_output_error = MD_Max(max_output_error, fabs(batch32.output[i] - batch.output[i]));
+    }
+    T_TestAssert(arena, &test_results, max_output_error <= 1e-5*max_output);
+    F64 max_grad = 0, max_grad_error = 0;
+    for (int i = 0; i < params->count; ++i) {
+        max_grad = MD_Max(max_grad, fabs(expected_grads[i]));
+        max_grad_error = MD_Max(max_grad_error, fabs(params->grads[i] - expected_grads[i]));
+    }
+    T_TestAssert(arena, &test_results, max_grad_error <= 1e-5*max_grad);
+
+    // An overflowing loss scale is detected and leaves the grads alone
+    F32 *huge_output_grads = push_array(scratch.arena, F32, output_count);
+    for (int i = 0; i < output_count; ++i) huge_output_grads[i] = 1e30f;
+    nn_params_zero_grad(params);
+    is_finite = nn_mlp_backward_batch_f32(&mlp, &batch32, huge_output_grads, 1e20f, 0);
+    T_TestAssert(arena, &test_results, !is_finite && params->grads[0] == 0);
+
+    NN_LossScaler scaler = nn_make_loss_scaler(65536, 2);
+    nn_loss_scaler_update(&scaler, 0);
+    T_TestAssert(arena, &test_results, scaler.scale == 32768);
+    nn_loss_scaler_update(&scaler, 1);
+    nn_loss_scaler_update(&scaler, 1);
+    T_TestAssert(arena, &test_results, scaler.scale == 65536);
+
+    // Training with F64 master weights tracks F64 training
+    {
+        NN_MLP mlp64 = nn_make_mlp_with_random_init(scratch.arena, input_dim, layer_dims, ArrayCount(layer_dims));
+        ArrayCopy(mlp64.params.values, params->values, params->count);
+        F64 *targets = push_array(scratch.arena, F64, output_count);
+        for (int i = 0; i < output_count; ++i) targets[i] = sin(0.9*i);
+        F64 lr = 0.02;
+        F64 loss64 = 0, loss32 = 0;
+        scaler = nn_make_loss_scaler(1024, 10);
+        for (int step = 0; step < 50; ++step) {
+            ArenaTemp step_scratch = scratch_begin(&arena, 1);
+
+            nn_params_zero_grad(&mlp64.params);
+            NN_MLPBatch b64 = nn_mlp_apply_batch(step_scratch.arena, &mlp64, x, batch_count, 0);
+            loss64 = nn_mse(output_count, b64.output, targets, output_grads);
+            nn_mlp_backward_batch(&mlp64, &b64, output_grads, 0, 0);
+            for (int i = 0; i < params->count; ++i) mlp64.params.values[i] -= lr*mlp64.params.grads[i];
+
+            nn_params_zero_grad(params);
+            NN_MLPBatchF32 b32 = nn_mlp_apply_batch_f32(step_scratch.arena, &mlp, x32, batch_count, 0);
+            F64 *output64 = push_array(step_scratch.arena, F64, output_count);
+            for (int i = 0; i < output_count; ++i) output64[i] = b32.output[i];
+            loss32 = nn_mse(output_count, output64, targets, output_grads);
+            for (int i = 0; i < output_count; ++i) output_grads32[i] = (F32)output_grads[i];
+            B32 step_is_finite = nn_mlp_backward_batch_f32(&mlp, &b32, output_grads32, scaler.scale, 0);
+            nn_loss_scaler_update(&scaler, step_is_finite);
+            if (step_is_finite) {
+                for (int i = 0; i < params->count; ++i) params->values[i] -= lr*params->grads[i];
+            }
+
+            scratch_end(step_scratch);
+        }
+        T_TestAssert(arena, &test_results, fabs(loss32 - loss64) <= 1e-4*loss64);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
 T_TestResultList test_conv(Arena *arena) {
     T_TestResultList test_results = {0};
     ArenaTemp scratch = scratch_begin(&arena, 1);
@@ -116,8 +337,8 @@ T_TestResultList test_conv(Arena *arena) {
         for (int i = 0; i < 2; ++i) {
             for (int j = 0; j < 2; ++j) {
                 AG_Value **val = ag_value_array3d_get_value(&conv_result, 0, i, j);
-                if (expected[i*2+j] != (*val)->value) {
-                    fprintf(stderr, "conv result i:%d,j:%d incorrect: %f but expected %f\n", i, j, (*val)->value, expected[2*i+j]);
+                if (expected[i*2+j] != *(*val)->value) {
+                    fprintf(stderr, "conv result i:%d,j:%d incorrect: %f but expected %f\n", i, j, *(*val)->value, expected[2*i+j]);
                     conv_result_values_correct = 0;
                 }
             }
@@ -130,6 +351,1156 @@ T_TestResultList test_conv(Arena *arena) {
     return test_results;
 }
 
+// loss = sum_i cos(i)*out_i, so every output gets a distinct grad
+internal AG_Value *test_conv_weighted_sum(Arena *arena, AG_ValueArray3D *out) {
+    AG_Value *loss = ag_constant(arena, 0);
+    int out_count = ag_value_array3d_element_count(out);
+    for (int i = 0; i < out_count; ++i) {
+        loss = ag_add(arena, loss, ag_mul(arena, out->values[i], ag_constant(arena, cos((F64)i))));
+    }
+    return loss;
+}
+
+T_TestResultList test_conv_block(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // {in_channels, out_channels, kernel_size, stride, padding, in_h, in_w, groups}
+    int configs[][8] = {
+        {3, 4, 3, 1, 1, 6, 5, 1},
+        {2, 3, 3, 2, 1, 7, 6, 1},
+        {2, 2, 3, 2, 0, 7, 7, 1},
+        {4, 3, 1, 1, 0, 3, 4, 1}, // pointwise
+        {3, 2, 3, 1, 0, 7, 6, 1}, // Winograd with odd output dims
+        {2, 3, 3, 1, 2, 5, 4, 1}, // Winograd, "full" padding
+        {1, 2, 5, 3, 2, 8, 9, 1},
+        {4, 6, 3, 1, 1, 5, 6, 2}, // grouped
+        {3, 3, 3, 2, 1, 7, 6, 3}, // depthwise
+        {2, 4, 3, 1, 1, 5, 5, 2}, // depthwise, channel multiplier 2
+    };
+
+    for (int config_idx = 0; config_idx < ArrayCount(configs); ++config_idx) {
+        int *config = configs[config_idx];
+        NN_Conv2D conv = nn_make_grouped_conv2d(scratch.arena, config[0], config[1], config[2], config[3], config[4], config[7], 1);
+        conv.has_relu = config_idx % 2; // every other config runs the fused relu
+        AG_ValueArray params = nn_conv2d_get_params(scratch.arena, &conv);
+        AG_ValueArray3D x = ag_push_null_value_array3d(scratch.arena, config[0], config[5], config[6]);
+        int x_count = ag_value_array3d_element_count(&x);
+        for (int i = 0; i < x_count; ++i) x.values[i] = ag_source(scratch.arena, sin(0.7*i));
+
+        // Scalar reference
+        AG_ValueArray3D expected = nn_conv2d_apply_scalar(scratch.arena, scratch.arena, &conv, &x);
+        ag_backward(test_conv_weighted_sum(scratch.arena, &expected));
+        F64 *expected_x_grads = push_array(scratch.arena, F64, x_count);
+        F64 *expected_param_grads = push_array(scratch.arena, F64, params.count);
+        for (int i = 0; i < x_count; ++i) { expected_x_grads[i] = *x.values[i]->grad; *x.values[i]->grad = 0; }
+        for (int i = 0; i < params.count; ++i) { expected_param_grads[i] = *params.values[i]->grad; *params.values[i]->grad = 0; }
+
+        // The conv block, with every algorithm that supports the shape
+        NN_ConvShape shape = nn_make_grouped_conv_shape(config[0], config[5], config[6], config[1], config[2], config[3], config[4], config[7]);
+        NN_ConvAlgorithm algorithms[] = {NN_ConvAlgorithm_Im2col, NN_ConvAlgorithm_Winograd, NN_ConvAlgorithm_Direct, NN_ConvAlgorithm_Depthwise};
+        for (int algorithm_idx = 0; algorithm_idx < ArrayCount(algorithms); ++algorithm_idx) {
+            conv.algorithm = algorithms[algorithm_idx];
+            if (nn_conv_pick_algorithm(&shape, conv.algorithm) != conv.algorithm) continue;
+            AG_ValueArray3D actual = nn_conv2d_apply(scratch.arena, scratch.arena, &conv, &x);
+            ag_backward(test_conv_weighted_sum(scratch.arena, &actual));
+
+            B32 shapes_match = memcmp(actual.shape, expected.shape, sizeof(actual.shape)) == 0;
+            T_TestAssert(arena, &test_results, shapes_match);
+            B32 values_match = shapes_match;
+            for (int i = 0; values_match && i < ag_value_array3d_element_count(&actual); ++i) {
+                if (fabs(*actual.values[i]->value - *expected.values[i]->value) > 1e-12) values_match = 0;
+            }
+            T_TestAssert(arena, &test_results, values_match);
+            B32 grads_match = 1;
+            for (int i = 0; i < x_count; ++i) {
+                if (fabs(*x.values[i]->grad - expected_x_grads[i]) > 1e-12) grads_match = 0;
+            }
+            for (int i = 0; i < params.count; ++i) {
+                if (fabs(*params.values[i]->grad - expected_param_grads[i]) > 1e-12) grads_match = 0;
+            }
+            T_TestAssert(arena, &test_results, grads_match);
+            for (int i = 0; i < x_count; ++i) *x.values[i]->grad = 0;
+            for (int i = 0; i < params.count; ++i) *params.values[i]->grad = 0;
+        }
+    }
+
+    // Forward mode through the block matches the scalar graph's tangents, with and without the fused relu
+    for (int has_relu = 0; has_relu <= 1; ++has_relu) {
+        NN_Conv2D conv = nn_make_conv2d(scratch.arena, 2, 3, 3, 2, 1, 1);
+        conv.has_relu = has_relu;
+        AG_ValueArray params = nn_conv2d_get_params(scratch.arena, &conv);
+        AG_ValueArray3D x = ag_push_null_value_array3d(scratch.arena, 2, 5, 5);
+        for (int i = 0; i < 2*5*5; ++i) {
+            x.values[i] = ag_source(scratch.arena, sin(0.3*i));
+            x.values[i]->tangent = cos(0.9*i);
+        }
+        for (int i = 0; i < params.count; ++i) params.values[i]->tangent = sin(1.1*i);
+
+        AG_ValueArray3D expected = nn_conv2d_apply_scalar(scratch.arena, scratch.arena, &conv, &x);
+        AG_ValueArray3D actual = nn_conv2d_apply(scratch.arena, scratch.arena, &conv, &x);
+        B32 tangents_match = 1;
+        for (int i = 0; i < ag_value_array3d_element_count(&actual); ++i) {
+            if (fabs(actual.values[i]->tangent - expected.values[i]->tangent) > 1e-12) tangents_match = 0;
+        }
+        T_TestAssert(arena, &test_results, tangents_match);
+        for (int i = 0; i < params.count; ++i) params.values[i]->tangent = 0;
+    }
+
+    // A batch sums the weight/bias grads of its images
+    {
+        NN_ConvShape shape = nn_make_conv_shape(2, 5, 4, 3, 3, 1, 1);
+        int x_image_count = 2*5*4, out_image_count = 3*5*4, weight_count = 3*2*3*3;
+        F64 *x_raw = push_array(scratch.arena, F64, 2*x_image_count);
+        F64 *weights = push_array(scratch.arena, F64, weight_count);
+        F64 *out_grads = push_array(scratch.arena, F64, 2*out_image_count);
+        for (int i = 0; i < 2*x_image_count; ++i) x_raw[i] = sin(0.5*i);
+        for (int i = 0; i < weight_count; ++i) weights[i] = cos(0.2*i);
+        for (int i = 0; i < 2*out_image_count; ++i) out_grads[i] = sin(1.7*i);
+
+        F64 *batch_weight_grads = push_array(scratch.arena, F64, weight_count);
+        F64 *batch_bias_grads = push_array(scratch.arena, F64, 3);
+        F64 *batch_x_grads = push_array(scratch.arena, F64, 2*x_image_count);
+        nn_conv2d_backward_im2col(&shape, 2, x_raw, weights, out_grads, batch_weight_grads, batch_bias_grads, batch_x_grads, 0);
+
+        F64 *weight_grads = push_array(scratch.arena, F64, weight_count);
+        F64 *bias_grads = push_array(scratch.arena, F64, 3);
+        F64 *x_grads = push_array(scratch.arena, F64, 2*x_image_count);
+        for (int n = 0; n < 2; ++n) {
+            nn_conv2d_backward_im2col(&shape, 1, x_raw + n*x_image_count, weights, out_grads + n*out_image_count, 
+                                      weight_grads, bias_grads, x_grads + n*x_image_count, 0);
+        }
+        B32 matches = 1;
+        for (int i = 0; i < weight_count; ++i) if (fabs(weight_grads[i] - batch_weight_grads[i]) > 1e-12) matches = 0;
+        for (int i = 0; i < 3; ++i) if (fabs(bias_grads[i] - batch_bias_grads[i]) > 1e-12) matches = 0;
+        for (int i = 0; i < 2*x_image_count; ++i) if (x_grads[i] != batch_x_grads[i]) matches = 0;
+        T_TestAssert(arena, &test_results, matches);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_conv_winograd(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    T_TestAssert(arena, &test_results, nn_conv_pick_algorithm(&(NN_ConvShape){.in_channels=64, .kernel_size=3, .stride=1, .padding=1}, NN_ConvAlgorithm_Auto) == NN_ConvAlgorithm_Winograd);
+    T_TestAssert(arena, &test_results, nn_conv_pick_algorithm(&(NN_ConvShape){.in_channels=16, .kernel_size=3, .stride=2, .padding=1}, NN_ConvAlgorithm_Auto) == NN_ConvAlgorithm_Direct);
+    T_TestAssert(arena, &test_results, nn_conv_pick_algorithm(&(NN_ConvShape){.in_channels=1, .kernel_size=3, .stride=1, .padding=1}, NN_ConvAlgorithm_Auto) == NN_ConvAlgorithm_Im2col);
+    T_TestAssert(arena, &test_results, nn_conv_pick_algorithm(&(NN_ConvShape){.kernel_size=3, .stride=2, .padding=1}, NN_ConvAlgorithm_Winograd) == NN_ConvAlgorithm_Im2col);
+    T_TestAssert(arena, &test_results, nn_conv_pick_algorithm(&(NN_ConvShape){.kernel_size=3, .stride=1, .padding=1}, NN_ConvAlgorithm_Im2col) == NN_ConvAlgorithm_Im2col);
+
+    // Raw batched Winograd against im2col, forward and backward
+    int batch_count = 2;
+    NN_ConvShape shape = nn_make_conv_shape(3, 9, 6, 5, 3, 1, 1);
+    int x_count = batch_count*3*9*6, out_count = batch_count*5*shape.out_h*shape.out_w, weight_count = 5*3*9;
+    F64 *x = push_array(scratch.arena, F64, x_count);
+    F64 *weights = push_array(scratch.arena, F64, weight_count);
+    F64 biases[] = {0.1, -0.2, 0.3, -0.4, 0.5};
+    F64 *out_grads = push_array(scratch.arena, F64, out_count);
+    for (int i = 0; i < x_count; ++i) x[i] = sin(0.31*i);
+    for (int i = 0; i < weight_count; ++i) weights[i] = cos(0.57*i);
+    for (int i = 0; i < out_count; ++i) out_grads[i] = sin(0.83*i);
+
+    NN_WinogradWeights winograd = nn_push_winograd_weights(scratch.arena, 3, 5);
+    nn_winograd_transform_weights(&winograd, weights);
+
+    F64 *expected_out = push_array(scratch.arena, F64, out_count);
+    F64 *actual_out = push_array(scratch.arena, F64, out_count);
+    nn_conv2d_forward_im2col(&shape, batch_count, x, weights, biases, expected_out, 0);
+    nn_conv2d_forward_winograd(&shape, batch_count, x, &winograd, biases, actual_out, 0);
+    B32 outputs_match = 1;
+    for (int i = 0; i < out_count; ++i) if (fabs(actual_out[i] - expected_out[i]) > 1e-12) outputs_match = 0;
+    T_TestAssert(arena, &test_results, outputs_match);
+
+    F64 *expected_x_grads = push_array(scratch.arena, F64, x_count);
+    F64 *actual_x_grads = push_array(scratch.arena, F64, x_count);
+    F64 *expected_weight_grads = push_array(scratch.arena, F64, weight_count);
+    F64 *actual_weight_grads = push_array(scratch.arena, F64, weight_count);
+    nn_conv2d_backward_im2col(&shape, batch_count, x, weights, out_grads, expected_weight_grads, 0, expected_x_grads, 0);
+    nn_conv2d_backward_winograd(&shape, batch_count, x, weights, &winograd, out_grads, actual_weight_grads, 0, actual_x_grads, 0);
+    B32 grads_match = 1;
+    for (int i = 0; i < x_count; ++i) if (fabs(actual_x_grads[i] - expected_x_grads[i]) > 1e-12) grads_match = 0;
+    for (int i = 0; i < weight_count; ++i) if (fabs(actual_weight_grads[i] - expected_weight_grads[i]) > 1e-12) grads_match = 0;
+    T_TestAssert(arena, &test_results, grads_match);
+
+    // The conv's cache picks up weight changes
+    {
+        NN_Conv2D conv = nn_make_conv2d(scratch.arena, 1, 1, 3, 1, 1, 0);
+        conv.algorithm = NN_ConvAlgorithm_Winograd;
+        AG_ValueArray3D conv_x = ag_push_null_value_array3d(scratch.arena, 1, 4, 4);
+        for (int i = 0; i < 16; ++i) conv_x.values[i] = ag_source(scratch.arena, i);
+        for (int i = 0; i < 9; ++i) *conv.weights.values[i]->value = 1;
+        AG_ValueArray3D y0 = nn_conv2d_apply(scratch.arena, scratch.arena, &conv, &conv_x);
+        for (int i = 0; i < 9; ++i) *conv.weights.values[i]->value = 2;
+        AG_ValueArray3D y1 = nn_conv2d_apply(scratch.arena, scratch.arena, &conv, &conv_x);
+        T_TestAssert(arena, &test_results, conv.winograd_cache->is_valid);
+        T_TestAssert(arena, &test_results, fabs(*y1.values[5]->value - 2 * *y0.values[5]->value) < 1e-12);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_conv_direct(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // Layout round trip with a partial channel block
+    {
+        int channels = 11, h = 3, w = 2;
+        F64 *x = push_array(scratch.arena, F64, channels*h*w);
+        F64 *xc = push_array(scratch.arena, F64, nn_channel_block_count(channels)*h*w*NN_CHANNEL_BLOCK);
+        F64 *x_back = push_array(scratch.arena, F64, channels*h*w);
+        for (int i = 0; i < channels*h*w; ++i) x[i] = i;
+        nn_nchw_to_nchwc(x, channels, h, w, xc);
+        nn_nchwc_to_nchw(xc, channels, h, w, x_back);
+        T_TestAssert(arena, &test_results, memcmp(x, x_back, channels*h*w*sizeof(F64)) == 0);
+        // channel 9 of pixel (1,0) lives in block 1, lane 1; lane 3 of block 1 is padding
+        T_TestAssert(arena, &test_results, xc[(1*h*w + 1*w + 0)*NN_CHANNEL_BLOCK + 1] == x[9*h*w + 1*w + 0]);
+        T_TestAssert(arena, &test_results, xc[(1*h*w + 1*w + 0)*NN_CHANNEL_BLOCK + 3] == 0);
+    }
+
+    // Direct against im2col, over shapes whose borders, interiors and channel blocks are all partial.
+    // {in_channels, out_channels, kernel_size, stride, padding, in_h, in_w}
+    int configs[][7] = {
+        {3, 5, 3, 1, 1, 7, 9},
+        {9, 10, 3, 2, 1, 8, 7},
+        {16, 8, 5, 1, 2, 6, 11},
+        {2, 3, 3, 1, 0, 5, 5},
+        {4, 17, 1, 1, 0, 4, 3},
+        {1, 2, 3, 3, 4, 5, 6}, // padding wider than the kernel, some outputs see no input
+    };
+    int batch_count = 2;
+    for (int config_idx = 0; config_idx < ArrayCount(configs); ++config_idx) {
+        int *config = configs[config_idx];
+        NN_ConvShape shape = nn_make_conv_shape(config[0], config[5], config[6], config[1], config[2], config[3], config[4]);
+        int x_count = batch_count*shape.in_channels*shape.in_h*shape.in_w;
+        int out_count = batch_count*shape.out_channels*shape.out_h*shape.out_w;
+        int weight_count = shape.out_channels*shape.in_channels*shape.kernel_size*shape.kernel_size;
+        F64 *x = push_array(scratch.arena, F64, x_count);
+        F64 *weights = push_array(scratch.arena, F64, weight_count);
+        F64 *biases = push_array(scratch.arena, F64, shape.out_channels);
+        for (int i = 0; i < x_count; ++i) x[i] = sin(0.13*i);
+        for (int i = 0; i < weight_count; ++i) weights[i] = cos(0.29*i);
+        for (int i = 0; i < shape.out_channels; ++i) biases[i] = 0.1*i;
+
+        F64 *expected = push_array(scratch.arena, F64, out_count);
+        F64 *actual = push_array(scratch.arena, F64, out_count);
+        nn_conv2d_forward_im2col(&shape, batch_count, x, weights, biases, expected, 0);
+        nn_conv2d_forward_direct(&shape, batch_count, x, weights, biases, actual, 0);
+        B32 matches = 1;
+        for (int i = 0; i < out_count; ++i) if (fabs(actual[i] - expected[i]) > 1e-12) matches = 0;
+        T_TestAssert(arena, &test_results, matches);
+    }
+
+    // Threaded rows match the serial result exactly
+    {
+        TP_ThreadPool *pool = tp_make_thread_pool(scratch.arena, 4);
+        NN_ConvShape shape = nn_make_conv_shape(16, 14, 14, 32, 3, 2, 1);
+        int x_count = 16*14*14, out_count = 32*7*7, weight_count = 32*16*9;
+        F64 *x = push_array(scratch.arena, F64, x_count);
+        F64 *weights = push_array(scratch.arena, F64, weight_count);
+        for (int i = 0; i < x_count; ++i) x[i] = sin(0.37*i);
+        for (int i = 0; i < weight_count; ++i) weights[i] = cos(0.71*i);
+        F64 *serial = push_array(scratch.arena, F64, out_count);
+        F64 *threaded = push_array(scratch.arena, F64, out_count);
+        nn_conv2d_forward_direct(&shape, 1, x, weights, 0, serial, 0);
+        nn_conv2d_forward_direct(&shape, 1, x, weights, 0, threaded, pool);
+        T_TestAssert(arena, &test_results, memcmp(serial, threaded, out_count*sizeof(F64)) == 0);
+        tp_release_thread_pool(pool);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_conv_depthwise(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    NN_ConvShape depthwise = nn_make_grouped_conv_shape(8, 5, 5, 8, 3, 1, 1, 8);
+    NN_ConvShape grouped = nn_make_grouped_conv_shape(8, 5, 5, 8, 3, 1, 1, 2);
+    NN_ConvShape pointwise = nn_make_conv_shape(8, 5, 5, 16, 1, 1, 0);
+    T_TestAssert(arena, &test_results, nn_conv_pick_algorithm(&depthwise, NN_ConvAlgorithm_Auto) == NN_ConvAlgorithm_Depthwise);
+    T_TestAssert(arena, &test_results, nn_conv_pick_algorithm(&depthwise, NN_ConvAlgorithm_Winograd) == NN_ConvAlgorithm_Depthwise);
+    T_TestAssert(arena, &test_results, nn_conv_pick_algorithm(&grouped, NN_ConvAlgorithm_Auto) == NN_ConvAlgorithm_Im2col);
+    T_TestAssert(arena, &test_results, nn_conv_pick_algorithm(&pointwise, NN_ConvAlgorithm_Auto) == NN_ConvAlgorithm_Im2col);
+
+    // Raw depthwise kernels against grouped im2col, with a channel multiplier, strides and a batch
+    // {in_channels, multiplier, kernel_size, stride, padding, in_h, in_w}
+    int configs[][7] = {
+        {3, 1, 3, 1, 1, 6, 7},
+        {4, 2, 3, 2, 1, 7, 6},
+        {2, 3, 5, 2, 2, 9, 8},
+        {3, 1, 3, 1, 0, 4, 4},
+    };
+    int batch_count = 2;
+    TP_ThreadPool *pool = tp_make_thread_pool(scratch.arena, 3);
+    for (int config_idx = 0; config_idx < ArrayCount(configs); ++config_idx) {
+        int *config = configs[config_idx];
+        int in_channels = config[0], out_channels = config[0]*config[1];
+        NN_ConvShape shape = nn_make_grouped_conv_shape(in_channels, config[5], config[6], out_channels, config[2], config[3], config[4], in_channels);
+        int x_count = batch_count*in_channels*shape.in_h*shape.in_w;
+        int out_count = batch_count*out_channels*shape.out_h*shape.out_w;
+        int weight_count = out_channels*shape.kernel_size*shape.kernel_size;
+        F64 *x = push_array(scratch.arena, F64, x_count);
+        F64 *weights = push_array(scratch.arena, F64, weight_count);
+        F64 *biases = push_array(scratch.arena, F64, out_channels);
+        F64 *out_grads = push_array(scratch.arena, F64, out_count);
+        for (int i = 0; i < x_count; ++i) x[i] = sin(0.23*i);
+        for (int i = 0; i < weight_count; ++i) weights[i] = cos(0.41*i);
+        for (int i = 0; i < out_channels; ++i) biases[i] = 0.3*i;
+        for (int i = 0; i < out_count; ++i) out_grads[i] = cos(0.17*i);
+
+        F64 *expected_out = push_array(scratch.arena, F64, out_count);
+        F64 *actual_out = push_array(scratch.arena, F64, out_count);
+        nn_conv2d_forward_im2col(&shape, batch_count, x, weights, biases, expected_out, 0);
+        nn_conv2d_forward_depthwise(&shape, batch_count, x, weights, biases, actual_out, pool);
+        B32 outputs_match = 1;
+        for (int i = 0; i < out_count; ++i) if (fabs(actual_out[i] - expected_out[i]) > 1e-12) outputs_match = 0;
+        T_TestAssert(arena, &test_results, outputs_match);
+
+        F64 *expected_grads = push_array(scratch.arena, F64, weight_count + out_channels + x_count);
+        F64 *actual_grads = push_array(scratch.arena, F64, weight_count + out_channels + x_count);
+        nn_conv2d_backward_im2col(&shape, batch_count, x, weights, out_grads,
+                                  expected_grads, expected_grads + weight_count, expected_grads + weight_count + out_channels, 0);
+        nn_conv2d_backward_depthwise(&shape, batch_count, x, weights, out_grads,
+                                     actual_grads, actual_grads + weight_count, actual_grads + weight_count + out_channels, pool);
+        B32 grads_match = 1;
+        for (int i = 0; i < weight_count + out_channels + x_count; ++i) {
+            if (fabs(actual_grads[i] - expected_grads[i]) > 1e-12) grads_match = 0;
+        }
+        T_TestAssert(arena, &test_results, grads_match);
+    }
+    tp_release_thread_pool(pool);
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_pool(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // 2x2 max/avg pool, stride 2, on a 1x4x4 input with hand-computed results
+    {
+        F64 x[16] = {
+            1, 5, 2, 0,
+            3, 4, 8, 1,
+            0, 2, 6, 6,
+            9, 1, 3, 7,
+        };
+        NN_PoolShape shape = nn_make_pool_shape(1, 4, 4, 2, 2, 0);
+        T_TestAssert(arena, &test_results, shape.out_h == 2 && shape.out_w == 2);
+
+        F64 out[4];
+        U8 argmax[4];
+        nn_max_pool2d_forward(&shape, 1, x, out, argmax);
+        T_TestAssert(arena, &test_results, out[0] == 5 && out[1] == 8 && out[2] == 9 && out[3] == 7);
+        T_TestAssert(arena, &test_results, argmax[0] == 1 && argmax[1] == 2 && argmax[2] == 2 && argmax[3] == 3);
+
+        F64 out_grads[4] = {1, 2, 3, 4};
+        F64 x_grads[16];
+        nn_max_pool2d_backward(&shape, 1, out_grads, argmax, x_grads);
+        F64 expected_x_grads[16] = {
+            0, 1, 0, 0,
+            0, 0, 2, 0,
+            0, 0, 0, 0,
+            3, 0, 0, 4,
+        };
+        T_TestAssert(arena, &test_results, memcmp(x_grads, expected_x_grads, sizeof(x_grads)) == 0);
+
+        nn_avg_pool2d_forward(&shape, 1, x, out);
+        T_TestAssert(arena, &test_results, out[0] == 3.25 && out[1] == 2.75 && out[2] == 3 && out[3] == 5.5);
+    }
+
+    // Padded average pool only divides by the in-image element count
+    {
+        F64 x[9] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+        NN_PoolShape shape = nn_make_pool_shape(1, 3, 3, 3, 2, 1);
+        T_TestAssert(arena, &test_results, shape.out_h == 2 && shape.out_w == 2);
+        F64 out[4];
+        nn_avg_pool2d_forward(&shape, 1, x, out);
+        T_TestAssert(arena, &test_results, out[0] == 3 && out[1] == 4 && out[2] == 6 && out[3] == 7);
+
+        F64 out_grads[4] = {4, 4, 4, 4};
+        F64 x_grads[9];
+        nn_avg_pool2d_backward(&shape, 1, out_grads, x_grads);
+        F64 expected_x_grads[9] = {1, 2, 1, 2, 4, 2, 1, 2, 1};
+        B32 grads_match = 1;
+        for (int i = 0; i < 9; ++i) if (fabs(x_grads[i] - expected_x_grads[i]) > 1e-12) grads_match = 0;
+        T_TestAssert(arena, &test_results, grads_match);
+    }
+
+    // Pool blocks and the fused global average pool against finite differences
+    {
+        NN_Pool2D pools[] = {
+            nn_make_max_pool2d(2, 2, 0),
+            nn_make_max_pool2d(3, 2, 1),
+            nn_make_avg_pool2d(3, 1, 1),
+        };
+        int channels = 2, h = 5, w = 6;
+        int x_count = channels*h*w;
+        F64 *x_raw = push_array(scratch.arena, F64, x_count);
+        for (int i = 0; i < x_count; ++i) x_raw[i] = sin(1.3*i + 0.2); // distinct values, so the argmax is stable
+
+        for (int pool_idx = 0; pool_idx < ArrayCount(pools); ++pool_idx) {
+            AG_ValueArray3D x = ag_make_value_array3d_from_raw(scratch.arena, scratch.arena, x_raw, channels, h, w);
+            AG_ValueArray3D y = nn_pool2d_apply(scratch.arena, scratch.arena, &pools[pool_idx], &x);
+            T_TestAssert(arena, &test_results, y.shape[1] == nn_pool2d_output_dim(&pools[pool_idx], h));
+            AG_ValueArray g = nn_gap(scratch.arena, scratch.arena, &y);
+            AG_Value *loss = ag_add(scratch.arena, g.values[0], ag_mul(scratch.arena, g.values[1], ag_constant(scratch.arena, 3)));
+            ag_backward(loss);
+
+            B32 grads_match = 1;
+            F64 eps = 1e-6;
+            for (int i = 0; i < x_count; ++i) {
+                F64 old = x_raw[i];
+                F64 loss_at[2];
+                for (int side = 0; side < 2; ++side) {
+                    x_raw[i] = old + (side ? eps : -eps);
+                    AG_ValueArray3D xp = ag_make_value_array3d_from_raw(scratch.arena, scratch.arena, x_raw, channels, h, w);
+                    AG_ValueArray3D yp = nn_pool2d_apply(scratch.arena, scratch.arena, &pools[pool_idx], &xp);
+                    AG_ValueArray gp = nn_gap(scratch.arena, scratch.arena, &yp);
+                    loss_at[side] = *gp.values[0]->value + 3 * *gp.values[1]->value;
+                }
+                x_raw[i] = old;
+                F64 numerical = (loss_at[1] - loss_at[0])/(2*eps);
+                if (fabs(numerical - *x.values[i]->grad) > 1e-6) grads_match = 0;
+            }
+            T_TestAssert(arena, &test_results, grads_match);
+        }
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+internal F64 test_batch_norm_loss(Arena *arena, NN_BatchNorm *bn, F64 *x_raw, int batch_count, int channels, int h, int w) {
+    AG_ValueArray3D *xs = push_array(arena, AG_ValueArray3D, batch_count);
+    for (int b = 0; b < batch_count; ++b) xs[b] = ag_make_value_array3d_from_raw(arena, arena, x_raw + b*channels*h*w, channels, h, w);
+    AG_ValueArray3D *ys = nn_batch_norm2d_apply(arena, arena, bn, xs, batch_count);
+    F64 loss = 0;
+    for (int b = 0; b < batch_count; ++b) {
+        for (int i = 0; i < channels*h*w; ++i) loss += cos(0.3*(b*channels*h*w + i)) * *ys[b].values[i]->value;
+    }
+    return loss;
+}
+
+T_TestResultList test_batch_norm(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // One-pass statistics stay accurate far away from zero
+    {
+        int batch_count = 3, channels = 2, plane_size = 5;
+        int x_count = batch_count*channels*plane_size;
+        F64 *x = push_array(scratch.arena, F64, x_count);
+        for (int i = 0; i < x_count; ++i) x[i] = 1e8 + sin(0.7*i);
+        F64 mean[2], var[2];
+        nn_batch_norm_statistics(batch_count, channels, plane_size, x, mean, var);
+        B32 stats_match = 1;
+        for (int c = 0; c < channels; ++c) {
+            F64 expected_mean = 0, expected_var = 0;
+            for (int b = 0; b < batch_count; ++b) for (int i = 0; i < plane_size; ++i) expected_mean += sin(0.7*((b*channels + c)*plane_size + i));
+            expected_mean /= batch_count*plane_size;
+            for (int b = 0; b < batch_count; ++b) {
+                for (int i = 0; i < plane_size; ++i) {
+                    F64 d = sin(0.7*((b*channels + c)*plane_size + i)) - expected_mean;
+                    expected_var += d*d;
+                }
+            }
+            expected_var /= batch_count*plane_size;
+            if (fabs(mean[c] - 1e8 - expected_mean) > 1e-7 || fabs(var[c] - expected_var) > 1e-7) stats_match = 0;
+        }
+        T_TestAssert(arena, &test_results, stats_match);
+    }
+
+    // Training mode: grads and tangents against finite differences, and the running statistics
+    {
+        int batch_count = 3, channels = 2, h = 2, w = 3;
+        int sample_count = channels*h*w, x_count = batch_count*sample_count;
+        NN_BatchNorm bn = nn_make_batch_norm(scratch.arena, channels);
+        *bn.gamma.values[0]->value = 1.5;
+        *bn.gamma.values[1]->value = -0.7;
+        *bn.beta.values[0]->value = 0.2;
+        *bn.beta.values[1]->value = -0.4;
+        F64 *x_raw = push_array(scratch.arena, F64, x_count);
+        for (int i = 0; i < x_count; ++i) x_raw[i] = 2*sin(1.1*i) + (i % sample_count < h*w ? 3 : -1);
+
+        AG_ValueArray3D *xs = push_array(scratch.arena, AG_ValueArray3D, batch_count);
+        for (int b = 0; b < batch_count; ++b) xs[b] = ag_make_value_array3d_from_raw(scratch.arena, scratch.arena, x_raw + b*sample_count, channels, h, w);
+        AG_ValueArray3D *ys = nn_batch_norm2d_apply(scratch.arena, scratch.arena, &bn, xs, batch_count);
+
+        // Each channel of the output has mean beta and std |gamma| (up to eps)
+        F64 channel_sum[2] = {0}, channel_sum_sq[2] = {0};
+        for (int b = 0; b < batch_count; ++b) {
+            for (int i = 0; i < sample_count; ++i) {
+                F64 y = *ys[b].values[i]->value;
+                channel_sum[i/(h*w)] += y;
+                channel_sum_sq[i/(h*w)] += y*y;
+            }
+        }
+        int n = batch_count*h*w;
+        T_TestAssert(arena, &test_results, fabs(channel_sum[0]/n - 0.2) < 1e-9 && fabs(channel_sum[1]/n + 0.4) < 1e-9);
+        T_TestAssert(arena, &test_results, fabs(channel_sum_sq[0]/n - 0.2*0.2 - 1.5*1.5) < 1e-4);
+
+        // Running statistics moved 10% of the way from (0, 1) towards the batch statistics
+        F64 mean[2], var[2];
+        nn_batch_norm_statistics(batch_count, channels, h*w, x_raw, mean, var);
+        T_TestAssert(arena, &test_results, fabs(bn.running_mean[1] - 0.1*mean[1]) < 1e-12);
+        T_TestAssert(arena, &test_results, fabs(bn.running_var[1] - (0.9 + 0.1*var[1]*n/(n - 1))) < 1e-12);
+
+        AG_Value *loss = ag_constant(scratch.arena, 0);
+        for (int b = 0; b < batch_count; ++b) {
+            for (int i = 0; i < sample_count; ++i) {
+                AG_Value *weight = ag_constant(scratch.arena, cos(0.3*(b*sample_count + i)));
+                loss = ag_add(scratch.arena, loss, ag_mul(scratch.arena, weight, ys[b].values[i]));
+            }
+        }
+        ag_backward(loss);
+
+        F64 eps = 1e-6;
+        B32 grads_match = 1;
+        for (int i = 0; i < x_count; ++i) {
+            F64 old = x_raw[i];
+            x_raw[i] = old + eps;
+            F64 loss_plus = test_batch_norm_loss(scratch.arena, &bn, x_raw, batch_count, channels, h, w);
+            x_raw[i] = old - eps;
+            F64 loss_minus = test_batch_norm_loss(scratch.arena, &bn, x_raw, batch_count, channels, h, w);
+            x_raw[i] = old;
+            F64 grad = *xs[i/sample_count].values[i%sample_count]->grad;
+            if (fabs((loss_plus - loss_minus)/(2*eps) - grad) > 1e-6) grads_match = 0;
+        }
+        AG_ValueArray bn_params = nn_batch_norm_get_params(scratch.arena, &bn);
+        for (int i = 0; i < bn_params.count; ++i) {
+            F64 old = *bn_params.values[i]->value;
+            *bn_params.values[i]->value = old + eps;
+            F64 loss_plus = test_batch_norm_loss(scratch.arena, &bn, x_raw, batch_count, channels, h, w);
+            *bn_params.values[i]->value = old - eps;
+            F64 loss_minus = test_batch_norm_loss(scratch.arena, &bn, x_raw, batch_count, channels, h, w);
+            *bn_params.values[i]->value = old;
+            if (fabs((loss_plus - loss_minus)/(2*eps) - *bn_params.values[i]->grad) > 1e-6) grads_match = 0;
+        }
+        T_TestAssert(arena, &test_results, grads_match);
+
+        // Forward mode along x: the loss tangent is the directional derivative
+        for (int b = 0; b < batch_count; ++b) {
+            for (int i = 0; i < sample_count; ++i) xs[b].values[i]->tangent = sin(0.9*(b*sample_count + i));
+        }
+        ys = nn_batch_norm2d_apply(scratch.arena, scratch.arena, &bn, xs, batch_count);
+        F64 loss_tangent = 0;
+        for (int b = 0; b < batch_count; ++b) {
+            for (int i = 0; i < sample_count; ++i) loss_tangent += cos(0.3*(b*sample_count + i))*ys[b].values[i]->tangent;
+        }
+        F64 *x_moved = push_array(scratch.arena, F64, x_count);
+        for (int i = 0; i < x_count; ++i) x_moved[i] = x_raw[i] + eps*sin(0.9*i);
+        F64 loss_plus = test_batch_norm_loss(scratch.arena, &bn, x_moved, batch_count, channels, h, w);
+        for (int i = 0; i < x_count; ++i) x_moved[i] = x_raw[i] - eps*sin(0.9*i);
+        F64 loss_minus = test_batch_norm_loss(scratch.arena, &bn, x_moved, batch_count, channels, h, w);
+        T_TestAssert(arena, &test_results, fabs((loss_plus - loss_minus)/(2*eps) - loss_tangent) < 1e-6);
+    }
+
+    // Inference mode uses the running statistics, per sample
+    {
+        NN_BatchNorm bn = nn_make_batch_norm(scratch.arena, 2);
+        bn.is_training = 0;
+        bn.running_mean[0] = 1;
+        bn.running_var[0] = 4 - bn.eps;
+        *bn.gamma.values[1]->value = 3;
+        *bn.beta.values[1]->value = 1;
+        F64 x_raw[2] = {5, 2};
+        AG_ValueArray x = ag_value_array_from_raw(scratch.arena, x_raw, 2);
+        AG_ValueArray *y = nn_batch_norm1d_apply(scratch.arena, scratch.arena, &bn, &x, 1);
+        T_TestAssert(arena, &test_results, fabs(*y[0].values[0]->value - 2) < 1e-12 && fabs(*y[0].values[1]->value - 7) < 1e-4);
+        ag_backward(ag_add(scratch.arena, y[0].values[0], y[0].values[1]));
+        T_TestAssert(arena, &test_results, fabs(*x.values[0]->grad - 0.5) < 1e-12);
+    }
+
+    // Folding into the preceding conv matches conv followed by an inference-mode batch norm
+    {
+        NN_Conv2D conv = nn_make_conv2d(scratch.arena, 3, 4, 3, 1, 1, 0);
+        NN_BatchNorm bn = nn_make_batch_norm(scratch.arena, 4);
+        bn.is_training = 0;
+        for (int c = 0; c < 4; ++c) {
+            bn.running_mean[c] = 0.3*c - 0.2;
+            bn.running_var[c] = 0.5 + c;
+            *bn.gamma.values[c]->value = 1 - 0.4*c;
+            *bn.beta.values[c]->value = 0.1*c;
+        }
+        F64 x_raw[3*5*5];
+        for (int i = 0; i < ArrayCount(x_raw); ++i) x_raw[i] = sin(0.5*i);
+        AG_ValueArray3D x = ag_make_value_array3d_from_raw(scratch.arena, scratch.arena, x_raw, 3, 5, 5);
+        AG_ValueArray3D y = nn_conv2d_apply(scratch.arena, scratch.arena, &conv, &x);
+        AG_ValueArray3D *expected = nn_batch_norm2d_apply(scratch.arena, scratch.arena, &bn, &y, 1);
+
+        nn_conv2d_fold_batch_norm(&conv, &bn);
+        AG_ValueArray3D actual = nn_conv2d_apply(scratch.arena, scratch.arena, &conv, &x);
+        B32 outputs_match = 1;
+        for (int i = 0; i < ag_value_array3d_element_count(&actual); ++i) {
+            if (fabs(*actual.values[i]->value - *expected[0].values[i]->value) > 1e-12) outputs_match = 0;
+        }
+        T_TestAssert(arena, &test_results, outputs_match);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_loss(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // Softmax cross-entropy against a graph built from scalar exp/log nodes
+    {
+        int batch_count = 3, class_count = 4;
+        int labels[] = {2, 0, 3};
+        AG_ValueArray *logits = push_array(scratch.arena, AG_ValueArray, batch_count);
+        F64 raw_logits[12];
+        for (int i = 0; i < 12; ++i) raw_logits[i] = 2*sin(0.8*i);
+        for (int b = 0; b < batch_count; ++b) logits[b] = ag_value_array_from_raw(scratch.arena, raw_logits + b*class_count, class_count);
+
+        AG_Value *expected = ag_constant(scratch.arena, 0);
+        for (int b = 0; b < batch_count; ++b) {
+            AG_Value *sum_exp = ag_constant(scratch.arena, 0);
+            for (int i = 0; i < class_count; ++i) sum_exp = ag_add(scratch.arena, sum_exp, ag_exp(scratch.arena, logits[b].values[i]));
+            AG_Value *sample_loss = ag_sub(scratch.arena, ag_log(scratch.arena, sum_exp), logits[b].values[labels[b]]);
+            expected = ag_add(scratch.arena, expected, sample_loss);
+        }
+        expected = ag_div(scratch.arena, expected, ag_constant(scratch.arena, batch_count));
+        ag_backward(expected);
+        F64 expected_grads[12];
+        for (int i = 0; i < 12; ++i) {
+            expected_grads[i] = *logits[i/class_count].values[i%class_count]->grad;
+            *logits[i/class_count].values[i%class_count]->grad = 0;
+        }
+
+        AG_Value *actual = nn_softmax_cross_entropy_apply(scratch.arena, logits, batch_count, labels);
+        T_TestAssert(arena, &test_results, fabs(*actual->value - *expected->value) < 1e-12);
+        ag_backward(actual);
+        B32 grads_match = 1;
+        for (int i = 0; i < 12; ++i) {
+            if (fabs(*logits[i/class_count].values[i%class_count]->grad - expected_grads[i]) > 1e-12) grads_match = 0;
+        }
+        T_TestAssert(arena, &test_results, grads_match);
+    }
+
+    // Huge logits don't overflow: shifting all logits by a constant doesn't change the loss
+    {
+        F64 logits[3] = {1000, 1001, 999};
+        F64 shifted[3] = {0, 1, -1};
+        int label = 1;
+        F64 grads[3];
+        F64 loss = nn_softmax_cross_entropy(1, 3, logits, &label, grads);
+        T_TestAssert(arena, &test_results, isfinite(loss) && fabs(loss - nn_softmax_cross_entropy(1, 3, shifted, &label, 0)) < 1e-12);
+        T_TestAssert(arena, &test_results, fabs(grads[0] + grads[1] + grads[2]) < 1e-12 && grads[1] < 0);
+    }
+
+    // BCE-with-logits: stable for large |z|, grads against finite differences, tangents
+    {
+        F64 logits[2] = {800, -800};
+        F64 targets[2] = {0, 0};
+        T_TestAssert(arena, &test_results, fabs(nn_bce_with_logits(2, logits, targets, 0) - 400) < 1e-9);
+
+        F64 raw_z[6] = {-3, -0.5, 0, 0.2, 1.5, 4};
+        F64 raw_t[6] = {0, 1, 0.5, 1, 0, 0.3};
+        AG_ValueArray z[2];
+        z[0] = ag_value_array_from_raw(scratch.arena, raw_z, 3);
+        z[1] = ag_value_array_from_raw(scratch.arena, raw_z + 3, 3);
+        for (int i = 0; i < 6; ++i) z[i/3].values[i%3]->tangent = cos(i);
+        AG_Value *loss = nn_bce_with_logits_apply(scratch.arena, z, 2, raw_t);
+        ag_backward(loss);
+
+        F64 eps = 1e-6;
+        B32 grads_match = 1;
+        F64 directional = 0;
+        for (int i = 0; i < 6; ++i) {
+            F64 old = raw_z[i];
+            raw_z[i] = old + eps;
+            F64 loss_plus = nn_bce_with_logits(6, raw_z, raw_t, 0);
+            raw_z[i] = old - eps;
+            F64 loss_minus = nn_bce_with_logits(6, raw_z, raw_t, 0);
+            raw_z[i] = old;
+            F64 numerical = (loss_plus - loss_minus)/(2*eps);
+            if (fabs(numerical - *z[i/3].values[i%3]->grad) > 1e-8) grads_match = 0;
+            directional += numerical*cos(i);
+        }
+        T_TestAssert(arena, &test_results, grads_match);
+        T_TestAssert(arena, &test_results, fabs(loss->tangent - directional) < 1e-8);
+    }
+
+    // MSE
+    {
+        F64 raw_preds[4] = {1, 2, 3, 4};
+        F64 targets[4] = {1, 0, 4, 2};
+        AG_ValueArray preds[2];
+        preds[0] = ag_value_array_from_raw(scratch.arena, raw_preds, 2);
+        preds[1] = ag_value_array_from_raw(scratch.arena, raw_preds + 2, 2);
+        AG_Value *loss = nn_mse_apply(scratch.arena, preds, 2, targets);
+        T_TestAssert(arena, &test_results, *loss->value == (0 + 4 + 1 + 4)/4.0);
+        ag_backward(ag_mul(scratch.arena, loss, ag_constant(scratch.arena, 2)));
+        T_TestAssert(arena, &test_results, *preds[0].values[1]->grad == 2 && *preds[1].values[0]->grad == -1);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+internal F64 test_model_loss(NN_Model *model, F64 *x, int batch_count) {
+    F64 *y = nn_model_forward(model, x, batch_count);
+    F64 loss = 0;
+    for (U64 i = 0; i < batch_count*nn_model_output_size(model); ++i) loss += cos(0.7*i)*y[i];
+    return loss;
+}
+
+T_TestResultList test_memory_plan(Arena *arena) {
+    T_TestResultList test_results = {0};
+
+    // A and C are never live together, B overlaps both
+    NN_PlanBuffer buffers[] = {
+        {.size = 16, .first_use = 0, .last_use = 1}, // A
+        {.size = 8,  .first_use = 1, .last_use = 2}, // B
+        {.size = 16, .first_use = 2, .last_use = 3}, // C
+        {.size = 3,  .first_use = 3, .last_use = 3}, // D: padded to 8
+        {.size = 0,  .first_use = 0, .last_use = 3}, // empty
+    };
+    NN_MemoryPlan plan = nn_plan_memory(buffers, ArrayCount(buffers));
+    T_TestAssert(arena, &test_results, buffers[0].offset == 0 && buffers[2].offset == 0);
+    T_TestAssert(arena, &test_results, buffers[1].offset == 16 && buffers[3].offset == 16);
+    T_TestAssert(arena, &test_results, plan.workspace_size == 24 && plan.live_peak == 24 && plan.unshared_size == 48);
+
+    return test_results;
+}
+
+T_TestResultList test_model(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    NN_LayerSpec depthwise = nn_conv_layer_spec(8, 3, 1, 1, 1);
+    depthwise.groups = 8;
+    NN_LayerSpec specs[] = {
+        nn_conv_layer_spec(8, 3, 1, 1, 1),               // 0: [8,8,8]
+        nn_batch_norm_layer_spec(),                      // 1
+        nn_relu_layer_spec(),                            // 2
+        nn_conv_layer_spec(8, 3, 1, 1, 0),               // 3
+        nn_add_layer_spec(0),                            // 4: residual around 1-3
+        nn_pool_layer_spec(NN_PoolType_Max, 2, 2, 0),    // 5: [8,4,4]
+        depthwise,                                       // 6
+        nn_pool_layer_spec(NN_PoolType_Avg, 3, 1, 1),    // 7
+        nn_conv_layer_spec(32, 1, 1, 0, 1),              // 8: pointwise, [32,4,4]
+        nn_conv_layer_spec(32, 3, 1, 1, 0),              // 9: Winograd
+        nn_add_layer_spec(8),                            // 10
+        nn_global_avg_pool_layer_spec(),                 // 11: [32,1,1]
+        nn_dense_layer_spec(5, 0),                       // 12: [5,1,1]
+    };
+    int batch_count = 3;
+    NN_Model model = nn_make_model(scratch.arena, 1, 8, 8, specs, ArrayCount(specs), batch_count, 0);
+
+    // Shape inference
+    T_TestAssert(arena, &test_results, model.layer_count == ArrayCount(specs));
+    T_TestAssert(arena, &test_results, model.layers[5].out_shape[0] == 8 && model.layers[5].out_shape[1] == 4 && model.layers[5].out_shape[2] == 4);
+    T_TestAssert(arena, &test_results, model.layers[7].out_shape[1] == 4 && model.layers[11].out_shape[0] == 32);
+    T_TestAssert(arena, &test_results, nn_model_output_size(&model) == 5);
+    int expected_param_count = (9*8+8) + 2*8 + (8*8*9+8) + (8*9+8) + (8*32+32) + (32*32*9+32) + (32+1)*5;
+    T_TestAssert(arena, &test_results, model.params.count == expected_param_count);
+    T_TestAssert(arena, &test_results, model.layers[6].conv_algorithm == NN_ConvAlgorithm_Depthwise);
+    T_TestAssert(arena, &test_results, model.layers[9].conv_algorithm == NN_ConvAlgorithm_Winograd);
+    T_TestAssert(arena, &test_results, model.is_skip_source[1] && model.is_skip_source[9] && !model.is_skip_source[4]);
+
+    // Specs that don't fit together are rejected
+    NN_LayerSpec bad_specs[] = {nn_conv_layer_spec(4, 3, 2, 1, 1), nn_add_layer_spec(-1)};
+    NN_Model bad_model = nn_make_model(scratch.arena, 1, 8, 8, bad_specs, ArrayCount(bad_specs), 1, 0);
+    T_TestAssert(arena, &test_results, bad_model.layer_count == 0);
+
+    // Grads against finite differences (training mode, so through the batch norm statistics too)
+    for (int i = 0; i < model.params.count; ++i) model.params.values[i] += 0.05*sin(1.3*i); // break the batch norm/bias symmetry
+    int x_count = batch_count*64;
+    F64 *x = push_array(scratch.arena, F64, x_count);
+    for (int i = 0; i < x_count; ++i) x[i] = sin(0.37*i) + 0.5*cos(1.9*i);
+
+    nn_model_forward(&model, x, batch_count);
+    int y_count = batch_count*5;
+    F64 *y_grads = push_array(scratch.arena, F64, y_count);
+    for (int i = 0; i < y_count; ++i) y_grads[i] = cos(0.7*i);
+    nn_params_zero_grad(&model.params);
+    nn_model_backward(&model, y_grads, batch_count);
+    F64 *x_grads = push_array(scratch.arena, F64, x_count);
+    MD_MemoryCopy(x_grads, model.activation_grads[0], x_count*sizeof(F64));
+
+    F64 eps = 1e-6;
+    B32 param_grads_match = 1;
+    for (int i = 0; i < model.params.count; i += 7) {
+        F64 old = model.params.values[i];
+        model.params.values[i] = old + eps;
+        F64 loss_plus = test_model_loss(&model, x, batch_count);
+        model.params.values[i] = old - eps;
+        F64 loss_minus = test_model_loss(&model, x, batch_count);
+        model.params.values[i] = old;
+        if (fabs((loss_plus - loss_minus)/(2*eps) - model.params.grads[i]) > 1e-5) param_grads_match = 0;
+    }
+    T_TestAssert(arena, &test_results, param_grads_match);
+    B32 x_grads_match = 1;
+    for (int i = 0; i < x_count; ++i) {
+        F64 old = x[i];
+        x[i] = old + eps;
+        F64 loss_plus = test_model_loss(&model, x, batch_count);
+        x[i] = old - eps;
+        F64 loss_minus = test_model_loss(&model, x, batch_count);
+        x[i] = old;
+        if (fabs((loss_plus - loss_minus)/(2*eps) - x_grads[i]) > 1e-5) x_grads_match = 0;
+    }
+    T_TestAssert(arena, &test_results, x_grads_match);
+
+    // The planned workspace: buffers that are live at the same step never share memory
+    int buffer_count = NN_MODEL_PLAN_BUFFER_COUNT(model.layer_count);
+    NN_PlanBuffer *buffers = push_array(scratch.arena, NN_PlanBuffer, buffer_count);
+    nn_model_plan_buffers(&model, buffers);
+    NN_MemoryPlan plan = nn_plan_memory(buffers, buffer_count);
+    T_TestAssert(arena, &test_results, plan.workspace_size == model.memory_plan.workspace_size);
+    T_TestAssert(arena, &test_results, plan.live_peak <= plan.workspace_size && plan.workspace_size < plan.unshared_size);
+    B32 no_collisions = 1;
+    for (int i = 0; i < buffer_count; ++i) {
+        for (int j = i+1; j < buffer_count; ++j) {
+            NN_PlanBuffer *a = &buffers[i], *b = &buffers[j];
+            if (a->size == 0 || b->size == 0 || !nn_plan_buffers_overlap_in_time(a, b)) continue;
+            if (a->offset < b->offset + b->size && b->offset < a->offset + a->size) no_collisions = 0;
+        }
+    }
+    T_TestAssert(arena, &test_results, no_collisions);
+
+    // Batch norm eps and momentum come from the spec
+    {
+        NN_LayerSpec bn_spec = nn_batch_norm_layer_spec();
+        T_TestAssert(arena, &test_results, bn_spec.eps == NN_BATCH_NORM_DEFAULT_EPS && bn_spec.momentum == NN_BATCH_NORM_DEFAULT_MOMENTUM);
+        bn_spec.eps = 0.5;
+        bn_spec.momentum = 0.25;
+        NN_Model bn_model = nn_make_model(scratch.arena, 1, 2, 2, &bn_spec, 1, 1, 0);
+        F64 bn_x[] = {1, 2, 3, 6}; // mean 3, biased var 3.5
+        nn_model_forward(&bn_model, bn_x, 1);
+        NN_ModelLayer *bn_layer = &bn_model.layers[0];
+        T_TestAssert(arena, &test_results, fabs(bn_layer->running_mean[0] - 0.25*3) < 1e-12);
+        T_TestAssert(arena, &test_results, fabs(bn_layer->inv_std[0] - 1/sqrt(3.5 + 0.5)) < 1e-12);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_small_cnn_checkpointed(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    NN_SmallCNN cnn = nn_make_small_cnn(scratch.arena, 3);
+    AG_ValueArray params = {0};
+    params.count = ag_value_array4d_element_count(&cnn.convs[0].weights);
+    params.values = cnn.convs[0].weights.values;
+
+    F64 x_raw[36];
+    for (int i = 0; i < ArrayCount(x_raw); ++i) x_raw[i] = sample_f64_in_range(-1, 1);
+    AG_ValueArray3D x = ag_make_value_array3d_from_raw(scratch.arena, scratch.arena, x_raw, 1, 6, 6);
+
+    // reference gradients without checkpointing
+    AG_ValueArray y = nn_small_cnn_apply(scratch.arena, scratch.arena, &cnn, &x);
+    AG_Value *loss = ag_add(scratch.arena, y.values[0], ag_mul(scratch.arena, y.values[1], y.values[2]));
+    ag_backward(loss);
+    F64 *expected_grads = push_array(scratch.arena, F64, params.count);
+    for (int i = 0; i < params.count; ++i) {
+        expected_grads[i] = *params.values[i]->grad;
+        *params.values[i]->grad = 0;
+    }
+
+    for (int segment_count = 0; segment_count <= 4; ++segment_count) {
+        AG_ValueArray yc = nn_small_cnn_apply_checkpointed(scratch.arena, scratch.arena, &cnn, &x, segment_count);
+        AG_Value *loss_c = ag_add(scratch.arena, yc.values[0], ag_mul(scratch.arena, yc.values[1], yc.values[2]));
+        T_TestAssert(arena, &test_results, fabs(*loss_c->value - *loss->value) < 1e-9);
+
+        ag_backward(loss_c);
+        B32 grads_match = 1;
+        for (int i = 0; i < params.count; ++i) {
+            if (fabs(*params.values[i]->grad - expected_grads[i]) > 1e-9) grads_match = 0;
+            *params.values[i]->grad = 0;
+        }
+        T_TestAssert(arena, &test_results, grads_match);
+    }
+
+    // The default splits the two stages into two segments (one would recompute every activation at
+    // once during backward), so the activations inside the stages aren't kept in value_arena
+    {
+        Arena *plain_arena = arena_alloc();
+        Arena *default_arena = arena_alloc();
+        U64 plain_begin = arena_pos(plain_arena), default_begin = arena_pos(default_arena);
+        AG_ValueArray plain = nn_small_cnn_apply(plain_arena, scratch.arena, &cnn, &x);
+        AG_ValueArray by_default = nn_small_cnn_apply_checkpointed(default_arena, scratch.arena, &cnn, &x, 0);
+        AG_ValueArray two_segments = nn_small_cnn_apply_checkpointed(scratch.arena, scratch.arena, &cnn, &x, 2);
+        U64 plain_bytes = arena_pos(plain_arena) - plain_begin;
+        U64 default_bytes = arena_pos(default_arena) - default_begin;
+        T_TestAssert(arena, &test_results, default_bytes < plain_bytes);
+
+        AG_GraphStats plain_stats = ag_graph_stats(plain.values[0], 0, 0);
+        AG_GraphStats default_stats = ag_graph_stats(by_default.values[0], 0, 0);
+        AG_GraphStats two_segment_stats = ag_graph_stats(two_segments.values[0], 0, 0);
+        T_TestAssert(arena, &test_results, default_stats.node_count < plain_stats.node_count);
+        T_TestAssert(arena, &test_results, default_stats.node_count == two_segment_stats.node_count);
+        T_TestAssert(arena, &test_results, default_stats.node_counts[AG_ValueType_Block] == two_segment_stats.node_counts[AG_ValueType_Block]);
+
+        arena_release(default_arena);
+        arena_release(plain_arena);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_small_cnn_batch(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // Against the graph forward pass, image by image
+    NN_SmallCNN cnn = nn_make_small_cnn(scratch.arena, 5);
+    int batch_count = 3, h = 10, w = 8;
+    F64 *x = push_array(scratch.arena, F64, batch_count*h*w);
+    for (int i = 0; i < batch_count*h*w; ++i) x[i] = sample_f64_in_range(-1, 1);
+
+    NN_SmallCNNBatch batch = nn_small_cnn_apply_batch(scratch.arena, &cnn, x, batch_count, h, w, 0);
+    B32 matches = 1;
+    for (int b = 0; b < batch_count; ++b) {
+        AG_ValueArray3D image = ag_make_value_array3d_from_raw(scratch.arena, scratch.arena, x + b*h*w, 1, h, w);
+        AG_ValueArray logits = nn_small_cnn_apply(scratch.arena, scratch.arena, &cnn, &image);
+        for (int i = 0; i < logits.count; ++i) {
+            if (fabs(*logits.values[i]->value - batch.logits[b*logits.count + i]) > 1e-9) matches = 0;
+        }
+    }
+    T_TestAssert(arena, &test_results, matches);
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_quantization(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // Per-channel weights: every channel's largest value maps to +-127, and every weight is within
+    // half a step of its channel's scale
+    {
+        int out_count = 3, in_count = 20;
+        F64 weights[3*20];
+        for (int o = 0; o < out_count; ++o) {
+            F64 range = o == 0 ? 1e-3 : (o == 1 ? 1 : 50);
+            for (int i = 0; i < in_count; ++i) weights[o*in_count + i] = range*sin(1.7*i + o);
+        }
+        NN_QuantizedWeights q = nn_quantize_weights(scratch.arena, out_count, in_count, weights, in_count, 0, 0);
+        T_TestAssert(arena, &test_results, q.in_stride == 32);
+        B32 within_half_step = 1, has_full_range = 1;
+        for (int o = 0; o < out_count; ++o) {
+            int q_abs_max = 0;
+            for (int i = 0; i < in_count; ++i) {
+                I8 v = q.values[o*q.in_stride + i];
+                q_abs_max = MD_Max(q_abs_max, abs(v));
+                if (fabs(v*q.scales[o] - weights[o*in_count + i]) > 0.5001*q.scales[o]) within_half_step = 0;
+            }
+            for (int i = in_count; i < q.in_stride; ++i) if (q.values[o*q.in_stride + i] != 0) within_half_step = 0;
+            if (q_abs_max != 127) has_full_range = 0;
+        }
+        T_TestAssert(arena, &test_results, within_half_step && has_full_range);
+    }
+
+    // Quantized MLP against the F64 batched forward pass, calibrated on the same data
+    {
+        int input_dim = 12;
+        int layer_dims[] = {32,24,4};
+        NN_MLP mlp = nn_make_mlp_with_random_init(scratch.arena, input_dim, layer_dims, ArrayCount(layer_dims));
+        int batch_count = 40;
+        F64 *x = push_array(scratch.arena, F64, batch_count*input_dim);
+        for (int i = 0; i < batch_count*input_dim; ++i) x[i] = sample_f64_in_range(-2, 2);
+
+        NN_Calibration calibration = nn_make_calibration(scratch.arena, mlp.layer_count);
+        nn_calibrate_mlp(&calibration, &mlp, x, batch_count, 0);
+        NN_QuantizedMLP qmlp = nn_quantize_mlp(scratch.arena, &mlp, &calibration);
+
+        NN_MLPBatch batch = nn_mlp_apply_batch(scratch.arena, &mlp, x, batch_count, 0);
+        F32 *q_output = nn_quantized_mlp_apply(scratch.arena, &qmlp, x, batch_count, 0);
+        F64 max_output = 0, max_error = 0;
+        for (int i = 0; i < batch_count*4; ++i) {
+            max_output = MD_Max(max_output, fabs(batch.output[i]));
+            max_error = MD_Max(max_error, fabs(q_output[i] - batch.output[i]));
+        }
+        T_TestAssert(arena, &test_results, max_error < 0.05*max_output);
+
+        // nn_quantize_layer reads the leaves, which are views into the params block
+        NN_QuantizedLayer q_layer = nn_quantize_layer(scratch.arena, &mlp.layers[1], calibration.abs_maxes[1]);
+        B32 layers_match = memcmp(q_layer.weights.values, qmlp.layers[1].weights.values, 24*q_layer.weights.in_stride) == 0 &&
+                           memcmp(q_layer.weights.scales, qmlp.layers[1].weights.scales, 24*sizeof(F32)) == 0 &&
+                           q_layer.input_scale == qmlp.layers[1].input_scale;
+        T_TestAssert(arena, &test_results, layers_match);
+    }
+
+    // A strided, padded, grouped conv with a relu against the F64 kernel
+    {
+        NN_Conv2D conv = nn_make_grouped_conv2d(scratch.arena, 4, 6, 3, 2, 1, 2, 1);
+        conv.has_relu = 1;
+        int batch_count = 2, h = 9, w = 7;
+        U64 x_count = batch_count*4*h*w;
+        F64 *x = push_array(scratch.arena, F64, x_count);
+        for (U64 i = 0; i < x_count; ++i) x[i] = sample_f64_in_range(-1, 1);
+
+        NN_Calibration calibration = nn_make_calibration(scratch.arena, 1);
+        nn_calibration_observe(&calibration, 0, x_count, x);
+        NN_QuantizedConv2D qconv = nn_quantize_conv2d(scratch.arena, &conv, h, w, calibration.abs_maxes[0]);
+        NN_ConvShape *shape = &qconv.shape;
+
+        F64 *weights = push_array(scratch.arena, F64, ag_value_array4d_element_count(&conv.weights));
+        for (int i = 0; i < ag_value_array4d_element_count(&conv.weights); ++i) weights[i] = *conv.weights.values[i]->value;
+        F64 *biases = push_array(scratch.arena, F64, conv.biases.count);
+        for (int i = 0; i < conv.biases.count; ++i) biases[i] = *conv.biases.values[i]->value;
+        U64 out_count = batch_count*shape->out_channels*shape->out_h*shape->out_w;
+        F64 *expected = push_array(scratch.arena, F64, out_count);
+        nn_conv2d_forward_im2col(shape, batch_count, x, weights, biases, expected, 0);
+        for (U64 i = 0; i < out_count; ++i) expected[i] = MD_Max(expected[i], 0);
+
+        I8 *qx = push_array(scratch.arena, I8, x_count);
+        nn_quantize_rows(1, (int)x_count, x, 0, qconv.input_scale, qx, (int)x_count);
+        F32 *out = push_array(scratch.arena, F32, out_count);
+        nn_quantized_conv2d_forward(&qconv, batch_count, qx, 0, 0, out, 0);
+        F64 max_output = 0, max_error = 0;
+        B32 relu_holds = 1;
+        for (U64 i = 0; i < out_count; ++i) {
+            max_output = MD_Max(max_output, fabs(expected[i]));
+            max_error = MD_Max(max_error, fabs(out[i] - expected[i]));
+            if (out[i] < 0) relu_holds = 0;
+        }
+        T_TestAssert(arena, &test_results, max_error < 0.03*max_output && relu_holds);
+
+        // One task per image, so threads must match serial exactly
+        TP_ThreadPool *pool = tp_make_thread_pool(scratch.arena, 3);
+        F32 *out_threaded = push_array(scratch.arena, F32, out_count);
+        nn_quantized_conv2d_forward(&qconv, batch_count, qx, 0, 0, out_threaded, pool);
+        T_TestAssert(arena, &test_results, memcmp(out, out_threaded, out_count*sizeof(F32)) == 0);
+        tp_release_thread_pool(pool);
+    }
+
+    // Quantized small CNN against nn_small_cnn_apply_batch
+    {
+        NN_SmallCNN cnn = nn_make_small_cnn(scratch.arena, 10);
+        int batch_count = 16, h = 12, w = 12;
+        F64 *x = push_array(scratch.arena, F64, batch_count*h*w);
+        for (int i = 0; i < batch_count*h*w; ++i) x[i] = sample_f64_in_range(-1, 1);
+
+        NN_Calibration calibration = nn_make_calibration(scratch.arena, NN_SMALL_CNN_CALIBRATION_COUNT);
+        nn_calibrate_small_cnn(&calibration, &cnn, x, batch_count, h, w, 0);
+        NN_QuantizedSmallCNN qcnn = nn_quantize_small_cnn(scratch.arena, &cnn, h, w, &calibration);
+
+        NN_SmallCNNBatch batch = nn_small_cnn_apply_batch(scratch.arena, &cnn, x, batch_count, h, w, 0);
+        F32 *q_logits = nn_quantized_small_cnn_apply(scratch.arena, &qcnn, x, batch_count, 0);
+        F64 max_logit = 0, max_error = 0;
+        for (int i = 0; i < batch_count*10; ++i) {
+            max_logit = MD_Max(max_logit, fabs(batch.logits[i]));
+            max_error = MD_Max(max_error, fabs(q_logits[i] - batch.logits[i]));
+        }
+        T_TestAssert(arena, &test_results, max_error < 0.05*max_logit);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_pruning(Arena *arena) {
+    T_TestResultList test_results = {0};
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // Unstructured: exactly the smallest magnitudes go
+    {
+        int rows = 5, cols = 7;
+        F64 weights[5*8];
+        for (int i = 0; i < ArrayCount(weights); ++i) weights[i] = sin(2.3*i + 0.1);
+        F64 original[5*8];
+        ArrayCopy(original, weights, ArrayCount(weights));
+        int pruned = nn_prune_weights(rows, cols, weights, 8, 0.6f, NN_PruneKind_Unstructured);
+        T_TestAssert(arena, &test_results, pruned == 21);
+
+        F64 max_pruned = 0, min_kept = 1e9;
+        int zero_count = 0;
+        B32 bias_column_kept = 1;
+        for (int r = 0; r < rows; ++r) {
+            for (int c = 0; c < cols; ++c) {
+                F64 w = weights[r*8 + c];
+                if (w == 0) {
+                    zero_count += 1;
+                    max_pruned = MD_Max(max_pruned, fabs(original[r*8 + c]));
+                } else {
+                    min_kept = MD_Min(min_kept, fabs(w));
+                }
+            }
+            if (weights[r*8 + 7] != original[r*8 + 7]) bias_column_kept = 0;
+        }
+        T_TestAssert(arena, &test_results, zero_count == 21 && max_pruned <= min_kept && bias_column_kept);
+    }
+
+    // Block: whole blocks go, the partial edge blocks included
+    {
+        int rows = 6, cols = 10;
+        F64 weights[6*10];
+        for (int i = 0; i < ArrayCount(weights); ++i) weights[i] = 1 + (i % 10);
+        nn_prune_weights(rows, cols, weights, cols, 0.5f, NN_PruneKind_Block);
+        // Blocks are 4x4 over a 2x3 grid, ranked by norm: the first block column is the smallest,
+        // then the bottom middle block (it's only 2 rows)
+        B32 matches = 1;
+        for (int r = 0; r < rows; ++r) {
+            for (int c = 0; c < cols; ++c) {
+                B32 expect_zero = c < 4 || (r >= 4 && c < 8);
+                if ((weights[r*cols + c] == 0) != expect_zero) matches = 0;
+            }
+        }
+        T_TestAssert(arena, &test_results, matches);
+    }
+
+    // Sparse forward passes against the dense one on the pruned weights
+    {
+        int input_dim = 23;
+        int layer_dims[] = {37,18,5};
+        int batch_count = 11;
+        F64 *x = push_array(scratch.arena, F64, batch_count*input_dim);
+        for (int i = 0; i < batch_count*input_dim; ++i) x[i] = sample_f64_in_range(-1, 1);
+        TP_ThreadPool *pool = tp_make_thread_pool(scratch.arena, 3);
+
+        for (int format = NN_SparseFormat_CSR; format <= NN_SparseFormat_BSR; ++format) {
+            NN_MLP mlp = nn_make_mlp_with_random_init(scratch.arena, input_dim, layer_dims, ArrayCount(layer_dims));
+            NN_PruneKind kind = format == NN_SparseFormat_BSR ? NN_PruneKind_Block : NN_PruneKind_Unstructured;
+            nn_prune_mlp(&mlp, 0.8f, kind);
+            // The leaves see the pruned values
+            T_TestAssert(arena, &test_results, *mlp.params.leaves[0]->value == mlp.params.values[0]);
+
+            NN_SparseMLP sparse = nn_make_sparse_mlp(scratch.arena, &mlp, format);
+            NN_MLPBatch batch = nn_mlp_apply_batch(scratch.arena, &mlp, x, batch_count, 0);
+            F64 *y = nn_sparse_mlp_apply(scratch.arena, &sparse, x, batch_count, 0);
+            F64 *y_threaded = nn_sparse_mlp_apply(scratch.arena, &sparse, x, batch_count, pool);
+            B32 matches = 1;
+            for (int i = 0; i < batch_count*5; ++i) {
+                if (fabs(y[i] - batch.output[i]) > 1e-12) matches = 0;
+            }
+            T_TestAssert(arena, &test_results, matches);
+            T_TestAssert(arena, &test_results, memcmp(y, y_threaded, batch_count*5*sizeof(F64)) == 0);
+
+            // 80% sparse is smaller than dense
+            U64 dense_size = 37*(23+1)*sizeof(F64);
+            T_TestAssert(arena, &test_results, nn_sparse_layer_size(&sparse.layers[0]) < dense_size);
+        }
+
+        // The leaf version matches the params block version
+        NN_MLP mlp = nn_make_mlp_with_random_init(scratch.arena, input_dim, layer_dims, ArrayCount(layer_dims));
+        nn_prune_layer(&mlp.layers[0], 0.5f, NN_PruneKind_Unstructured);
+        NN_SparseLayer from_leaves = nn_make_sparse_layer(scratch.arena, &mlp.layers[0], NN_SparseFormat_CSR);
+        T_TestAssert(arena, &test_results, from_leaves.csr.nonzero_count == 37*23 - (int)(0.5f*37*23 + 0.5f));
+
+        tp_release_thread_pool(pool);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
 T_TestResultList test_nn(Arena *arena) {
     T_TestResultList test_results = {0};
 
@@ -138,7 +1509,23 @@ T_TestResultList test_nn(Arena *arena) {
     T_RunTest(arena, &test_results, test_neuron);
     T_RunTest(arena, &test_results, test_layer);
     T_RunTest(arena, &test_results, test_mlp);
+    T_RunTest(arena, &test_results, test_params);
+    T_RunTest(arena, &test_results, test_mlp_batch);
+    T_RunTest(arena, &test_results, test_mlp_batch_f32);
     T_RunTest(arena, &test_results, test_conv);
+    T_RunTest(arena, &test_results, test_conv_block);
+    T_RunTest(arena, &test_results, test_conv_winograd);
+    T_RunTest(arena, &test_results, test_conv_direct);
+    T_RunTest(arena, &test_results, test_conv_depthwise);
+    T_RunTest(arena, &test_results, test_pool);
+    T_RunTest(arena, &test_results, test_batch_norm);
+    T_RunTest(arena, &test_results, test_loss);
+    T_RunTest(arena, &test_results, test_model);
+    T_RunTest(arena, &test_results, test_memory_plan);
+    T_RunTest(arena, &test_results, test_small_cnn_checkpointed);
+    T_RunTest(arena, &test_results, test_small_cnn_batch);
+    T_RunTest(arena, &test_results, test_quantization);
+    T_RunTest(arena, &test_results, test_pruning);
 
     scratch_end(scratch);
     return test_results;
@@ -0,0 +1,150 @@
+T_TestResultList test_optim_sgd(Arena *arena) {
+    T_TestResultList test_results = {0};
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // Odd count so both the vector loop and the scalar tail run
+    F64 grads[] = {0.5, -2, 3, 0.25, -0.75};
+    int count = ArrayCount(grads);
+
+    // Plain SGD
+    {
+        F64 values[] = {1, 2, 3, 4, 5};
+        OPT_Optimizer opt = opt_make_optimizer(scratch.arena, opt_sgd_config(0.1, 0, 0), count, 0);
+        opt_step(&opt, values, grads);
+        B32 matches = (opt.m == 0);
+        for (int i = 0; i < count; ++i) {
+            if (fabs(values[i] - ((i+1) - 0.1*grads[i])) > 1e-12) matches = 0;
+        }
+        T_TestAssert(arena, &test_results, matches);
+    }
+
+    // Momentum and Nesterov, with L2 weight decay and value clipping, two steps against a scalar reference
+    for (int nesterov = 0; nesterov < 2; ++nesterov) {
+        F64 lr = 0.1, mu = 0.9, wd = 0.01, clip = 1;
+        F64 values[] = {1, 2, 3, 4, 5};
+        F64 expected[] = {1, 2, 3, 4, 5};
+        F64 m[5] = {0};
+        OPT_Config config = opt_sgd_config(lr, mu, nesterov);
+        config.weight_decay = wd;
+        config.clip_value = clip;
+        OPT_Optimizer opt = opt_make_optimizer(scratch.arena, config, count, 0);
+        for (int step = 0; step < 2; ++step) {
+            opt_step(&opt, values, grads);
+            for (int i = 0; i < count; ++i) {
+                F64 g = MD_Min(MD_Max(grads[i], -clip), clip) + wd*expected[i];
+                m[i] = mu*m[i] + g;
+                expected[i] -= lr*(nesterov ? g + mu*m[i] : m[i]);
+            }
+        }
+        B32 matches = 1;
+        for (int i = 0; i < count; ++i) {
+            if (fabs(values[i] - expected[i]) > 1e-12) matches = 0;
+        }
+        T_TestAssert(arena, &test_results, matches);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_optim_adam(Arena *arena) {
+    T_TestResultList test_results = {0};
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    F64 grads[] = {0.5, -2, 3, 0.25, -0.75};
+    int count = ArrayCount(grads);
+
+    // Adam (L2 decay) and AdamW (decoupled decay), three steps against the textbook formulation
+    for (int decoupled = 0; decoupled < 2; ++decoupled) {
+        F64 lr = 0.01, wd = 0.1;
+        OPT_Config config = decoupled ? opt_adamw_config(lr, wd) : opt_adam_config(lr);
+        if (!decoupled) config.weight_decay = wd;
+        F64 b1 = config.beta1, b2 = config.beta2, eps = config.eps;
+
+        F64 values[] = {1, 2, 3, 4, 5};
+        F64 expected[] = {1, 2, 3, 4, 5};
+        F64 m[5] = {0};
+        F64 v[5] = {0};
+        OPT_Optimizer opt = opt_make_optimizer(scratch.arena, config, count, 0);
+        for (int step = 1; step <= 3; ++step) {
+            opt_step(&opt, values, grads);
+            for (int i = 0; i < count; ++i) {
+                F64 g = grads[i] + (decoupled ? 0 : wd*expected[i]);
+                if (decoupled) expected[i] -= lr*wd*expected[i];
+                m[i] = b1*m[i] + (1-b1)*g;
+                v[i] = b2*v[i] + (1-b2)*g*g;
+                F64 m_hat = m[i]/(1 - pow(b1, step));
+                F64 v_hat = v[i]/(1 - pow(b2, step));
+                expected[i] -= lr*m_hat/(sqrt(v_hat) + eps);
+            }
+        }
+        B32 matches = 1;
+        for (int i = 0; i < count; ++i) {
+            if (fabs(values[i] - expected[i]) > 1e-12) matches = 0;
+        }
+        T_TestAssert(arena, &test_results, matches);
+        T_TestAssert(arena, &test_results, opt.step_count == 3);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_optim_clip_norm_and_threads(Arena *arena) {
+    T_TestResultList test_results = {0};
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    // Global norm clipping: grads (3, 4) have norm 5, clipped to norm 1 they become (0.6, 0.8)
+    {
+        F64 values[] = {0, 0};
+        F64 grads[] = {3, 4};
+        OPT_Config config = opt_sgd_config(1, 0, 0);
+        config.clip_norm = 1;
+        OPT_Optimizer opt = opt_make_optimizer(scratch.arena, config, 2, 0);
+        opt_step(&opt, values, grads);
+        T_TestAssert(arena, &test_results, fabs(values[0] + 0.6) < 1e-12 && fabs(values[1] + 0.8) < 1e-12);
+        T_TestAssert(arena, &test_results, grads[0] == 3 && grads[1] == 4);
+    }
+
+    // Spanning several chunks, the threaded step must match the serial one bit for bit
+    {
+        TP_ThreadPool *pool = tp_make_thread_pool(scratch.arena, 4);
+        int count = 3*OPT_CHUNK_SIZE + 7;
+        F64 *grads = push_array(scratch.arena, F64, count);
+        F64 *values_serial = push_array(scratch.arena, F64, count);
+        F64 *values_threaded = push_array(scratch.arena, F64, count);
+        for (int i = 0; i < count; ++i) {
+            grads[i] = sin(0.37*i);
+            values_serial[i] = values_threaded[i] = cos(0.11*i);
+        }
+        OPT_Config config = opt_adamw_config(0.01, 0.01);
+        config.clip_norm = 10;
+        OPT_Optimizer serial = opt_make_optimizer(scratch.arena, config, count, 0);
+        OPT_Optimizer threaded = opt_make_optimizer(scratch.arena, config, count, pool);
+        for (int step = 0; step < 2; ++step) {
+            opt_step(&serial, values_serial, grads);
+            opt_step(&threaded, values_threaded, grads);
+        }
+        T_TestAssert(arena, &test_results, memcmp(values_serial, values_threaded, count*sizeof(F64)) == 0);
+        tp_release_thread_pool(pool);
+    }
+
+    scratch_end(scratch);
+    return test_results;
+}
+
+T_TestResultList test_optim(Arena *arena) {
+    T_TestResultList test_results = {0};
+
+    ArenaTemp scratch = scratch_begin(&arena, 1);
+
+    T_RunTest(arena, &test_results, test_optim_sgd);
+    T_RunTest(arena, &test_results, test_optim_adam);
+    T_RunTest(arena, &test_results, test_optim_clip_norm_and_threads);
+
+    scratch_end(scratch);
+    return test_results;
+}
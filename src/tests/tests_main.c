@@ -1,19 +1,30 @@
 // .h
 #include "base/md.h"
 #include "base/md_alias.h"
+#include "os/os_inc.h"
+#include "linalg/linalg.h"
 #include "testing/testing.h"
 #include "autograd/autograd.h"
 #include "nn/nn_inc.h"
+#include "optim/optim.h"
+#include "checkpoint/checkpoint.h"
 
 // .c
 #include "base/md.c"
+#include "os/os_inc.c"
+#include "linalg/linalg.c"
 #include "testing/testing.c"
 #include "autograd/autograd.c"
 #include "nn/nn_inc.c"
+#include "optim/optim.c"
+#include "checkpoint/checkpoint.c"
 
 // test functions includes
+#include "test_linalg.c"
 #include "test_autograd.c"
 #include "test_nn.c"
+#include "test_optim.c"
+#include "test_checkpoint.c"
 
 
 int main(void) {
@@ -24,8 +35,11 @@ int main(void) {
     //
     // Run all tests
     //
+    T_RunTest(arena, &all_results, test_linalg);
     T_RunTest(arena, &all_results, test_autograd);
     T_RunTest(arena, &all_results, test_nn);
+    T_RunTest(arena, &all_results, test_optim);
+    T_RunTest(arena, &all_results, test_model_checkpoints);
 
     t_print_test_report(&all_results);
 